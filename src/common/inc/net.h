@@ -25,6 +25,13 @@
 // bottlenecks. This module is not thread safe. Namespace changes will affect
 // the entire process. Some operations may be asynchronous or synchronous.
 // Asynchronous calls will not report kernel errors.
+//
+// Most operations are socket-bound: they are performed through netlink or
+// ioctl sockets that were opened inside the target namespace when its context
+// was created, so they do not depend on the active namespace for the process.
+// The remaining operations are namespace-bound (e.g., sysctl writes through
+// /proc and opening new contexts), and they switch the active namespace as
+// needed. Switching to the namespace that is already active is skipped.
 
 // See the GOTCHAS file for common issues and misconceptions related to this
 // module, or if the code stops working in a new kernel version.
@@ -81,19 +88,44 @@ void netCloseNamespace(netContext* ctx, bool inPlace);
 // until all bound processes are closed or switch to another namespace.
 int netDeleteNamespace(const char* name);
 
+// Enables or disables the warm pool of namespaces. When the pool is enabled,
+// creating a named namespace reuses a pooled one if possible, which is much
+// cheaper than creating it from scratch. Pooled namespaces share the global
+// prefix and are reported by netEnumNamespaces.
+void netSetNamespacePool(bool enabled);
+
+// Moves a namespace into the warm pool under a new name. The caller is
+// responsible for removing its contents first. Any associated contexts should
+// be freed first. Returns 0 on success or an error code otherwise.
+int netRetireNamespace(const char* name);
+
+// Returns true if the namespace name (without the prefix) refers to a namespace
+// in the warm pool.
+bool netIsPooledNamespace(const char* name);
+
 // Enumerates all of the namespaces on the system matching the prefix. If
 // callback returns a non-zero value, enumeration is terminated and the value is
 // returned to the caller. Returns 0 on success.
 typedef int (*netNsCallback)(const char* name, void* userData);
 int netEnumNamespaces(netNsCallback callback, void* userData);
 
-// Switches the active namespace for the process. Returns 0 on success or an
+// Switches the active namespace for the process. If the namespace for the
+// context is already active, no system call is made. Returns 0 on success or an
 // error code otherwise.
 int netSwitchNamespace(netContext* ctx);
 
+typedef struct {
+	uint64_t performed; // Number of setns calls made to switch namespaces
+	uint64_t avoided;   // Number of switches skipped because they were redundant
+} netSwitchStats;
+
+// Retrieves statistics about the namespace switches made by this process.
+void netGetSwitchStats(netSwitchStats* stats);
+
 // Enumerates all of the network interfaces in the given namespace. If
 // callback returns a non-zero value, enumeration is terminated and the value
-// is returned to the caller. Returns 0 on success.
+// is returned to the caller. callback may be NULL, in which case the
+// enumeration only refreshes the interface index cache. Returns 0 on success.
 typedef int (*netIfCallback)(const char* intfName, int idx, void* userData);
 int netEnumInterfaces(netIfCallback callback, netContext* ctx, void* userData);
 
@@ -102,8 +134,15 @@ int netEnumInterfaces(netIfCallback callback, netContext* ctx, void* userData);
 // new interfaces.
 int netCreateVethPair(const char* name1, const char* name2, netContext* ctx1, netContext* ctx2, const macAddr* addr1, const macAddr* addr2, int mtu, bool sync);
 
-// Returns the interface index for an interface. On error, returns -1 and sets
-// err (if provided) to the error code.
+// Deletes an interface. Deleting one end of a veth pair also deletes its peer.
+// Asynchronous deletions can be issued in bulk without waiting for the kernel;
+// a final synchronous call waits for all of the previous ones to complete.
+// Returns 0 on success or an error code otherwise.
+int netDeleteInterface(netContext* ctx, int devIdx, bool sync);
+
+// Returns the interface index for an interface. Indices are cached in the
+// context, so repeated lookups do not require system calls. On error, returns
+// -1 and sets err (if provided) to the error code.
 int netGetInterfaceIndex(netContext* ctx, const char* name, int* err);
 
 // Moves an interface from one namespace to another. Returns 0 on success or an
@@ -140,6 +179,42 @@ int netSetInterfaceGro(netContext* ctx, const char* name, bool enabled);
 // otherwise.
 int netSetEgressShaping(netContext* ctx, int devIdx, double delayMs, double jitterMs, double lossRate, double rateMbit, uint32_t queueLen, bool sync);
 
+// The following functions implement a simple switch using Linux Traffic
+// Control. Interfaces are connected to the switch by attaching their ingress
+// hook to a shared filter block, and flows are represented by flower filters
+// in the block. Packets are first matched against the filters in chain 0, and
+// filters can send them on to other chains. Within a chain, filters with lower
+// priority values are evaluated first. Each function returns 0 on success or
+// an error code otherwise.
+
+// Attaches the ingress hook of an interface to a shared filter block. The block
+// is created when the first interface is attached.
+int netAttachIngressBlock(netContext* ctx, int devIdx, uint32_t block, bool sync);
+
+// Detaches an interface from its shared filter block. The block is destroyed
+// when the last interface is detached.
+int netDetachIngressBlock(netContext* ctx, int devIdx, bool sync);
+
+// Detaches every interface that is attached to a shared filter block.
+int netDetachIngressBlockAll(netContext* ctx, uint32_t block);
+
+// Deletes all of the filters in one chain of a shared filter block.
+int netFlushIngressBlock(netContext* ctx, uint32_t block, uint32_t chain, bool sync);
+
+// Adds a filter for IPv4 packets to a chain in a shared filter block. If
+// inDevIdx is not 0, only packets arriving on that interface are matched. If
+// srcNet or dstNet are NULL, then they are not used for matching. If non-NULL,
+// newSrcMac and newDstMac specify new MAC addresses for the packet. Matching
+// packets are redirected out of outDevIdx, or dropped if outDevIdx is 0. If
+// handle is 0, the kernel chooses a handle for the filter. Otherwise, the
+// function returns EEXIST if the chain already has a filter with the same
+// priority and handle.
+int netAddBlockFilter(netContext* ctx, uint32_t block, uint32_t chain, uint16_t priority, uint32_t handle, int inDevIdx, const ip4Subnet* srcNet, const ip4Subnet* dstNet, const macAddr* newSrcMac, const macAddr* newDstMac, int outDevIdx, bool sync);
+
+// Adds a filter that continues matching IPv4 packets in gotoChain. The match
+// parameters have the same meaning as for netAddBlockFilter.
+int netAddBlockGotoFilter(netContext* ctx, uint32_t block, uint32_t chain, uint16_t priority, int inDevIdx, const ip4Subnet* srcNet, const ip4Subnet* dstNet, uint32_t gotoChain, bool sync);
+
 // Retrieves low-level settings that apply to an interface. Returns 0 on
 // success or an error code otherwise.
 int netGetInterfaceSettings(netContext* ctx, const char* name, interfaceSettings* result);
@@ -161,30 +236,32 @@ int netGetLocalMacAddr(netContext* ctx, const char* name, macAddr* result);
 // otherwise.
 int netGetMtu(netContext* ctx, const char* name, int* result);
 
-// Enables or disables packet routing between interfaces in the active
-// namespace. Returns 0 on success or an error code otherwise.
-int netSetForwarding(bool enabled);
+// Enables or disables packet routing between interfaces in the namespace. This
+// operation is namespace-bound. Returns 0 on success or an error code
+// otherwise.
+int netSetForwarding(netContext* ctx, bool enabled);
 
-// Allows or disallows Martian packets in the active namespace. This setting is
+// Allows or disallows Martian packets in the namespace. This setting is
 // only guaranteed to operate properly if it is set before any interfaces are
 // added to the namespace; if interfaces were added before this call, then the
-// implications are subtle and depend on the details of the calls. Returns 0 on
-// success or an error code otherwise.
-int netSetMartians(bool allow);
+// implications are subtle and depend on the details of the calls. This
+// operation is namespace-bound. Returns 0 on success or an error code
+// otherwise.
+int netSetMartians(netContext* ctx, bool allow);
 
-// Enables or disables IPv6 in the active namespace. Returns 0 on success or an
-// error code otherwise.
-int netSetIPv6(bool enabled);
+// Enables or disables IPv6 in the namespace. This operation is
+// namespace-bound. Returns 0 on success or an error code otherwise.
+int netSetIPv6(netContext* ctx, bool enabled);
 
 // Gets the garbage collector thresholds for the system-wide ARP hash table.
-// Must be called within the init namespace. Returns 0 on success or an error
-// code otherwise.
-int netGetArpTableSize(int* thresh1, int* thresh2, int* thresh3);
+// ctx must be a context for the init namespace. Returns 0 on success or an
+// error code otherwise.
+int netGetArpTableSize(netContext* ctx, int* thresh1, int* thresh2, int* thresh3);
 
 // Sets the garbage collector thresholds for the system-wide ARP hash table.
-// Must be called within the init namespace. Returns 0 on success or an error
-// code otherwise.
-int netSetArpTableSize(int thresh1, int thresh2, int thresh3);
+// ctx must be a context for the init namespace. Returns 0 on success or an
+// error code otherwise.
+int netSetArpTableSize(netContext* ctx, int thresh1, int thresh2, int thresh3);
 
 typedef enum {
 	TableMain,
@@ -26,8 +26,16 @@
 // Embed nlContext for performance
 #include "netlink.inl"
 
+#include <glib.h>
+
 struct netContext {
 	int fd;
 	int ioctlFd;
 	nlContext nl;
-};
\ No newline at end of file
+
+	// Interface indices, keyed by name. The first miss fills the table with a
+	// single dump of all of the interfaces in the namespace, and the table
+	// grows as needed, so that later lookups do not need to ask the kernel.
+	bool idxCacheDumped;
+	GHashTable* idxCache;
+};
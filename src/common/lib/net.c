@@ -36,7 +36,6 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <math.h>
-#include <stdarg.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -50,9 +49,13 @@
 #include <linux/if_packet.h>
 #include <linux/limits.h>
 #include <linux/netlink.h>
+#include <linux/pkt_cls.h>
 #include <linux/pkt_sched.h>
 #include <linux/rtnetlink.h>
 #include <linux/sockios.h>
+#include <linux/tc_act/tc_gact.h>
+#include <linux/tc_act/tc_mirred.h>
+#include <linux/tc_act/tc_skbmod.h>
 #include <net/ethernet.h>
 #include <net/if.h>
 #include <net/if_arp.h>
@@ -83,17 +86,51 @@
 #define INIT_NS_FILE      "/proc/1/ns/net"
 #define PSCHED_PARAM_FILE "/proc/net/psched"
 
-#define SYSCTL_FORWARDING       "/proc/sys/net/ipv4/ip_forward"
-#define SYSCTL_MARTIANS         "/proc/sys/net/ipv4/conf/all/rp_filter"
-#define SYSCTL_MARTIANS_DEFAULT "/proc/sys/net/ipv4/conf/default/rp_filter"
-#define SYSCTL_DISABLE_IPV6     "/proc/sys/net/ipv6/conf/all/disable_ipv6"
-#define SYSCTL_ARP_GC_PREFIX    "/proc/sys/net/ipv4/neigh/default/gc_thresh"
+// Sysctl paths are relative to SYSCTL_NET_DIR
+#define SYSCTL_NET_DIR          "/proc/sys/net"
+#define SYSCTL_FORWARDING       "ipv4/ip_forward"
+#define SYSCTL_MARTIANS         "ipv4/conf/all/rp_filter"
+#define SYSCTL_MARTIANS_DEFAULT "ipv4/conf/default/rp_filter"
+#define SYSCTL_DISABLE_IPV6     "ipv6/conf/all/disable_ipv6"
+#define SYSCTL_ARP_GC_PREFIX    "ipv4/neigh/default/gc_thresh"
 
 const int IP4_DEFAULT_MTU = ETH_DATA_LEN;
 
 static char namespacePrefix[PATH_MAX];
 static double pschedTicksPerMs = 1.0;
 
+// The context whose namespace is currently active for the process, or NULL if
+// it is not known. This allows us to avoid redundant setns calls, which are
+// surprisingly expensive on a busy system.
+static const netContext* activeCtx = NULL;
+static netSwitchStats switchStats = { 0, 0 };
+
+// Descriptor for SYSCTL_NET_DIR, or -1 if it has not been opened yet. The
+// kernel resolves the entries in this directory using the active namespace of
+// the process at lookup time, so one descriptor serves every namespace.
+static int sysctlDirFd = -1;
+
+// Namespaces in the warm pool are named with this prefix (after the global
+// namespace prefix). Host namespaces have numeric names, so there are no
+// collisions.
+#define NS_POOL_PREFIX      "pool-"
+#define NS_POOL_NAME_BUFLEN 32
+
+typedef struct {
+	char name[NS_POOL_NAME_BUFLEN];
+} netPoolEntry;
+
+// Pooled namespaces that this process may attempt to claim. The list is built
+// lazily, and entries may be claimed concurrently by other processes.
+static bool poolEnabled = false;
+static bool poolScanned = false;
+static netPoolEntry* poolEntries = NULL;
+static size_t poolEntryCount = 0;
+static size_t poolEntryCap = 0;
+static size_t poolNextEntry = 0;
+static size_t poolUntried = 0;
+static uint32_t poolRetiredCount = 0;
+
 #if INTERFACE_BUF_LEN != IFNAMSIZ
 #error "Mismatch between internal interface name buffer length and the buffer length for this kernel."
 #endif
@@ -174,6 +211,12 @@ int netInit(const char* prefix) {
 }
 
 void netCleanup(void) {
+	if (sysctlDirFd != -1) {
+		close(sysctlDirFd);
+		sysctlDirFd = -1;
+	}
+	flexBufferFree((void**)&poolEntries, &poolEntryCount, &poolEntryCap);
+	poolScanned = false;
 	nlCleanup();
 }
 
@@ -185,6 +228,75 @@ static int getNamespacePath(char* buffer, const char* name) {
 	return 0;
 }
 
+void netSetNamespacePool(bool enabled) {
+	poolEnabled = enabled;
+	poolScanned = false;
+}
+
+bool netIsPooledNamespace(const char* name) {
+	return strncmp(name, NS_POOL_PREFIX, strlen(NS_POOL_PREFIX)) == 0;
+}
+
+static int recordPoolEntry(const char* name, void* userData) {
+	if (!netIsPooledNamespace(name) || strlen(name) >= NS_POOL_NAME_BUFLEN) return 0;
+
+	netPoolEntry entry;
+	strcpy(entry.name, name);
+	flexBufferGrow((void**)&poolEntries, poolEntryCount, &poolEntryCap, 1, sizeof(netPoolEntry));
+	flexBufferAppend(poolEntries, &poolEntryCount, &entry, 1, sizeof(netPoolEntry));
+	return 0;
+}
+
+// Lists the namespaces currently in the pool. All workers claim from the same
+// list, so each process starts at a different offset to reduce contention.
+static void scanPool(void) {
+	poolEntryCount = 0;
+	if (netEnumNamespaces(&recordPoolEntry, NULL) != 0) poolEntryCount = 0;
+	poolNextEntry = (poolEntryCount == 0 ? 0 : ((uint32_t)getpid() * 2654435761U) % poolEntryCount);
+	poolUntried = poolEntryCount;
+	poolScanned = true;
+	lprintf(LogDebug, "Found %lu namespaces in the warm pool\n", poolEntryCount);
+}
+
+// Attempts to take a namespace out of the warm pool and switch to it. Returns
+// true if the process is now in a claimed namespace, which has no remaining
+// file in the pool and must be bind mounted by the caller.
+static bool claimPooledNamespace(void) {
+	if (!poolEnabled) return false;
+	if (!poolScanned) scanPool();
+
+	char poolPath[PATH_MAX];
+	while (poolUntried > 0) {
+		const char* name = poolEntries[poolNextEntry].name;
+		poolNextEntry = (poolNextEntry + 1) % poolEntryCount;
+		--poolUntried;
+		if (getNamespacePath(poolPath, name) != 0) continue;
+
+		// Other workers may race us for the same entry. Our descriptor only
+		// refers to the namespace if we opened the file while it was still
+		// mounted, and only one process can successfully unmount it.
+		int fd = open(poolPath, O_RDONLY | O_CLOEXEC, 0);
+		if (fd == -1) continue;
+		if (umount2(poolPath, MNT_DETACH) != 0) {
+			close(fd);
+			continue;
+		}
+		unlink(poolPath);
+
+		errno = 0;
+		int res = setns(fd, CLONE_NEWNET);
+		close(fd);
+		if (res != 0) {
+			lprintf(LogWarning, "Failed to switch to pooled network namespace '%s': %s\n", poolPath, strerror(errno));
+			continue;
+		}
+		++switchStats.performed;
+		lprintf(LogDebug, "Claimed pooled network namespace '%s'\n", poolPath);
+		return true;
+	}
+	return false;
+}
+
 // This implementation is meant to be compatible with the "ip netns add"
 // command.
 netContext* netOpenNamespace(const char* name, bool create, bool excl, int* err) {
@@ -200,6 +312,9 @@ netContext* netOpenNamespace(const char* name, bool create, bool excl, int* err)
 int netOpenNamespaceInPlace(netContext* ctx, bool reusing, const char* name, bool create, bool excl) {
 	int err;
 
+	// Whatever happens, we may end up in a different namespace
+	activeCtx = NULL;
+
 	const char* netNsPath;
 	char pathBuffer[PATH_MAX];
 	if (name == NULL) {
@@ -230,11 +345,13 @@ int netOpenNamespaceInPlace(netContext* ctx, bool reusing, const char* name, boo
 		}
 		close(nsFd);
 
-		// Create a new network namespace (any forked processes will still use
-		// the old one). This command implicitly switches us to the new
-		// namespace.
+		// Reuse a scrubbed namespace from the warm pool if one is available.
+		// Otherwise, create a new network namespace (any forked processes will
+		// still use the old one). Both approaches implicitly switch us to the
+		// new namespace.
+		bool claimed = (name != NULL && claimPooledNamespace());
 		errno = 0;
-		if (unshare(CLONE_NEWNET) != 0) {
+		if (!claimed && unshare(CLONE_NEWNET) != 0) {
 			lprintf(LogError, "Failed to instantiate a new network namespace: %s\n", strerror(errno));
 			goto abort;
 		}
@@ -253,7 +370,7 @@ int netOpenNamespaceInPlace(netContext* ctx, bool reusing, const char* name, boo
 		// bind mount is not a valid namespace descriptor.
 		excl = false;
 
-		lprintf(LogDebug, "Created network namespace mounted at '%s'\n", netNsPath);
+		lprintf(LogDebug, "%s network namespace mounted at '%s'\n", claimed ? "Reused pooled" : "Created", netNsPath);
 	}
 
 	// We have to switch if the namespace already existed and we just opened it.
@@ -264,6 +381,7 @@ int netOpenNamespaceInPlace(netContext* ctx, bool reusing, const char* name, boo
 			lprintf(LogError, "Failed to switch to existing network namespace: %s\n", strerror(errno));
 			goto deleteAbort;
 		}
+		++switchStats.performed;
 	}
 
 	errno = nlNewContextInPlace(&ctx->nl);
@@ -280,6 +398,9 @@ int netOpenNamespaceInPlace(netContext* ctx, bool reusing, const char* name, boo
 
 	ctx->fd = nsFd;
 	ctx->ioctlFd = ioctlFd;
+	ctx->idxCacheDumped = false;
+	ctx->idxCache = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, NULL);
+	activeCtx = ctx;
 	lprintf(LogDebug, "Opened network namespace file at '%s' with context %p%s\n", netNsPath, ctx, mustSwitch ? " (required switch)" : "");
 	return 0;
 freeDeleteAbort:
@@ -299,9 +420,12 @@ void netCloseNamespace(netContext* ctx, bool inPlace) {
 
 void netInvalidateContext(netContext* ctx) {
 	lprintf(LogDebug, "Releasing network context %p\n", ctx);
+	// The namespace stays active, but the memory may be reused for another one
+	if (activeCtx == ctx) activeCtx = NULL;
 	close(ctx->fd);
 	close(ctx->ioctlFd);
 	nlInvalidateContext(&ctx->nl);
+	g_hash_table_destroy(ctx->idxCache);
 }
 
 int netDeleteNamespace(const char* name) {
@@ -325,6 +449,43 @@ int netDeleteNamespace(const char* name) {
 	return 0;
 }
 
+int netRetireNamespace(const char* name) {
+	char netNsPath[PATH_MAX];
+	int res = getNamespacePath(netNsPath, name);
+	if (res != 0) return res;
+
+	// Leftover pool files from an earlier process with the same PID may exist
+	char poolPath[PATH_MAX];
+	int fd;
+	do {
+		char poolName[NS_POOL_NAME_BUFLEN];
+		snprintf(poolName, NS_POOL_NAME_BUFLEN, NS_POOL_PREFIX "%ld-%" PRIu32, (long)getpid(), poolRetiredCount++);
+		res = getNamespacePath(poolPath, poolName);
+		if (res != 0) return res;
+
+		errno = 0;
+		fd = open(poolPath, O_RDONLY | O_CLOEXEC | O_CREAT | O_EXCL, S_IRUSR | S_IRGRP | S_IROTH);
+	} while (fd == -1 && errno == EEXIST);
+	if (fd == -1) {
+		lprintf(LogError, "Failed to create pooled network namespace file '%s': %s\n", poolPath, strerror(errno));
+		return errno;
+	}
+	close(fd);
+
+	// The pool file keeps the namespace alive after the original is deleted
+	errno = 0;
+	if (mount(netNsPath, poolPath, "none", MS_BIND, NULL) != 0) {
+		res = errno;
+		lprintf(LogError, "Failed to bind network namespace file '%s' into the pool at '%s': %s\n", netNsPath, poolPath, strerror(res));
+		unlink(poolPath);
+		return res;
+	}
+	poolScanned = false;
+
+	lprintf(LogDebug, "Retired network namespace file '%s' to the pool as '%s'\n", netNsPath, poolPath);
+	return netDeleteNamespace(name);
+}
+
 int netEnumNamespaces(netNsCallback callback, void* userData) {
 	errno = 0;
 	DIR* d = opendir(NET_NS_DIR);
@@ -362,6 +523,11 @@ int netEnumNamespaces(netNsCallback callback, void* userData) {
 }
 
 int netSwitchNamespace(netContext* ctx) {
+	if (ctx == activeCtx) {
+		++switchStats.avoided;
+		return 0;
+	}
+
 	lprintf(LogDebug, "Switching to network namespace context %p\n", ctx);
 	int nsFd = ctx->fd;
 	errno = 0;
@@ -370,9 +536,34 @@ int netSwitchNamespace(netContext* ctx) {
 		lprintf(LogError, "Failed to set active network namespace: %s\n", strerror(errno));
 		return errno;
 	}
+	++switchStats.performed;
+	activeCtx = ctx;
 	return 0;
 }
 
+void netGetSwitchStats(netSwitchStats* stats) {
+	*stats = switchStats;
+}
+
+// Returns 0 if the interface is not in the cache. The kernel never assigns this
+// index to an interface.
+static int idxCacheLookup(netContext* ctx, const char* name) {
+	gpointer idx = g_hash_table_lookup(ctx->idxCache, name);
+	return GPOINTER_TO_INT(idx);
+}
+
+static void idxCacheStore(netContext* ctx, const char* name, int idx) {
+	g_hash_table_insert(ctx->idxCache, g_strdup(name), GINT_TO_POINTER(idx));
+}
+
+static void idxCacheForget(netContext* ctx, const char* name) {
+	g_hash_table_remove(ctx->idxCache, name);
+}
+
+static gboolean idxCacheHasIndex(gpointer key, gpointer value, gpointer userData) {
+	return GPOINTER_TO_INT(value) == GPOINTER_TO_INT(userData);
+}
+
 typedef struct {
 	netContext* netCtx;
 	netIfCallback callback;
@@ -398,6 +589,8 @@ static int netSendLinkCallback(const nlContext* ctx, const void* data, uint32_t
 	if (intfName == NULL) {
 		lprintf(LogWarning, "Interface enumeration ignored nameless interface %p:%d\n", enumCtx->netCtx, idx);
 	} else {
+		idxCacheStore(enumCtx->netCtx, intfName, idx);
+		if (enumCtx->callback == NULL) return 0;
 		return enumCtx->callback(intfName, idx, enumCtx->userData);
 	}
 	return 0;
@@ -547,6 +740,7 @@ int netMoveInterface(netContext* srcCtx, const char* intfName, int devIdx, netCo
 	if (err != 0) goto cleanup;
 
 	// Get index in new namespace
+	idxCacheForget(srcCtx, intfName);
 	int idx = netGetInterfaceIndex(dstCtx, intfName, &err);
 	if (idx == -1) goto cleanup;
 	linkAttrs.msg.ifi.ifi_index = idx;
@@ -577,6 +771,18 @@ cleanup:
 	return err;
 }
 
+int netDeleteInterface(netContext* ctx, int devIdx, bool sync) {
+	lprintf(LogDebug, "Deleting interface %p:%d\n", ctx, devIdx);
+
+	g_hash_table_foreach_remove(ctx->idxCache, &idxCacheHasIndex, GINT_TO_POINTER(devIdx));
+
+	nlContext* nl = &ctx->nl;
+	nlInitMessage(nl, RTM_DELLINK, sync ? NLM_F_ACK : 0);
+	struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC, .ifi_type = 0, .ifi_index = devIdx, .ifi_flags = 0, .ifi_change = UINT_MAX };
+	nlBufferAppend(nl, &ifi, sizeof(ifi));
+	return nlSendMessage(nl, sync, NULL, NULL);
+}
+
 int netCreateVethPair(const char* name1, const char* name2, netContext* ctx1, netContext* ctx2, const macAddr* addr1, const macAddr* addr2, int mtu, bool sync) {
 	if (PASSES_LOG_THRESHOLD(LogDebug)) {
 		lprintHead(LogDebug);
@@ -714,6 +920,20 @@ static int sendIoCtlIfReq(netContext* ctx, const char* name, unsigned long comma
 }
 
 int netGetInterfaceIndex(netContext* ctx, const char* name, int* err) {
+	int idx = idxCacheLookup(ctx, name);
+	if (idx != 0) return idx;
+
+	// The first time that we miss, we fill the cache with a single dump of all
+	// of the interfaces. This is useful for contexts that were reopened for
+	// existing namespaces. New interfaces are looked up individually.
+	if (!ctx->idxCacheDumped) {
+		ctx->idxCacheDumped = true;
+		if (netEnumInterfaces(NULL, ctx, NULL) == 0) {
+			idx = idxCacheLookup(ctx, name);
+			if (idx != 0) return idx;
+		}
+	}
+
 	struct ifreq ifr;
 	initIfReq(&ifr);
 	int res = sendIoCtlIfReq(ctx, name, SIOCGIFINDEX, NULL, &ifr);
@@ -723,6 +943,7 @@ int netGetInterfaceIndex(netContext* ctx, const char* name, int* err) {
 	}
 
 	lprintf(LogDebug, "Interface %p:'%s' has index %d\n", ctx, name, ifr.ifr_ifindex);
+	idxCacheStore(ctx, name, ifr.ifr_ifindex);
 	return ifr.ifr_ifindex;
 }
 
@@ -915,6 +1136,306 @@ int netSetEgressShaping(netContext* ctx, int devIdx, double delayMs, double jitt
 	return nlSendMessage(nl, sync, NULL, NULL);
 }
 
+#ifdef TCM_IFINDEX_MAGIC_BLOCK
+
+// Appends a complete attribute containing the given data
+static void netAppendAttr(nlContext* nl, unsigned short type, const void* data, size_t len) {
+	nlPushAttr(nl, type);
+	{
+		nlBufferAppend(nl, data, len);
+	}
+	nlPopAttr(nl);
+}
+
+int netAttachIngressBlock(netContext* ctx, int devIdx, uint32_t block, bool sync) {
+	lprintf(LogDebug, "Attaching ingress of interface %p:%d to filter block %u\n", ctx, devIdx, block);
+
+	nlContext* nl = &ctx->nl;
+	nlInitMessage(nl, RTM_NEWQDISC, NLM_F_CREATE | NLM_F_REPLACE | (sync ? NLM_F_ACK : 0));
+
+	struct tcmsg tcm = { .tcm_family = AF_UNSPEC, .tcm_ifindex = devIdx, .tcm_handle = TC_H_MAKE(TC_H_CLSACT, 0), .tcm_parent = TC_H_CLSACT, .tcm_info = 0 };
+	nlBufferAppend(nl, &tcm, sizeof(tcm));
+
+	netAppendAttr(nl, TCA_KIND, "clsact", 7);
+	netAppendAttr(nl, TCA_INGRESS_BLOCK, &block, sizeof(block));
+
+	return nlSendMessage(nl, sync, NULL, NULL);
+}
+
+int netDetachIngressBlock(netContext* ctx, int devIdx, bool sync) {
+	lprintf(LogDebug, "Detaching ingress of interface %p:%d from its filter block\n", ctx, devIdx);
+
+	nlContext* nl = &ctx->nl;
+	nlInitMessage(nl, RTM_DELQDISC, (sync ? NLM_F_ACK : 0));
+
+	struct tcmsg tcm = { .tcm_family = AF_UNSPEC, .tcm_ifindex = devIdx, .tcm_handle = TC_H_MAKE(TC_H_CLSACT, 0), .tcm_parent = TC_H_CLSACT, .tcm_info = 0 };
+	nlBufferAppend(nl, &tcm, sizeof(tcm));
+
+	return nlSendMessage(nl, sync, NULL, NULL);
+}
+
+typedef struct {
+	uint32_t block;
+	int* devs; // Flexible buffer of interfaces attached to the block
+	size_t devCount;
+	size_t devCap;
+} netBlockQdiscContext;
+
+static int netFindBlockQdisc(const nlContext* ctx, const void* data, uint32_t len, uint16_t type, uint16_t flags, void* arg) {
+	netBlockQdiscContext* qdiscCtx = arg;
+
+	const struct tcmsg* tcm = data;
+	if (tcm->tcm_parent != TC_H_CLSACT) return 0;
+
+	size_t headerSize = NLMSG_ALIGN(sizeof(struct tcmsg));
+	len -= (uint32_t)headerSize;
+
+	for (const struct rtattr* rta = (const struct rtattr*)((const char*)data + headerSize); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == TCA_INGRESS_BLOCK && *(const uint32_t*)RTA_DATA(rta) == qdiscCtx->block) {
+			flexBufferGrow((void**)&qdiscCtx->devs, qdiscCtx->devCount, &qdiscCtx->devCap, 1, sizeof(int));
+			flexBufferAppend(qdiscCtx->devs, &qdiscCtx->devCount, &tcm->tcm_ifindex, 1, sizeof(int));
+			break;
+		}
+	}
+	return 0;
+}
+
+int netDetachIngressBlockAll(netContext* ctx, uint32_t block) {
+	nlContext* nl = &ctx->nl;
+
+	netBlockQdiscContext qdiscCtx = { .block = block };
+	flexBufferInit((void**)&qdiscCtx.devs, &qdiscCtx.devCount, &qdiscCtx.devCap);
+
+	struct tcmsg tcm = { .tcm_family = AF_UNSPEC, .tcm_ifindex = 0, .tcm_handle = 0, .tcm_parent = 0, .tcm_info = 0 };
+	nlInitMessage(nl, RTM_GETQDISC, NLM_F_ACK | NLM_F_ROOT);
+	nlBufferAppend(nl, &tcm, sizeof(tcm));
+	int err = nlSendMessage(nl, true, &netFindBlockQdisc, &qdiscCtx);
+
+	// We cannot detach the interfaces while enumerating them, because this
+	// would result in nested netlink calls
+	for (size_t i = 0; err == 0 && i < qdiscCtx.devCount; ++i) {
+		err = netDetachIngressBlock(ctx, qdiscCtx.devs[i], i+1 == qdiscCtx.devCount);
+	}
+
+	flexBufferFree((void**)&qdiscCtx.devs, &qdiscCtx.devCount, &qdiscCtx.devCap);
+	return err;
+}
+
+int netFlushIngressBlock(netContext* ctx, uint32_t block, uint32_t chain, bool sync) {
+	lprintf(LogDebug, "Deleting all filters in block %u chain %u for %p\n", block, chain, ctx);
+
+	nlContext* nl = &ctx->nl;
+	nlInitMessage(nl, RTM_DELTFILTER, (sync ? NLM_F_ACK : 0));
+
+	// A priority of 0 deletes every filter in the chain
+	struct tcmsg tcm = { .tcm_family = AF_UNSPEC, .tcm_ifindex = (int)TCM_IFINDEX_MAGIC_BLOCK, .tcm_block_index = block, .tcm_handle = 0, .tcm_info = 0 };
+	nlBufferAppend(nl, &tcm, sizeof(tcm));
+	netAppendAttr(nl, TCA_CHAIN, &chain, sizeof(chain));
+
+	return nlSendMessage(nl, sync, NULL, NULL);
+}
+
+// Appends a generic action with the given kind. The caller must append the
+// options and then pop two attributes.
+static void netPushAction(nlContext* nl, unsigned short order, const char* kind) {
+	nlPushAttr(nl, order);
+	netAppendAttr(nl, TCA_ACT_KIND, kind, strlen(kind) + 1);
+	nlPushAttr(nl, TCA_ACT_OPTIONS | NLA_F_NESTED);
+}
+
+// Logs the match portion of a filter. Must be called between lprintHead and
+// lprintDirectFinish.
+static void netLogFilterMatch(int inDevIdx, const ip4Subnet* srcNet, const ip4Subnet* dstNet) {
+	char subnetStr[IP4_CIDR_BUFLEN];
+	if (inDevIdx != 0) lprintDirectf(LogDebug, "in dev = %d", inDevIdx);
+	if (srcNet != NULL) {
+		ip4SubnetToString(srcNet, subnetStr);
+		lprintDirectf(LogDebug, ", source = %s", subnetStr);
+	}
+	if (dstNet != NULL) {
+		ip4SubnetToString(dstNet, subnetStr);
+		lprintDirectf(LogDebug, ", destination = %s", subnetStr);
+	}
+}
+
+// Begins a flower filter message for IPv4 packets in a shared filter block. On
+// success, the caller must append the actions, pop two attributes, and send the
+// message. Returns 0 on success or an error code otherwise.
+static int netBeginBlockFilter(netContext* ctx, uint32_t block, uint32_t chain, uint16_t priority, uint32_t handle, int inDevIdx, const ip4Subnet* srcNet, const ip4Subnet* dstNet, bool sync) {
+	if (priority == 0) {
+		lprintln(LogError, "BUG: filter priority 0 is reserved by the kernel");
+		return 1;
+	}
+
+	// Flower identifies the input device by name
+	struct ifreq ifr;
+	if (inDevIdx != 0) {
+		initIfReq(&ifr);
+		ifr.ifr_ifindex = inDevIdx;
+		errno = 0;
+		if (ioctl(ctx->ioctlFd, SIOCGIFNAME, &ifr) == -1) {
+			lprintf(LogError, "Could not find the name of interface %p:%d: %s\n", ctx, inDevIdx, strerror(errno));
+			return errno;
+		}
+	}
+
+	nlContext* nl = &ctx->nl;
+	nlInitMessage(nl, RTM_NEWTFILTER, NLM_F_CREATE | NLM_F_EXCL | (sync ? NLM_F_ACK : 0));
+
+	uint16_t ethType = htons(ETH_P_IP);
+	struct tcmsg tcm = { .tcm_family = AF_UNSPEC, .tcm_ifindex = (int)TCM_IFINDEX_MAGIC_BLOCK, .tcm_block_index = block, .tcm_handle = handle };
+	tcm.tcm_info = TC_H_MAKE((uint32_t)priority << 16, ethType);
+	nlBufferAppend(nl, &tcm, sizeof(tcm));
+
+	netAppendAttr(nl, TCA_KIND, "flower", 7);
+	if (chain != 0) netAppendAttr(nl, TCA_CHAIN, &chain, sizeof(chain));
+
+	nlPushAttr(nl, TCA_OPTIONS);
+	{
+		netAppendAttr(nl, TCA_FLOWER_KEY_ETH_TYPE, &ethType, sizeof(ethType));
+		if (inDevIdx != 0) {
+			netAppendAttr(nl, TCA_FLOWER_INDEV, ifr.ifr_name, strlen(ifr.ifr_name) + 1);
+		}
+		if (srcNet != NULL) {
+			ip4Addr mask = ip4SubnetMask(srcNet);
+			netAppendAttr(nl, TCA_FLOWER_KEY_IPV4_SRC, &srcNet->addr, sizeof(srcNet->addr));
+			netAppendAttr(nl, TCA_FLOWER_KEY_IPV4_SRC_MASK, &mask, sizeof(mask));
+		}
+		if (dstNet != NULL) {
+			ip4Addr mask = ip4SubnetMask(dstNet);
+			netAppendAttr(nl, TCA_FLOWER_KEY_IPV4_DST, &dstNet->addr, sizeof(dstNet->addr));
+			netAppendAttr(nl, TCA_FLOWER_KEY_IPV4_DST_MASK, &mask, sizeof(mask));
+		}
+
+		// Emulated interfaces have no hardware to offload to
+		uint32_t flags = TCA_CLS_FLAGS_SKIP_HW;
+		netAppendAttr(nl, TCA_FLOWER_FLAGS, &flags, sizeof(flags));
+
+		nlPushAttr(nl, TCA_FLOWER_ACT);
+	}
+	return 0;
+}
+
+// Appends a generic action with the given verdict
+static void netAppendGact(nlContext* nl, unsigned short order, int verdict) {
+	netPushAction(nl, order, "gact");
+	{
+		struct tc_gact gact;
+		memset(&gact, 0, sizeof(gact));
+		gact.action = verdict;
+		netAppendAttr(nl, TCA_GACT_PARMS, &gact, sizeof(gact));
+	}
+	nlPopAttr(nl);
+	nlPopAttr(nl);
+}
+
+int netAddBlockFilter(netContext* ctx, uint32_t block, uint32_t chain, uint16_t priority, uint32_t handle, int inDevIdx, const ip4Subnet* srcNet, const ip4Subnet* dstNet, const macAddr* newSrcMac, const macAddr* newDstMac, int outDevIdx, bool sync) {
+	if (PASSES_LOG_THRESHOLD(LogDebug)) {
+		lprintHead(LogDebug);
+		lprintDirectf(LogDebug, "Adding filter to block %u chain %u for %p: priority %u, match (", block, chain, ctx, priority);
+		netLogFilterMatch(inDevIdx, srcNet, dstNet);
+		if (outDevIdx != 0) lprintDirectf(LogDebug, "), perform (out dev = %d)\n", outDevIdx);
+		else lprintDirectf(LogDebug, "), perform (drop)\n");
+		lprintDirectFinish(LogDebug);
+	}
+
+	int err = netBeginBlockFilter(ctx, block, chain, priority, handle, inDevIdx, srcNet, dstNet, sync);
+	if (err != 0) return err;
+
+	nlContext* nl = &ctx->nl;
+	{
+		unsigned short order = 1;
+		if (outDevIdx == 0) {
+			netAppendGact(nl, order++, TC_ACT_SHOT);
+		} else {
+			if (newSrcMac != NULL || newDstMac != NULL) {
+				netPushAction(nl, order++, "skbmod");
+				{
+					struct tc_skbmod skbmod;
+					memset(&skbmod, 0, sizeof(skbmod));
+					skbmod.action = TC_ACT_PIPE;
+					if (newSrcMac != NULL) skbmod.flags |= SKBMOD_F_SMAC;
+					if (newDstMac != NULL) skbmod.flags |= SKBMOD_F_DMAC;
+					netAppendAttr(nl, TCA_SKBMOD_PARMS, &skbmod, sizeof(skbmod));
+					if (newSrcMac != NULL) netAppendAttr(nl, TCA_SKBMOD_SMAC, newSrcMac->octets, MAC_ADDR_BYTES);
+					if (newDstMac != NULL) netAppendAttr(nl, TCA_SKBMOD_DMAC, newDstMac->octets, MAC_ADDR_BYTES);
+				}
+				nlPopAttr(nl);
+				nlPopAttr(nl);
+			}
+			netPushAction(nl, order++, "mirred");
+			{
+				struct tc_mirred mirred;
+				memset(&mirred, 0, sizeof(mirred));
+				mirred.action = TC_ACT_STOLEN;
+				mirred.eaction = TCA_EGRESS_REDIR;
+				mirred.ifindex = (__u32)outDevIdx;
+				netAppendAttr(nl, TCA_MIRRED_PARMS, &mirred, sizeof(mirred));
+			}
+			nlPopAttr(nl);
+			nlPopAttr(nl);
+		}
+	}
+	nlPopAttr(nl);
+	nlPopAttr(nl);
+
+	return nlSendMessage(nl, sync, NULL, NULL);
+}
+
+int netAddBlockGotoFilter(netContext* ctx, uint32_t block, uint32_t chain, uint16_t priority, int inDevIdx, const ip4Subnet* srcNet, const ip4Subnet* dstNet, uint32_t gotoChain, bool sync) {
+	if (PASSES_LOG_THRESHOLD(LogDebug)) {
+		lprintHead(LogDebug);
+		lprintDirectf(LogDebug, "Adding filter to block %u chain %u for %p: priority %u, match (", block, chain, ctx, priority);
+		netLogFilterMatch(inDevIdx, srcNet, dstNet);
+		lprintDirectf(LogDebug, "), perform (go to chain %u)\n", gotoChain);
+		lprintDirectFinish(LogDebug);
+	}
+
+	if (gotoChain > TC_ACT_EXT_VAL_MASK) {
+		lprintf(LogError, "BUG: filter chain %u is out of range\n", gotoChain);
+		return 1;
+	}
+
+	int err = netBeginBlockFilter(ctx, block, chain, priority, 0, inDevIdx, srcNet, dstNet, sync);
+	if (err != 0) return err;
+
+	nlContext* nl = &ctx->nl;
+	netAppendGact(nl, 1, TC_ACT_GOTO_CHAIN | (int)gotoChain);
+	nlPopAttr(nl);
+	nlPopAttr(nl);
+
+	return nlSendMessage(nl, sync, NULL, NULL);
+}
+
+#else
+
+int netAttachIngressBlock(netContext* ctx, int devIdx, uint32_t block, bool sync) {
+	lprintln(LogError, "This program was compiled against kernel headers that do not support shared filter blocks. Recompile with Linux 4.16 headers or later to use the kernel switch.");
+	return ENOTSUP;
+}
+
+int netDetachIngressBlock(netContext* ctx, int devIdx, bool sync) {
+	return ENOTSUP;
+}
+
+int netDetachIngressBlockAll(netContext* ctx, uint32_t block) {
+	return ENOTSUP;
+}
+
+int netFlushIngressBlock(netContext* ctx, uint32_t block, uint32_t chain, bool sync) {
+	return ENOTSUP;
+}
+
+int netAddBlockFilter(netContext* ctx, uint32_t block, uint32_t chain, uint16_t priority, uint32_t handle, int inDevIdx, const ip4Subnet* srcNet, const ip4Subnet* dstNet, const macAddr* newSrcMac, const macAddr* newDstMac, int outDevIdx, bool sync) {
+	return ENOTSUP;
+}
+
+int netAddBlockGotoFilter(netContext* ctx, uint32_t block, uint32_t chain, uint16_t priority, int inDevIdx, const ip4Subnet* srcNet, const ip4Subnet* dstNet, uint32_t gotoChain, bool sync) {
+	return ENOTSUP;
+}
+
+#endif
+
 #define NETIF_F_NETNS_LOCAL_BLOCK 0
 #define NETIF_F_NETNS_LOCAL_BIT 13
 
@@ -1045,74 +1566,132 @@ int netGetMtu(netContext* ctx, const char* name, int* result) {
 	return 0;
 }
 
-static int readSysctlFmt(const char* filePath, const char* fmt, void* value) {
-	errno = 0;
-	FILE* f = fopen(filePath, "re");
-	if (f == NULL) return errno;
+// Opens a sysctl file in the active namespace. Returns a descriptor on success
+// or -1 on error, in which case errno is set.
+static int openSysctl(const char* relPath, int flags) {
+	if (sysctlDirFd == -1) {
+		sysctlDirFd = open(SYSCTL_NET_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (sysctlDirFd == -1) {
+			lprintf(LogError, "Could not open sysctl directory '" SYSCTL_NET_DIR "': %s\n", strerror(errno));
+			return -1;
+		}
+	}
+	return openat(sysctlDirFd, relPath, flags | O_CLOEXEC);
+}
 
-	int res = fscanf(f, fmt, value);
-	fclose(f);
-	return (res == 1) ? 0 : 1;
+// Reads the current value of an open sysctl file into buffer, without the
+// trailing newline. Returns 0 on success or an error code otherwise.
+static int preadSysctl(int fd, char* buffer, size_t bufferLen) {
+	errno = 0;
+	ssize_t len = pread(fd, buffer, bufferLen-1, 0);
+	if (len < 0) return errno;
+	while (len > 0 && (buffer[len-1] == '\n' || buffer[len-1] == ' ')) --len;
+	buffer[len] = '\0';
+	return 0;
 }
 
-static int writeSysctlFmt(const char* filePath, const char* fmt, ...) {
+static int readSysctlInt(const char* relPath, int* value) {
 	errno = 0;
-	FILE* f = fopen(filePath, "we");
-	if (f == NULL) return errno;
+	int fd = openSysctl(relPath, O_RDONLY);
+	if (fd == -1) return errno;
 
-	va_list args;
-	va_start(args, fmt);
-	int res = vfprintf(f, fmt, args);
-	va_end(args);
+	char buffer[32];
+	int err = preadSysctl(fd, buffer, sizeof(buffer));
+	close(fd);
+	if (err != 0) return err;
 
-	fclose(f);
-	return (res < 0) ? 1 : 0;
+	char* end;
+	long parsed = strtol(buffer, &end, 10);
+	if (end == buffer || parsed < INT_MIN || parsed > INT_MAX) return 1;
+	*value = (int)parsed;
+	return 0;
 }
 
-int netSetForwarding(bool enabled) {
-	lprintf(LogDebug, "Turning %s IP forwarding (routing) for the active namespace\n", enabled ? "on" : "off");
-	return writeSysctlFmt(SYSCTL_FORWARDING, enabled ? "1" : "0");
+// Writes a preformatted value to a sysctl file. The current value is read first
+// so that writes that would not change anything can be skipped. Writing to a
+// sysctl is relatively expensive because some settings trigger notifications
+// in the kernel.
+static int writeSysctl(const char* relPath, const char* value) {
+	errno = 0;
+	int fd = openSysctl(relPath, O_RDWR);
+	if (fd == -1) return errno;
+
+	int err = 0;
+	char current[32];
+	size_t valueLen = strlen(value);
+	if (preadSysctl(fd, current, sizeof(current)) == 0 && strcmp(current, value) == 0) {
+		lprintf(LogDebug, "Sysctl '%s' already has value '%s'\n", relPath, value);
+	} else {
+		errno = 0;
+		ssize_t written = pwrite(fd, value, valueLen, 0);
+		if (written < 0) err = errno;
+		else if ((size_t)written != valueLen) err = 1;
+	}
+	close(fd);
+	return err;
 }
 
-int netSetMartians(bool allow) {
-	lprintf(LogDebug, "%s Martian packets in the active namespace\n", allow ? "Allowing" : "Disallowing");
+static int writeSysctlInt(const char* relPath, int value) {
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%d", value);
+	return writeSysctl(relPath, buffer);
+}
+
+int netSetForwarding(netContext* ctx, bool enabled) {
+	int err = netSwitchNamespace(ctx);
+	if (err != 0) return err;
+
+	lprintf(LogDebug, "Turning %s IP forwarding (routing) for namespace %p\n", enabled ? "on" : "off", ctx);
+	return writeSysctl(SYSCTL_FORWARDING, enabled ? "1" : "0");
+}
+
+int netSetMartians(netContext* ctx, bool allow) {
+	int err = netSwitchNamespace(ctx);
+	if (err != 0) return err;
+
+	lprintf(LogDebug, "%s Martian packets in namespace %p\n", allow ? "Allowing" : "Disallowing", ctx);
 
 	// We need to write the setting to both the "default" and "all" values
 	// because the kernel uses the maximum of the values as the effective
 	// setting. A consequence of this is that any interfaces that were created
 	// with a higher setting will be unaffected by this call.
 	const char* setting = allow ? "0" : "1";
-	int err = writeSysctlFmt(SYSCTL_MARTIANS, setting);
+	err = writeSysctl(SYSCTL_MARTIANS, setting);
 	if (err != 0) return err;
-	return writeSysctlFmt(SYSCTL_MARTIANS_DEFAULT, setting);
+	return writeSysctl(SYSCTL_MARTIANS_DEFAULT, setting);
 }
 
-int netSetIPv6(bool enabled) {
-	lprintf(LogDebug, "Turning %s IPv6 support in the active namespace\n", enabled ? "on" : "off");
-	return writeSysctlFmt(SYSCTL_DISABLE_IPV6, enabled ? "0" : "1");
+int netSetIPv6(netContext* ctx, bool enabled) {
+	int err = netSwitchNamespace(ctx);
+	if (err != 0) return err;
+
+	lprintf(LogDebug, "Turning %s IPv6 support in namespace %p\n", enabled ? "on" : "off", ctx);
+	return writeSysctl(SYSCTL_DISABLE_IPV6, enabled ? "0" : "1");
 }
 
-int netGetArpTableSize(int* thresh1, int* thresh2, int* thresh3) {
-	int err;
+int netGetArpTableSize(netContext* ctx, int* thresh1, int* thresh2, int* thresh3) {
+	int err = netSwitchNamespace(ctx);
+	if (err != 0) return err;
 
-	err = readSysctlFmt(SYSCTL_ARP_GC_PREFIX "1", "%d", thresh1);
+	err = readSysctlInt(SYSCTL_ARP_GC_PREFIX "1", thresh1);
 	if (err != 0) return err;
-	err = readSysctlFmt(SYSCTL_ARP_GC_PREFIX "2", "%d", thresh2);
+	err = readSysctlInt(SYSCTL_ARP_GC_PREFIX "2", thresh2);
 	if (err != 0) return err;
-	err = readSysctlFmt(SYSCTL_ARP_GC_PREFIX "3", "%d", thresh3);
+	err = readSysctlInt(SYSCTL_ARP_GC_PREFIX "3", thresh3);
 	if (err != 0) return err;
 
 	return 0;
 }
 
-int netSetArpTableSize(int thresh1, int thresh2, int thresh3) {
-	int err;
+int netSetArpTableSize(netContext* ctx, int thresh1, int thresh2, int thresh3) {
+	int err = netSwitchNamespace(ctx);
+	if (err != 0) return err;
 
-	err = writeSysctlFmt(SYSCTL_ARP_GC_PREFIX "1", "%d", thresh1);
+	err = writeSysctlInt(SYSCTL_ARP_GC_PREFIX "1", thresh1);
 	if (err != 0) return err;
-	err = writeSysctlFmt(SYSCTL_ARP_GC_PREFIX "2", "%d", thresh2);
+	err = writeSysctlInt(SYSCTL_ARP_GC_PREFIX "2", thresh2);
 	if (err != 0) return err;
-	err = writeSysctlFmt(SYSCTL_ARP_GC_PREFIX "3", "%d", thresh3);
+	err = writeSysctlInt(SYSCTL_ARP_GC_PREFIX "3", thresh3);
 	if (err != 0) return err;
 
 	return 0;
@@ -0,0 +1,435 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#define _POSIX_C_SOURCE 200809L // Require POSIX.1-2008
+
+#include "decompress.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <zlib.h>
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "log.h"
+#include "mem.h"
+
+// Number of compressed bytes read from the input at a time
+static const size_t InputChunkSize = 1024 * 256;
+
+// Longest signature checked by decompDetect
+#define MAX_MAGIC_LEN 6
+
+static const unsigned char GzipMagic[] = { 0x1F, 0x8B };
+static const unsigned char XzMagic[] = { 0xFD, '7', 'z', 'X', 'Z', 0x00 };
+static const unsigned char ZstdMagic[] = { 0x28, 0xB5, 0x2F, 0xFD };
+
+typedef struct {
+	char* data;
+	size_t len;
+	bool full; // True if the buffer is waiting to be consumed
+} decompBuffer;
+
+struct decompStream {
+	FILE* input;
+	CompressionFormat format;
+	size_t chunkSize;
+
+	// Bytes read from the input while detecting the format. These are
+	// consumed before any further input.
+	unsigned char magic[MAX_MAGIC_LEN];
+	size_t magicLen;
+	size_t magicPos;
+
+	// Compressed input awaiting decompression
+	unsigned char* in;
+	bool inEof;
+
+	union {
+		z_stream gzip;
+#ifdef HAVE_LZMA
+		lzma_stream xz;
+#endif
+#ifdef HAVE_ZSTD
+		struct {
+			ZSTD_DStream* ctx;
+			ZSTD_inBuffer in;
+			bool frameDone; // True if the last progress completed a frame
+		} zstd;
+#endif
+	} codec;
+	bool gzipMemberDone;
+
+	// The following members are protected by the lock
+	GMutex lock;
+	GCond changed;
+	decompBuffer buffers[2];
+	size_t consumerIdx;
+	bool consumerHolding; // True if the caller holds buffers[consumerIdx]
+	bool finished;        // True if the thread has produced its last buffer
+	bool stop;            // True if the caller wants the thread to exit
+	int err;
+
+	GThread* thread;
+};
+
+CompressionFormat decompDetect(const void* data, size_t len) {
+	if (len >= sizeof(GzipMagic) && memcmp(data, GzipMagic, sizeof(GzipMagic)) == 0) return CompressionGzip;
+	if (len >= sizeof(XzMagic) && memcmp(data, XzMagic, sizeof(XzMagic)) == 0) return CompressionXz;
+	if (len >= sizeof(ZstdMagic) && memcmp(data, ZstdMagic, sizeof(ZstdMagic)) == 0) return CompressionZstd;
+	return CompressionNone;
+}
+
+const char* decompFormatName(CompressionFormat format) {
+	switch (format) {
+	case CompressionNone: return "uncompressed";
+	case CompressionGzip: return "gzip";
+	case CompressionXz: return "xz";
+	case CompressionZstd: return "zstd";
+	default: return "unknown";
+	}
+}
+
+// Reads raw input, beginning with the bytes consumed by format detection.
+// Returns the number of bytes read, which is 0 at the end of the input.
+static size_t readInput(decompStream* stream, unsigned char* buffer, size_t cap) {
+	size_t len = 0;
+	if (stream->magicPos < stream->magicLen) {
+		len = stream->magicLen - stream->magicPos;
+		if (len > cap) len = cap;
+		memcpy(buffer, stream->magic + stream->magicPos, len);
+		stream->magicPos += len;
+	}
+	if (len < cap) len += fread(buffer + len, 1, cap - len, stream->input);
+	return len;
+}
+
+// Reads the next chunk of compressed input. Returns 0 on success or an error
+// code otherwise. Sets inEof at the end of the input.
+static int readCompressed(decompStream* stream, size_t* len) {
+	*len = readInput(stream, stream->in, InputChunkSize);
+	if (*len == 0) {
+		if (ferror(stream->input)) {
+			lprintln(LogError, "Failed to read the compressed input");
+			return 1;
+		}
+		stream->inEof = true;
+	}
+	return 0;
+}
+
+static int fillPlain(decompStream* stream, char* out, size_t* len, bool* end) {
+	*len = readInput(stream, (unsigned char*)out, stream->chunkSize);
+	if (*len < stream->chunkSize) {
+		*end = true;
+		if (ferror(stream->input)) return 1;
+	}
+	return 0;
+}
+
+static int fillGzip(decompStream* stream, char* out, size_t* len, bool* end) {
+	z_stream* z = &stream->codec.gzip;
+	z->next_out = (Bytef*)out;
+	z->avail_out = (uInt)stream->chunkSize;
+	while (z->avail_out > 0) {
+		if (z->avail_in == 0 && !stream->inEof) {
+			size_t read;
+			if (readCompressed(stream, &read) != 0) return 1;
+			z->next_in = stream->in;
+			z->avail_in = (uInt)read;
+		}
+		uInt availOut = z->avail_out;
+		int res = inflate(z, Z_NO_FLUSH);
+		if (res == Z_STREAM_END) {
+			// Files may consist of several concatenated gzip members
+			stream->gzipMemberDone = true;
+			inflateReset(z);
+		} else if (res == Z_OK) {
+			stream->gzipMemberDone = false;
+		} else if (res == Z_BUF_ERROR && z->avail_out == availOut && stream->inEof) {
+			// No further progress is possible
+			if (!stream->gzipMemberDone) {
+				lprintln(LogError, "The gzip input is truncated");
+				return 1;
+			}
+			*end = true;
+			break;
+		} else if (res != Z_BUF_ERROR) {
+			lprintf(LogError, "Failed to decompress the gzip input: %s\n", z->msg ? z->msg : "unknown error");
+			return 1;
+		}
+	}
+	*len = stream->chunkSize - z->avail_out;
+	return 0;
+}
+
+#ifdef HAVE_LZMA
+static int fillXz(decompStream* stream, char* out, size_t* len, bool* end) {
+	lzma_stream* xz = &stream->codec.xz;
+	xz->next_out = (uint8_t*)out;
+	xz->avail_out = stream->chunkSize;
+	while (xz->avail_out > 0) {
+		if (xz->avail_in == 0 && !stream->inEof) {
+			size_t read;
+			if (readCompressed(stream, &read) != 0) return 1;
+			xz->next_in = stream->in;
+			xz->avail_in = read;
+		}
+		lzma_ret res = lzma_code(xz, stream->inEof ? LZMA_FINISH : LZMA_RUN);
+		if (res == LZMA_STREAM_END) {
+			*end = true;
+			break;
+		} else if (res != LZMA_OK) {
+			lprintf(LogError, "Failed to decompress the xz input (error %d). The input may be truncated or corrupt.\n", (int)res);
+			return 1;
+		}
+	}
+	*len = stream->chunkSize - xz->avail_out;
+	return 0;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static int fillZstd(decompStream* stream, char* out, size_t* len, bool* end) {
+	ZSTD_outBuffer output = { .dst = out, .size = stream->chunkSize, .pos = 0 };
+	ZSTD_inBuffer* input = &stream->codec.zstd.in;
+	while (output.pos < output.size) {
+		if (input->pos == input->size && !stream->inEof) {
+			size_t read;
+			if (readCompressed(stream, &read) != 0) return 1;
+			input->src = stream->in;
+			input->size = read;
+			input->pos = 0;
+		}
+		size_t oldInPos = input->pos;
+		size_t oldOutPos = output.pos;
+		size_t res = ZSTD_decompressStream(stream->codec.zstd.ctx, &output, input);
+		if (ZSTD_isError(res)) {
+			lprintf(LogError, "Failed to decompress the zstd input: %s\n", ZSTD_getErrorName(res));
+			return 1;
+		}
+		if (input->pos != oldInPos || output.pos != oldOutPos) {
+			stream->codec.zstd.frameDone = (res == 0);
+		} else if (stream->inEof) {
+			// The decoder has flushed everything that it can
+			if (!stream->codec.zstd.frameDone) {
+				lprintln(LogError, "The zstd input is truncated");
+				return 1;
+			}
+			*end = true;
+			break;
+		}
+	}
+	*len = output.pos;
+	return 0;
+}
+#endif
+
+// Fills a buffer with the next block of decompressed data. Sets end if no
+// further data is available.
+static int fillBuffer(decompStream* stream, char* out, size_t* len, bool* end) {
+	*len = 0;
+	switch (stream->format) {
+	case CompressionGzip: return fillGzip(stream, out, len, end);
+#ifdef HAVE_LZMA
+	case CompressionXz: return fillXz(stream, out, len, end);
+#endif
+#ifdef HAVE_ZSTD
+	case CompressionZstd: return fillZstd(stream, out, len, end);
+#endif
+	default: return fillPlain(stream, out, len, end);
+	}
+}
+
+static gpointer decompThread(gpointer data) {
+	decompStream* stream = data;
+	for (size_t idx = 0; ; idx ^= 1) {
+		decompBuffer* buffer = &stream->buffers[idx];
+
+		// Wait for the caller to release the buffer
+		g_mutex_lock(&stream->lock);
+		while (buffer->full && !stream->stop) g_cond_wait(&stream->changed, &stream->lock);
+		bool stop = stream->stop;
+		g_mutex_unlock(&stream->lock);
+		if (stop) break;
+
+		size_t len;
+		bool end = false;
+		int err = fillBuffer(stream, buffer->data, &len, &end);
+
+		g_mutex_lock(&stream->lock);
+		buffer->len = len;
+		buffer->full = true;
+		if (err != 0 || end) {
+			stream->err = err;
+			stream->finished = true;
+		}
+		g_cond_broadcast(&stream->changed);
+		g_mutex_unlock(&stream->lock);
+		if (err != 0 || end) break;
+	}
+	return NULL;
+}
+
+// Prepares the decoder for the detected format. Returns false if the format is
+// not supported.
+static bool initCodec(decompStream* stream) {
+	switch (stream->format) {
+	case CompressionNone: return true;
+	case CompressionGzip: {
+		z_stream* z = &stream->codec.gzip;
+		memset(z, 0, sizeof(*z));
+		// Adding 32 to the window size enables gzip header detection
+		if (inflateInit2(z, 15 + 32) != Z_OK) {
+			lprintln(LogError, "Failed to initialize the gzip decoder");
+			return false;
+		}
+		stream->gzipMemberDone = false;
+		return true;
+	}
+#ifdef HAVE_LZMA
+	case CompressionXz: {
+		lzma_stream init = LZMA_STREAM_INIT;
+		stream->codec.xz = init;
+		if (lzma_stream_decoder(&stream->codec.xz, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+			lprintln(LogError, "Failed to initialize the xz decoder");
+			return false;
+		}
+		return true;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case CompressionZstd: {
+		stream->codec.zstd.ctx = ZSTD_createDStream();
+		if (stream->codec.zstd.ctx == NULL) {
+			lprintln(LogError, "Failed to initialize the zstd decoder");
+			return false;
+		}
+		ZSTD_initDStream(stream->codec.zstd.ctx);
+		stream->codec.zstd.in.src = NULL;
+		stream->codec.zstd.in.size = 0;
+		stream->codec.zstd.in.pos = 0;
+		stream->codec.zstd.frameDone = false;
+		return true;
+	}
+#endif
+	default:
+		lprintf(LogError, "The input is compressed with %s, which is not supported by this build\n", decompFormatName(stream->format));
+		return false;
+	}
+}
+
+static void freeCodec(decompStream* stream) {
+	switch (stream->format) {
+	case CompressionGzip: inflateEnd(&stream->codec.gzip); break;
+#ifdef HAVE_LZMA
+	case CompressionXz: lzma_end(&stream->codec.xz); break;
+#endif
+#ifdef HAVE_ZSTD
+	case CompressionZstd: ZSTD_freeDStream(stream->codec.zstd.ctx); break;
+#endif
+	default: break;
+	}
+}
+
+decompStream* decompOpen(FILE* input, size_t chunkSize) {
+	decompStream* stream = emalloc(sizeof(decompStream));
+	stream->input = input;
+	stream->chunkSize = chunkSize;
+	stream->magicLen = fread(stream->magic, 1, sizeof(stream->magic), input);
+	stream->magicPos = 0;
+	stream->format = decompDetect(stream->magic, stream->magicLen);
+	if (!initCodec(stream)) {
+		free(stream);
+		return NULL;
+	}
+	if (stream->format != CompressionNone) {
+		lprintf(LogDebug, "Decompressing %s input\n", decompFormatName(stream->format));
+	}
+	stream->in = (stream->format == CompressionNone ? NULL : emalloc(InputChunkSize));
+	stream->inEof = false;
+
+	g_mutex_init(&stream->lock);
+	g_cond_init(&stream->changed);
+	for (size_t i = 0; i < 2; ++i) {
+		stream->buffers[i].data = emalloc(chunkSize);
+		stream->buffers[i].len = 0;
+		stream->buffers[i].full = false;
+	}
+	stream->consumerIdx = 0;
+	stream->consumerHolding = false;
+	stream->finished = false;
+	stream->stop = false;
+	stream->err = 0;
+	stream->thread = g_thread_new("Decompress", &decompThread, stream);
+	return stream;
+}
+
+int decompRead(decompStream* stream, const char** data, size_t* len) {
+	g_mutex_lock(&stream->lock);
+	if (stream->consumerHolding) {
+		// Return the previous buffer to the thread
+		stream->buffers[stream->consumerIdx].full = false;
+		stream->consumerIdx ^= 1;
+		stream->consumerHolding = false;
+		g_cond_broadcast(&stream->changed);
+	}
+	decompBuffer* buffer = &stream->buffers[stream->consumerIdx];
+	while (!buffer->full && !stream->finished) g_cond_wait(&stream->changed, &stream->lock);
+
+	int err = 0;
+	if (buffer->full && buffer->len > 0) {
+		*data = buffer->data;
+		*len = buffer->len;
+		stream->consumerHolding = true;
+	} else {
+		*data = NULL;
+		*len = 0;
+		err = stream->err;
+	}
+	g_mutex_unlock(&stream->lock);
+	return err;
+}
+
+CompressionFormat decompFormat(const decompStream* stream) {
+	return stream->format;
+}
+
+void decompClose(decompStream* stream) {
+	g_mutex_lock(&stream->lock);
+	stream->stop = true;
+	g_cond_broadcast(&stream->changed);
+	g_mutex_unlock(&stream->lock);
+	g_thread_join(stream->thread);
+
+	freeCodec(stream);
+	for (size_t i = 0; i < 2; ++i) free(stream->buffers[i].data);
+	free(stream->in);
+	g_cond_clear(&stream->changed);
+	g_mutex_clear(&stream->lock);
+	free(stream);
+}
@@ -0,0 +1,61 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module provides streaming decompression of input files. The compression
+// format is detected from the first bytes of the input. Decompression runs on
+// a separate thread, which fills one buffer while the caller consumes the
+// other, so that decompression and parsing can proceed in parallel.
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef enum {
+	CompressionNone,
+	CompressionGzip,
+	CompressionXz,
+	CompressionZstd,
+} CompressionFormat;
+
+typedef struct decompStream decompStream;
+
+// Detects the compression format of data beginning with the given bytes.
+CompressionFormat decompDetect(const void* data, size_t len);
+
+// Returns a human-readable name for a compression format.
+const char* decompFormatName(CompressionFormat format);
+
+// Begins reading from an input stream, decompressing it if necessary. Data is
+// returned in blocks of up to chunkSize bytes. Returns NULL if an error
+// occurred, such as the input using a format that is not supported by this
+// build.
+decompStream* decompOpen(FILE* input, size_t chunkSize);
+
+// Retrieves the next block of decompressed data. The block remains valid until
+// the next call to decompRead or decompClose. At the end of the input, *len is
+// set to 0. Returns 0 on success or an error code otherwise.
+int decompRead(decompStream* stream, const char** data, size_t* len);
+
+// Returns the compression format of the input.
+CompressionFormat decompFormat(const decompStream* stream);
+
+// Stops decompression and releases all resources associated with the stream.
+// The underlying input stream is not closed.
+void decompClose(decompStream* stream);
@@ -0,0 +1,527 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "edgelist.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decompress.h"
+#include "log.h"
+#include "mem.h"
+#include "nametable.h"
+#include "numparse.h"
+
+// Size of the blocks read from the input
+static const size_t ChunkSize = 1024 * 1024;
+
+// Fields are found by examining 8 bytes at a time
+static const uint64_t WordLowBits = 0x0101010101010101ULL;
+static const uint64_t WordHighBits = 0x8080808080808080ULL;
+
+static const size_t NoColumn = SIZE_MAX;
+
+typedef enum {
+	NcId,
+	NcType,
+	NcPacketLoss,
+	NcBandwidthUp,
+	NcBandwidthDown,
+	NodeColumnCount,
+} NodeColumn;
+
+static const char* NodeColumnNames[NodeColumnCount] = { "id", "type", "packetloss", "bandwidthup", "bandwidthdown" };
+
+typedef enum {
+	EcSource,
+	EcTarget,
+	EcWeight,
+	EcLatency,
+	EcPacketLoss,
+	EcJitter,
+	EcQueueLen,
+	EdgeColumnCount,
+} EdgeColumn;
+
+typedef enum {
+	ElStart,	// Waiting for the first header row
+	ElNodes,	// Inside the node table
+	ElEdges,	// Inside the edge table
+} ElSection;
+
+typedef struct {
+	const char* str;
+	size_t len;
+} elField;
+
+typedef struct {
+	NewNodeFunc newNode;
+	NewLinkFunc newLink;
+	void* userData;
+	const char* clientType;
+	const char* weightKey;
+
+	ElSection section;
+	char delim;
+	uint64_t line; // Current line number, for error messages
+
+	// Index of the field holding each column in the current table
+	size_t nodeColumns[NodeColumnCount];
+	size_t edgeColumns[EdgeColumnCount];
+
+	// Fields of the current row
+	elField* fields;
+	size_t fieldCount;
+	size_t fieldCap;
+
+	// Mutable copy of the current row, used when it contains quotes
+	char* quoted;
+	size_t quotedLen;
+	size_t quotedCap;
+
+	// NUL-terminated copies of the names passed to the callbacks
+	char* names;
+	size_t namesLen;
+	size_t namesCap;
+
+	// Names of the nodes that were implied by edges, if there is no node table
+	nameTable* implied;
+
+	int err;
+} elParser;
+
+static void elError(elParser* parser, const char* fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	lprintHead(LogError);
+	lprintDirectf(LogError, "Edge list parse error on line %lu: ", (unsigned long)parser->line);
+	lvprintDirectf(LogError, fmt, args);
+	lprintDirectFinish(LogError);
+	va_end(args);
+	if (parser->err == 0) parser->err = 1;
+}
+
+// Loads 8 bytes so that the first byte is always in the lowest position
+static uint64_t elLoadWord(const char* p) {
+	uint64_t word;
+	memcpy(&word, p, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	return word;
+}
+
+// Flags the bytes of a word that are equal to the byte repeated in pattern.
+// Bytes above a match may also be flagged, but the lowest flag is exact.
+static uint64_t elMatchBytes(uint64_t word, uint64_t pattern) {
+	uint64_t diff = word ^ pattern;
+	return (diff - WordLowBits) & ~diff & WordHighBits;
+}
+
+// Finds the first delimiter or quote in [p, end), or returns end if there are
+// none
+static const char* elNextSpecial(const char* p, const char* end, char delim) {
+	uint64_t delimPattern = WordLowBits * (uint8_t)delim;
+	uint64_t quotePattern = WordLowBits * (uint8_t)'"';
+	while (end - p >= 8) {
+		uint64_t word = elLoadWord(p);
+		uint64_t matches = elMatchBytes(word, delimPattern) | elMatchBytes(word, quotePattern);
+		if (matches != 0) return p + __builtin_ctzll(matches) / 8;
+		p += 8;
+	}
+	while (p < end && *p != delim && *p != '"') ++p;
+	return p;
+}
+
+static void elAddField(elParser* parser, const char* str, size_t len) {
+	flexBufferGrow((void**)&parser->fields, parser->fieldCount, &parser->fieldCap, 1, sizeof(elField));
+	parser->fields[parser->fieldCount].str = str;
+	parser->fields[parser->fieldCount].len = len;
+	++parser->fieldCount;
+}
+
+// Splits a row without quotes into fields. Returns false if a quote was found,
+// in which case the row must be split with elSplitQuoted instead.
+static bool elSplitPlain(elParser* parser, const char* line, const char* end) {
+	parser->fieldCount = 0;
+	const char* p = line;
+	while (true) {
+		const char* fieldEnd = elNextSpecial(p, end, parser->delim);
+		if (fieldEnd < end && *fieldEnd == '"') return false;
+		elAddField(parser, p, (size_t)(fieldEnd - p));
+		if (fieldEnd == end) return true;
+		p = fieldEnd + 1;
+	}
+}
+
+// Splits a row that may contain quoted fields. Quoted fields are unescaped in
+// place and NUL-terminated. Returns false if the row is malformed.
+static bool elSplitQuoted(elParser* parser, char* line, char* end) {
+	parser->fieldCount = 0;
+	char* p = line;
+	while (true) {
+		if (p < end && *p == '"') {
+			char* out = p;
+			const char* in = p + 1;
+			while (true) {
+				if (in >= end) {
+					elError(parser, "Unterminated quoted field\n");
+					return false;
+				}
+				if (*in == '"') {
+					if (in + 1 < end && in[1] == '"') {
+						*out++ = '"';
+						in += 2;
+						continue;
+					}
+					++in;
+					break;
+				}
+				*out++ = *in++;
+			}
+			elAddField(parser, p, (size_t)(out - p));
+			*out = '\0'; // The closing quote has been consumed
+			if (in == end) return true;
+			if (*in != parser->delim) {
+				elError(parser, "Unexpected characters after a quoted field\n");
+				return false;
+			}
+			p = line + (in - line) + 1;
+		} else {
+			char* fieldEnd = memchr(p, parser->delim, (size_t)(end - p));
+			if (fieldEnd == NULL) fieldEnd = end;
+			elAddField(parser, p, (size_t)(fieldEnd - p));
+			if (fieldEnd == end) return true;
+			p = fieldEnd + 1;
+		}
+	}
+}
+
+// Returns the field for a column, or an empty field if the column is absent
+static elField elGetField(const elParser* parser, size_t column) {
+	elField field = { .str = "", .len = 0 };
+	if (column != NoColumn && column < parser->fieldCount) field = parser->fields[column];
+	return field;
+}
+
+static bool elFieldIs(elField field, const char* str) {
+	return strlen(str) == field.len && memcmp(field.str, str, field.len) == 0;
+}
+
+// Numeric fields are converted from NUL-terminated copies. Otherwise, the
+// conversion would skip over the delimiter after an empty field and read the
+// number in the next field or row.
+#define EL_NUMBER_BUF 64
+
+// Returns a NUL-terminated copy of a field, which is either buf (if the field
+// fits) or a heap allocation that the caller must free
+static char* elCopyNumber(elField field, char* buf) {
+	char* text = (field.len < EL_NUMBER_BUF ? buf : emalloc(field.len + 1));
+	memcpy(text, field.str, field.len);
+	text[field.len] = '\0';
+	return text;
+}
+
+static double elParseDouble(elField field) {
+	if (field.len == 0) return 0.0;
+	char buf[EL_NUMBER_BUF];
+	char* text = elCopyNumber(field, buf);
+	double value = npParseDouble(text, NULL);
+	if (text != buf) free(text);
+	return value;
+}
+
+static float elParseFloat(elField field) {
+	if (field.len == 0) return 0.f;
+	char buf[EL_NUMBER_BUF];
+	char* text = elCopyNumber(field, buf);
+	float value = npParseFloat(text, NULL);
+	if (text != buf) free(text);
+	return value;
+}
+
+static uint32_t elParseUint32(elField field) {
+	if (field.len == 0) return 0;
+	char buf[EL_NUMBER_BUF];
+	char* text = elCopyNumber(field, buf);
+	uint32_t value = npParseUint32(text, NULL);
+	if (text != buf) free(text);
+	return value;
+}
+
+// Returns a NUL-terminated copy of a field that remains valid until the next
+// row. Fields are copied because they are usually followed by a delimiter.
+static size_t elStoreName(elParser* parser, elField field) {
+	flexBufferGrow((void**)&parser->names, parser->namesLen, &parser->namesCap, field.len + 1, 1);
+	size_t offset = parser->namesLen;
+	memcpy(&parser->names[offset], field.str, field.len);
+	parser->names[offset + field.len] = '\0';
+	parser->namesLen += field.len + 1;
+	return offset;
+}
+
+// Interprets a header row. Returns false if it is not a valid header.
+static bool elReadHeader(elParser* parser) {
+	for (size_t i = 0; i < EdgeColumnCount; ++i) parser->edgeColumns[i] = NoColumn;
+	for (size_t i = 0; i < NodeColumnCount; ++i) parser->nodeColumns[i] = NoColumn;
+
+	// The weight column may also be one of the other columns
+	const char* edgeColumnNames[EdgeColumnCount] = { "source", "target", parser->weightKey, "latency", "packetloss", "jitter", "queue_len" };
+	for (size_t f = 0; f < parser->fieldCount; ++f) {
+		for (size_t i = 0; i < EdgeColumnCount; ++i) {
+			if (parser->edgeColumns[i] == NoColumn && elFieldIs(parser->fields[f], edgeColumnNames[i])) parser->edgeColumns[i] = f;
+		}
+	}
+	bool edgeHeader = (parser->edgeColumns[EcSource] != NoColumn && parser->edgeColumns[EcTarget] != NoColumn);
+
+	if (edgeHeader) {
+		if (parser->edgeColumns[EcWeight] == NoColumn) {
+			elError(parser, "The edge table did not include a column '%s' for route calculations. Specify --weight to use a different column.\n", parser->weightKey);
+			return false;
+		}
+		parser->section = ElEdges;
+		return true;
+	}
+
+	if (parser->section != ElStart) return false;
+	for (size_t f = 0; f < parser->fieldCount; ++f) {
+		for (size_t i = 0; i < NodeColumnCount; ++i) {
+			if (parser->nodeColumns[i] == NoColumn && elFieldIs(parser->fields[f], NodeColumnNames[i])) parser->nodeColumns[i] = f;
+		}
+	}
+	if (parser->nodeColumns[NcId] == NoColumn) {
+		elError(parser, "Expected a node table header with an 'id' column, or an edge table header with 'source' and 'target' columns\n");
+		return false;
+	}
+	parser->section = ElNodes;
+	return true;
+}
+
+static bool elIsClient(const elParser* parser, elField type) {
+	return parser->clientType == NULL || elFieldIs(type, parser->clientType);
+}
+
+static void elEmitNode(elParser* parser, const char* name, size_t nameLen, const TopoNode* t) {
+	GmlNode node = { .name = name, .nameLen = nameLen, .t = *t };
+	int err = parser->newNode(&node, parser->userData);
+	if (err != 0 && parser->err == 0) parser->err = err;
+}
+
+static void elReadNode(elParser* parser) {
+	elField id = elGetField(parser, parser->nodeColumns[NcId]);
+	if (id.len == 0) {
+		elError(parser, "Node without an identifier\n");
+		return;
+	}
+	TopoNode t = {
+		.client = elIsClient(parser, elGetField(parser, parser->nodeColumns[NcType])),
+		.packetLoss = elParseDouble(elGetField(parser, parser->nodeColumns[NcPacketLoss])),
+		.bandwidthUp = elParseDouble(elGetField(parser, parser->nodeColumns[NcBandwidthUp])),
+		.bandwidthDown = elParseDouble(elGetField(parser, parser->nodeColumns[NcBandwidthDown])),
+	};
+	parser->namesLen = 0;
+	size_t name = elStoreName(parser, id);
+	elEmitNode(parser, &parser->names[name], id.len, &t);
+}
+
+// Reports a node that is referenced by an edge if there is no node table and
+// the node has not been seen before
+static void elImplyNode(elParser* parser, const char* name, size_t nameLen) {
+	if (parser->implied == NULL) return;
+	uint32_t unused;
+	if (ntLookup(parser->implied, name, nameLen, &unused)) return;
+	ntInsert(parser->implied, name, nameLen, 0);
+	TopoNode t = {
+		.client = (parser->clientType == NULL),
+		.packetLoss = 0.0,
+		.bandwidthUp = 0.0,
+		.bandwidthDown = 0.0,
+	};
+	elEmitNode(parser, name, nameLen, &t);
+}
+
+static void elReadEdge(elParser* parser) {
+	elField source = elGetField(parser, parser->edgeColumns[EcSource]);
+	elField target = elGetField(parser, parser->edgeColumns[EcTarget]);
+	if (source.len == 0 || target.len == 0) {
+		elError(parser, "Edge without a source or target node\n");
+		return;
+	}
+	parser->namesLen = 0;
+	size_t sourceName = elStoreName(parser, source);
+	size_t targetName = elStoreName(parser, target);
+
+	elImplyNode(parser, &parser->names[sourceName], source.len);
+	elImplyNode(parser, &parser->names[targetName], target.len);
+	if (parser->err != 0) return;
+
+	elField weight = elGetField(parser, parser->edgeColumns[EcWeight]);
+	GmlLink link = {
+		.sourceName = &parser->names[sourceName],
+		.sourceNameLen = source.len,
+		.targetName = &parser->names[targetName],
+		.targetNameLen = target.len,
+		.weight = (weight.len > 0 ? elParseFloat(weight) : INFINITY),
+		.t = {
+			.latency = elParseDouble(elGetField(parser, parser->edgeColumns[EcLatency])),
+			.packetLoss = elParseDouble(elGetField(parser, parser->edgeColumns[EcPacketLoss])),
+			.jitter = elParseDouble(elGetField(parser, parser->edgeColumns[EcJitter])),
+			.queueLen = elParseUint32(elGetField(parser, parser->edgeColumns[EcQueueLen])),
+		},
+	};
+	int err = parser->newLink(&link, parser->userData);
+	if (err != 0 && parser->err == 0) parser->err = err;
+}
+
+// Handles one row of the input, which ends before end. Fields are only read
+// within the bounds of the row.
+static void elReadLine(elParser* parser, const char* line, const char* end) {
+	++parser->line;
+	if (end > line && end[-1] == '\r') --end;
+	if (end == line || *line == '#') return;
+
+	if (parser->section == ElStart) {
+		parser->delim = (memchr(line, '\t', (size_t)(end - line)) != NULL ? '\t' : ',');
+	}
+
+	if (!elSplitPlain(parser, line, end)) {
+		// Quoted fields are unescaped in a mutable copy of the row
+		size_t len = (size_t)(end - line);
+		parser->quotedLen = 0;
+		flexBufferGrow((void**)&parser->quoted, parser->quotedLen, &parser->quotedCap, len + 1, 1);
+		flexBufferAppend(parser->quoted, &parser->quotedLen, line, len, 1);
+		parser->quoted[len] = '\0';
+		if (!elSplitQuoted(parser, parser->quoted, parser->quoted + len)) return;
+	}
+
+	// A row is a header if it starts a table. Node rows never contain both of
+	// the edge table's required columns, so the edge header is recognized
+	// by its contents.
+	if (parser->section == ElStart) {
+		elReadHeader(parser);
+		if (parser->section == ElEdges) parser->implied = ntNewTable(UINT64_MAX);
+		return;
+	}
+	if (parser->section == ElNodes) {
+		bool hasSource = false, hasTarget = false;
+		for (size_t f = 0; f < parser->fieldCount; ++f) {
+			if (elFieldIs(parser->fields[f], "source")) hasSource = true;
+			else if (elFieldIs(parser->fields[f], "target")) hasTarget = true;
+		}
+		if (hasSource && hasTarget) {
+			elReadHeader(parser);
+			return;
+		}
+		elReadNode(parser);
+	} else {
+		elReadEdge(parser);
+	}
+}
+
+int elParse(FILE* input, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
+	elParser parser = {
+		.newNode = newNode,
+		.newLink = newLink,
+		.userData = userData,
+		.clientType = clientType,
+		.weightKey = weightKey,
+		.section = ElStart,
+		.delim = ',',
+		.line = 0,
+		.implied = NULL,
+		.err = 0,
+	};
+	flexBufferInit((void**)&parser.fields, &parser.fieldCount, &parser.fieldCap);
+	flexBufferInit((void**)&parser.quoted, &parser.quotedLen, &parser.quotedCap);
+	flexBufferInit((void**)&parser.names, &parser.namesLen, &parser.namesCap);
+
+	// Rows that span blocks are collected in the carry buffer. All other rows
+	// are read directly from the decompressed blocks.
+	char* carry;
+	size_t carryLen, carryCap;
+	flexBufferInit((void**)&carry, &carryLen, &carryCap);
+
+	decompStream* stream = decompOpen(input, ChunkSize);
+	if (stream == NULL) parser.err = 1;
+	while (parser.err == 0) {
+		const char* data;
+		size_t len;
+		parser.err = decompRead(stream, &data, &len);
+		if (parser.err != 0 || len == 0) break;
+
+		const char* p = data;
+		const char* end = data + len;
+		if (carryLen > 0) {
+			const char* newline = memchr(p, '\n', len);
+			const char* rowEnd = (newline != NULL ? newline : end);
+			flexBufferGrow((void**)&carry, carryLen, &carryCap, (size_t)(rowEnd - p) + 1, 1);
+			flexBufferAppend(carry, &carryLen, p, (size_t)(rowEnd - p), 1);
+			if (newline == NULL) continue;
+			carry[carryLen] = '\0';
+			elReadLine(&parser, carry, carry + carryLen);
+			carryLen = 0;
+			p = newline + 1;
+		}
+		while (p < end && parser.err == 0) {
+			const char* newline = memchr(p, '\n', (size_t)(end - p));
+			if (newline == NULL) {
+				flexBufferGrow((void**)&carry, carryLen, &carryCap, (size_t)(end - p) + 1, 1);
+				flexBufferAppend(carry, &carryLen, p, (size_t)(end - p), 1);
+				break;
+			}
+			elReadLine(&parser, p, newline);
+			p = newline + 1;
+		}
+	}
+
+	// The last row may not end with a newline
+	if (parser.err == 0 && carryLen > 0) {
+		carry[carryLen] = '\0';
+		elReadLine(&parser, carry, carry + carryLen);
+	}
+	if (parser.err == 0 && parser.section != ElEdges) {
+		elError(&parser, "The edge list did not contain an edge table\n");
+	}
+
+	if (stream != NULL) decompClose(stream);
+	flexBufferFree((void**)&carry, &carryLen, &carryCap);
+	flexBufferFree((void**)&parser.fields, &parser.fieldCount, &parser.fieldCap);
+	flexBufferFree((void**)&parser.quoted, &parser.quotedLen, &parser.quotedCap);
+	flexBufferFree((void**)&parser.names, &parser.namesLen, &parser.namesCap);
+	if (parser.implied != NULL) ntFreeTable(parser.implied);
+	return parser.err;
+}
+
+int elParseFile(const char* filename, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
+	errno = 0;
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL) {
+		int err = errno;
+		lprintf(LogError, "Could not open edge list '%s': %s\n", filename, strerror(err));
+		return err;
+	}
+	int err = elParse(file, newNode, newLink, userData, clientType, weightKey);
+	fclose(file);
+	return err;
+}
@@ -0,0 +1,52 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module reads topologies from edge lists: delimited text files with an
+// optional table of nodes followed by a table of edges. Each table begins with
+// a header row naming its columns, which may appear in any order:
+//
+//   Nodes: id, type, packetloss, bandwidthup, bandwidthdown
+//   Edges: source, target, latency, packetloss, jitter, queue_len
+//
+// The node table's header must contain an "id" column, and the edge table's
+// header must contain "source" and "target" columns, as well as the column
+// used for route calculations. Columns with other names are ignored, as are
+// missing cells. If there is no node table, the nodes are implied by the
+// edges, and use default parameters. Columns are separated by tabs if the
+// first header row contains any, and by commas otherwise. Fields may be
+// enclosed in double quotes, in which case two consecutive quotes denote one
+// quote character, but fields may not span lines. Empty lines and lines
+// beginning with '#' are ignored.
+
+#include <stdio.h>
+
+#include "graphml.h"
+
+// Parses an edge list from a stream. Streams compressed with gzip, xz, or zstd
+// are decompressed transparently. clientType is the value of the "type" column
+// that marks client nodes; if it is NULL, all nodes are clients. weightKey is
+// the name of the edge column used for route calculations. Returns 0 for
+// success.
+int elParse(FILE* input, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey);
+
+// Parses an edge list stored on the disk. The behavior is the same as elParse.
+// Returns 0 for success.
+int elParseFile(const char* filename, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey);
@@ -17,18 +17,32 @@
  * You should have received a copy of the GNU Affero General Public License
  * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
  *******************************************************************************/
+#define _POSIX_C_SOURCE 200809L // Require POSIX.1-2008
+
 #include "graphml.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <math.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#include <glib.h>
 #include <libxml/parser.h>
 
+#include "decompress.h"
 #include "log.h"
 #include "mem.h"
+#include "numparse.h"
 #include "topology.h"
 
 typedef struct {
@@ -36,9 +50,28 @@ typedef struct {
 	size_t cap;
 } xmlCharBuffer;
 
+// A string that is not necessarily NUL-terminated, such as a region of a
+// memory-mapped file
+typedef struct {
+	const xmlChar* str;
+	size_t len;
+} xmlCharSlice;
+
 const size_t DefaultXmlBufferLen = 255; // Arbitrary default; very generous
                                         // for GraphML identifiers
 
+// Compares a slice with a string literal
+#define SLICE_IS(slice, literal) ((slice).len == sizeof(literal)-1 && memcmp((slice).str, literal, sizeof(literal)-1) == 0)
+
+static xmlCharSlice sliceOf(const xmlChar* str) {
+	xmlCharSlice slice = { .str = str, .len = strlen((const char*)str) };
+	return slice;
+}
+
+static bool sliceEqualStr(xmlCharSlice slice, const char* str) {
+	return strncmp((const char*)slice.str, str, slice.len) == 0 && str[slice.len] == '\0';
+}
+
 static void initXmlCharBuffer(xmlCharBuffer* buffer) {
 	flexBufferInit((void**)&buffer->data, NULL, &buffer->cap);
 }
@@ -47,16 +80,25 @@ static void freeXmlCharBuffer(xmlCharBuffer* buffer) {
 	flexBufferFree((void**)&buffer->data, NULL, &buffer->cap);
 }
 
-// Copy a libxml string quickly, reallocating the target buffer if needed.
-// We do this to prevent allocating memory for every element in the graph.
-static void copyXmlStr(xmlCharBuffer* dst, const xmlChar* src) {
-	// xmlChars represent bytes of UTF-8 code points. UTF-8 never contains a NUL
-	// except for the final terminator, so we can treat these like C-strings for
-	// the purpose of copying.
-	size_t srcLen = strlen((const char*)src);
-	eaddSize(srcLen, 1, &srcLen);
-	flexBufferGrow((void**)&dst->data, 0, &dst->cap, srcLen, 1);
-	flexBufferAppend(dst->data, NULL, src, srcLen, 1);
+// Copy a string slice quickly, reallocating the target buffer if needed. The
+// copy is NUL-terminated. We do this to prevent allocating memory for every
+// element in the graph.
+static void copyXmlSlice(xmlCharBuffer* dst, xmlCharSlice src) {
+	size_t bufLen;
+	eaddSize(src.len, 1, &bufLen);
+	flexBufferGrow((void**)&dst->data, 0, &dst->cap, bufLen, 1);
+	memcpy(dst->data, src.str, src.len);
+	dst->data[src.len] = '\0';
+}
+
+// Allocates a NUL-terminated copy of a slice
+static xmlChar* sliceDup(xmlCharSlice src) {
+	size_t bufLen;
+	eaddSize(src.len, 1, &bufLen);
+	xmlChar* copy = emalloc(bufLen);
+	memcpy(copy, src.str, src.len);
+	copy[src.len] = '\0';
+	return copy;
 }
 
 typedef enum {
@@ -69,6 +111,43 @@ typedef enum {
 	GpData,		// Inside a data element
 } GraphParserMode;
 
+// Element names recognized by the parser. Names are classified once per tag so
+// that the state machine only compares small integers.
+typedef enum {
+	GeOther,
+	GeGraphml,
+	GeKey,
+	GeGraph,
+	GeNode,
+	GeEdge,
+	GeData,
+} GraphElement;
+
+// Setters that a data key can feed. A single key may drive several setters
+// (e.g., the shortest path weight is usually also the latency).
+typedef enum {
+	KsNodeType          = 1 << 0,
+	KsNodePacketLoss    = 1 << 1,
+	KsNodeBandwidthUp   = 1 << 2,
+	KsNodeBandwidthDown = 1 << 3,
+	KsEdgeWeight        = 1 << 4,
+	KsEdgeLatency       = 1 << 5,
+	KsEdgePacketLoss    = 1 << 6,
+	KsEdgeJitter        = 1 << 7,
+	KsEdgeQueueLen      = 1 << 8,
+} KeySetter;
+
+// Entry in the key dispatch table. id points into the attribute identifiers
+// owned by the parser state.
+typedef struct {
+	const xmlChar* id;
+	size_t len;
+	unsigned int setters;
+} KeyDispatch;
+
+// Must be a power of two comfortably larger than the number of known setters
+#define KeyDispatchSize 32
+
 // Parser state for GraphML files
 typedef struct {
 	GraphParserMode mode;
@@ -100,8 +179,17 @@ typedef struct {
 		xmlChar* queueLenId;
 	} edgeAttribs;
 
+	// Open-addressed table mapping data keys to setters. Built from the
+	// attribute identifiers once all of the keys have been read.
+	KeyDispatch keyDispatch[KeyDispatchSize];
+
+	// Element attributes, stored as alternating name and value slices
+	xmlCharSlice* atts;
+	size_t attsCap;
+
 	// Attribute values
 	xmlCharBuffer dataKey;		// Key for the data being parsed
+	size_t dataKeyLen;			// Length of the key
 	xmlChar* dataValue;			// Buffer for the data value
 	size_t dataValueLen;		// Size of the data value buffer contents
 	size_t dataValueCap;		// Capacity of the data value buffer
@@ -117,6 +205,7 @@ typedef struct {
 	// Error handling state
 	bool partialError;	// True if libxml sent an error without a newline
 	bool dead;			// True if a fatal error has been encountered
+	bool quiet;			// True if fatal errors are not shown
 
 	// Data necessary for calling back to the client
 	void* userData;
@@ -160,6 +249,8 @@ static void showXmlError(void* ctx, const char* msg, ...) {
 
 // Display a parsing error and terminate the parsing
 static void graphFatalError(GraphParserState* state, const char* fmt, ...) {
+	state->dead = true;
+	if (state->quiet) return;
 	va_list args;
 	va_start(args, fmt);
 	lprintHead(LogError);
@@ -167,10 +258,10 @@ static void graphFatalError(GraphParserState* state, const char* fmt, ...) {
 	lvprintDirectf(LogError, fmt, args);
 	lprintDirectFinish(LogError);
 	va_end(args);
-	state->dead = true;
 }
 
-static void initGraphParserState(GraphParserState* state, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
+// Initializes a parser state without registering it with libxml
+static void initGraphParserFields(GraphParserState* state, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
 	state->clientType = clientType;
 	state->weightKey = weightKey;
 	state->newNodeFunc = newNode;
@@ -178,7 +269,9 @@ static void initGraphParserState(GraphParserState* state, NewNodeFunc newNode, N
 	state->userData = userData;
 	state->mode = GpInitial;
 	state->defaultUndirected = false;
+	flexBufferInit((void**)&state->atts, NULL, &state->attsCap);
 	initXmlCharBuffer(&state->dataKey);
+	state->dataKeyLen = 0;
 	flexBufferInit((void**)&state->dataValue, &state->dataValueLen, &state->dataValueCap);
 	flexBufferGrow((void**)&state->dataValue, state->dataValueLen, &state->dataValueCap, DefaultXmlBufferLen, 1);
 	initXmlCharBuffer(&state->nodeId);
@@ -186,13 +279,20 @@ static void initGraphParserState(GraphParserState* state, NewNodeFunc newNode, N
 	initXmlCharBuffer(&state->linkTargetId);
 	state->partialError = false;
 	state->dead = false;
+	state->quiet = false;
 	state->userError = 0;
 	memset(&state->nodeAttribs, 0, sizeof(state->nodeAttribs));
 	memset(&state->edgeAttribs, 0, sizeof(state->edgeAttribs));
+	memset(state->keyDispatch, 0, sizeof(state->keyDispatch));
+}
+
+static void initGraphParserState(GraphParserState* state, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
+	initGraphParserFields(state, newNode, newLink, userData, clientType, weightKey);
 	xmlSetGenericErrorFunc(state, &showXmlError);
 }
 
 static void cleanupGraphParserState(GraphParserState* state) {
+	flexBufferFree((void**)&state->atts, NULL, &state->attsCap);
 	freeXmlCharBuffer(&state->dataKey);
 	flexBufferFree((void**)&state->dataValue, &state->dataValueLen, &state->dataValueCap);
 	freeXmlCharBuffer(&state->nodeId);
@@ -210,10 +310,131 @@ static void cleanupGraphParserState(GraphParserState* state) {
 	FREE_ATTRIBS(edge);
 }
 
-static void graphStartElement(void* ctx, const xmlChar* name, const xmlChar** atts) {
-	GraphParserState* state = (GraphParserState*)ctx;
+// Classifies an element name. Only the lengths that correspond to known names
+// need a comparison, and each length has at most three candidates.
+static GraphElement classifyElement(xmlCharSlice name) {
+	const char* s = (const char*)name.str;
+	switch (name.len) {
+	case 3:
+		if (memcmp(s, "key", 3) == 0) return GeKey;
+		break;
+	case 4:
+		switch (s[0]) {
+		case 'n': if (memcmp(s, "node", 4) == 0) return GeNode; break;
+		case 'e': if (memcmp(s, "edge", 4) == 0) return GeEdge; break;
+		case 'd': if (memcmp(s, "data", 4) == 0) return GeData; break;
+		}
+		break;
+	case 5:
+		if (memcmp(s, "graph", 5) == 0) return GeGraph;
+		break;
+	case 7:
+		if (memcmp(s, "graphml", 7) == 0) return GeGraphml;
+		break;
+	}
+	return GeOther;
+}
+
+// Hashes a key identifier using its length and boundary bytes. Key identifiers
+// in practice are short generated names (e.g., "d0" to "d42"), which these
+// bytes distinguish.
+static size_t keyDispatchHash(const xmlChar* id, size_t len) {
+	size_t h = len * 131;
+	if (len > 0) h += (size_t)id[0] * 31 + (size_t)id[len-1] * 7;
+	if (len > 2) h += (size_t)id[len-2] * 17;
+	return h & (KeyDispatchSize-1);
+}
+
+static void keyDispatchAdd(GraphParserState* state, const xmlChar* id, unsigned int setter) {
+	if (id == NULL) return;
+	size_t len = strlen((const char*)id);
+	for (size_t i = keyDispatchHash(id, len);; i = (i+1) & (KeyDispatchSize-1)) {
+		KeyDispatch* entry = &state->keyDispatch[i];
+		if (entry->id == NULL) {
+			entry->id = id;
+			entry->len = len;
+			entry->setters = setter;
+			return;
+		}
+		if (entry->len == len && memcmp(entry->id, id, len) == 0) {
+			entry->setters |= setter;
+			return;
+		}
+	}
+}
+
+// Rebuilds the key dispatch table from the recorded attribute identifiers.
+// Must be called again whenever the identifiers change.
+static void buildKeyDispatch(GraphParserState* state) {
+	memset(state->keyDispatch, 0, sizeof(state->keyDispatch));
+	if (state->clientType != NULL) keyDispatchAdd(state, state->nodeAttribs.typeId, KsNodeType);
+	keyDispatchAdd(state, state->nodeAttribs.packetLossId, KsNodePacketLoss);
+	keyDispatchAdd(state, state->nodeAttribs.bandwidthUpId, KsNodeBandwidthUp);
+	keyDispatchAdd(state, state->nodeAttribs.bandwidthDownId, KsNodeBandwidthDown);
+	keyDispatchAdd(state, state->edgeAttribs.weightId, KsEdgeWeight);
+	keyDispatchAdd(state, state->edgeAttribs.latencyId, KsEdgeLatency);
+	keyDispatchAdd(state, state->edgeAttribs.packetLossId, KsEdgePacketLoss);
+	keyDispatchAdd(state, state->edgeAttribs.jitterId, KsEdgeJitter);
+	keyDispatchAdd(state, state->edgeAttribs.queueLenId, KsEdgeQueueLen);
+}
+
+// Returns the setters associated with a data key, or 0 for unused keys
+static unsigned int keyDispatchLookup(const GraphParserState* state, xmlCharSlice key) {
+	for (size_t i = keyDispatchHash(key.str, key.len);; i = (i+1) & (KeyDispatchSize-1)) {
+		const KeyDispatch* entry = &state->keyDispatch[i];
+		if (entry->id == NULL) return 0;
+		if (entry->len == key.len && memcmp(entry->id, key.str, key.len) == 0) return entry->setters;
+	}
+}
+
+// Applies the value of a data element to the current node or link. objMode is
+// the mode of the element that contains the data. The value does not need to
+// be NUL-terminated, but it must be followed by a character that cannot be
+// part of a number.
+static void graphApplyData(GraphParserState* state, GraphParserMode objMode, xmlCharSlice key, xmlCharSlice value) {
+	const char* valueStr = (const char*)value.str;
+	unsigned int setters = keyDispatchLookup(state, key);
+	if (setters == 0 && (objMode == GpNode || objMode == GpEdge)) return;
+
+	switch (objMode) {
+	case GpNode:
+		if (setters & KsNodeType) {
+			state->node.t.client = sliceEqualStr(value, state->clientType);
+		} else if (setters & KsNodePacketLoss) {
+			state->node.t.packetLoss = npParseDouble(valueStr, NULL);
+		} else if (setters & KsNodeBandwidthUp) {
+			state->node.t.bandwidthUp = npParseDouble(valueStr, NULL);
+		} else if (setters & KsNodeBandwidthDown) {
+			state->node.t.bandwidthDown = npParseDouble(valueStr, NULL);
+		}
+		break;
+
+	case GpEdge:
+		if (setters & KsEdgeWeight) {
+			state->link.weight = npParseFloat(valueStr, NULL);
+		}
+		if (setters & KsEdgeLatency) {
+			state->link.t.latency = npParseDouble(valueStr, NULL);
+		} else if (setters & KsEdgePacketLoss) {
+			state->link.t.packetLoss = npParseDouble(valueStr, NULL);
+		} else if (setters & KsEdgeJitter) {
+			state->link.t.jitter = npParseDouble(valueStr, NULL);
+		} else if (setters & KsEdgeQueueLen) {
+			state->link.t.queueLen = npParseUint32(valueStr, NULL);
+		}
+		break;
+
+	default: graphFatalError(state, "BUG: Unknown GraphML data state %d when parsing key!\n", objMode);
+	}
+}
+
+// Handles the start of an element. atts contains attCount pairs of slices for
+// the names and values of the attributes.
+static void graphStartElementSlices(GraphParserState* state, xmlCharSlice name, const xmlCharSlice* atts, size_t attCount) {
 	if (state->dead) return;
 	bool unknown = false;
+	const xmlCharSlice* attsEnd = atts + attCount*2;
+	GraphElement element = (state->mode == GpUnknown ? GeOther : classifyElement(name));
 
 	switch (state->mode) {
 	case GpUnknown:
@@ -221,13 +442,13 @@ static void graphStartElement(void* ctx, const xmlChar* name, const xmlChar** at
 		break;
 
 	case GpInitial:
-		if (!xmlStrEqual(name, (const xmlChar*)"graphml")) {
+		if (element != GeGraphml) {
 			graphFatalError(state, "The topology file is not a GraphML file.\n");
 			break;
 		}
-		for (const xmlChar** att = atts; *att; att += 2) {
-			if (xmlStrEqual(att[0], (const xmlChar*)"xmlns")) {
-				if (!xmlStrEqual(att[1], (const xmlChar*)"http://graphml.graphdrawing.org/xmlns")) {
+		for (const xmlCharSlice* att = atts; att < attsEnd; att += 2) {
+			if (SLICE_IS(att[0], "xmlns")) {
+				if (!SLICE_IS(att[1], "http://graphml.graphdrawing.org/xmlns")) {
 					graphFatalError(state, "The topology file used an unknown GraphML namespace.\n");
 				}
 				break;
@@ -237,40 +458,43 @@ static void graphStartElement(void* ctx, const xmlChar* name, const xmlChar** at
 		break;
 
 	case GpTopLevel:
-		if (xmlStrEqual(name, (const xmlChar*)"key")) {
-			const xmlChar* keyName = NULL;
-			const xmlChar* id = NULL;
-			const xmlChar* type = NULL;
-			const xmlChar* keyFor = NULL;
-			for (const xmlChar** att = atts; *att; att += 2) {
-				if (xmlStrEqual(att[0], (const xmlChar*)"attr.name")) keyName = att[1];
-				else if (xmlStrEqual(att[0], (const xmlChar*)"id")) id = att[1];
-				else if (xmlStrEqual(att[0], (const xmlChar*)"attr.type")) type = att[1];
-				else if (xmlStrEqual(att[0], (const xmlChar*)"for")) keyFor = att[1];
+		if (element == GeKey) {
+			const xmlCharSlice* keyName = NULL;
+			const xmlCharSlice* id = NULL;
+			const xmlCharSlice* type = NULL;
+			const xmlCharSlice* keyFor = NULL;
+			for (const xmlCharSlice* att = atts; att < attsEnd; att += 2) {
+				if (SLICE_IS(att[0], "attr.name")) keyName = &att[1];
+				else if (SLICE_IS(att[0], "id")) id = &att[1];
+				else if (SLICE_IS(att[0], "attr.type")) type = &att[1];
+				else if (SLICE_IS(att[0], "for")) keyFor = &att[1];
 			}
 
 			if (keyName && id && type && keyFor) {
 				// Convenience macro used to record attribute identifiers.
-				// We store it explicitly rather than using a hash map for
-				// performance reasons.
+				// The identifiers are indexed into the key dispatch table
+				// when the graph element begins.
 				#define CHECK_SET_ATTR(key, acceptInt, acceptFloat, acceptStr, objType, attr) \
-					if (xmlStrEqual(keyName, (const xmlChar*)key)) { \
+					if (sliceEqualStr(*keyName, key)) { \
 						bool correctType = false; \
-						if (xmlStrEqual(type, (const xmlChar*)"int") || xmlStrEqual(type, (const xmlChar*)"long")) correctType = (acceptInt); \
-						else if (xmlStrEqual(type, (const xmlChar*)"float") || xmlStrEqual(type, (const xmlChar*)"double")) correctType = (acceptFloat); \
-						else if (xmlStrEqual(type, (const xmlChar*)"string")) correctType = (acceptStr); \
+						if (SLICE_IS(*type, "int") || SLICE_IS(*type, "long")) correctType = (acceptInt); \
+						else if (SLICE_IS(*type, "float") || SLICE_IS(*type, "double")) correctType = (acceptFloat); \
+						else if (SLICE_IS(*type, "string")) correctType = (acceptStr); \
 						if (!correctType) { \
-							graphFatalError(state, "The key '%s' in the topology file had unexpected type '%s'.\n", key, type); \
-						} else state->objType##Attribs.attr##Id = xmlStrdup(id); \
+							graphFatalError(state, "The key '%s' in the topology file had unexpected type '%.*s'.\n", key, (int)type->len, type->str); \
+						} else { \
+							free(state->objType##Attribs.attr##Id); \
+							state->objType##Attribs.attr##Id = sliceDup(*id); \
+						} \
 					}
 
 				// Record the attribute if it is one of the known ones
-				if (xmlStrEqual(keyFor, (const xmlChar*)"node")) {
+				if (SLICE_IS(*keyFor, "node")) {
 					CHECK_SET_ATTR("type", false, false, true, node, type)
 					else CHECK_SET_ATTR("packetloss", true, true, false, node, packetLoss)
 					else CHECK_SET_ATTR("bandwidthup", true, true, false, node, bandwidthUp)
 					else CHECK_SET_ATTR("bandwidthdown", true, true, false, node, bandwidthDown)
-				} else if (xmlStrEqual(keyFor, (const xmlChar*)"edge")) {
+				} else if (SLICE_IS(*keyFor, "edge")) {
 					CHECK_SET_ATTR(state->weightKey, false, true, false, edge, weight)
 					CHECK_SET_ATTR("latency", true, true, false, edge, latency)
 					else CHECK_SET_ATTR("packetloss", true, true, false, edge, packetLoss)
@@ -279,11 +503,12 @@ static void graphStartElement(void* ctx, const xmlChar* name, const xmlChar** at
 				}
 			}
 			unknown = true;
-		} else if (xmlStrEqual(name, (const xmlChar*)"graph")) {
+		} else if (element == GeGraph) {
 			if (state->edgeAttribs.weightId == NULL) graphFatalError(state, "The topology file did not include an edge parameter '%s' for route calculations. Specify --weight to use a different attribute.\n", state->weightKey);
-			for (const xmlChar** att = atts; *att; att += 2) {
-				if (xmlStrEqual(att[0], (const xmlChar*)"edgedefault")) {
-					state->defaultUndirected = xmlStrEqual(att[1], (const xmlChar*)"undirected");
+			buildKeyDispatch(state);
+			for (const xmlCharSlice* att = atts; att < attsEnd; att += 2) {
+				if (SLICE_IS(att[0], "edgedefault")) {
+					state->defaultUndirected = SLICE_IS(att[1], "undirected");
 					break;
 				}
 			}
@@ -292,48 +517,51 @@ static void graphStartElement(void* ctx, const xmlChar* name, const xmlChar** at
 		break;
 
 	case GpGraph:
-		if (xmlStrEqual(name, (const xmlChar*)"node")) {
-			const xmlChar* id = NULL;
-			for (const xmlChar** att = atts; *att; att += 2) {
-				if (xmlStrEqual(att[0], (const xmlChar*)"id")) {
-					id = att[1];
+		if (element == GeNode) {
+			const xmlCharSlice* id = NULL;
+			for (const xmlCharSlice* att = atts; att < attsEnd; att += 2) {
+				if (SLICE_IS(att[0], "id")) {
+					id = &att[1];
 				}
 			}
 			if (!id) graphFatalError(state, "Topology contained a node without an identifier.\n");
 			else {
-				copyXmlStr(&state->nodeId, id);
+				copyXmlSlice(&state->nodeId, *id);
 				state->node.name = (const char*)state->nodeId.data;
+				state->node.nameLen = id->len;
 				state->node.t.client = (state->clientType != NULL ? false : true);
 				state->node.t.packetLoss = 0.0;
 				state->node.t.bandwidthUp = 0;
 				state->node.t.bandwidthDown = 0;
 				state->mode = GpNode;
 			}
-		} else if (xmlStrEqual(name, (const xmlChar*)"edge")) {
+		} else if (element == GeEdge) {
 			bool undirected = state->defaultUndirected;
-			const xmlChar* source = NULL;
-			const xmlChar* target = NULL;
-			for (const xmlChar** att = atts; *att; att += 2) {
-				if (xmlStrEqual(att[0], (const xmlChar*)"directed")) {
-					if (xmlStrEqual(att[1], (const xmlChar*)"false")) {
+			const xmlCharSlice* source = NULL;
+			const xmlCharSlice* target = NULL;
+			for (const xmlCharSlice* att = atts; att < attsEnd; att += 2) {
+				if (SLICE_IS(att[0], "directed")) {
+					if (SLICE_IS(att[1], "false")) {
 						undirected = true;
 					} else {
 						undirected = false;
 					}
-				} else if (xmlStrEqual(att[0], (const xmlChar*)"source")) {
-					source = att[1];
-				} else if (xmlStrEqual(att[0], (const xmlChar*)"target")) {
-					target = att[1];
+				} else if (SLICE_IS(att[0], "source")) {
+					source = &att[1];
+				} else if (SLICE_IS(att[0], "target")) {
+					target = &att[1];
 				}
 			}
 			if (!source) graphFatalError(state, "Topology contained an edge that did not specify a source node.\n");
 			else if (!target) graphFatalError(state, "Topology contained an edge that did not specify a target node.\n");
-			else if (!undirected) graphFatalError(state, "Topology contained a directed edge from '%s' to '%s'. Only undirected edges are supported.\n", source, target);
+			else if (!undirected) graphFatalError(state, "Topology contained a directed edge from '%.*s' to '%.*s'. Only undirected edges are supported.\n", (int)source->len, source->str, (int)target->len, target->str);
 			else {
-				copyXmlStr(&state->linkSourceId, source);
-				copyXmlStr(&state->linkTargetId, target);
+				copyXmlSlice(&state->linkSourceId, *source);
+				copyXmlSlice(&state->linkTargetId, *target);
 				state->link.sourceName = (const char*)state->linkSourceId.data;
+				state->link.sourceNameLen = source->len;
 				state->link.targetName = (const char*)state->linkTargetId.data;
+				state->link.targetNameLen = target->len;
 				state->link.weight = INFINITY;
 				state->link.t.latency = 0.0;
 				state->link.t.packetLoss = 0.0;
@@ -346,12 +574,13 @@ static void graphStartElement(void* ctx, const xmlChar* name, const xmlChar** at
 
 	case GpNode:
 	case GpEdge:
-		if (xmlStrEqual(name, (const xmlChar*)"data")) {
+		if (element == GeData) {
 			bool foundKey = false;
-			for (const xmlChar** att = atts; *att; att += 2) {
-				if (xmlStrEqual(att[0], (const xmlChar*)"key")) {
+			for (const xmlCharSlice* att = atts; att < attsEnd; att += 2) {
+				if (SLICE_IS(att[0], "key")) {
 					foundKey = true;
-					copyXmlStr(&state->dataKey, att[1]);
+					copyXmlSlice(&state->dataKey, att[1]);
+					state->dataKeyLen = att[1].len;
 					break;
 				}
 			}
@@ -376,6 +605,23 @@ static void graphStartElement(void* ctx, const xmlChar* name, const xmlChar** at
 	}
 }
 
+static void graphStartElement(void* ctx, const xmlChar* name, const xmlChar** atts) {
+	GraphParserState* state = (GraphParserState*)ctx;
+	if (state->dead) return;
+
+	// libxml omits the attribute array for elements without attributes
+	size_t attCount = 0;
+	if (atts != NULL) {
+		while (atts[attCount*2] != NULL) ++attCount;
+	}
+	flexBufferGrow((void**)&state->atts, 0, &state->attsCap, attCount*2, sizeof(xmlCharSlice));
+	for (size_t i = 0; i < attCount*2; ++i) {
+		state->atts[i] = sliceOf(atts[i]);
+	}
+
+	graphStartElementSlices(state, sliceOf(name), state->atts, attCount);
+}
+
 static void graphEndElement(void* ctx, const xmlChar* name) {
 	GraphParserState* state = (GraphParserState*)ctx;
 	if (state->dead) return;
@@ -391,42 +637,14 @@ static void graphEndElement(void* ctx, const xmlChar* name) {
 
 	case GpData: {
 		// Add NUL terminator if characters were read
-		const xmlChar* value = (const xmlChar*)"";
+		xmlCharSlice value = { .str = (const xmlChar*)"", .len = 0 };
 		if (state->dataValue) {
 			state->dataValue[state->dataValueLen] = 0;
-			value = state->dataValue;
-		}
-
-		switch (state->dataMode) {
-		case GpNode:
-			if (state->clientType != NULL && state->nodeAttribs.typeId && xmlStrEqual(state->dataKey.data, state->nodeAttribs.typeId)) {
-				state->node.t.client = (xmlStrEqual(value, (const xmlChar*)state->clientType));
-			} else if (state->nodeAttribs.packetLossId && xmlStrEqual(state->dataKey.data, state->nodeAttribs.packetLossId)) {
-				state->node.t.packetLoss = strtod((const char*)value, NULL);
-			} else if (state->nodeAttribs.bandwidthUpId && xmlStrEqual(state->dataKey.data, state->nodeAttribs.bandwidthUpId)) {
-				state->node.t.bandwidthUp = strtod((const char*)value, NULL);
-			} else if (state->nodeAttribs.bandwidthDownId && xmlStrEqual(state->dataKey.data, state->nodeAttribs.bandwidthDownId)) {
-				state->node.t.bandwidthDown = strtod((const char*)value, NULL);
-			}
-			break;
-
-		case GpEdge:
-			if (state->edgeAttribs.weightId && xmlStrEqual(state->dataKey.data, state->edgeAttribs.weightId)) {
-				state->link.weight = strtof((const char*)value, NULL);
-			}
-			if (state->edgeAttribs.latencyId && xmlStrEqual(state->dataKey.data, state->edgeAttribs.latencyId)) {
-				state->link.t.latency = strtod((const char*)value, NULL);
-			} else if (state->edgeAttribs.packetLossId && xmlStrEqual(state->dataKey.data, state->edgeAttribs.packetLossId)) {
-				state->link.t.packetLoss = strtod((const char*)value, NULL);
-			} else if (state->edgeAttribs.jitterId && xmlStrEqual(state->dataKey.data, state->edgeAttribs.jitterId)) {
-				state->link.t.jitter = strtod((const char*)value, NULL);
-			} else if (state->edgeAttribs.queueLenId && xmlStrEqual(state->dataKey.data, state->edgeAttribs.queueLenId)) {
-				state->link.t.queueLen = (uint32_t)strtoul((const char*)value, NULL, 10);
-			}
-			break;
-
-		default: graphFatalError(state, "BUG: Unknown GraphML data state %d when parsing key!\n", state->dataMode);
+			value.str = state->dataValue;
+			value.len = state->dataValueLen;
 		}
+		xmlCharSlice key = { .str = state->dataKey.data, .len = state->dataKeyLen };
+		graphApplyData(state, state->dataMode, key, value);
 
 		state->mode = state->dataMode;
 		break;
@@ -460,17 +678,22 @@ static void graphEndElement(void* ctx, const xmlChar* name) {
 	}
 }
 
-static void graphCharacters(void* ctx, const xmlChar* ch, int len) {
-	GraphParserState* state = (GraphParserState*)ctx;
+static void graphCharactersSlice(GraphParserState* state, xmlCharSlice ch) {
 	if (state->dead) return;
 
 	if (state->mode == GpData) {
-		// Append the new UTF-8 characters to the data buffer
-		flexBufferGrow((void**)&state->dataValue, state->dataValueLen, &state->dataValueCap, (size_t)len, 1);
-		flexBufferAppend(state->dataValue, &state->dataValueLen, ch, (size_t)len, 1);
+		// Append the new UTF-8 characters to the data buffer. We reserve an
+		// extra byte for the terminator added by graphEndElement.
+		flexBufferGrow((void**)&state->dataValue, state->dataValueLen, &state->dataValueCap, ch.len+1, 1);
+		flexBufferAppend(state->dataValue, &state->dataValueLen, ch.str, ch.len, 1);
 	}
 }
 
+static void graphCharacters(void* ctx, const xmlChar* ch, int len) {
+	xmlCharSlice slice = { .str = ch, .len = (size_t)len };
+	graphCharactersSlice((GraphParserState*)ctx, slice);
+}
+
 // Callbacks for parsing GraphML files with libxml SAX interface
 static xmlSAXHandler graphHandlers = {
 	startElement: &graphStartElement,
@@ -489,33 +712,39 @@ int gmlParse(FILE* input, NewNodeFunc newNode, NewLinkFunc newLink, void* userDa
 	xmlParserCtxtPtr xmlContext = NULL;
 	int err = 0;
 
-	// Read the input in chunks
-	const size_t chunkSize = 1024 * 8; // Must fit in an int
-	size_t read;
-	char* buffer = emalloc(chunkSize);
-	do {
-		read = fread(buffer, 1, chunkSize, input);
-		if (read > 0) {
+	// Read the input in chunks. Compressed input is decompressed on another
+	// thread while the previous chunk is being parsed.
+	const size_t chunkSize = 1024 * 1024; // Must fit in an int
+	decompStream* stream = decompOpen(input, chunkSize);
+	if (stream == NULL) {
+		cleanupGraphParserState(&state);
+		return 1;
+	}
+	while (!err) {
+		const char* buffer;
+		size_t read;
+		err = decompRead(stream, &buffer, &read);
+		if (err || read == 0) break;
+
+		if (!xmlContext) {
+			// Initialize the context using the first chunk to detect the
+			// encoding
+			xmlContext = xmlCreatePushParserCtxt(&graphHandlers, &state, buffer, (int)read, NULL);
 			if (!xmlContext) {
-				// Initialize the context using the first chunk to detect the
-				// encoding
-				xmlContext = xmlCreatePushParserCtxt(&graphHandlers, &state, buffer, (int)read, NULL);
-				if (!xmlContext) {
-					err = -1;
-				} else {
-					xmlSetGenericErrorFunc(xmlContext, &showXmlError);
-				}
+				err = -1;
 			} else {
-				err = xmlParseChunk(xmlContext, buffer, (int)read, 0);
+				xmlSetGenericErrorFunc(xmlContext, &showXmlError);
 			}
+		} else {
+			err = xmlParseChunk(xmlContext, buffer, (int)read, 0);
 		}
-	} while (read == chunkSize && !err);
+	}
 
 	// If there were no problems, terminate the reading
 	if (xmlContext && !err) {
 		err = xmlParseChunk(xmlContext, NULL, 0, 1);
 	}
-	free(buffer);
+	decompClose(stream);
 	cleanupGraphParserState(&state);
 
 	// Handle errors
@@ -539,12 +768,40 @@ static int reportErrors(const GraphParserState* state, int libXmlResult) {
 	return 0;
 }
 
-int gmlParseFile(const char* filename, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
+// Parses a GraphML file that has already been opened as fd with libxml. The
+// file is not opened again, so that pipes can be read. fd is always closed.
+static int gmlParseDescriptor(int fd, const char* filename, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
+#ifdef LIBXML_PUSH_ENABLED
+	errno = 0;
+	FILE* file = fdopen(fd, "rb");
+	if (file == NULL) {
+		int err = errno;
+		close(fd);
+		lprintf(LogError, "Could not open GraphML file '%s': %s\n", filename, strerror(err));
+		return err;
+	}
+	int err = gmlParse(file, newNode, newLink, userData, clientType, weightKey);
+	fclose(file);
+	return err;
+#else
+	close(fd);
 	GraphParserState state;
 	initGraphParserState(&state, newNode, newLink, userData, clientType, weightKey);
 	int result = xmlSAXUserParseFile(&graphHandlers, &state, filename);
 	cleanupGraphParserState(&state);
 	return reportErrors(&state, result);
+#endif
+}
+
+int gmlParseFile(const char* filename, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
+	errno = 0;
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		int err = errno;
+		lprintf(LogError, "Could not open GraphML file '%s': %s\n", filename, strerror(err));
+		return err;
+	}
+	return gmlParseDescriptor(fd, filename, newNode, newLink, userData, clientType, weightKey);
 }
 
 int gmlParseMemory(char* buffer, int size, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
@@ -554,3 +811,606 @@ int gmlParseMemory(char* buffer, int size, NewNodeFunc newNode, NewLinkFunc newL
 	cleanupGraphParserState(&state);
 	return reportErrors(&state, result);
 }
+
+// The remaining functions implement a scanner for memory-mapped GraphML files.
+// It only supports the subset of XML that is used by GraphML generators in
+// practice, and emits the same events as libxml to the functions above.
+// Element names, attributes, and data values are passed as slices of the
+// mapping, so nothing is copied except for the identifiers passed to the
+// callers. Delimiters are located with memchr, which is vectorized in common C
+// libraries.
+
+static bool isXmlSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static const char* skipXmlSpace(const char* p, const char* end) {
+	while (p < end && isXmlSpace(*p)) ++p;
+	return p;
+}
+
+// Finds the first occurrence of delim in [p, end), or returns NULL
+static const char* findDelim(const char* p, const char* end, const char* delim, size_t delimLen) {
+	while (p < end) {
+		p = memchr(p, delim[0], (size_t)(end - p));
+		if (p == NULL) return NULL;
+		if ((size_t)(end - p) >= delimLen && memcmp(p, delim, delimLen) == 0) return p;
+		++p;
+	}
+	return NULL;
+}
+
+// Determines whether the scanner can parse a document. If it cannot, reason is
+// set to a description of the unsupported feature. The scanner does not support
+// entity or character references, CDATA sections, document type declarations,
+// or encodings other than UTF-8. These are all handled by libxml instead.
+static bool scannerSupports(const char* buf, size_t len, const char** reason) {
+	const char* end = buf + len;
+
+	if (len >= 2 && (buf[0] == '\0' || buf[1] == '\0' || ((unsigned char)buf[0] == 0xFE && (unsigned char)buf[1] == 0xFF) || ((unsigned char)buf[0] == 0xFF && (unsigned char)buf[1] == 0xFE))) {
+		*reason = "a multi-byte character encoding";
+		return false;
+	}
+
+	const char* p = buf;
+	if (len >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) p += 3;
+	if ((size_t)(end - p) >= 5 && memcmp(p, "<?xml", 5) == 0) {
+		const char* declEnd = findDelim(p, end, "?>", 2);
+		if (declEnd == NULL) {
+			*reason = "an unterminated XML declaration";
+			return false;
+		}
+		const char* enc = findDelim(p, declEnd, "encoding", 8);
+		if (enc != NULL) {
+			enc = skipXmlSpace(enc + 8, declEnd);
+			if (enc < declEnd && *enc == '=') enc = skipXmlSpace(enc + 1, declEnd);
+			const char* encEnd = NULL;
+			if (enc < declEnd && (*enc == '"' || *enc == '\'')) {
+				encEnd = memchr(enc + 1, *enc, (size_t)(declEnd - enc - 1));
+				++enc;
+			}
+			bool utf8 = false;
+			if (encEnd != NULL) {
+				const char* utf8Names[] = { "UTF-8", "UTF8", "US-ASCII", "ASCII", NULL };
+				for (const char** name = utf8Names; *name != NULL; ++name) {
+					size_t nameLen = strlen(*name);
+					if ((size_t)(encEnd - enc) == nameLen && strncasecmp(enc, *name, nameLen) == 0) {
+						utf8 = true;
+						break;
+					}
+				}
+			}
+			if (!utf8) {
+				*reason = "an encoding other than UTF-8";
+				return false;
+			}
+		}
+	}
+
+	if (memchr(buf, '&', len) != NULL) {
+		*reason = "entity or character references";
+		return false;
+	}
+
+	// Comments are supported, but no other "<!" constructs
+	for (const char* bang = memchr(buf, '!', len); bang != NULL; bang = memchr(bang + 1, '!', (size_t)(end - bang - 1))) {
+		if (bang > buf && bang[-1] == '<' && !(end - bang >= 3 && bang[1] == '-' && bang[2] == '-')) {
+			*reason = "CDATA sections or document type declarations";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void scanError(GraphParserState* state, const char* buf, const char* p, const char* msg) {
+	graphFatalError(state, "%s at byte %lu of the file.\n", msg, (unsigned long)(p - buf));
+}
+
+// Scans the part of a GraphML document in [p, end). buf is the start of the
+// document, and is used for error messages. If stopInGraph is true, scanning
+// stops after the start tag of the graph element. Returns the position where
+// scanning stopped.
+static const char* scanRange(GraphParserState* state, const char* buf, const char* p, const char* end, bool stopInGraph) {
+	while (p < end && !state->dead) {
+		const char* lt = memchr(p, '<', (size_t)(end - p));
+		if (lt == NULL) lt = end;
+		if (lt > p && state->mode == GpData) {
+			xmlCharSlice text = { .str = (const xmlChar*)p, .len = (size_t)(lt - p) };
+			graphCharactersSlice(state, text);
+		}
+		if (lt == end) break;
+
+		const char* tag = lt;
+		p = lt + 1;
+		if (p == end) {
+			scanError(state, buf, tag, "The document ended inside of a tag");
+			break;
+		}
+
+		// Processing instructions and comments are skipped
+		if (*p == '?') {
+			const char* close = findDelim(p, end, "?>", 2);
+			if (close == NULL) {
+				scanError(state, buf, tag, "Unterminated processing instruction");
+				break;
+			}
+			p = close + 2;
+			continue;
+		}
+		if (*p == '!') {
+			if (end - p >= 3 && p[1] == '-' && p[2] == '-') {
+				const char* close = findDelim(p + 3, end, "-->", 3);
+				if (close == NULL) {
+					scanError(state, buf, tag, "Unterminated comment");
+					break;
+				}
+				p = close + 3;
+				continue;
+			}
+			scanError(state, buf, tag, "Unsupported markup declaration");
+			break;
+		}
+
+		// End tags are matched by depth, so their names are not needed
+		if (*p == '/') {
+			const char* gt = memchr(p, '>', (size_t)(end - p));
+			if (gt == NULL) {
+				scanError(state, buf, tag, "Unterminated end tag");
+				break;
+			}
+			graphEndElement(state, NULL);
+			p = gt + 1;
+			continue;
+		}
+
+		// Start tag
+		const char* nameStart = p;
+		while (p < end && !isXmlSpace(*p) && *p != '/' && *p != '>') ++p;
+		xmlCharSlice name = { .str = (const xmlChar*)nameStart, .len = (size_t)(p - nameStart) };
+
+		size_t attCount = 0;
+		bool selfClosing = false;
+		bool closed = false;
+		while (true) {
+			p = skipXmlSpace(p, end);
+			if (p >= end) break;
+			if (*p == '>') {
+				++p;
+				closed = true;
+				break;
+			}
+			if (*p == '/') {
+				if (end - p >= 2 && p[1] == '>') {
+					p += 2;
+					closed = true;
+					selfClosing = true;
+				}
+				break;
+			}
+
+			const char* attName = p;
+			while (p < end && !isXmlSpace(*p) && *p != '=' && *p != '>' && *p != '/') ++p;
+			const char* attNameEnd = p;
+			p = skipXmlSpace(p, end);
+			if (p >= end || *p != '=' || attNameEnd == attName) break;
+			p = skipXmlSpace(p + 1, end);
+			if (p >= end || (*p != '"' && *p != '\'')) break;
+			const char* value = p + 1;
+			const char* valueEnd = memchr(value, *p, (size_t)(end - value));
+			if (valueEnd == NULL) break;
+
+			flexBufferGrow((void**)&state->atts, attCount*2, &state->attsCap, 2, sizeof(xmlCharSlice));
+			state->atts[attCount*2].str = (const xmlChar*)attName;
+			state->atts[attCount*2].len = (size_t)(attNameEnd - attName);
+			state->atts[attCount*2+1].str = (const xmlChar*)value;
+			state->atts[attCount*2+1].len = (size_t)(valueEnd - value);
+			++attCount;
+			p = valueEnd + 1;
+		}
+		if (!closed || name.len == 0) {
+			scanError(state, buf, tag, "Malformed start tag");
+			break;
+		}
+
+		// Data elements almost always contain plain text, so we apply their
+		// values directly from the mapping without entering the GpData mode
+		if (!selfClosing && (state->mode == GpNode || state->mode == GpEdge) && classifyElement(name) == GeData) {
+			const char* textEnd = memchr(p, '<', (size_t)(end - p));
+			if (textEnd != NULL && end - textEnd >= 6 && memcmp(textEnd, "</data", 6) == 0) {
+				const char* gt = skipXmlSpace(textEnd + 6, end);
+				if (gt < end && *gt == '>') {
+					const xmlCharSlice* key = NULL;
+					for (size_t i = 0; i < attCount; ++i) {
+						if (SLICE_IS(state->atts[i*2], "key")) {
+							key = &state->atts[i*2+1];
+							break;
+						}
+					}
+					if (key == NULL) {
+						graphFatalError(state, "Topology contains a data attributed with no key.\n");
+						break;
+					}
+					xmlCharSlice value = { .str = (const xmlChar*)p, .len = (size_t)(textEnd - p) };
+					graphApplyData(state, state->mode, *key, value);
+					p = gt + 1;
+					continue;
+				}
+			}
+		}
+
+		graphStartElementSlices(state, name, state->atts, attCount);
+		if (selfClosing) graphEndElement(state, NULL);
+		if (stopInGraph && state->mode == GpGraph) break;
+	}
+	return p;
+}
+
+// Returns true if the graphml element has been closed
+static bool scanFinished(const GraphParserState* state) {
+	return state->mode == GpUnknown && state->unknownMode == GpUnknown && state->unknownDepth == 0;
+}
+
+// Scans a GraphML document that passed scannerSupports
+static void scanGraph(GraphParserState* state, const char* buf, size_t len) {
+	const char* p = buf;
+	if (len >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) p += 3;
+	scanRange(state, buf, p, buf + len, false);
+	if (!state->dead && !scanFinished(state)) {
+		graphFatalError(state, "The GraphML document ended unexpectedly.\n");
+	}
+}
+
+// The remaining functions scan large mapped documents in parallel. The body of
+// the graph element is split into chunks that end after </node> or </edge>
+// tags. Worker threads scan the chunks into lists of records, which the calling
+// thread passes to the callbacks in document order. A chunk boundary could
+// fall inside of a nested graph or a comment; in this case, the scan of the
+// chunk before the boundary does not end in the expected state. The document is
+// then scanned sequentially from the start of that chunk, which is known to be
+// a real boundary because the previous chunk ended correctly.
+
+// Documents smaller than two chunks are scanned sequentially
+static const size_t MinScanChunkSize = 1024 * 1024 * 4;
+
+// Number of chunks for each worker thread, which balances the work
+static const size_t ScanChunksPerThread = 8;
+
+// Number of chunks for each worker thread that may be scanned before they are
+// passed to the callbacks. This bounds the memory used for records.
+static const size_t ScanChunksAhead = 2;
+
+typedef struct {
+	bool isLink;
+	float weight;
+	size_t nameOffset; // Node identifier or link source in the chunk's names
+	size_t nameLen;
+	size_t targetOffset;
+	size_t targetLen;
+	union {
+		TopoNode node;
+		TopoLink link;
+	} t;
+} ScanRecord;
+
+typedef struct {
+	const char* start;
+	const char* end;
+	bool last;
+
+	ScanRecord* records;
+	size_t recordCount;
+	size_t recordCap;
+	char* names; // NUL-terminated identifiers used by the records
+	size_t namesLen;
+	size_t namesCap;
+
+	bool done; // Protected by the lock in ParallelScan
+	bool ok;   // True if the chunk was scanned completely and correctly
+} ScanChunk;
+
+typedef struct {
+	const char* buf;
+	const GraphParserState* head; // State after scanning the graph start tag
+
+	ScanChunk* chunks;
+	size_t chunkCount;
+	size_t maxAhead;
+
+	// The following members are protected by the lock
+	GMutex lock;
+	GCond changed;
+	size_t nextChunk;  // Next chunk to be scanned
+	size_t dispatched; // Number of chunks passed to the callbacks
+	bool cancel;
+} ParallelScan;
+
+static size_t scanStoreName(ScanChunk* chunk, const char* name, size_t len) {
+	size_t offset = chunk->namesLen;
+	flexBufferGrow((void**)&chunk->names, chunk->namesLen, &chunk->namesCap, len+1, 1);
+	flexBufferAppend(chunk->names, &chunk->namesLen, name, len+1, 1);
+	return offset;
+}
+
+static int scanRecordNode(const GmlNode* node, void* userData) {
+	ScanChunk* chunk = userData;
+	ScanRecord record = {
+		.isLink = false,
+		.nameOffset = scanStoreName(chunk, node->name, node->nameLen),
+		.nameLen = node->nameLen,
+		.t.node = node->t,
+	};
+	flexBufferGrow((void**)&chunk->records, chunk->recordCount, &chunk->recordCap, 1, sizeof(ScanRecord));
+	flexBufferAppend(chunk->records, &chunk->recordCount, &record, 1, sizeof(ScanRecord));
+	return 0;
+}
+
+static int scanRecordLink(const GmlLink* link, void* userData) {
+	ScanChunk* chunk = userData;
+	ScanRecord record = {
+		.isLink = true,
+		.weight = link->weight,
+		.nameOffset = scanStoreName(chunk, link->sourceName, link->sourceNameLen),
+		.nameLen = link->sourceNameLen,
+		.targetOffset = scanStoreName(chunk, link->targetName, link->targetNameLen),
+		.targetLen = link->targetNameLen,
+		.t.link = link->t,
+	};
+	flexBufferGrow((void**)&chunk->records, chunk->recordCount, &chunk->recordCap, 1, sizeof(ScanRecord));
+	flexBufferAppend(chunk->records, &chunk->recordCount, &record, 1, sizeof(ScanRecord));
+	return 0;
+}
+
+static void scanChunk(const ParallelScan* scan, ScanChunk* chunk) {
+	const GraphParserState* head = scan->head;
+	GraphParserState state;
+	initGraphParserFields(&state, &scanRecordNode, &scanRecordLink, chunk, head->clientType, head->weightKey);
+	state.quiet = true;
+	state.mode = GpGraph;
+	state.defaultUndirected = head->defaultUndirected;
+
+	// Copy the attribute identifiers found in the keys
+	#define COPY_ATTRIBS(objType) do{ \
+		for (size_t i = 0; i < sizeof(state.objType##Attribs); i += sizeof(xmlChar*)) { \
+			const xmlChar* src = *(xmlChar* const*)(((const char*)&head->objType##Attribs) + i); \
+			xmlChar** dst = (xmlChar**)(((char*)&state.objType##Attribs) + i); \
+			if (src) *dst = sliceDup(sliceOf(src)); \
+		} }while(0)
+	COPY_ATTRIBS(node);
+	COPY_ATTRIBS(edge);
+	buildKeyDispatch(&state);
+
+	scanRange(&state, scan->buf, chunk->start, chunk->end, false);
+	chunk->ok = !state.dead && (chunk->last ? scanFinished(&state) : state.mode == GpGraph);
+	cleanupGraphParserState(&state);
+}
+
+static gpointer scanThread(gpointer data) {
+	ParallelScan* scan = data;
+	while (true) {
+		g_mutex_lock(&scan->lock);
+		while (!scan->cancel && scan->nextChunk < scan->chunkCount && scan->nextChunk >= scan->dispatched + scan->maxAhead) {
+			g_cond_wait(&scan->changed, &scan->lock);
+		}
+		if (scan->cancel || scan->nextChunk >= scan->chunkCount) {
+			g_mutex_unlock(&scan->lock);
+			break;
+		}
+		ScanChunk* chunk = &scan->chunks[scan->nextChunk++];
+		g_mutex_unlock(&scan->lock);
+
+		scanChunk(scan, chunk);
+
+		g_mutex_lock(&scan->lock);
+		chunk->done = true;
+		g_cond_broadcast(&scan->changed);
+		g_mutex_unlock(&scan->lock);
+	}
+	return NULL;
+}
+
+// Finds the position after the next </node> or </edge> tag at or after p.
+// Returns NULL if there are no such tags.
+static const char* findChunkBoundary(const char* p, const char* end) {
+	while ((p = findDelim(p, end, "</", 2)) != NULL) {
+		p += 2;
+		if (end - p >= 4 && (memcmp(p, "node", 4) == 0 || memcmp(p, "edge", 4) == 0)) {
+			const char* gt = skipXmlSpace(p + 4, end);
+			if (gt < end && *gt == '>') return gt + 1;
+		}
+	}
+	return NULL;
+}
+
+// Splits [body, end) into chunks. Returns the number of chunks.
+static size_t splitScanChunks(const char* body, const char* end, size_t chunkSize, ScanChunk** chunks) {
+	size_t count = 0;
+	size_t cap = 0;
+	flexBufferInit((void**)chunks, &count, &cap);
+	const char* start = body;
+	while (start < end) {
+		const char* chunkEnd = NULL;
+		if ((size_t)(end - start) > chunkSize) chunkEnd = findChunkBoundary(start + chunkSize, end);
+		if (chunkEnd == NULL) chunkEnd = end;
+
+		ScanChunk chunk = {
+			.start = start,
+			.end = chunkEnd,
+			.last = (chunkEnd == end),
+			.done = false,
+			.ok = false,
+		};
+		flexBufferInit((void**)&chunk.records, &chunk.recordCount, &chunk.recordCap);
+		flexBufferInit((void**)&chunk.names, &chunk.namesLen, &chunk.namesCap);
+		flexBufferGrow((void**)chunks, count, &cap, 1, sizeof(ScanChunk));
+		flexBufferAppend(*chunks, &count, &chunk, 1, sizeof(ScanChunk));
+		start = chunkEnd;
+	}
+	return count;
+}
+
+static void freeScanChunk(ScanChunk* chunk) {
+	flexBufferFree((void**)&chunk->records, &chunk->recordCount, &chunk->recordCap);
+	flexBufferFree((void**)&chunk->names, &chunk->namesLen, &chunk->namesCap);
+}
+
+// Passes the records of a chunk to the callbacks of the state
+static void dispatchScanChunk(GraphParserState* state, const ScanChunk* chunk) {
+	for (size_t i = 0; i < chunk->recordCount && state->userError == 0; ++i) {
+		const ScanRecord* record = &chunk->records[i];
+		if (record->isLink) {
+			GmlLink link = {
+				.sourceName = chunk->names + record->nameOffset,
+				.targetName = chunk->names + record->targetOffset,
+				.sourceNameLen = record->nameLen,
+				.targetNameLen = record->targetLen,
+				.weight = record->weight,
+				.t = record->t.link,
+			};
+			state->userError = state->newLinkFunc(&link, state->userData);
+		} else {
+			GmlNode node = {
+				.name = chunk->names + record->nameOffset,
+				.nameLen = record->nameLen,
+				.t = record->t.node,
+			};
+			state->userError = state->newNodeFunc(&node, state->userData);
+		}
+	}
+	if (state->userError != 0) {
+		graphFatalError(state, "Terminating GraphML parsing due to client error code %d\n", state->userError);
+	}
+}
+
+// Scans a GraphML document that passed scannerSupports using several threads
+static void scanGraphParallel(GraphParserState* state, const char* buf, size_t len, size_t threads) {
+	const char* end = buf + len;
+	const char* p = buf;
+	if (len >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) p += 3;
+
+	// Keys are defined before the graph, so they are scanned first
+	p = scanRange(state, buf, p, end, true);
+	if (!state->dead && state->mode == GpGraph && p < end) {
+		size_t chunkSize = (size_t)(end - p) / (threads * ScanChunksPerThread);
+		if (chunkSize < MinScanChunkSize) chunkSize = MinScanChunkSize;
+
+		ParallelScan scan = {
+			.buf = buf,
+			.head = state,
+			.maxAhead = threads * ScanChunksAhead,
+			.nextChunk = 0,
+			.dispatched = 0,
+			.cancel = false,
+		};
+		scan.chunkCount = splitScanChunks(p, end, chunkSize, &scan.chunks);
+		if (scan.chunkCount < threads) threads = scan.chunkCount;
+		lprintf(LogDebug, "Scanning the GraphML graph in %lu chunks with %lu threads\n", (unsigned long)scan.chunkCount, (unsigned long)threads);
+
+		g_mutex_init(&scan.lock);
+		g_cond_init(&scan.changed);
+		GThread** workers = eamalloc(threads, sizeof(GThread*), 0);
+		for (size_t i = 0; i < threads; ++i) {
+			workers[i] = g_thread_new("GraphMLScan", &scanThread, &scan);
+		}
+
+		// Dispatch the records in order. The remainder of the document is
+		// scanned sequentially if a chunk could not be scanned on its own.
+		const char* resume = NULL;
+		for (size_t i = 0; i < scan.chunkCount; ++i) {
+			ScanChunk* chunk = &scan.chunks[i];
+			g_mutex_lock(&scan.lock);
+			while (!chunk->done) g_cond_wait(&scan.changed, &scan.lock);
+			g_mutex_unlock(&scan.lock);
+
+			if (chunk->ok) {
+				dispatchScanChunk(state, chunk);
+				if (chunk->last) {
+					// The graphml element was closed by the last chunk
+					state->mode = GpUnknown;
+					state->unknownMode = GpUnknown;
+					state->unknownDepth = 0;
+				}
+			} else {
+				resume = chunk->start;
+			}
+			freeScanChunk(chunk);
+
+			g_mutex_lock(&scan.lock);
+			scan.dispatched = i+1;
+			if (resume != NULL || state->dead) scan.cancel = true;
+			g_cond_broadcast(&scan.changed);
+			g_mutex_unlock(&scan.lock);
+			if (scan.cancel) break;
+		}
+
+		for (size_t i = 0; i < threads; ++i) g_thread_join(workers[i]);
+		free(workers);
+		for (size_t i = scan.dispatched; i < scan.chunkCount; ++i) freeScanChunk(&scan.chunks[i]);
+		free(scan.chunks);
+		g_cond_clear(&scan.changed);
+		g_mutex_clear(&scan.lock);
+
+		if (resume != NULL && !state->dead) {
+			lprintf(LogDebug, "GraphML chunk at byte %lu could not be scanned separately, so the rest of the file will be scanned sequentially\n", (unsigned long)(resume - buf));
+			scanRange(state, buf, resume, end, false);
+		}
+	} else if (!state->dead) {
+		// The document has no graph body, so it is finished sequentially
+		scanRange(state, buf, p, end, false);
+	}
+
+	if (!state->dead && !scanFinished(state)) {
+		graphFatalError(state, "The GraphML document ended unexpectedly.\n");
+	}
+}
+
+int gmlParseFileMapped(const char* filename, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
+	errno = 0;
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		int err = errno;
+		lprintf(LogError, "Could not open GraphML file '%s': %s\n", filename, strerror(err));
+		return err;
+	}
+
+	// Streams and empty files cannot be mapped
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 || (uintmax_t)st.st_size > SIZE_MAX) {
+		lprintf(LogDebug, "GraphML file '%s' cannot be mapped into memory, so it will be parsed with libxml\n", filename);
+		return gmlParseDescriptor(fd, filename, newNode, newLink, userData, clientType, weightKey);
+	}
+	size_t len = (size_t)st.st_size;
+	void* map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		lprintf(LogDebug, "Failed to map GraphML file '%s' into memory, so it will be parsed with libxml: %s\n", filename, strerror(errno));
+		return gmlParseDescriptor(fd, filename, newNode, newLink, userData, clientType, weightKey);
+	}
+	posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+
+	CompressionFormat compression = decompDetect(map, len);
+	if (compression != CompressionNone) {
+		munmap(map, len);
+		lprintf(LogInfo, "The GraphML file is compressed with %s, so it will be decompressed and parsed with libxml\n", decompFormatName(compression));
+		return gmlParseDescriptor(fd, filename, newNode, newLink, userData, clientType, weightKey);
+	}
+
+	const char* reason;
+	if (!scannerSupports(map, len, &reason)) {
+		munmap(map, len);
+		lprintf(LogInfo, "The GraphML file uses %s, so it will be parsed with libxml\n", reason);
+		return gmlParseDescriptor(fd, filename, newNode, newLink, userData, clientType, weightKey);
+	}
+	close(fd);
+
+	GraphParserState state;
+	initGraphParserState(&state, newNode, newLink, userData, clientType, weightKey);
+	size_t threads = g_get_num_processors();
+	if (threads > 1 && len >= MinScanChunkSize * 2) {
+		scanGraphParallel(&state, map, len, threads);
+	} else {
+		scanGraph(&state, map, len);
+	}
+	cleanupGraphParserState(&state);
+	munmap(map, len);
+	return reportErrors(&state, 0);
+}
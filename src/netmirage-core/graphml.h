@@ -19,6 +19,7 @@
  *******************************************************************************/
 #pragma once
 
+#include <stddef.h>
 #include <stdio.h>
 
 #include "topology.h"
@@ -27,6 +28,7 @@ typedef struct {
 	// An opaque string token identifying the node in the file's namespace. Its
 	// encoding is undefined, and thus should not be shown to the user.
 	const char* name;
+	size_t nameLen; // Length of name in bytes, excluding the terminator
 
 	TopoNode t;
 } GmlNode;
@@ -35,6 +37,8 @@ typedef struct {
 	// Opaque string tokens denoting the start and end of the link
 	const char* sourceName;
 	const char* targetName;
+	size_t sourceNameLen;
+	size_t targetNameLen;
 
 	float weight;
 	TopoLink t;
@@ -48,11 +52,25 @@ typedef int (*NewNodeFunc)(const GmlNode* node, void* userData);
 // for the duration of the call. Non-zero return values terminate parsing.
 typedef int (*NewLinkFunc)(const GmlLink* link, void* userData);
 
-// Parses a GraphML file from a stream. Returns 0 for success.
+// Parses a GraphML file from a stream. Streams compressed with gzip, xz, or
+// zstd are decompressed transparently. Returns 0 for success.
 int gmlParse(FILE* input, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey);
 
-// Parses a GraphML file stored on the disk. Returns 0 for success.
+// Parses a GraphML file stored on the disk. Compressed files are decompressed
+// transparently. The file is only opened and read once, so it may also be a
+// pipe. Returns 0 for success.
 int gmlParseFile(const char* filename, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey);
 
+// Parses a GraphML file stored on the disk by mapping it into memory and
+// scanning it directly, without using libxml. This is much faster for large
+// files. On machines with several processors, the nodes and edges of large
+// files are scanned in parallel, and are passed to the callbacks in document
+// order on the calling thread. Files that use XML features that the scanner
+// does not support (entity references, CDATA sections, document type
+// declarations, or encodings other than UTF-8), or that are compressed or
+// cannot be mapped, are parsed with gmlParseFile instead. Returns 0 for
+// success.
+int gmlParseFileMapped(const char* filename, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey);
+
 // Parses a GraphML file stored in memory. Returns 0 for success.
 int gmlParseMemory(char* buffer, int size, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey);
@@ -41,6 +41,13 @@
 // TODO: normalize (return result, out err) vs (return err, out result)
 // TODO: normalize res and err
 
+// Supported topology file formats
+typedef enum {
+	FormatGraphML,
+	FormatEdgeList,
+	FormatModelNet,
+} TopologyFormat;
+
 // Argument data recovered by argp
 static struct {
 	size_t edgeNodeCap; // Buffer length is stored in the setupParams
@@ -49,12 +56,22 @@ static struct {
 	// Actual parameters for setup procedure
 	setupParams params;
 	setupGraphMLParams gmlParams;
+	TopologyFormat format;
 } args;
 
 enum {
 	AcOvsDir = 256,
 	AcOvsSchema,
 	AcClientNode,
+	AcNsPool,
+	AcSwitch,
+	AcSwitchPipeline,
+	AcOvsTuning,
+	AcKeepSwitch,
+	AcMappedScan,
+	AcBufferEdges,
+	AcSaveTopology,
+	AcFormat,
 } ArgCodes;
 
 // Divisors for GraphML bandwidths
@@ -109,6 +126,21 @@ static error_t parseArg(int key, char* arg, struct argp_state* state, unsigned i
 	case 'f': args.params.srcFile = arg; break;
 	case AcOvsDir: args.params.ovsDir = arg; break;
 	case AcOvsSchema: args.params.ovsSchema = arg; break;
+	case AcNsPool: args.params.nsPool = true; break;
+	case AcSwitchPipeline: args.params.switchPipeline = true; break;
+	case AcOvsTuning: args.params.ovsTuning = true; break;
+	case AcKeepSwitch: args.params.keepSwitch = true; break;
+	case AcSwitch: {
+		const char* options[] = {"ovs", "tc", NULL};
+		SwitchBackend settings[] = {SwitchOvs, SwitchTc};
+		long index = matchArg(arg, options);
+		if (index < 0) {
+			fprintf(stderr, "Unknown switch implementation '%s'\n", arg);
+			return EINVAL;
+		}
+		args.params.switchBackend = settings[index];
+		break;
+	}
 
 	case 'i': {
 		args.params.edgeNodeDefaults.intfSpecified = true;
@@ -224,6 +256,20 @@ static error_t parseArg(int key, char* arg, struct argp_state* state, unsigned i
 	case 'w': args.gmlParams.weightKey = arg; break;
 	case AcClientNode: args.gmlParams.clientType = arg; break;
 	case '2': args.gmlParams.twoPass = true; break;
+	case AcMappedScan: args.gmlParams.mappedScan = true; break;
+	case AcBufferEdges: args.gmlParams.bufferLinks = true; break;
+	case AcSaveTopology: args.gmlParams.saveTopology = arg; break;
+	case AcFormat: {
+		const char* options[] = {"graphml", "edgelist", "modelnet", NULL};
+		TopologyFormat formats[] = {FormatGraphML, FormatEdgeList, FormatModelNet};
+		long index = matchArg(arg, options);
+		if (index < 0) {
+			fprintf(stderr, "Unknown topology format '%s'\n", arg);
+			return EINVAL;
+		}
+		args.format = formats[index];
+		break;
+	}
 
 	default: return ARGP_ERR_UNKNOWN;
 	}
@@ -281,7 +327,8 @@ int main(int argc, char** argv) {
 	struct argp_option generalOptions[] = {
 			{ "destroy",      'd', NULL,   OPTION_ARG_OPTIONAL, "If specified, any previous virtual network created by the program will be destroyed and the program terminates without creating a new network.", 0 },
 			{ "keep",         'k', NULL,   OPTION_ARG_OPTIONAL, "If specified, previous virtual networks created by the program are not destroyed before setting up new ones. Note that --destroy takes priority.", 0 },
-			{ "file",         'f', "FILE", 0,                   "The GraphML file containing the network topology. If omitted, the topology is read from stdin.", 0 },
+			{ "file",         'f', "FILE", 0,                   "The GraphML file or compiled topology containing the network topology. GraphML input may be compressed with gzip, xz, or zstd. If omitted, the topology is read from stdin.", 0 },
+			{ "format",       AcFormat, "{graphml,edgelist,modelnet}", 0, "The format of the topology. \"graphml\" reads GraphML files. \"edgelist\" reads tab- or comma-separated text with an optional table of nodes (columns \"id\", \"type\", \"packetloss\", \"bandwidthup\", and \"bandwidthdown\") followed by a table of edges (columns \"source\", \"target\", \"latency\", \"packetloss\", \"jitter\", and \"queue_len\"), each starting with a header row. \"modelnet\" reads the XML topologies produced by the ModelNet tools, in which \"virtnode\" vertices are clients. The --weight, --client-node, and --save-topology options also apply to edge lists, and --save-topology applies to ModelNet topologies. Compiled topologies are detected automatically. Default: \"graphml\".", 0 },
 			{ "setup-file",   's', "FILE", 0,                   "The file containing setup information about edge nodes and emulator interfaces. This file is a key-value file (similar to an .ini file). Every group whose name begins with \"edge\" or \"node\" denotes the configuration for an edge node. The keys and values permitted in an edge node group are the same as those in an --edge-node argument. There may also be an \"emulator\" group. This group may contain any of the long names for command arguments. Note that any file paths specified in the setup file are relative to the current working directory (not the file location). Any arguments passed on the command line override the defaults and those set in the setup file. By default, the program attempts to read setup information from " DEFAULT_SETUP_FILE ".", 0 },
 
 			{ "iface",        'i', "DEVNAME",                                                                  0, "Default interface connected to the edge nodes. Individual edge nodes can override this setting in the setup file or as part of the --edge-nodes argument.", 1 },
@@ -299,6 +346,11 @@ int main(int argc, char** argv) {
 			{ "root-ns",      'r',         "{custom,init}",  0, "Specifies the location of the \"root\" namespace, which is used for routing traffic between external interfaces and the internal network. \"custom\" places the links in a custom namespace. \"init\" places the links in the same namespace as the init process. This may be necessary if your edges are connected to advanced interfaces that cannot be moved. However, using the init namespace as the root may cause some global networking settings to be modified. Default: \"custom\".", 4 },
 			{ "ovs-dir",      AcOvsDir,    "DIR",            0, "Directory for storing temporary Open vSwitch files, such as the flow database and management sockets (default: \"" DEFAULT_OVS_DIR "\").", 4 },
 			{ "ovs-schema",   AcOvsSchema, "FILE",           0, "Path to the OVSDB schema definition for Open vSwitch (default: \"/usr/share/openvswitch/vswitch.ovsschema\").", 4 },
+			{ "ns-pool",      AcNsPool,    NULL,             OPTION_ARG_OPTIONAL, "If specified, the host namespaces of destroyed networks are emptied and kept in a warm pool instead of being deleted, and new hosts reuse pooled namespaces when possible. This greatly reduces the cost of repeatedly setting up networks of similar sizes. Destroying a network without this option also deletes the pool.", 4 },
+			{ "switch",       AcSwitch,    "{ovs,tc}",       0, "Specifies the implementation of the switch in the \"root\" namespace. \"ovs\" runs an isolated Open vSwitch instance. \"tc\" installs Linux Traffic Control flower filters directly, which avoids starting any daemons but requires kernel 4.18 or later with the cls_flower, act_mirred, act_skbmod, and act_gact modules. A network must be destroyed using the same setting that was used to create it. Default: \"ovs\".", 4 },
+			{ "switch-pipeline", AcSwitchPipeline, NULL,     OPTION_ARG_OPTIONAL, "If specified, the switch in the \"root\" namespace matches traffic from edge nodes in two stages. The first table contains a single rule per edge node that selects the range of client subnets belonging to that edge node, and a second table selects the client by its subnet. This keeps the first table independent of the number of clients, which speeds up the switching of traffic sent by clients in large networks.", 4 },
+			{ "ovs-tuning",   AcOvsTuning,   NULL,   OPTION_ARG_OPTIONAL, "If specified, the Open vSwitch handler and revalidator thread counts, flow limit, and flow idle timeout are adjusted based on the number of clients in the topology. These settings affect the entire Open vSwitch instance and are not restored afterwards.", 4 },
+			{ "keep-switch",  AcKeepSwitch,  NULL,   OPTION_ARG_OPTIONAL, "If specified, destroying a network leaves the Open vSwitch daemons and the \"root\" namespace running, and only removes the ports and flows from the switch. The next network reuses the running instance instead of starting a new one. Destroying a network without this option shuts the instance down.", 4 },
 
 			{ "mem",          'm', "MiB",    0, "Approximate maximum memory use, specified in MiB. The program may use more than this amount if needed.", 5 },
 
@@ -308,9 +360,12 @@ int main(int argc, char** argv) {
 	};
 	struct argp_option gmlOptions[] = {
 			{ "units",        'u',          "{shadow,modelnet,KiB,Kb}", 0,                   "Specifies the bandwidth units used in the input file. Shadow uses KiB/s (the default), whereas ModelNet uses Kbit/s." },
-			{ "weight",       'w',          "KEY",                      0,                   "Edge parameter to use for computing shortest paths for static routes. Must be a key used in the GraphML file (default: \"latency\")." },
+			{ "weight",       'w',          "KEY",                      0,                   "Edge parameter to use for computing shortest paths for static routes. Must be a key used in the GraphML file, or a column of the edge table in an edge list (default: \"latency\")." },
 			{ "client-node",  AcClientNode, "TYPE",                     0,                   "Type of client nodes. Nodes in the GraphML file whose \"type\" attribute matches this value will be clients. If omitted, all nodes are clients." },
 			{ "two-pass",     '2',          NULL,                       OPTION_ARG_OPTIONAL, "This option must be specified if the GraphML file does not place all <node> tags before all <edge> tags. This option doubles the data retrieved from disk." },
+			{ "buffer-edges", AcBufferEdges, NULL,                      OPTION_ARG_OPTIONAL, "Like --two-pass, this option allows the GraphML file to place <node> tags after <edge> tags. However, the file is only read once: edges are stored in memory until all nodes have been read, and moved to a temporary file if they exceed the memory limit. This option can be used when reading from stdin. Edge lists use this behavior by default, unless --two-pass is specified, because their nodes may be implied by the edges." },
+			{ "mmap",         AcMappedScan, NULL,                       OPTION_ARG_OPTIONAL, "If specified, the GraphML file is mapped into memory and read with a specialized scanner instead of libxml, which is much faster for large files. Files using XML features that the scanner does not support (entity references, CDATA sections, document type declarations, or encodings other than UTF-8) are still read with libxml. Has no effect when reading from stdin." },
+			{ "save-topology", AcSaveTopology, "FILE",                  0,                   "Saves the parsed topology to FILE as a compiled topology. Passing a compiled topology to --file loads it directly, without parsing any XML. Compiled topologies include the routing weights and client types that were chosen when they were saved, so --weight and --client-node have no effect when loading them." },
 			{ NULL },
 	};
 	struct argp_option defaultDoc[] = { { "\n These options provide program documentation:", 0, NULL, OPTION_DOC | OPTION_NO_USAGE }, { NULL } };
@@ -333,10 +388,19 @@ int main(int argc, char** argv) {
 	args.params.keepOldNetworks = false;
 	args.params.quiet = false;
 	args.params.rootIsInitNs = false;
+	args.params.nsPool = false;
+	args.params.switchBackend = SwitchOvs;
+	args.params.switchPipeline = false;
+	args.params.ovsTuning = false;
+	args.params.keepSwitch = false;
 	ip4GetSubnet(DEFAULT_CLIENTS_SUBNET, &args.params.edgeNodeDefaults.globalVSubnet);
 	args.gmlParams.bandwidthDivisor = ShadowDivisor;
 	args.gmlParams.weightKey = "latency";
+	args.format = FormatGraphML;
 	args.gmlParams.twoPass = false;
+	args.gmlParams.mappedScan = false;
+	args.gmlParams.bufferLinks = false;
+	args.gmlParams.saveTopology = NULL;
 
 	int err = 0;
 
@@ -351,7 +415,25 @@ int main(int argc, char** argv) {
 
 	if (!args.params.destroyOnly) {
 		lprintln(LogInfo, "Beginning network construction");
-		err = setupGraphML(&args.gmlParams);
+		if (args.format == FormatEdgeList) {
+			setupEdgeListParams elParams = {
+				.weightKey = args.gmlParams.weightKey,
+				.clientType = args.gmlParams.clientType,
+				.saveTopology = args.gmlParams.saveTopology,
+				.twoPass = args.gmlParams.twoPass,
+				.bufferLinks = args.gmlParams.bufferLinks,
+			};
+			err = setupEdgeList(&elParams);
+		} else if (args.format == FormatModelNet) {
+			setupModelNetParams mnParams = {
+				.saveTopology = args.gmlParams.saveTopology,
+				.twoPass = args.gmlParams.twoPass,
+				.bufferLinks = args.gmlParams.bufferLinks,
+			};
+			err = setupModelNet(&mnParams);
+		} else {
+			err = setupGraphML(&args.gmlParams);
+		}
 	}
 
 	if (err != 0) {
@@ -0,0 +1,450 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "modelnet.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxml/parser.h>
+
+#include "decompress.h"
+#include "log.h"
+#include "mem.h"
+#include "nametable.h"
+#include "numparse.h"
+#include "topology.h"
+
+// Size of the blocks read from the input. Must fit in an int.
+static const size_t ChunkSize = 1024 * 1024;
+
+// Marks edges that do not refer to a specification
+static const uint32_t NoSpec = UINT32_MAX;
+
+// ModelNet bandwidths are in Kbit/s, but node bandwidths are in Mbit/s
+static const double KbitPerMbit = 1000.0;
+
+// Flags for the parameters that were given for an edge or specification
+typedef enum {
+	MpKbps     = 1 << 0,
+	MpDelay    = 1 << 1,
+	MpLoss     = 1 << 2,
+	MpQueueLen = 1 << 3,
+} mnParamFlag;
+
+typedef struct {
+	unsigned int set; // Combination of mnParamFlag values
+	double kbps;
+	double delayMs;
+	double packetLoss;
+	uint32_t queueLen;
+} mnParams;
+
+typedef struct {
+	bool exists;
+	bool client;
+} mnVertex;
+
+typedef struct {
+	uint32_t source;
+	uint32_t target;
+	uint32_t spec;
+	mnParams params;
+} mnEdge;
+
+typedef struct {
+	const char* name; // Interned in the specification name table
+	bool defined;
+	mnParams params;
+} mnSpec;
+
+typedef struct {
+	unsigned int depth;      // Depth of the current element
+	unsigned int specsDepth; // Depth of the specs element, or 0 if outside
+
+	// Vertices, indexed by their int_idx values
+	mnVertex* vertices;
+	size_t vertexCount;
+	size_t vertexCap;
+
+	mnEdge* edges;
+	size_t edgeCount;
+	size_t edgeCap;
+
+	// Specifications are numbered when they are first referenced, since edges
+	// precede the definitions
+	nameTable* specNames;
+	mnSpec* specs;
+	size_t specCount;
+	size_t specCap;
+
+	bool partialError; // True if libxml sent an error without a newline
+	bool dead;         // True if a fatal error has been encountered
+} mnState;
+
+// Prepend internal libxml errors
+static void mnShowXmlError(void* ctx, const char* msg, ...) {
+	va_list args;
+	va_start(args, msg);
+	char* errBuffer;
+	if (newVsprintf(&errBuffer, msg, args) == -1) {
+		lprintln(LogError, "Could not display libxml error");
+	} else {
+		mnState* state = ctx;
+		if (!state->partialError) {
+			lprintHead(LogError);
+			lprintDirectf(LogError, "libxml error while parsing ModelNet file: ");
+		}
+		lprintDirectf(LogError, "%s", errBuffer);
+
+		// The error is considered partial if it doesn't end with a newline
+		size_t len = strlen(errBuffer);
+		state->partialError = (len > 0 && errBuffer[len-1] != '\n');
+		if (!state->partialError) {
+			lprintDirectFinish(LogError);
+		}
+		free(errBuffer);
+	}
+	va_end(args);
+}
+
+static void mnFatalError(mnState* state, const char* fmt, ...) {
+	state->dead = true;
+	va_list args;
+	va_start(args, fmt);
+	lprintHead(LogError);
+	lprintDirectf(LogError, "ModelNet parse error: ");
+	lvprintDirectf(LogError, fmt, args);
+	lprintDirectFinish(LogError);
+	va_end(args);
+}
+
+// Parses an index attribute. Returns false if it is not a valid index.
+static bool mnParseIndex(const xmlChar* value, uint32_t* index) {
+	const char* str = (const char*)value;
+	const char* end;
+	*index = npParseUint32(str, &end);
+	return end != str && *end == '\0' && *index <= MAX_NODE_ID;
+}
+
+// Records a link parameter if the attribute is one. The type prefix of the
+// attribute name ("int_" or "dbl_") is ignored, since tools disagree on it.
+static void mnReadParam(mnParams* params, const xmlChar* name, const xmlChar* value) {
+	const char* param = (const char*)name;
+	if (strncmp(param, "int_", 4) == 0 || strncmp(param, "dbl_", 4) == 0) param += 4;
+	const char* str = (const char*)value;
+	if (strcmp(param, "kbps") == 0) {
+		params->kbps = npParseDouble(str, NULL);
+		params->set |= MpKbps;
+	} else if (strcmp(param, "delayms") == 0) {
+		params->delayMs = npParseDouble(str, NULL);
+		params->set |= MpDelay;
+	} else if (strcmp(param, "plr") == 0) {
+		params->packetLoss = npParseDouble(str, NULL);
+		params->set |= MpLoss;
+	} else if (strcmp(param, "qlen") == 0) {
+		params->queueLen = npParseUint32(str, NULL);
+		params->set |= MpQueueLen;
+	}
+}
+
+// Returns the index of a specification, numbering it if it is new
+static uint32_t mnSpecIndex(mnState* state, const xmlChar* name) {
+	size_t len = strlen((const char*)name);
+	uint32_t index;
+	if (ntLookup(state->specNames, (const char*)name, len, &index)) return index;
+
+	index = (uint32_t)state->specCount;
+	flexBufferGrow((void**)&state->specs, state->specCount, &state->specCap, 1, sizeof(mnSpec));
+	mnSpec* spec = &state->specs[state->specCount++];
+	spec->name = ntInsert(state->specNames, (const char*)name, len, index);
+	spec->defined = false;
+	memset(&spec->params, 0, sizeof(spec->params));
+	return index;
+}
+
+static void mnReadVertex(mnState* state, const xmlChar** atts) {
+	const xmlChar* idx = NULL;
+	const xmlChar* role = NULL;
+	for (size_t i = 0; atts != NULL && atts[i] != NULL; i += 2) {
+		if (xmlStrEqual(atts[i], (const xmlChar*)"int_idx")) idx = atts[i+1];
+		else if (xmlStrEqual(atts[i], (const xmlChar*)"role")) role = atts[i+1];
+	}
+	uint32_t index;
+	if (idx == NULL || !mnParseIndex(idx, &index)) {
+		mnFatalError(state, "Topology contained a vertex without a valid index.\n");
+		return;
+	}
+	if (index >= state->vertexCount) {
+		size_t added = index + 1 - state->vertexCount;
+		flexBufferGrow((void**)&state->vertices, state->vertexCount, &state->vertexCap, added, sizeof(mnVertex));
+		memset(&state->vertices[state->vertexCount], 0, added * sizeof(mnVertex));
+		state->vertexCount = index + 1;
+	}
+	mnVertex* vertex = &state->vertices[index];
+	if (vertex->exists) {
+		mnFatalError(state, "Topology contained more than one vertex with index %u.\n", index);
+		return;
+	}
+	vertex->exists = true;
+	vertex->client = (role != NULL && xmlStrEqual(role, (const xmlChar*)"virtnode"));
+}
+
+static void mnReadEdge(mnState* state, const xmlChar** atts) {
+	flexBufferGrow((void**)&state->edges, state->edgeCount, &state->edgeCap, 1, sizeof(mnEdge));
+	mnEdge* edge = &state->edges[state->edgeCount];
+	memset(edge, 0, sizeof(mnEdge));
+	edge->spec = NoSpec;
+	bool haveSource = false, haveTarget = false;
+	for (size_t i = 0; atts != NULL && atts[i] != NULL; i += 2) {
+		if (xmlStrEqual(atts[i], (const xmlChar*)"int_src")) haveSource = mnParseIndex(atts[i+1], &edge->source);
+		else if (xmlStrEqual(atts[i], (const xmlChar*)"int_dst")) haveTarget = mnParseIndex(atts[i+1], &edge->target);
+		else if (xmlStrEqual(atts[i], (const xmlChar*)"specs")) edge->spec = mnSpecIndex(state, atts[i+1]);
+		else mnReadParam(&edge->params, atts[i], atts[i+1]);
+	}
+	if (!haveSource || !haveTarget) {
+		mnFatalError(state, "Topology contained an edge without a valid source and destination.\n");
+		return;
+	}
+	++state->edgeCount;
+}
+
+static void mnReadSpec(mnState* state, const xmlChar* name, const xmlChar** atts) {
+	uint32_t index = mnSpecIndex(state, name);
+	mnSpec* spec = &state->specs[index];
+	spec->defined = true;
+	for (size_t i = 0; atts != NULL && atts[i] != NULL; i += 2) {
+		mnReadParam(&spec->params, atts[i], atts[i+1]);
+	}
+}
+
+static void mnStartElement(void* ctx, const xmlChar* name, const xmlChar** atts) {
+	mnState* state = ctx;
+	if (state->dead) return;
+	++state->depth;
+
+	if (state->depth == 1) {
+		if (!xmlStrEqual(name, (const xmlChar*)"topology")) mnFatalError(state, "The topology file is not a ModelNet topology.\n");
+	} else if (state->specsDepth != 0) {
+		if (state->depth == state->specsDepth + 1) mnReadSpec(state, name, atts);
+	} else if (xmlStrEqual(name, (const xmlChar*)"vertex")) {
+		mnReadVertex(state, atts);
+	} else if (xmlStrEqual(name, (const xmlChar*)"edge")) {
+		mnReadEdge(state, atts);
+	} else if (xmlStrEqual(name, (const xmlChar*)"specs")) {
+		state->specsDepth = state->depth;
+	}
+}
+
+static void mnEndElement(void* ctx, const xmlChar* name) {
+	mnState* state = ctx;
+	if (state->dead) return;
+	if (state->depth == state->specsDepth) state->specsDepth = 0;
+	--state->depth;
+}
+
+static xmlSAXHandler mnHandlers = {
+	startElement: &mnStartElement,
+	endElement: &mnEndElement,
+
+	warning: &mnShowXmlError,
+	error: &mnShowXmlError,
+	fatalError: &mnShowXmlError,
+};
+
+// Combines the parameters of an edge with those of its specification
+static bool mnResolveParams(mnState* state, const mnEdge* edge, mnParams* params) {
+	memset(params, 0, sizeof(mnParams));
+	if (edge->spec != NoSpec) {
+		const mnSpec* spec = &state->specs[edge->spec];
+		if (!spec->defined) {
+			mnFatalError(state, "Topology contained an edge using the undefined specification '%s'.\n", spec->name);
+			return false;
+		}
+		*params = spec->params;
+	}
+	if (edge->params.set & MpKbps) params->kbps = edge->params.kbps;
+	if (edge->params.set & MpDelay) params->delayMs = edge->params.delayMs;
+	if (edge->params.set & MpLoss) params->packetLoss = edge->params.packetLoss;
+	if (edge->params.set & MpQueueLen) params->queueLen = edge->params.queueLen;
+	return true;
+}
+
+// Orders edges by the vertices that they connect, with the direction from the
+// lower to the higher index first
+static int mnCompareEdges(const void* a, const void* b) {
+	const mnEdge* ea = a;
+	const mnEdge* eb = b;
+	uint32_t loA = (ea->source < ea->target ? ea->source : ea->target);
+	uint32_t loB = (eb->source < eb->target ? eb->source : eb->target);
+	uint32_t hiA = (ea->source < ea->target ? ea->target : ea->source);
+	uint32_t hiB = (eb->source < eb->target ? eb->target : eb->source);
+	if (loA != loB) return (loA < loB ? -1 : 1);
+	if (hiA != hiB) return (hiA < hiB ? -1 : 1);
+	bool forwardA = (ea->source <= ea->target);
+	bool forwardB = (eb->source <= eb->target);
+	if (forwardA != forwardB) return (forwardA ? -1 : 1);
+	return 0;
+}
+
+// Reports the nodes and links after the whole topology has been read
+static int mnReport(mnState* state, NewNodeFunc newNode, NewLinkFunc newLink, void* userData) {
+	mnParams* resolved = eamalloc(state->edgeCount, sizeof(mnParams), 0);
+	TopoNode* nodes = eamalloc(state->vertexCount, sizeof(TopoNode), 0);
+	int err = 0;
+
+	for (size_t i = 0; i < state->vertexCount; ++i) {
+		nodes[i].client = state->vertices[i].client;
+		nodes[i].packetLoss = 0.0;
+		nodes[i].bandwidthUp = 0.0;
+		nodes[i].bandwidthDown = 0.0;
+	}
+
+	qsort(state->edges, state->edgeCount, sizeof(mnEdge), &mnCompareEdges);
+	for (size_t i = 0; i < state->edgeCount; ++i) {
+		const mnEdge* edge = &state->edges[i];
+		if (edge->source >= state->vertexCount || !state->vertices[edge->source].exists || edge->target >= state->vertexCount || !state->vertices[edge->target].exists) {
+			mnFatalError(state, "Topology contained an edge from vertex %u to vertex %u, but one of them does not exist.\n", edge->source, edge->target);
+			err = 1;
+			goto cleanup;
+		}
+		if (!mnResolveParams(state, edge, &resolved[i])) {
+			err = 1;
+			goto cleanup;
+		}
+
+		// Clients take their bandwidth from their access links
+		if (nodes[edge->source].client && nodes[edge->source].bandwidthUp == 0.0) nodes[edge->source].bandwidthUp = resolved[i].kbps / KbitPerMbit;
+		if (nodes[edge->target].client && nodes[edge->target].bandwidthDown == 0.0) nodes[edge->target].bandwidthDown = resolved[i].kbps / KbitPerMbit;
+	}
+
+	char name[MAX_NODE_ID_BUFLEN];
+	for (size_t i = 0; i < state->vertexCount && err == 0; ++i) {
+		if (!state->vertices[i].exists) continue;
+		GmlNode node = { .name = name, .t = nodes[i] };
+		node.nameLen = (size_t)snprintf(name, sizeof(name), "%lu", (unsigned long)i);
+		err = newNode(&node, userData);
+	}
+
+	char targetName[MAX_NODE_ID_BUFLEN];
+	for (size_t i = 0; i < state->edgeCount && err == 0; ++i) {
+		const mnEdge* edge = &state->edges[i];
+
+		// Edges between the same vertices are adjacent after sorting, and only
+		// the first of them becomes a link
+		if (i > 0) {
+			const mnEdge* prev = &state->edges[i-1];
+			if ((prev->source == edge->source && prev->target == edge->target) || (prev->source == edge->target && prev->target == edge->source)) continue;
+		}
+
+		GmlLink link = {
+			.sourceName = name,
+			.targetName = targetName,
+			.weight = (float)resolved[i].delayMs,
+			.t = {
+				.latency = resolved[i].delayMs,
+				.packetLoss = resolved[i].packetLoss,
+				.jitter = 0.0,
+				.queueLen = resolved[i].queueLen,
+			},
+		};
+		link.sourceNameLen = (size_t)snprintf(name, sizeof(name), "%u", edge->source);
+		link.targetNameLen = (size_t)snprintf(targetName, sizeof(targetName), "%u", edge->target);
+		err = newLink(&link, userData);
+	}
+
+cleanup:
+	free(resolved);
+	free(nodes);
+	return err;
+}
+
+int mnParse(FILE* input, NewNodeFunc newNode, NewLinkFunc newLink, void* userData) {
+#ifdef LIBXML_PUSH_ENABLED
+	mnState state = {
+		.depth = 0,
+		.specsDepth = 0,
+		.specNames = ntNewTable(UINT64_MAX),
+		.partialError = false,
+		.dead = false,
+	};
+	flexBufferInit((void**)&state.vertices, &state.vertexCount, &state.vertexCap);
+	flexBufferInit((void**)&state.edges, &state.edgeCount, &state.edgeCap);
+	flexBufferInit((void**)&state.specs, &state.specCount, &state.specCap);
+	xmlSetGenericErrorFunc(&state, &mnShowXmlError);
+
+	xmlParserCtxtPtr xmlContext = NULL;
+	int err = 0;
+	decompStream* stream = decompOpen(input, ChunkSize);
+	if (stream == NULL) err = 1;
+	while (!err) {
+		const char* buffer;
+		size_t read;
+		err = decompRead(stream, &buffer, &read);
+		if (err || read == 0) break;
+
+		if (!xmlContext) {
+			xmlContext = xmlCreatePushParserCtxt(&mnHandlers, &state, buffer, (int)read, NULL);
+			if (!xmlContext) err = -1;
+		} else {
+			err = xmlParseChunk(xmlContext, buffer, (int)read, 0);
+		}
+		if (state.dead) err = 1;
+	}
+	if (xmlContext && !err) {
+		err = xmlParseChunk(xmlContext, NULL, 0, 1);
+	}
+	if (xmlContext) xmlFreeParserCtxt(xmlContext);
+	if (stream != NULL) decompClose(stream);
+
+	if (err == 0 && state.dead) err = 1;
+	if (err == 0) {
+		lprintf(LogDebug, "ModelNet topology contains %lu vertices, %lu directed edges, and %lu specifications\n", (unsigned long)state.vertexCount, (unsigned long)state.edgeCount, (unsigned long)state.specCount);
+		err = mnReport(&state, newNode, newLink, userData);
+	} else {
+		lprintf(LogError, "Failed to parse the ModelNet file (error: %d). The document may be malformed.\n", err);
+	}
+
+	flexBufferFree((void**)&state.vertices, &state.vertexCount, &state.vertexCap);
+	flexBufferFree((void**)&state.edges, &state.edgeCount, &state.edgeCap);
+	flexBufferFree((void**)&state.specs, &state.specCount, &state.specCap);
+	ntFreeTable(state.specNames);
+	return err;
+#else
+	lprintln(LogError, "Reading ModelNet topologies is not supported because libxml was compiled without push parser support");
+	return -1;
+#endif
+}
+
+int mnParseFile(const char* filename, NewNodeFunc newNode, NewLinkFunc newLink, void* userData) {
+	errno = 0;
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL) {
+		int err = errno;
+		lprintf(LogError, "Could not open ModelNet file '%s': %s\n", filename, strerror(err));
+		return err;
+	}
+	int err = mnParse(file, newNode, newLink, userData);
+	fclose(file);
+	return err;
+}
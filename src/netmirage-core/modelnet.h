@@ -0,0 +1,44 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module reads topologies in the XML format produced by the ModelNet
+// tools (e.g., inet2xml). Vertices whose role is "virtnode" become client
+// nodes, and all other vertices become non-client nodes. ModelNet edges are
+// directed, so each pair of opposing edges becomes one link, using the
+// parameters of the edge from the lower to the higher vertex index. Link
+// parameters are taken from the edge's named specification, and are
+// overridden by any parameters given on the edge itself. The bandwidth of a
+// client's outgoing and incoming edges becomes its upstream and downstream
+// bandwidth, which is converted from Kbit/s to Mbit/s. Links are weighted by
+// their latency for route calculations.
+
+#include <stdio.h>
+
+#include "graphml.h"
+
+// Parses a ModelNet topology from a stream. Streams compressed with gzip, xz,
+// or zstd are decompressed transparently. Since edges refer to specifications
+// that are listed after them, the whole topology is read before any nodes are
+// reported. Returns 0 for success.
+int mnParse(FILE* input, NewNodeFunc newNode, NewLinkFunc newLink, void* userData);
+
+// Parses a ModelNet topology stored on the disk. Returns 0 for success.
+int mnParseFile(const char* filename, NewNodeFunc newNode, NewLinkFunc newLink, void* userData);
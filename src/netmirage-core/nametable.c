@@ -0,0 +1,347 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "nametable.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "mem.h"
+
+// Metadata for hash slots. Occupied slots hold the low 7 bits of the hash of
+// their name, so only empty slots have the high bit set. Names are never
+// removed, so no deletion markers are needed.
+static const uint8_t CtrlEmpty = 0x80;
+
+// Slots are probed in aligned groups whose metadata bytes are loaded into a
+// single 64-bit word.
+#define GROUP_SIZE 8
+static const uint64_t GroupLowBits = 0x0101010101010101ULL;
+static const uint64_t GroupHighBits = 0x8080808080808080ULL;
+
+static const size_t InitialSlots = 16;
+
+// Limits for names that are treated as numbers
+#define MAX_PREFIX_LEN 8
+#define MAX_NUMERIC_DIGITS 9
+
+// Numbers are only placed in the direct-indexed array if they are not much
+// larger than the number of names, so that sparse numbering does not waste
+// memory.
+static const size_t NumericSlack = 4096;
+
+// Value marking unused entries in the direct-indexed array
+static const uint32_t NumericUnused = UINT32_MAX;
+
+static const size_t ArenaBlockSize = 1024 * 64;
+
+typedef struct {
+	const char* name;
+	uint32_t len;
+	uint32_t value;
+} ntEntry;
+
+typedef struct ntBlock ntBlock;
+struct ntBlock {
+	ntBlock* next;
+	size_t used;
+	size_t cap;
+	char data[];
+};
+
+struct nameTable {
+	uint64_t maxMemoryUse;
+	bool warned;
+	size_t count;
+
+	// Direct-indexed array for names of the form prefix + number
+	bool hasPrefix;
+	char prefix[MAX_PREFIX_LEN];
+	size_t prefixLen;
+	uint32_t* numeric;
+	size_t numericCap;
+
+	// Open-addressing table for all other names
+	uint8_t* ctrl;
+	ntEntry* entries;
+	size_t slots; // Power of 2, or 0 before the first insertion
+	size_t hashed;
+
+	// Storage for the interned names
+	ntBlock* blocks;
+	uint64_t arenaBytes;
+};
+
+nameTable* ntNewTable(uint64_t maxMemoryUse) {
+	nameTable* table = emalloc(sizeof(nameTable));
+	table->maxMemoryUse = maxMemoryUse;
+	table->warned = false;
+	table->count = 0;
+	table->hasPrefix = false;
+	table->prefixLen = 0;
+	table->numeric = NULL;
+	table->numericCap = 0;
+	table->ctrl = NULL;
+	table->entries = NULL;
+	table->slots = 0;
+	table->hashed = 0;
+	table->blocks = NULL;
+	table->arenaBytes = 0;
+	return table;
+}
+
+void ntFreeTable(nameTable* table) {
+	ntBlock* block = table->blocks;
+	while (block != NULL) {
+		ntBlock* next = block->next;
+		free(block);
+		block = next;
+	}
+	free(table->numeric);
+	free(table->ctrl);
+	free(table->entries);
+	free(table);
+}
+
+size_t ntCount(const nameTable* table) {
+	return table->count;
+}
+
+uint64_t ntMemoryUse(const nameTable* table) {
+	return sizeof(nameTable) + table->arenaBytes + (uint64_t)table->numericCap * sizeof(uint32_t) + (uint64_t)table->slots * (1 + sizeof(ntEntry));
+}
+
+static bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+// Determines whether the name is the table's prefix followed by a canonical
+// decimal number. If so, returns true and sets *num.
+static bool ntParseNumeric(const nameTable* table, const char* name, size_t len, size_t* num) {
+	if (!table->hasPrefix || len <= table->prefixLen) return false;
+	size_t digits = len - table->prefixLen;
+	if (digits > MAX_NUMERIC_DIGITS) return false;
+	if (memcmp(name, table->prefix, table->prefixLen) != 0) return false;
+
+	const char* p = name + table->prefixLen;
+	if (p[0] == '0' && digits > 1) return false;
+	size_t value = 0;
+	for (size_t i = 0; i < digits; ++i) {
+		if (!isDigit(p[i])) return false;
+		value = value * 10 + (size_t)(p[i] - '0');
+	}
+	*num = value;
+	return true;
+}
+
+// Adopts the non-numeric start of the name as the table's prefix, if the name
+// has a suitable form and no prefix has been chosen yet.
+static void ntLearnPrefix(nameTable* table, const char* name, size_t len) {
+	if (table->hasPrefix) return;
+	size_t prefixLen = 0;
+	while (prefixLen < len && !isDigit(name[prefixLen])) ++prefixLen;
+	if (prefixLen > MAX_PREFIX_LEN || prefixLen == len) return;
+	for (size_t i = prefixLen; i < len; ++i) {
+		if (!isDigit(name[i])) return;
+	}
+	memcpy(table->prefix, name, prefixLen);
+	table->prefixLen = prefixLen;
+	table->hasPrefix = true;
+}
+
+static uint64_t ntHash(const char* name, size_t len) {
+	const uint64_t Mul = 0x9E3779B97F4A7C15ULL;
+	uint64_t h = (uint64_t)len * Mul;
+	while (len >= 8) {
+		uint64_t word;
+		memcpy(&word, name, 8);
+		h = (h ^ word) * Mul;
+		h ^= h >> 32;
+		name += 8;
+		len -= 8;
+	}
+	if (len > 0) {
+		uint64_t word = 0;
+		memcpy(&word, name, len);
+		h = (h ^ word) * Mul;
+		h ^= h >> 32;
+	}
+	h *= Mul;
+	return h ^ (h >> 29);
+}
+
+// Loads the metadata for a group. The first slot of the group is always in the
+// lowest byte.
+static uint64_t ntLoadGroup(const nameTable* table, size_t group) {
+	uint64_t word;
+	memcpy(&word, &table->ctrl[group * GROUP_SIZE], sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	return word;
+}
+
+// Returns the index within a group of the lowest flagged byte in a mask
+static size_t ntFirstInMask(uint64_t mask) {
+	return (size_t)__builtin_ctzll(mask) / 8;
+}
+
+// Finds the slot containing a name, or returns false if it is absent
+static bool ntFindSlot(const nameTable* table, const char* name, size_t len, uint64_t hash, size_t* slot) {
+	if (table->slots == 0) return false;
+	uint8_t tag = (uint8_t)(hash & 0x7F);
+	size_t groupMask = table->slots / GROUP_SIZE - 1;
+	size_t group = (size_t)(hash >> 7) & groupMask;
+	for (size_t step = 1; ; ++step) {
+		uint64_t ctrl = ntLoadGroup(table, group);
+
+		// Flag the bytes equal to the tag. This may flag some extra bytes,
+		// which are rejected when the slots are compared.
+		uint64_t diff = ctrl ^ (GroupLowBits * tag);
+		uint64_t matches = (diff - GroupLowBits) & ~diff & GroupHighBits;
+		while (matches != 0) {
+			size_t index = group * GROUP_SIZE + ntFirstInMask(matches);
+			const ntEntry* entry = &table->entries[index];
+			if (table->ctrl[index] == tag && entry->len == len && memcmp(entry->name, name, len) == 0) {
+				*slot = index;
+				return true;
+			}
+			matches &= matches - 1;
+		}
+		if ((ctrl & GroupHighBits) != 0) return false;
+
+		// Triangular probing visits every group when the count is a power of 2
+		group = (group + step) & groupMask;
+	}
+}
+
+// Places an entry in the first empty slot along its probe sequence. The table
+// must have an empty slot.
+static void ntPlaceEntry(nameTable* table, const ntEntry* entry, uint64_t hash) {
+	size_t groupMask = table->slots / GROUP_SIZE - 1;
+	size_t group = (size_t)(hash >> 7) & groupMask;
+	for (size_t step = 1; ; ++step) {
+		uint64_t empty = ntLoadGroup(table, group) & GroupHighBits;
+		if (empty != 0) {
+			size_t index = group * GROUP_SIZE + ntFirstInMask(empty);
+			table->ctrl[index] = (uint8_t)(hash & 0x7F);
+			table->entries[index] = *entry;
+			return;
+		}
+		group = (group + step) & groupMask;
+	}
+}
+
+// Ensures that there is room for another hashed name, keeping the table at
+// most 7/8 full
+static void ntReserveSlot(nameTable* table) {
+	if (table->slots > 0 && (table->hashed + 1) * 8 <= table->slots * 7) return;
+
+	size_t oldSlots = table->slots;
+	uint8_t* oldCtrl = table->ctrl;
+	ntEntry* oldEntries = table->entries;
+
+	if (oldSlots == 0) {
+		table->slots = InitialSlots;
+	} else {
+		emulSize(oldSlots, 2, &table->slots);
+	}
+	table->ctrl = emalloc(table->slots);
+	memset(table->ctrl, CtrlEmpty, table->slots);
+	table->entries = eamalloc(table->slots, sizeof(ntEntry), 0);
+
+	for (size_t i = 0; i < oldSlots; ++i) {
+		if (oldCtrl[i] & CtrlEmpty) continue;
+		const ntEntry* entry = &oldEntries[i];
+		ntPlaceEntry(table, entry, ntHash(entry->name, entry->len));
+	}
+	free(oldCtrl);
+	free(oldEntries);
+}
+
+// Copies a name into the arena and terminates it
+static const char* ntArenaCopy(nameTable* table, const char* name, size_t len) {
+	ntBlock* block = table->blocks;
+	if (block == NULL || block->cap - block->used < len + 1) {
+		size_t cap = (len + 1 > ArenaBlockSize ? len + 1 : ArenaBlockSize);
+		block = eamalloc(cap, 1, sizeof(ntBlock));
+		block->next = table->blocks;
+		block->used = 0;
+		block->cap = cap;
+		table->blocks = block;
+		table->arenaBytes += sizeof(ntBlock) + cap;
+	}
+	char* copy = block->data + block->used;
+	memcpy(copy, name, len);
+	copy[len] = '\0';
+	block->used += len + 1;
+	return copy;
+}
+
+// Stores a value in the direct-indexed array if the number is dense enough.
+// Returns false if the name should be hashed instead.
+static bool ntStoreNumeric(nameTable* table, size_t num, uint32_t value) {
+	if (num >= table->numericCap) {
+		if (num >= 2 * table->count + NumericSlack) return false;
+		size_t newCap = table->numericCap * 2;
+		if (newCap <= num) newCap = num + 1;
+		if (newCap < NumericSlack) newCap = NumericSlack;
+		table->numeric = earealloc(table->numeric, newCap, sizeof(uint32_t), 0);
+		memset(&table->numeric[table->numericCap], 0xFF, (newCap - table->numericCap) * sizeof(uint32_t));
+		table->numericCap = newCap;
+	}
+	if (table->numeric[num] != NumericUnused) return false;
+	table->numeric[num] = value;
+	return true;
+}
+
+bool ntLookup(nameTable* table, const char* name, size_t len, uint32_t* value) {
+	size_t num;
+	if (ntParseNumeric(table, name, len, &num) && num < table->numericCap && table->numeric[num] != NumericUnused) {
+		*value = table->numeric[num];
+		return true;
+	}
+	if (table->hashed == 0) return false;
+
+	size_t slot;
+	if (!ntFindSlot(table, name, len, ntHash(name, len), &slot)) return false;
+	*value = table->entries[slot].value;
+	return true;
+}
+
+const char* ntInsert(nameTable* table, const char* name, size_t len, uint32_t value) {
+	const char* copy = ntArenaCopy(table, name, len);
+
+	size_t num;
+	ntLearnPrefix(table, name, len);
+	if (value == NumericUnused || !ntParseNumeric(table, name, len, &num) || !ntStoreNumeric(table, num, value)) {
+		ntReserveSlot(table);
+		ntEntry entry = { .name = copy, .len = (uint32_t)len, .value = value };
+		ntPlaceEntry(table, &entry, ntHash(name, len));
+		++table->hashed;
+	}
+	++table->count;
+
+	if (!table->warned && ntMemoryUse(table) > table->maxMemoryUse) {
+		table->warned = true;
+		lprintf(LogWarning, "The table of node names uses %lu bytes, which exceeds the memory limit of %lu bytes\n", (unsigned long)ntMemoryUse(table), (unsigned long)table->maxMemoryUse);
+	}
+	return copy;
+}
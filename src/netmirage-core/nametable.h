@@ -0,0 +1,56 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module implements an interning table that maps names to 32-bit values.
+// Names are copied into an arena, so that adding a name requires no individual
+// allocations. Names consisting of a common prefix followed by a decimal
+// number (such as "n123" or "123") are stored in a direct-indexed array and are
+// found without hashing. Other names are stored in an open-addressing hash
+// table whose metadata is probed 8 slots at a time.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct nameTable nameTable;
+
+// Allocates a new name table. The maxMemoryUse serves as a guideline for the
+// size of the table. A warning is shown if it is exceeded, but the table
+// continues to grow.
+nameTable* ntNewTable(uint64_t maxMemoryUse);
+
+// Releases the table and all interned names.
+void ntFreeTable(nameTable* table);
+
+// Looks up a name of the given length. If the name exists, returns true and
+// sets *value. Otherwise, returns false.
+bool ntLookup(nameTable* table, const char* name, size_t len, uint32_t* value);
+
+// Adds a name that does not already exist in the table. Returns the interned
+// copy of the name, which is NUL-terminated and remains valid until the table
+// is freed.
+const char* ntInsert(nameTable* table, const char* name, size_t len, uint32_t value);
+
+// Returns the number of names in the table.
+size_t ntCount(const nameTable* table);
+
+// Returns the approximate number of bytes used by the table.
+uint64_t ntMemoryUse(const nameTable* table);
@@ -53,6 +53,7 @@ struct netCache {
 	ncNode* oldest;
 	ncNode* newest;
 	GHashTable* map;
+	uint64_t hits;
 };
 
 static gpointer ncMakeKey(nodeId id) {
@@ -67,6 +68,7 @@ netCache* ncNewCache(uint64_t maxMemoryUse) {
 	cache->map = g_hash_table_new(&g_direct_hash, &g_direct_equal);
 	cache->oldest = NULL;
 	cache->newest = NULL;
+	cache->hits = 0;
 	return cache;
 }
 
@@ -89,12 +91,10 @@ netContext* ncOpenNamespace(netCache* cache, nodeId id, const char* name, bool c
 	gpointer key = ncMakeKey(id);
 	gpointer val = g_hash_table_lookup(cache->map, key);
 	if (val != NULL) { // Found in hash table
+		// The context's sockets are already bound to the namespace, so there
+		// is no need to switch to it
 		ncNode* node = val;
-		int res = netSwitchNamespace(&node->ctx);
-		if (res != 0) {
-			if (err != NULL) *err = res;
-			return NULL;
-		}
+		++cache->hits;
 		return &node->ctx;
 	}
 
@@ -126,3 +126,7 @@ netContext* ncOpenNamespace(netCache* cache, nodeId id, const char* name, bool c
 	g_hash_table_insert(cache->map, key, node);
 	return &node->ctx;
 }
+
+uint64_t ncCacheHits(const netCache* cache) {
+	return cache->hits;
+}
@@ -44,6 +44,12 @@ void ncFreeCache(netCache* cache);
 // context is retrieved from the cache. Otherwise, the namespace is opened with
 // the specified name and stored in the cache. If the cache is full, an existing
 // namespace is released and discarded from the cache. excl and err have the
-// same meaning as for netOpenNamespace. The active namespace for the process is
-// set to the given namespace.
+// same meaning as for netOpenNamespace. If the namespace needs to be opened,
+// then the active namespace for the process is set to the given namespace.
+// Cached contexts are returned without switching the active namespace; callers
+// performing namespace-bound operations must switch explicitly.
 netContext* ncOpenNamespace(netCache* cache, nodeId id, const char* name, bool create, bool excl, int* err);
+
+// Returns the number of requests that were served from the cache without
+// switching namespaces.
+uint64_t ncCacheHits(const netCache* cache);
@@ -0,0 +1,223 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "numparse.h"
+
+#include "mem.h"
+
+#include <float.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The fast paths rely on arithmetic being performed at the precision of the
+// operands. Otherwise, intermediate results could be rounded twice.
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define NP_FAST_PATH 1
+#else
+#define NP_FAST_PATH 0
+#endif
+
+// Longest text passed to the C library without allocating memory
+#define FALLBACK_BUF_LEN 64
+
+// Maximum number of significant digits that are accumulated. 19 digits always
+// fit into a uint64_t.
+static const int MaxSignificantDigits = 19;
+
+// Largest mantissas and powers of 10 that are represented exactly
+static const uint64_t MaxExactDouble = (uint64_t)1 << 53;
+static const uint64_t MaxExactFloat = (uint64_t)1 << 24;
+#define MAX_EXACT_DOUBLE_POW10 22
+#define MAX_EXACT_FLOAT_POW10 10
+
+static const double DoublePow10[MAX_EXACT_DOUBLE_POW10+1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static const float FloatPow10[MAX_EXACT_FLOAT_POW10+1] = {
+	1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f,
+};
+
+// Decimal number decomposed as (negative ? -1 : 1) * mantissa * 10^exponent
+typedef struct {
+	bool negative;
+	uint64_t mantissa;
+	int exponent;
+} npDecimal;
+
+static bool isSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+static bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+// Splits a plain decimal number into its parts. Returns false if the text uses
+// a form that is not handled here, or if it has too many significant digits.
+// On success, *end points after the number.
+static bool npDecompose(const char* p, npDecimal* dec, const char** end) {
+	while (isSpace(*p)) ++p;
+	dec->negative = false;
+	if (*p == '-' || *p == '+') {
+		dec->negative = (*p == '-');
+		++p;
+	}
+
+	uint64_t mantissa = 0;
+	int significant = 0;
+	int exponent = 0;
+	bool anyDigits = false;
+
+	const char* digitsStart = p;
+	for (; isDigit(*p); ++p) {
+		anyDigits = true;
+		if (mantissa == 0 && *p == '0') continue;
+		if (significant == MaxSignificantDigits) return false;
+		mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+		++significant;
+	}
+	// Hexadecimal numbers are left to the C library
+	if ((*p == 'x' || *p == 'X') && p - digitsStart == 1 && *digitsStart == '0') return false;
+
+	if (*p == '.') {
+		++p;
+		for (; isDigit(*p); ++p) {
+			anyDigits = true;
+			--exponent;
+			if (mantissa == 0 && *p == '0') continue;
+			if (significant == MaxSignificantDigits) return false;
+			mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+			++significant;
+		}
+	}
+	if (!anyDigits) return false;
+
+	// The exponent is only part of the number if it contains digits
+	if (*p == 'e' || *p == 'E') {
+		const char* q = p + 1;
+		bool negativeExp = false;
+		if (*q == '-' || *q == '+') {
+			negativeExp = (*q == '-');
+			++q;
+		}
+		if (isDigit(*q)) {
+			int exp = 0;
+			for (; isDigit(*q); ++q) {
+				if (exp > 10000) return false;
+				exp = exp * 10 + (*q - '0');
+			}
+			exponent += (negativeExp ? -exp : exp);
+			p = q;
+		}
+	}
+
+	dec->mantissa = mantissa;
+	dec->exponent = exponent;
+	*end = p;
+	return true;
+}
+
+// Returns true for characters that may be part of a number accepted by the C
+// library, including forms such as "0x1p4", "inf", and "nan(chars)"
+static bool isNumberChar(char c) {
+	return isDigit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '+' || c == '-' || c == '.' || c == '(' || c == ')' || c == '_';
+}
+
+// Returns a NUL-terminated copy of text that may be a number, for the C
+// library. Copying stops at the first character that cannot be part of a
+// number, such as the start of the next markup or a field delimiter. Short
+// text is copied into buf; longer text is copied into allocated memory that
+// must be freed if it is not equal to buf.
+static char* npCopyForFallback(const char* str, char* buf) {
+	size_t len = 0;
+	while (isSpace(str[len])) ++len;
+	while (isNumberChar(str[len])) ++len;
+	char* copy = (len < FALLBACK_BUF_LEN ? buf : eamalloc(len, 1, 1));
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+double npParseDouble(const char* str, const char** end) {
+	npDecimal dec;
+	const char* numEnd;
+	if (NP_FAST_PATH && npDecompose(str, &dec, &numEnd) && dec.mantissa <= MaxExactDouble && dec.exponent >= -MAX_EXACT_DOUBLE_POW10 && dec.exponent <= MAX_EXACT_DOUBLE_POW10) {
+		double value = (double)dec.mantissa;
+		if (dec.exponent < 0) value /= DoublePow10[-dec.exponent];
+		else value *= DoublePow10[dec.exponent];
+		if (end != NULL) *end = numEnd;
+		return dec.negative ? -value : value;
+	}
+
+	char buf[FALLBACK_BUF_LEN];
+	char* copy = npCopyForFallback(str, buf);
+	char* copyEnd;
+	double value = strtod(copy, &copyEnd);
+	if (end != NULL) *end = str + (copyEnd - copy);
+	if (copy != buf) free(copy);
+	return value;
+}
+
+float npParseFloat(const char* str, const char** end) {
+	npDecimal dec;
+	const char* numEnd;
+	if (NP_FAST_PATH && npDecompose(str, &dec, &numEnd) && dec.mantissa <= MaxExactFloat && dec.exponent >= -MAX_EXACT_FLOAT_POW10 && dec.exponent <= MAX_EXACT_FLOAT_POW10) {
+		float value = (float)dec.mantissa;
+		if (dec.exponent < 0) value /= FloatPow10[-dec.exponent];
+		else value *= FloatPow10[dec.exponent];
+		if (end != NULL) *end = numEnd;
+		return dec.negative ? -value : value;
+	}
+
+	char buf[FALLBACK_BUF_LEN];
+	char* copy = npCopyForFallback(str, buf);
+	char* copyEnd;
+	float value = strtof(copy, &copyEnd);
+	if (end != NULL) *end = str + (copyEnd - copy);
+	if (copy != buf) free(copy);
+	return value;
+}
+
+uint32_t npParseUint32(const char* str, const char** end) {
+	const char* p = str;
+	while (isSpace(*p)) ++p;
+	if (*p == '+') ++p;
+	if (isDigit(*p)) {
+		uint64_t value = 0;
+		for (; isDigit(*p); ++p) {
+			value = value * 10 + (uint64_t)(*p - '0');
+			if (value > UINT32_MAX) break;
+		}
+		if (value <= UINT32_MAX) {
+			if (end != NULL) *end = p;
+			return (uint32_t)value;
+		}
+	}
+
+	char buf[FALLBACK_BUF_LEN];
+	char* copy = npCopyForFallback(str, buf);
+	char* copyEnd;
+	unsigned long value = strtoul(copy, &copyEnd, 10);
+	if (end != NULL) *end = str + (copyEnd - copy);
+	if (copy != buf) free(copy);
+	return (value > UINT32_MAX ? UINT32_MAX : (uint32_t)value);
+}
@@ -0,0 +1,48 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module converts decimal text into numbers. Common values are converted
+// without any library calls or locale lookups: if the significant digits fit
+// into the mantissa of the result and the power of 10 is small, both are
+// exactly representable, so a single multiplication or division produces the
+// correctly rounded result. Other values, such as those with many digits,
+// extreme exponents, or special forms like "inf", are passed to the C library.
+// NetMirage never changes the locale, so these use the "C" locale.
+//
+// As with strtod, leading whitespace is skipped and conversion stops at the
+// first character that cannot be part of the number. The input does not need
+// to be NUL-terminated if it is followed by such a character.
+
+#include <stdint.h>
+
+// Converts text to a double. If end is not NULL, it is set to the first
+// character after the number. If there is no number, returns 0 and sets end to
+// str.
+double npParseDouble(const char* str, const char** end);
+
+// Converts text to a float. The behavior is the same as npParseDouble, but the
+// result is rounded directly to single precision.
+float npParseFloat(const char* str, const char** end);
+
+// Converts decimal text to an unsigned 32-bit integer. Values that do not fit
+// are clamped to UINT32_MAX. If end is not NULL, it is set to the first
+// character after the number.
+uint32_t npParseUint32(const char* str, const char** end);
@@ -0,0 +1,530 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#define _GNU_SOURCE // Needed for MSG_NOSIGNAL
+
+#include "openflow.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ip.h"
+#include "log.h"
+#include "mem.h"
+
+// Protocol constants from the OpenFlow 1.3.5 specification
+#define OFP_VERSION_13       0x04
+#define OFP_HEADER_LEN       8
+
+#define OFPT_HELLO           0
+#define OFPT_ERROR           1
+#define OFPT_ECHO_REQUEST    2
+#define OFPT_ECHO_REPLY      3
+#define OFPT_FLOW_MOD        14
+#define OFPT_BARRIER_REQUEST 20
+#define OFPT_BARRIER_REPLY   21
+
+#define OFPFC_ADD            0
+#define OFPFC_DELETE         3
+
+#define OFPTT_ALL            0xFF
+#define OFP_NO_BUFFER        0xFFFFFFFFU
+#define OFPP_IN_PORT         0xFFFFFFF8U
+#define OFPP_ANY             0xFFFFFFFFU
+#define OFPG_ANY             0xFFFFFFFFU
+
+#define OFPMT_OXM            1
+#define OFPIT_GOTO_TABLE     1
+#define OFPIT_APPLY_ACTIONS  4
+#define OFPAT_OUTPUT         0
+#define OFPAT_SET_FIELD      25
+#define OFPAT_EXPERIMENTER   0xFFFF
+
+#define OFPXMC_OPENFLOW_BASIC 0x8000
+#define OFPXMT_IN_PORT       0
+#define OFPXMT_ETH_DST       3
+#define OFPXMT_ETH_SRC       4
+#define OFPXMT_ETH_TYPE      5
+#define OFPXMT_IPV4_SRC      11
+#define OFPXMT_IPV4_DST      12
+#define OFPXMT_ARP_OP        21
+#define OFPXMT_ARP_SPA       22
+#define OFPXMT_ARP_TPA       23
+#define OFPXMT_ARP_SHA       24
+
+#define ETH_TYPE_IP          0x0800
+#define ETH_TYPE_ARP         0x0806
+#define ARP_OP_REPLY         2
+
+// Open vSwitch's "move" action is a Nicira extension (NXAST_REG_MOVE). Fields
+// are identified by their NXM headers.
+#define NX_VENDOR_ID         0x00002320U
+#define NXAST_REG_MOVE       6
+#define NXM_HEADER(vendor, field, len) ((uint32_t)(((vendor) << 16) | ((field) << 9) | (len)))
+#define NXM_OF_ETH_DST       NXM_HEADER(0x0000, 1, 6)
+#define NXM_OF_ETH_SRC       NXM_HEADER(0x0000, 2, 6)
+#define NXM_OF_ARP_SPA       NXM_HEADER(0x0000, 16, 4)
+#define NXM_OF_ARP_TPA       NXM_HEADER(0x0000, 17, 4)
+#define NXM_NX_ARP_SHA       NXM_HEADER(0x0001, 17, 6)
+#define NXM_NX_ARP_THA       NXM_HEADER(0x0001, 18, 6)
+
+// Queued messages are sent once this many bytes accumulate
+static const size_t SendThreshold = 64 * 1024;
+
+struct ofConn {
+	int fd;
+	uint32_t nextXid;
+	int sendErr; // First error encountered while sending queued messages
+
+	uint8_t* outBuf; // Flexible buffer of queued messages
+	size_t outLen;
+	size_t outCap;
+
+	uint8_t* inBuf; // Flexible buffer for the message being received
+	size_t inCap;
+};
+
+static void ofPut(ofConn* conn, const void* data, size_t len) {
+	flexBufferGrow((void**)&conn->outBuf, conn->outLen, &conn->outCap, len, 1);
+	flexBufferAppend(conn->outBuf, &conn->outLen, data, len, 1);
+}
+
+static void ofPut8(ofConn* conn, uint8_t value) {
+	ofPut(conn, &value, sizeof(value));
+}
+
+static void ofPut16(ofConn* conn, uint16_t value) {
+	value = htobe16(value);
+	ofPut(conn, &value, sizeof(value));
+}
+
+static void ofPut32(ofConn* conn, uint32_t value) {
+	value = htobe32(value);
+	ofPut(conn, &value, sizeof(value));
+}
+
+static void ofPut64(ofConn* conn, uint64_t value) {
+	value = htobe64(value);
+	ofPut(conn, &value, sizeof(value));
+}
+
+static void ofPutZeros(ofConn* conn, size_t len) {
+	static const uint8_t zeros[8] = { 0 };
+	while (len > 0) {
+		size_t chunk = (len < sizeof(zeros) ? len : sizeof(zeros));
+		ofPut(conn, zeros, chunk);
+		len -= chunk;
+	}
+}
+
+// Pads the queue with zeros so that the data starting at offset start has a
+// length that is a multiple of 8 bytes
+static void ofPadTo8(ofConn* conn, size_t start) {
+	size_t len = conn->outLen - start;
+	ofPutZeros(conn, (8 - (len % 8)) % 8);
+}
+
+// Overwrites a 16-bit length field at the given offset with the length of the
+// data written since start
+static void ofPatchLen(ofConn* conn, size_t fieldOffset, size_t start) {
+	uint16_t len = htobe16((uint16_t)(conn->outLen - start));
+	memcpy(&conn->outBuf[fieldOffset], &len, sizeof(len));
+}
+
+// Writes a message header and returns the offset of the message. The length
+// is filled in by ofEndMessage.
+static size_t ofBeginMessage(ofConn* conn, uint8_t type, uint32_t* xid) {
+	size_t start = conn->outLen;
+	uint32_t msgXid = conn->nextXid++;
+	if (xid != NULL) *xid = msgXid;
+	ofPut8(conn, OFP_VERSION_13);
+	ofPut8(conn, type);
+	ofPut16(conn, 0);
+	ofPut32(conn, msgXid);
+	return start;
+}
+
+static int ofSendQueued(ofConn* conn);
+
+static void ofEndMessage(ofConn* conn, size_t start) {
+	ofPatchLen(conn, start + 2, start);
+	if (conn->outLen >= SendThreshold) ofSendQueued(conn);
+}
+
+static void ofPutOxm(ofConn* conn, uint8_t field, const void* value, const void* mask, uint8_t len) {
+	bool hasMask = (mask != NULL);
+	ofPut32(conn, ((uint32_t)OFPXMC_OPENFLOW_BASIC << 16) | ((uint32_t)field << 9) | ((uint32_t)hasMask << 8) | (uint32_t)(hasMask ? 2*len : len));
+	ofPut(conn, value, len);
+	if (hasMask) ofPut(conn, mask, len);
+}
+
+static void ofPutOxm16(ofConn* conn, uint8_t field, uint16_t value) {
+	value = htobe16(value);
+	ofPutOxm(conn, field, &value, NULL, sizeof(value));
+}
+
+// Matches a subnet, omitting the mask when it is not needed
+static void ofPutOxmSubnet(ofConn* conn, uint8_t field, const ip4Subnet* subnet) {
+	if (subnet->prefixLen == 0) return;
+	ip4Addr mask = ip4SubnetMask(subnet);
+	ip4Addr addr = subnet->addr & mask;
+	ofPutOxm(conn, field, &addr, (subnet->prefixLen < 32 ? &mask : NULL), sizeof(addr));
+}
+
+static void ofPutSetField(ofConn* conn, uint8_t field, const void* value, uint8_t len) {
+	size_t start = conn->outLen;
+	ofPut16(conn, OFPAT_SET_FIELD);
+	ofPut16(conn, 0);
+	ofPutOxm(conn, field, value, NULL, len);
+	ofPadTo8(conn, start);
+	ofPatchLen(conn, start + 2, start);
+}
+
+static void ofPutOutput(ofConn* conn, uint32_t port) {
+	ofPut16(conn, OFPAT_OUTPUT);
+	ofPut16(conn, 16);
+	ofPut32(conn, port);
+	ofPut16(conn, 0); // max_len (only used for the controller)
+	ofPutZeros(conn, 6);
+}
+
+static void ofPutMove(ofConn* conn, uint32_t src, uint32_t dst, uint16_t bits) {
+	ofPut16(conn, OFPAT_EXPERIMENTER);
+	ofPut16(conn, 24);
+	ofPut32(conn, NX_VENDOR_ID);
+	ofPut16(conn, NXAST_REG_MOVE);
+	ofPut16(conn, bits);
+	ofPut16(conn, 0); // Source offset
+	ofPut16(conn, 0); // Destination offset
+	ofPut32(conn, src);
+	ofPut32(conn, dst);
+}
+
+// Writes the fixed part of a flow modification and returns the message offset
+static size_t ofBeginFlowMod(ofConn* conn, uint8_t command, uint8_t tableId, uint16_t priority) {
+	size_t start = ofBeginMessage(conn, OFPT_FLOW_MOD, NULL);
+	ofPut64(conn, 0); // Cookie
+	ofPut64(conn, 0); // Cookie mask
+	ofPut8(conn, tableId);
+	ofPut8(conn, command);
+	ofPut16(conn, 0); // Idle timeout
+	ofPut16(conn, 0); // Hard timeout
+	ofPut16(conn, priority);
+	ofPut32(conn, OFP_NO_BUFFER);
+	ofPut32(conn, OFPP_ANY);
+	ofPut32(conn, OFPG_ANY);
+	ofPut16(conn, 0); // Flags
+	ofPutZeros(conn, 2);
+	return start;
+}
+
+static size_t ofBeginMatch(ofConn* conn) {
+	size_t start = conn->outLen;
+	ofPut16(conn, OFPMT_OXM);
+	ofPut16(conn, 0);
+	return start;
+}
+
+// The match length excludes the padding
+static void ofEndMatch(ofConn* conn, size_t start) {
+	ofPatchLen(conn, start + 2, start);
+	ofPadTo8(conn, start);
+}
+
+static size_t ofBeginApplyActions(ofConn* conn) {
+	size_t start = conn->outLen;
+	ofPut16(conn, OFPIT_APPLY_ACTIONS);
+	ofPut16(conn, 0);
+	ofPutZeros(conn, 4);
+	return start;
+}
+
+static void ofEndApplyActions(ofConn* conn, size_t start) {
+	ofPatchLen(conn, start + 2, start);
+}
+
+static int ofSendAll(ofConn* conn, const uint8_t* data, size_t len) {
+	while (len > 0) {
+		errno = 0;
+		ssize_t sent = send(conn->fd, data, len, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) continue;
+			lprintf(LogError, "Failed to send OpenFlow messages to the switch: %s\n", strerror(errno));
+			return errno;
+		}
+		data += sent;
+		len -= (size_t)sent;
+	}
+	return 0;
+}
+
+static int ofSendQueued(ofConn* conn) {
+	int err = ofSendAll(conn, conn->outBuf, conn->outLen);
+	conn->outLen = 0;
+	if (err != 0 && conn->sendErr == 0) conn->sendErr = err;
+	return err;
+}
+
+static int ofRecvAll(ofConn* conn, uint8_t* data, size_t len) {
+	while (len > 0) {
+		errno = 0;
+		ssize_t got = recv(conn->fd, data, len, 0);
+		if (got < 0) {
+			if (errno == EINTR) continue;
+			lprintf(LogError, "Failed to read OpenFlow messages from the switch: %s\n", strerror(errno));
+			return errno;
+		}
+		if (got == 0) {
+			lprintln(LogError, "The switch closed the OpenFlow connection unexpectedly");
+			return 1;
+		}
+		data += got;
+		len -= (size_t)got;
+	}
+	return 0;
+}
+
+// Receives the next message into conn->inBuf and returns its type, length, and
+// transaction identifier. Echo requests are answered automatically.
+static int ofRecv(ofConn* conn, uint8_t* type, uint16_t* len, uint32_t* xid) {
+	while (true) {
+		flexBufferGrow((void**)&conn->inBuf, 0, &conn->inCap, OFP_HEADER_LEN, 1);
+		int err = ofRecvAll(conn, conn->inBuf, OFP_HEADER_LEN);
+		if (err != 0) return err;
+
+		uint16_t msgLen;
+		memcpy(&msgLen, &conn->inBuf[2], sizeof(msgLen));
+		msgLen = be16toh(msgLen);
+		if (msgLen < OFP_HEADER_LEN) {
+			lprintf(LogError, "Received an OpenFlow message with invalid length %u\n", msgLen);
+			return 1;
+		}
+		flexBufferGrow((void**)&conn->inBuf, 0, &conn->inCap, msgLen, 1);
+		err = ofRecvAll(conn, &conn->inBuf[OFP_HEADER_LEN], msgLen - OFP_HEADER_LEN);
+		if (err != 0) return err;
+
+		*type = conn->inBuf[1];
+		*len = msgLen;
+		memcpy(xid, &conn->inBuf[4], sizeof(*xid));
+		*xid = be32toh(*xid);
+
+		if (*type == OFPT_ECHO_REQUEST) {
+			conn->inBuf[0] = OFP_VERSION_13;
+			conn->inBuf[1] = OFPT_ECHO_REPLY;
+			err = ofSendAll(conn, conn->inBuf, msgLen);
+			if (err != 0) return err;
+			continue;
+		}
+		return 0;
+	}
+}
+
+static void ofLogError(ofConn* conn, uint16_t len, uint32_t xid) {
+	uint16_t errType = 0, errCode = 0;
+	if (len >= OFP_HEADER_LEN + 4) {
+		memcpy(&errType, &conn->inBuf[OFP_HEADER_LEN], sizeof(errType));
+		memcpy(&errCode, &conn->inBuf[OFP_HEADER_LEN + 2], sizeof(errCode));
+	}
+	lprintf(LogError, "The switch rejected OpenFlow message %u (error type %u, code %u)\n", xid, be16toh(errType), be16toh(errCode));
+}
+
+ofConn* ofConnect(const char* socketPath, int* err) {
+	int localErr;
+	if (err == NULL) err = &localErr;
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+		lprintf(LogError, "OpenFlow socket path '%s' is too long\n", socketPath);
+		*err = ENAMETOOLONG;
+		return NULL;
+	}
+	strcpy(addr.sun_path, socketPath);
+
+	errno = 0;
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		lprintf(LogError, "Failed to create OpenFlow socket: %s\n", strerror(errno));
+		*err = errno;
+		return NULL;
+	}
+	errno = 0;
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		lprintf(LogError, "Failed to connect to OpenFlow management socket '%s': %s\n", socketPath, strerror(errno));
+		*err = errno;
+		close(fd);
+		return NULL;
+	}
+
+	ofConn* conn = emalloc(sizeof(ofConn));
+	conn->fd = fd;
+	conn->nextXid = 1;
+	conn->sendErr = 0;
+	flexBufferInit((void**)&conn->outBuf, &conn->outLen, &conn->outCap);
+	flexBufferInit((void**)&conn->inBuf, NULL, &conn->inCap);
+
+	// We only offer OpenFlow 1.3, so the negotiated version is the lower of
+	// ours and the one in the switch's hello
+	size_t start = ofBeginMessage(conn, OFPT_HELLO, NULL);
+	ofEndMessage(conn, start);
+	*err = ofSendQueued(conn);
+	if (*err != 0) goto abort;
+
+	while (true) {
+		uint8_t type;
+		uint16_t len;
+		uint32_t xid;
+		*err = ofRecv(conn, &type, &len, &xid);
+		if (*err != 0) goto abort;
+		if (type == OFPT_ERROR) {
+			ofLogError(conn, len, xid);
+			lprintf(LogError, "Could not negotiate OpenFlow 1.3 with the switch at '%s'\n", socketPath);
+			*err = 1;
+			goto abort;
+		}
+		if (type == OFPT_HELLO) {
+			if (conn->inBuf[0] < OFP_VERSION_13) {
+				lprintf(LogError, "The switch at '%s' does not support OpenFlow 1.3 (offered version 0x%02x)\n", socketPath, conn->inBuf[0]);
+				*err = 1;
+				goto abort;
+			}
+			break;
+		}
+	}
+
+	lprintf(LogDebug, "Connected to OpenFlow management socket '%s' with connection %p\n", socketPath, conn);
+	return conn;
+abort:
+	ofClose(conn);
+	return NULL;
+}
+
+void ofClose(ofConn* conn) {
+	close(conn->fd);
+	flexBufferFree((void**)&conn->outBuf, &conn->outLen, &conn->outCap);
+	flexBufferFree((void**)&conn->inBuf, NULL, &conn->inCap);
+	free(conn);
+}
+
+void ofDeleteAllFlows(ofConn* conn) {
+	size_t start = ofBeginFlowMod(conn, OFPFC_DELETE, OFPTT_ALL, 0);
+	size_t match = ofBeginMatch(conn);
+	ofEndMatch(conn, match);
+	ofEndMessage(conn, start);
+}
+
+void ofAddArpResponse(ofConn* conn, ip4Addr ip, const macAddr* mac, uint16_t priority) {
+	size_t start = ofBeginFlowMod(conn, OFPFC_ADD, 0, priority);
+
+	size_t match = ofBeginMatch(conn);
+	ofPutOxm16(conn, OFPXMT_ETH_TYPE, ETH_TYPE_ARP);
+	ofPutOxm(conn, OFPXMT_ARP_TPA, &ip, NULL, sizeof(ip));
+	ofEndMatch(conn, match);
+
+	// We rewrite the request in place to transform it into a reply
+	size_t actions = ofBeginApplyActions(conn);
+	ofPutMove(conn, NXM_OF_ETH_SRC, NXM_OF_ETH_DST, 48);
+	ofPutSetField(conn, OFPXMT_ETH_SRC, mac->octets, MAC_ADDR_BYTES);
+	uint16_t arpOp = htobe16(ARP_OP_REPLY);
+	ofPutSetField(conn, OFPXMT_ARP_OP, &arpOp, sizeof(arpOp));
+	ofPutMove(conn, NXM_NX_ARP_SHA, NXM_NX_ARP_THA, 48);
+	ofPutMove(conn, NXM_OF_ARP_SPA, NXM_OF_ARP_TPA, 32);
+	ofPutSetField(conn, OFPXMT_ARP_SHA, mac->octets, MAC_ADDR_BYTES);
+	ofPutSetField(conn, OFPXMT_ARP_SPA, &ip, sizeof(ip));
+	ofPutOutput(conn, OFPP_IN_PORT);
+	ofEndApplyActions(conn, actions);
+
+	ofEndMessage(conn, start);
+}
+
+static void ofPutIpMatch(ofConn* conn, uint32_t inPort, const ip4Subnet* srcNet, const ip4Subnet* dstNet) {
+	size_t match = ofBeginMatch(conn);
+	if (inPort > 0) {
+		uint32_t port = htobe32(inPort);
+		ofPutOxm(conn, OFPXMT_IN_PORT, &port, NULL, sizeof(port));
+	}
+	ofPutOxm16(conn, OFPXMT_ETH_TYPE, ETH_TYPE_IP);
+	if (srcNet != NULL) ofPutOxmSubnet(conn, OFPXMT_IPV4_SRC, srcNet);
+	if (dstNet != NULL) ofPutOxmSubnet(conn, OFPXMT_IPV4_DST, dstNet);
+	ofEndMatch(conn, match);
+}
+
+void ofAddIpFlow(ofConn* conn, uint8_t tableId, uint32_t inPort, const ip4Subnet* srcNet, const ip4Subnet* dstNet, const macAddr* newSrcMac, const macAddr* newDstMac, uint32_t outPort, uint16_t priority) {
+	size_t start = ofBeginFlowMod(conn, OFPFC_ADD, tableId, priority);
+	ofPutIpMatch(conn, inPort, srcNet, dstNet);
+
+	size_t actions = ofBeginApplyActions(conn);
+	if (newSrcMac != NULL) ofPutSetField(conn, OFPXMT_ETH_SRC, newSrcMac->octets, MAC_ADDR_BYTES);
+	if (newDstMac != NULL) ofPutSetField(conn, OFPXMT_ETH_DST, newDstMac->octets, MAC_ADDR_BYTES);
+	ofPutOutput(conn, outPort);
+	ofEndApplyActions(conn, actions);
+
+	ofEndMessage(conn, start);
+}
+
+void ofAddIpGotoTable(ofConn* conn, uint8_t tableId, uint32_t inPort, const ip4Subnet* srcNet, const ip4Subnet* dstNet, uint8_t gotoTableId, uint16_t priority) {
+	size_t start = ofBeginFlowMod(conn, OFPFC_ADD, tableId, priority);
+	ofPutIpMatch(conn, inPort, srcNet, dstNet);
+
+	ofPut16(conn, OFPIT_GOTO_TABLE);
+	ofPut16(conn, 8);
+	ofPut8(conn, gotoTableId);
+	ofPutZeros(conn, 3);
+
+	ofEndMessage(conn, start);
+}
+
+int ofBarrier(ofConn* conn) {
+	uint32_t barrierXid;
+	size_t start = ofBeginMessage(conn, OFPT_BARRIER_REQUEST, &barrierXid);
+	ofEndMessage(conn, start);
+	ofSendQueued(conn);
+
+	int err = conn->sendErr;
+	conn->sendErr = 0;
+	if (err != 0) return err;
+
+	// The switch processes messages in order, so every error for the queued
+	// messages arrives before the barrier reply
+	while (true) {
+		uint8_t type;
+		uint16_t len;
+		uint32_t xid;
+		int recvErr = ofRecv(conn, &type, &len, &xid);
+		if (recvErr != 0) return recvErr;
+
+		if (type == OFPT_ERROR) {
+			ofLogError(conn, len, xid);
+			err = 1;
+		} else if (type == OFPT_BARRIER_REPLY && xid == barrierXid) {
+			break;
+		}
+	}
+	return err;
+}
@@ -0,0 +1,60 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module implements a minimal OpenFlow 1.3 client for installing flows in
+// an Open vSwitch bridge through its management socket. Flow modifications are
+// encoded directly and sent back-to-back without waiting for responses. Errors
+// are collected when the caller synchronizes with ofBarrier. This module is not
+// thread-safe, but it does not depend on the active network namespace.
+
+#include <stdint.h>
+
+#include "ip.h"
+
+typedef struct ofConn ofConn;
+
+// Connects to the OpenFlow management socket of a bridge and negotiates
+// OpenFlow 1.3. Returns a new connection on success. If an error occurs,
+// returns NULL and sets err to the error code (if err is not NULL).
+ofConn* ofConnect(const char* socketPath, int* err);
+
+// Closes a connection and frees its resources. Any queued messages that have
+// not been synchronized with ofBarrier are discarded.
+void ofClose(ofConn* conn);
+
+// Queues a request to delete all flows in all tables.
+void ofDeleteAllFlows(ofConn* conn);
+
+// Queues a flow that transforms ARP requests for ip into replies from mac and
+// sends them back out of the port on which they arrived.
+void ofAddArpResponse(ofConn* conn, ip4Addr ip, const macAddr* mac, uint16_t priority);
+
+// Queues an IPv4 flow. The parameters have the same meaning as for ovsAddIpFlow.
+void ofAddIpFlow(ofConn* conn, uint8_t tableId, uint32_t inPort, const ip4Subnet* srcNet, const ip4Subnet* dstNet, const macAddr* newSrcMac, const macAddr* newDstMac, uint32_t outPort, uint16_t priority);
+
+// Queues an IPv4 flow that continues processing matching packets in another
+// table. The parameters have the same meaning as for ovsAddIpGotoTable.
+void ofAddIpGotoTable(ofConn* conn, uint8_t tableId, uint32_t inPort, const ip4Subnet* srcNet, const ip4Subnet* dstNet, uint8_t gotoTableId, uint16_t priority);
+
+// Sends all queued messages followed by a barrier, and waits for the switch to
+// finish processing them. Returns 0 if every queued message succeeded, or an
+// error code otherwise.
+int ofBarrier(ofConn* conn);
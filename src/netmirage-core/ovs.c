@@ -22,6 +22,7 @@
 #include "ovs.h"
 
 #include <errno.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -38,33 +39,48 @@
 #include "log.h"
 #include "mem.h"
 #include "net.h"
+#include "openflow.h"
+#include "ovsdb.h"
 
 struct ovsContext {
+	SwitchBackend backend;
 	netContext* net;
 	const char* directory;
-	char* dbSocketConnArg;
-	char* actionBuffer; // Flexible buffer
+	char* dbSocket;
+	ovsdbConn* db; // Connected lazily; use ovsGetDb
+	ofConn* of;    // Connected lazily; use ovsGetOf
+	char* ofBridge;
 	const char* compatArgs;
-	size_t actionBufferCap;
+	uint8_t tcMaxChain; // Highest chain that may contain Traffic Control filters
 };
 
-static int switchContext(ovsContext* ctx) {
-	return netSwitchNamespace(ctx->net);
-}
-
 #define OVS_DEFAULT_SCHEMA_PATH "/usr/share/openvswitch/vswitch.ovsschema"
 #define OVS_CMD_MAX_ARGS 20
 #define OVSDB_CTL_FILE "ovsdb-server.ctl"
+#define OVS_VERSION_CACHE_FILE "version.cache"
 #define OVS_CTL_FILE "ovs-vswitchd.ctl"
 #define LKM_LIST_FILE "/proc/modules"
 #define LKM_OVS_NAME "openvswitch"
 
+// Traffic Control switches use a single shared filter block per namespace. The
+// index is arbitrary, but chosen to avoid blocks that the user may have created
+// manually.
+#define TC_SWITCH_BLOCK 0x4e4d
+
+// The lowest-priority filter in a Traffic Control switch drops all IPv4 traffic
+// that was not matched by a flow. It has a fixed handle so that it is only
+// installed once, regardless of how many times ports are added.
+#define TC_DROP_PRIORITY 0xFFFF
+#define TC_DROP_HANDLE 1
+
 // Forks and executes an OVS command with the given arguments. The first
-// argument is automatically set to be the command. Must call switchContext
-// before this function. If output is non-NULL, output, outputLen, and
-// outputCap are a flexBuffer that will contain the merger of stdout and stderr
-// for the subprocess. If dir is not NULL, the process runs in the given working
-// directory. Returns 0 on success or an error code otherwise.
+// argument is automatically set to be the command. The OVS tools communicate
+// with the daemons through UNIX sockets in the state directory, so the active
+// namespace only matters when starting ovs-vswitchd. If output is non-NULL,
+// output, outputLen, and outputCap are a flexBuffer that will contain the
+// merger of stdout and stderr for the subprocess. If dir is not NULL, the
+// process runs in the given working directory. Returns 0 on success or an
+// error code otherwise.
 static int ovsCommandVArg(char** output, size_t* outputLen, size_t* outputCap, const char* dir, va_list args) {
 	char* argv[OVS_CMD_MAX_ARGS+2];
 	char* command = va_arg(args, char*); // Safe cast (see POSIX standard)
@@ -179,61 +195,187 @@ static const char* ovsToolVersion(char** output, size_t* outputLen, size_t* outp
 	return p+1;
 }
 
-char* ovsVersion(bool* validVersion, unsigned int* major, unsigned int* minor) {
-	*validVersion = false;
+// The tools that must be installed. All of them must report the same version.
+static const char* const OvsTools[] = {
+	"ovsdb-tool",
+	"ovsdb-server",
+	"ovs-vsctl",
+	"ovs-vswitchd",
+	"ovs-appctl",
+	NULL,
+};
+
+// The version in use by this process, once it is known
+static bool versionKnown = false;
+static bool versionValid;
+static unsigned int versionMajor;
+static unsigned int versionMinor;
+
+void ovsUseVersion(bool validVersion, unsigned int major, unsigned int minor) {
+	versionKnown = true;
+	versionValid = validVersion;
+	versionMajor = major;
+	versionMinor = minor;
+}
+
+// Builds a string that identifies the installed tools by the inode and
+// modification time of each executable found in the PATH. If any of the tools
+// are replaced, the fingerprint changes. Returns NULL if a tool is missing. The
+// caller is responsible for freeing the string.
+static char* ovsToolFingerprint(void) {
+	const char* pathEnv = getenv("PATH");
+	if (pathEnv == NULL) return NULL;
+
+	char* fingerprint;
+	size_t len, cap;
+	flexBufferInit((void**)&fingerprint, &len, &cap);
+
+	for (const char* const* tool = OvsTools; *tool != NULL; ++tool) {
+		bool found = false;
+		const char* dir = pathEnv;
+		while (!found) {
+			// Empty PATH entries refer to the working directory
+			const char* dirEnd = strchrnul(dir, ':');
+			int dirLen = (int)(dirEnd - dir);
+			char* candidate;
+			if (dirLen > 0) newSprintf(&candidate, "%.*s/%s", dirLen, dir, *tool);
+			else newSprintf(&candidate, "./%s", *tool);
+
+			struct stat st;
+			if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+				flexBufferPrintf((void**)&fingerprint, &len, &cap, "%s %lu %lu %ld.%09ld\n", candidate, (unsigned long)st.st_dev, (unsigned long)st.st_ino, (long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec);
+				--len; // The next entry overwrites the terminator
+				found = true;
+			}
+			free(candidate);
+
+			if (*dirEnd == '\0') break;
+			dir = dirEnd+1;
+		}
+		if (!found) {
+			flexBufferFree((void**)&fingerprint, &len, &cap);
+			return NULL;
+		}
+	}
+	return fingerprint;
+}
+
+// Returns the version recorded in the cache file if it was saved for the same
+// tool fingerprint, or NULL if the cache is missing or stale. The caller is
+// responsible for freeing the string.
+static char* ovsReadVersionCache(const char* cacheFile, const char* fingerprint) {
+	FILE* file = fopen(cacheFile, "re");
+	if (file == NULL) return NULL;
+	char buf[4 * 1024];
+	size_t readLen = fread(buf, 1, sizeof(buf)-1, file);
+	fclose(file);
+	buf[readLen] = '\0';
+
+	size_t fingerprintLen = strlen(fingerprint);
+	if (strncmp(buf, fingerprint, fingerprintLen) != 0) return NULL;
+	const char* line = &buf[fingerprintLen];
+	if (strncmp(line, "version ", 8) != 0) return NULL;
+	line += 8;
+	const char* lineEnd = strchr(line, '\n');
+	if (lineEnd == NULL || lineEnd == line) return NULL;
+	return strndup(line, (size_t)(lineEnd - line));
+}
+
+// Saves the version for the tool fingerprint. The file is replaced atomically
+// so that concurrent runs never see a partial cache. Failures are not errors;
+// the version will simply be probed again next time.
+static void ovsWriteVersionCache(const char* cacheDir, const char* cacheFile, const char* fingerprint, const char* version) {
+	errno = 0;
+	if (mkdir(cacheDir, 0700) != 0 && errno != EEXIST) {
+		lprintf(LogDebug, "Could not create directory '%s' for the Open vSwitch version cache: %s\n", cacheDir, strerror(errno));
+		return;
+	}
+
+	char* tmpFile;
+	newSprintf(&tmpFile, "%s.%ld", cacheFile, (long)getpid());
+	bool saved = false;
+	FILE* file = fopen(tmpFile, "we");
+	if (file != NULL) {
+		saved = (fprintf(file, "%sversion %s\n", fingerprint, version) > 0);
+		if (fclose(file) != 0) saved = false;
+		if (saved) saved = (rename(tmpFile, cacheFile) == 0);
+		if (!saved) unlink(tmpFile);
+	}
+	if (!saved) {
+		lprintf(LogDebug, "Could not save the Open vSwitch version cache to '%s'\n", cacheFile);
+	}
+	free(tmpFile);
+}
 
+// Runs each of the tools to determine the installed version. Returns NULL if a
+// tool is missing or if the tools report different versions.
+static char* ovsProbeVersion(void) {
 	char* output;
 	size_t outputLen, outputCap;
 	flexBufferInit((void**)&output, &outputLen, &outputCap);
 
-	const char* neededCommands[] = {
-		"ovsdb-tool",
-		"ovsdb-server",
-		"ovs-vsctl",
-		"ovs-vswitchd",
-		"ovs-appctl",
-		"ovs-ofctl",
-		NULL,
-	};
-
 	char* version = NULL;
-	for (const char** cmd = neededCommands; *cmd != NULL; ++cmd) {
+	for (const char* const* cmd = OvsTools; *cmd != NULL; ++cmd) {
 		const char* cmdVer = ovsToolVersion(&output, &outputLen, &outputCap, *cmd);
-		if (cmdVer == NULL) return NULL;
-		if (version == NULL) {
-			version = strdup(cmdVer);
-		} else if (strcmp(cmdVer, version) != 0) {
-			return NULL;
+		if (cmdVer == NULL || (version != NULL && strcmp(cmdVer, version) != 0)) {
+			free(version);
+			version = NULL;
+			break;
 		}
+		if (version == NULL) version = strdup(cmdVer);
 	}
 
 	flexBufferFree((void**)&output, &outputLen, &outputCap);
+	return version;
+}
+
+char* ovsVersion(const char* cacheDir, bool* validVersion, unsigned int* major, unsigned int* minor) {
+	*validVersion = false;
+	*major = 0;
+	*minor = 0;
+
+	char* version = NULL;
+	char* fingerprint = NULL;
+	char* cacheFile = NULL;
+	if (cacheDir != NULL) {
+		fingerprint = ovsToolFingerprint();
+		if (fingerprint != NULL) {
+			newSprintf(&cacheFile, "%s/%s", cacheDir, OVS_VERSION_CACHE_FILE);
+			version = ovsReadVersionCache(cacheFile, fingerprint);
+			if (version != NULL) lprintf(LogDebug, "Using cached Open vSwitch version from '%s'\n", cacheFile);
+		}
+	}
+	if (version == NULL) {
+		version = ovsProbeVersion();
+		if (version != NULL && cacheFile != NULL) ovsWriteVersionCache(cacheDir, cacheFile, fingerprint, version);
+	}
+	free(cacheFile);
+	free(fingerprint);
+	if (version == NULL) return NULL;
 
 	*validVersion = (sscanf(version, "%u.%u.", major, minor) == 2);
+	ovsUseVersion(*validVersion, *major, *minor);
 
 	return version;
 }
 
 // Determines the compatability arguments required for the current version
 static const char* ovsCompatArgs(void) {
-	const char* compatArgs = "";
-
-	bool validVer;
-	unsigned int majorVer, minorVer;
-	char* ver = ovsVersion(&validVer, &majorVer, &minorVer);
-	if (ver != NULL) {
-		if (validVer && (majorVer > 2 || (majorVer == 2 && minorVer > 4))) {
-			lprintf(LogDebug, "Using an OVS version ('%s') with the \"logging bug\". Using workaround.\n", ver);
-			// If this is not provided to most commands, the 2.5.0 branch
-			// crashes with an assertion failure.
-			// Confirmed still an issue in 2.10.1.
-			// TODO: This is probably an OVS bug. Report it!
-			compatArgs = "--log-file=/dev/null";
-		}
-		free(ver);
+	if (!versionKnown) {
+		bool validVer;
+		unsigned int majorVer, minorVer;
+		free(ovsVersion(NULL, &validVer, &majorVer, &minorVer));
 	}
 
-	return compatArgs;
+	if (versionKnown && versionValid && (versionMajor > 2 || (versionMajor == 2 && versionMinor > 4))) {
+		lprintf(LogDebug, "Using an OVS version (%u.%u) with the \"logging bug\". Using workaround.\n", versionMajor, versionMinor);
+		// If this is not provided to most commands, the 2.5.0 branch crashes
+		// with an assertion failure.
+		// Confirmed still an issue in 2.10.1.
+		// TODO: This is probably an OVS bug. Report it!
+		return "--log-file=/dev/null";
+	}
+	return "";
 }
 
 static int ovsModuleLoad(void) {
@@ -285,7 +427,18 @@ static int ovsModuleLoad(void) {
 	return 0;
 }
 
-ovsContext* ovsStart(netContext* net, const char* directory, const char* ovsSchema, bool existing, int* err) {
+ovsContext* ovsStart(netContext* net, SwitchBackend backend, const char* directory, const char* ovsSchema, bool existing, int* err) {
+	if (backend == SwitchTc) {
+		// Traffic Control switches live entirely in the kernel, so there is
+		// nothing to start
+		ovsContext* ctx = ecalloc(1, sizeof(ovsContext));
+		ctx->backend = backend;
+		ctx->net = net;
+		ctx->directory = directory;
+		lprintf(LogDebug, "Created Traffic Control switch context %p in namespace %p\n", ctx, net);
+		return ctx;
+	}
+
 	lprintf(LogDebug, "%s Open vSwitch instance in namespace %p with state directory %s\n", (existing ? "Connecting to" : "Starting an"), net, directory);
 
 	int localErr;
@@ -352,34 +505,40 @@ ovsContext* ovsStart(netContext* net, const char* directory, const char* ovsSche
 	}
 
 	ctx = emalloc(sizeof(ovsContext));
+	ctx->backend = backend;
 	ctx->net = net;
 	ctx->directory = directory;
-	ctx->dbSocketConnArg = ovsdbSocketConnArg;
+	ctx->dbSocket = ovsdbSocket;
+	ctx->db = NULL;
+	ctx->of = NULL;
+	ctx->ofBridge = NULL;
 	ctx->compatArgs = compatArgs;
-	flexBufferInit((void**)&ctx->actionBuffer, NULL, &ctx->actionBufferCap);
+	ctx->tcMaxChain = 0;
 	lprintf(LogDebug, "Created Open vSwitch context %p\n", ctx);
 	goto cleanup;
 abort:
 	// We don't free this unless there was an error (it is used in ctx)
-	free(ovsdbSocketConnArg);
+	free(ovsdbSocket);
 cleanup:
 	free(dbFile);
-	free(ovsdbLogArg); free(ovsdbPidArg); free(ovsdbSocket); free(ovsdbSocketArg); free(ovsdbControlArg);
+	free(ovsdbLogArg); free(ovsdbPidArg); free(ovsdbSocketArg); free(ovsdbSocketConnArg); free(ovsdbControlArg);
 	free(ovsLogArg); free(ovsPidArg); free(ovsControlArg);
 	return ctx;
 }
 
 int ovsFree(ovsContext* ctx) {
-	int err = switchContext(ctx);
-	if (err != 0) return err;
-
-	flexBufferFree((void**)&ctx->actionBuffer, NULL, &ctx->actionBufferCap);
-	free(ctx->dbSocketConnArg);
+	int err = ovsFlushFlows(ctx);
+	if (ctx->of != NULL) ofClose(ctx->of);
+	free(ctx->ofBridge);
+	if (ctx->db != NULL) ovsdbClose(ctx->db);
+	free(ctx->dbSocket);
 	free(ctx);
-	return 0;
+	return err;
 }
 
-int ovsDestroy(const char* directory) {
+int ovsDestroy(SwitchBackend backend, const char* directory) {
+	if (backend == SwitchTc) return 0;
+
 	// PATH_MAX is quite large for the stack, so we use the heap
 	char* ovsdbControl;
 	char* ovsControl;
@@ -409,94 +568,259 @@ int ovsDestroy(const char* directory) {
 	return err;
 }
 
+bool ovsIsRunning(SwitchBackend backend, const char* directory) {
+	if (backend == SwitchTc) return false;
+
+	char* ovsdbControl;
+	char* ovsControl;
+	newSprintf(&ovsdbControl, "%s/" OVSDB_CTL_FILE, directory);
+	newSprintf(&ovsControl, "%s/" OVS_CTL_FILE, directory);
+	bool running = (access(ovsdbControl, F_OK) != -1 && access(ovsControl, F_OK) != -1);
+	free(ovsdbControl);
+	free(ovsControl);
+	return running;
+}
+
+// Returns the OVSDB connection for a context, connecting if needed. We connect
+// lazily because contexts for existing instances are sometimes created only to
+// shut them down.
+static ovsdbConn* ovsGetDb(ovsContext* ctx, int* err) {
+	if (ctx->db == NULL) {
+		ctx->db = ovsdbConnect(ctx->dbSocket, err);
+	}
+	return ctx->db;
+}
+
 int ovsAddBridge(ovsContext* ctx, const char* name) {
-	int err = switchContext(ctx);
-	if (err != 0) return err;
+	// Traffic Control switches have no bridge device. Interfaces are connected
+	// directly to the filter block when they are added as ports.
+	if (ctx->backend == SwitchTc) return 0;
 
 	lprintf(LogDebug, "Creating Open vSwitch bridge '%s' in context %p\n", name, ctx);
-	err = ovsCommand(ctx->directory, "ovs-vsctl", ctx->compatArgs, ctx->dbSocketConnArg, "add-br", name, NULL);
-	return err;
+
+	int err;
+	ovsdbConn* db = ovsGetDb(ctx, &err);
+	if (db == NULL) return err;
+	err = ovsdbAddBridge(db, name);
+	if (err != 0) return err;
+
+	return netSetInterfaceUp(ctx->net, name, true);
 }
 
 int ovsDelBridge(ovsContext* ctx, const char* name) {
-	int err = switchContext(ctx);
-	if (err != 0) return err;
+	if (ctx->backend == SwitchTc) {
+		lprintf(LogDebug, "Detaching all interfaces from Traffic Control switch in context %p\n", ctx);
+		return netDetachIngressBlockAll(ctx->net, TC_SWITCH_BLOCK);
+	}
+
+	int err = 0;
 
 	char* brMgmt;
 	newSprintf(&brMgmt, "%s/%s.mgmt", ctx->directory, name);
 	if (access(brMgmt, F_OK) != -1) {
 		lprintf(LogDebug, "Deleting Open vSwitch bridge '%s' in context %p\n", name, ctx);
-		err = ovsCommand(ctx->directory, "ovs-vsctl", ctx->compatArgs, ctx->dbSocketConnArg, "del-br", name, NULL);
+		ovsdbConn* db = ovsGetDb(ctx, &err);
+		if (db != NULL) err = ovsdbDelBridge(db, name);
 	}
 	free(brMgmt);
 	return err;
 }
 
+int ovsResetBridge(ovsContext* ctx, const char* bridge) {
+	lprintf(LogDebug, "Resetting Open vSwitch bridge '%s' in context %p\n", bridge, ctx);
+
+	int err;
+	if (ctx->backend == SwitchTc) {
+		err = netDetachIngressBlockAll(ctx->net, TC_SWITCH_BLOCK);
+		if (err != 0) return err;
+	} else {
+		ovsdbConn* db = ovsGetDb(ctx, &err);
+		if (db == NULL) return err;
+		err = ovsdbClearPorts(db, bridge);
+		if (err != 0) return err;
+	}
+	return ovsClearFlows(ctx, bridge);
+}
+
 int ovsSetBridgeMtu(ovsContext* ctx, const char* bridge, int mtu) {
 	if (mtu <= 0) {
 		lprintf(LogError, "Requested MTU for OVS bridge is non-positive (%d)\n", mtu);
 		return 1;
 	}
 
-	int err = switchContext(ctx);
-	if (err != 0) return err;
+	// There is no bridge device to configure in a Traffic Control switch
+	if (ctx->backend == SwitchTc) return 0;
 
 	lprintf(LogDebug, "Setting MTU to %d for Open vSwitch bridge '%s' in context %p\n", mtu, bridge, ctx);
 
-	char mtuStr[12 + (CHAR_BIT * sizeof(int) / 3) + 3];
-	sprintf(mtuStr, "mtu_request=%d", mtu);
+	// The bridge's internal interface shares its name
+	int err;
+	ovsdbConn* db = ovsGetDb(ctx, &err);
+	if (db == NULL) return err;
+	return ovsdbSetInterfaceMtu(db, bridge, mtu);
+}
 
-	err = ovsCommand(ctx->directory, "ovs-vsctl", ctx->compatArgs, ctx->dbSocketConnArg, "set", "int", bridge, mtuStr, NULL);
-	return err;
+int ovsTuneDatapath(ovsContext* ctx, uint32_t clientCount) {
+	if (ctx->backend == SwitchTc) return 0;
+
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cores < 1) cores = 1;
+
+	// Revalidators expire and update the cached megaflows, so their workload
+	// grows with the number of communicating client pairs. Handlers set up new
+	// megaflows on cache misses, which are frequent when there are many
+	// short-lived flows, so they receive the remaining processors.
+	long revalidators = 1 + (long)(clientCount / 2000);
+	long maxRevalidators = (cores / 2 > 1 ? cores / 2 : 1);
+	if (revalidators > maxRevalidators) revalidators = maxRevalidators;
+	long handlers = (cores - revalidators > 1 ? cores - revalidators : 1);
+
+	// The default limit of 200,000 datapath flows is reached quickly when many
+	// clients talk to each other. Idle flows are kept for longer so that
+	// recurring client pairs do not need to be set up again.
+	uint64_t flowLimit = (uint64_t)clientCount * 100;
+	if (flowLimit < 200000) flowLimit = 200000;
+	if (flowLimit > 2000000) flowLimit = 2000000;
+	long maxIdleMs = (clientCount >= 1000 ? 30000 : 10000);
+
+	// The exact match cache (only used by userspace datapaths) thrashes with
+	// many short-lived flows, so fewer of them are inserted in large networks
+	long emcInvProb = (clientCount >= 1000 ? 1000 : 100);
+
+	char handlersStr[24], revalidatorsStr[24], maxIdleStr[24], flowLimitStr[24], emcStr[24];
+	snprintf(handlersStr, sizeof(handlersStr), "%ld", handlers);
+	snprintf(revalidatorsStr, sizeof(revalidatorsStr), "%ld", revalidators);
+	snprintf(maxIdleStr, sizeof(maxIdleStr), "%ld", maxIdleMs);
+	snprintf(flowLimitStr, sizeof(flowLimitStr), "%" PRIu64, flowLimit);
+	snprintf(emcStr, sizeof(emcStr), "%ld", emcInvProb);
+
+	const char* keys[] = { "n-handler-threads", "n-revalidator-threads", "max-idle", "flow-limit", "emc-insert-inv-prob" };
+	const char* values[] = { handlersStr, revalidatorsStr, maxIdleStr, flowLimitStr, emcStr };
+	size_t count = sizeof(keys) / sizeof(keys[0]);
+
+	for (size_t i = 0; i < count; ++i) {
+		lprintf(LogDebug, "Setting Open vSwitch option %s=%s for %u clients on %ld processors in context %p\n", keys[i], values[i], clientCount, cores, ctx);
+	}
+
+	int err;
+	ovsdbConn* db = ovsGetDb(ctx, &err);
+	if (db == NULL) return err;
+	return ovsdbSetOtherConfig(db, keys, values, count);
 }
 
-int ovsAddPort(ovsContext* ctx, const char* bridge, const char* intfName) {
-	int err = switchContext(ctx);
-	if (err != 0) return err;
+int ovsAddPort(ovsContext* ctx, const char* bridge, const char* intfName, uint32_t requestedPort) {
+	return ovsAddPorts(ctx, bridge, &intfName, &requestedPort, 1);
+}
 
-	lprintf(LogDebug, "Adding interface '%s' to Open vSwitch bridge '%s' in context %p\n", intfName, bridge, ctx);
-	err = ovsCommand(ctx->directory, "ovs-vsctl", ctx->compatArgs, ctx->dbSocketConnArg, "add-port", bridge, intfName, NULL);
-	if (err != 0) return err;
+// Maps an OpenFlow priority, where larger values take precedence, onto a
+// Traffic Control filter priority, where smaller values take precedence. The
+// result is always less than TC_DROP_PRIORITY and greater than 0.
+static uint16_t ovsTcPriority(uint32_t priority) {
+	if (priority > TC_DROP_PRIORITY - 2) priority = TC_DROP_PRIORITY - 2;
+	return (uint16_t)(TC_DROP_PRIORITY - 1 - priority);
+}
 
-	return 0;
+// Installs the filter that drops unmatched traffic in a chain of a Traffic
+// Control switch. Each table is represented by the chain with the same index.
+// Only IPv4 traffic is dropped; ARP is handled by the kernel.
+static int ovsTcAddDropFilter(ovsContext* ctx, uint8_t table) {
+	if (table > ctx->tcMaxChain) ctx->tcMaxChain = table;
+	int err = netAddBlockFilter(ctx->net, TC_SWITCH_BLOCK, table, TC_DROP_PRIORITY, TC_DROP_HANDLE, 0, NULL, NULL, NULL, NULL, 0, true);
+	if (err == EEXIST) err = 0;
+	return err;
 }
 
-int ovsClearFlows(ovsContext* ctx, const char* bridge) {
-	int err = switchContext(ctx);
-	if (err != 0) return err;
+int ovsAddPorts(ovsContext* ctx, const char* bridge, const char* const intfNames[], const uint32_t requestedPorts[], size_t count) {
+	if (PASSES_LOG_THRESHOLD(LogDebug)) {
+		for (size_t i = 0; i < count; ++i) {
+			lprintf(LogDebug, "Adding interface '%s' to %s bridge '%s' in context %p\n", intfNames[i], (ctx->backend == SwitchTc ? "Traffic Control" : "Open vSwitch"), bridge, ctx);
+		}
+	}
 
-	lprintf(LogDebug, "Removing all OpenFlow rules from bridge '%s' in context %p except for ARP switching\n", bridge, ctx);
+	int err;
+	if (ctx->backend == SwitchTc) {
+		if (count == 0) return 0;
+		for (size_t i = 0; i < count; ++i) {
+			int intfIdx = netGetInterfaceIndex(ctx->net, intfNames[i], &err);
+			if (intfIdx == -1) return err;
+			err = netAttachIngressBlock(ctx->net, intfIdx, TC_SWITCH_BLOCK, i == count-1);
+			if (err != 0) return err;
+		}
+		// The block only exists once an interface is attached to it
+		return ovsTcAddDropFilter(ctx, 0);
+	}
 
-	err = ovsCommand(ctx->directory, "ovs-ofctl", ctx->compatArgs, "del-flows", bridge, NULL);
-	if (err != 0) return err;
+	ovsdbConn* db = ovsGetDb(ctx, &err);
+	if (db == NULL) return err;
+	return ovsdbAddPorts(db, bridge, intfNames, requestedPorts, count);
+}
 
-	return 0;
+// Returns the OpenFlow connection to a bridge, connecting if needed. Each
+// context keeps a single connection, so switching to a different bridge
+// flushes and closes the previous one.
+static ofConn* ovsGetOf(ovsContext* ctx, const char* bridge, int* err) {
+	if (ctx->of != NULL && strcmp(ctx->ofBridge, bridge) != 0) {
+		*err = ovsFlushFlows(ctx);
+		ofClose(ctx->of);
+		free(ctx->ofBridge);
+		ctx->of = NULL;
+		ctx->ofBridge = NULL;
+		if (*err != 0) return NULL;
+	}
+	if (ctx->of == NULL) {
+		char* mgmtSocket;
+		newSprintf(&mgmtSocket, "%s/%s.mgmt", ctx->directory, bridge);
+		ctx->of = ofConnect(mgmtSocket, err);
+		free(mgmtSocket);
+		if (ctx->of == NULL) return NULL;
+		ctx->ofBridge = strdup(bridge);
+	}
+	return ctx->of;
 }
 
-int ovsAddArpResponse(ovsContext* ctx, const char* bridge, ip4Addr ip, const macAddr* mac, uint32_t priority) {
-	int err = switchContext(ctx);
-	if (err != 0) return err;
+int ovsClearFlows(ovsContext* ctx, const char* bridge) {
+	lprintf(LogDebug, "Removing all OpenFlow rules from bridge '%s' in context %p except for ARP switching\n", bridge, ctx);
 
-	char ipStr[IP4_ADDR_BUFLEN];
-	ip4AddrToString(ip, ipStr);
+	int err;
+	if (ctx->backend == SwitchTc) {
+		// If no interfaces have been attached yet, then the block does not
+		// exist and there is nothing to clear
+		err = netFlushIngressBlock(ctx->net, TC_SWITCH_BLOCK, 0, true);
+		if (err == EINVAL || err == ENOENT) {
+			ctx->tcMaxChain = 0;
+			return 0;
+		}
+		if (err != 0) return err;
 
-	char macStr[MAC_ADDR_BUFLEN];
-	macAddrToString(mac, macStr);
+		// Only chains up to the highest one that we installed filters in can
+		// exist. A chain may still be missing if adding its filters failed.
+		for (uint32_t chain = 1; chain <= ctx->tcMaxChain; ++chain) {
+			err = netFlushIngressBlock(ctx->net, TC_SWITCH_BLOCK, chain, true);
+			if (err != 0 && err != ENOENT) return err;
+		}
+		ctx->tcMaxChain = 0;
 
-	// OVS requires the IP address in big endian hex string format
-	char ipOctetStr[4*2+1];
-	for (int i = 0; i < 4; ++i) {
-		sprintf(&ipOctetStr[i*2], "%02x", (uint8_t)(((uint32_t)ip) >> (8 * i)) & 0xFFU);
+		return ovsTcAddDropFilter(ctx, 0);
 	}
-	ipOctetStr[4*2] = '\0';
 
-	char macOctetStr[MAC_ADDR_BYTES*2+1];
-	for (int i = 0; i < MAC_ADDR_BYTES; ++i) {
-		sprintf(&macOctetStr[i*2], "%02x", mac->octets[i]);
+	ofConn* of = ovsGetOf(ctx, bridge, &err);
+	if (of == NULL) return err;
+	ofDeleteAllFlows(of);
+	return ofBarrier(of);
+}
+
+int ovsAddArpResponse(ovsContext* ctx, const char* bridge, ip4Addr ip, const macAddr* mac, uint32_t priority) {
+	if (PASSES_LOG_THRESHOLD(LogDebug)) {
+		char ipStr[IP4_ADDR_BUFLEN];
+		ip4AddrToString(ip, ipStr);
+		char macStr[MAC_ADDR_BUFLEN];
+		macAddrToString(mac, macStr);
+		lprintf(LogDebug, "Adding ARP response %s => %s to Open vSwitch bridge '%s' in context %p\n", ipStr, macStr, bridge, ctx);
 	}
-	macOctetStr[MAC_ADDR_BYTES*2] = '\0';
 
-	lprintf(LogDebug, "Adding ARP response %s => %s to Open vSwitch bridge '%s' in context %p\n", ipStr, macStr, bridge, ctx);
+	// Traffic Control switches only intercept IPv4 traffic. ARP queries reach
+	// the kernel, which already responds for the interface addresses.
+	if (ctx->backend == SwitchTc) return 0;
 
 	// We rewrite the source packet to transform it into an ARP response. There
 	// isn't any cleaner way to do this in Open vSwitch, but this approach is
@@ -504,84 +828,265 @@ int ovsAddArpResponse(ovsContext* ctx, const char* bridge, ip4Addr ip, const mac
 	// responses for internal ports (e.g., those switch ports connected to the
 	// namespaces), so a simple action=NORMAL for ARP traffic is insufficient.
 
-	size_t actionLen = 0;
+	int err;
+	ofConn* of = ovsGetOf(ctx, bridge, &err);
+	if (of == NULL) return err;
+	ofAddArpResponse(of, ip, mac, (uint16_t)priority);
+	return 0;
+}
+
+int ovsAddIpFlow(ovsContext* ctx, const char* bridge, uint8_t table, uint32_t inPort, const ip4Subnet* srcNet, const ip4Subnet* dstNet, const macAddr* newSrcMac, const macAddr* newDstMac, uint32_t outPort, uint32_t priority) {
+	if (PASSES_LOG_THRESHOLD(LogDebug)) {
+		char subnetStr[IP4_CIDR_BUFLEN];
+		char macStr[MAC_ADDR_BUFLEN];
+
+		lprintHead(LogDebug);
+		lprintDirectf(LogDebug, "Adding OpenFlow rule to bridge '%s' in context %p: table %u, priority %u, match (", bridge, ctx, table, priority);
+		if (inPort > 0) {
+			lprintDirectf(LogDebug, "in port = %u", inPort);
+		}
+		if (srcNet != NULL) {
+			ip4SubnetToString(srcNet, subnetStr);
+			lprintDirectf(LogDebug, ", source = %s", subnetStr);
+		}
+		if (dstNet != NULL) {
+			ip4SubnetToString(dstNet, subnetStr);
+			lprintDirectf(LogDebug, ", destination = %s", subnetStr);
+		}
+		lprintDirectf(LogDebug, "), perform (out port = %u", outPort);
+		if (newSrcMac != NULL) {
+			macAddrToString(newSrcMac, macStr);
+			lprintDirectf(LogDebug, "source MAC = %s", macStr);
+		}
+		if (newDstMac != NULL) {
+			macAddrToString(newDstMac, macStr);
+			lprintDirectf(LogDebug, "destination MAC = %s", macStr);
+		}
+		lprintDirectf(LogDebug, ") priority %u\n", priority);
+		lprintDirectFinish(LogDebug);
+	}
+
+	if (ctx->backend == SwitchTc) {
+		// Port numbers in Traffic Control switches are interface indices. The
+		// filters are installed immediately so that errors are reported; there
+		// is nothing left to do in ovsFlushFlows.
+		if (table > ctx->tcMaxChain) ctx->tcMaxChain = table;
+		return netAddBlockFilter(ctx->net, TC_SWITCH_BLOCK, table, ovsTcPriority(priority), 0, (int)inPort, srcNet, dstNet, newSrcMac, newDstMac, (int)outPort, true);
+	}
+
+	int err;
+	ofConn* of = ovsGetOf(ctx, bridge, &err);
+	if (of == NULL) return err;
+	ofAddIpFlow(of, table, inPort, srcNet, dstNet, newSrcMac, newDstMac, outPort, (uint16_t)priority);
+	return 0;
+}
+
+int ovsAddIpGotoTable(ovsContext* ctx, const char* bridge, uint8_t table, uint32_t inPort, const ip4Subnet* srcNet, const ip4Subnet* dstNet, uint8_t gotoTable, uint32_t priority) {
+	if (PASSES_LOG_THRESHOLD(LogDebug)) {
+		char subnetStr[IP4_CIDR_BUFLEN];
 
-	flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, "dl_type=0x0806, priority=%u,", priority);
-	--actionLen; // Remove NUL terminator to concatenate
+		lprintHead(LogDebug);
+		lprintDirectf(LogDebug, "Adding OpenFlow rule to bridge '%s' in context %p: table %u, priority %u, match (", bridge, ctx, table, priority);
+		if (inPort > 0) {
+			lprintDirectf(LogDebug, "in port = %u", inPort);
+		}
+		if (srcNet != NULL) {
+			ip4SubnetToString(srcNet, subnetStr);
+			lprintDirectf(LogDebug, ", source = %s", subnetStr);
+		}
+		if (dstNet != NULL) {
+			ip4SubnetToString(dstNet, subnetStr);
+			lprintDirectf(LogDebug, ", destination = %s", subnetStr);
+		}
+		lprintDirectf(LogDebug, "), perform (go to table %u)\n", gotoTable);
+		lprintDirectFinish(LogDebug);
+	}
 
-	flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, "nw_dst=%s,", ipStr);
-	--actionLen;
+	if (gotoTable <= table) {
+		lprintf(LogError, "BUG: OpenFlow rule in table %u cannot go to table %u\n", table, gotoTable);
+		return 1;
+	}
 
-	flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, "actions=move:NXM_OF_ETH_SRC[]->NXM_OF_ETH_DST[],");
-	--actionLen;
+	int err;
+	if (ctx->backend == SwitchTc) {
+		// Traffic that reaches a chain but matches none of its filters would
+		// otherwise be passed to the kernel
+		err = ovsTcAddDropFilter(ctx, gotoTable);
+		if (err != 0) return err;
+		return netAddBlockGotoFilter(ctx->net, TC_SWITCH_BLOCK, table, ovsTcPriority(priority), (int)inPort, srcNet, dstNet, gotoTable, true);
+	}
 
-	flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, "mod_dl_src:%s,", macStr);
-	--actionLen;
+	ofConn* of = ovsGetOf(ctx, bridge, &err);
+	if (of == NULL) return err;
+	ofAddIpGotoTable(of, table, inPort, srcNet, dstNet, gotoTable, (uint16_t)priority);
+	return 0;
+}
 
-	flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, "load:0x2->NXM_OF_ARP_OP[], move:NXM_NX_ARP_SHA[]->NXM_NX_ARP_THA[], move:NXM_OF_ARP_SPA[]->NXM_OF_ARP_TPA[],");
-	--actionLen;
+int ovsFlushFlows(ovsContext* ctx) {
+	if (ctx->of == NULL) return 0;
+	return ofBarrier(ctx->of);
+}
 
-	flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, "load:0x%s->NXM_NX_ARP_SHA[],", macOctetStr);
-	--actionLen;
+int ovsGetPorts(ovsContext* ctx, const char* bridge, const char* const intfNames[], size_t count, uint32_t ports[]) {
+	int err = 0;
+	if (ctx->backend == SwitchTc) {
+		for (size_t i = 0; i < count; ++i) {
+			int intfIdx = netGetInterfaceIndex(ctx->net, intfNames[i], &err);
+			if (intfIdx == -1) return err;
+			ports[i] = (uint32_t)intfIdx;
+		}
+		return 0;
+	}
 
-	flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, "load:0x%s->NXM_OF_ARP_SPA[],", ipOctetStr);
-	--actionLen;
+	ovsdbConn* db = ovsGetDb(ctx, &err);
+	if (db == NULL) return err;
+	return ovsdbGetInterfacePorts(db, intfNames, count, ports);
+}
 
-	flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, "in_port");
+typedef struct {
+	uint8_t table;
+	uint32_t inPort;
+	bool hasSrcNet;
+	bool hasDstNet;
+	bool hasNewSrcMac;
+	bool hasNewDstMac;
+	ip4Subnet srcNet;
+	ip4Subnet dstNet;
+	macAddr newSrcMac;
+	macAddr newDstMac;
+	size_t outPortHandle;
+	uint32_t priority;
+} ovsBatchFlow;
+
+typedef struct {
+	char* name;
+	uint32_t requestedPort;
+} ovsBatchPort;
+
+struct ovsBatch {
+	ovsContext* ctx;
+	char* bridge;
+
+	ovsBatchPort* ports; // Flexible buffer of pending ports
+	size_t portCount;
+	size_t portCap;
+
+	ovsBatchFlow* flows; // Flexible buffer of pending flows
+	size_t flowCount;
+	size_t flowCap;
+};
 
-	return ovsCommand(ctx->directory, "ovs-ofctl", ctx->compatArgs, "add-flow", bridge, ctx->actionBuffer, NULL);
+ovsBatch* ovsBatchNew(ovsContext* ctx, const char* bridge) {
+	ovsBatch* batch = ecalloc(1, sizeof(ovsBatch));
+	batch->ctx = ctx;
+	batch->bridge = strdup(bridge);
+	return batch;
 }
 
-int ovsAddIpFlow(ovsContext* ctx, const char* bridge, uint32_t inPort, const ip4Subnet* srcNet, const ip4Subnet* dstNet, const macAddr* newSrcMac, const macAddr* newDstMac, uint32_t outPort, uint32_t priority) {
-	int err = switchContext(ctx);
-	if (err != 0) return err;
+static void ovsBatchClear(ovsBatch* batch) {
+	for (size_t i = 0; i < batch->portCount; ++i) free(batch->ports[i].name);
+	batch->portCount = 0;
+	batch->flowCount = 0;
+}
 
-	char subnetStr[IP4_CIDR_BUFLEN];
-	char macStr[MAC_ADDR_BUFLEN];
+void ovsBatchFree(ovsBatch* batch) {
+	ovsBatchClear(batch);
+	flexBufferFree((void**)&batch->ports, &batch->portCount, &batch->portCap);
+	flexBufferFree((void**)&batch->flows, &batch->flowCount, &batch->flowCap);
+	free(batch->bridge);
+	free(batch);
+}
 
-	lprintHead(LogDebug);
-	lprintDirectf(LogDebug, "Adding OpenFlow rule to bridge '%s' in context %p: priority %u, match (", bridge, ctx, priority);
-
-	size_t actionLen = 0;
-
-	flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, "ip, priority=%u", priority);
-	--actionLen; // Remove NUL terminator to concatenate
-
-	if (inPort > 0) {
-		lprintDirectf(LogDebug, "in port = %u", inPort);
-		flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, ", in_port=%u", inPort);
-		--actionLen;
-	}
-	if (srcNet != NULL) {
-		ip4SubnetToString(srcNet, subnetStr);
-		lprintDirectf(LogDebug, ", source = %s", subnetStr);
-		flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, ", nw_src=%s", subnetStr);
-		--actionLen;
-	}
-	if (dstNet != NULL) {
-		ip4SubnetToString(dstNet, subnetStr);
-		lprintDirectf(LogDebug, ", destination = %s", subnetStr);
-		flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, ", nw_dst=%s", subnetStr);
-		--actionLen;
-	}
-	lprintDirectf(LogDebug, "), perform (out port = %u", outPort);
-	flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, ", actions=");
-	--actionLen;
-	if (newSrcMac != NULL) {
-		macAddrToString(newSrcMac, macStr);
-		lprintDirectf(LogDebug, "source MAC = %s", macStr);
-		flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, ", mod_dl_src=%s", macStr);
-		--actionLen;
-	}
-	if (newDstMac != NULL) {
-		macAddrToString(newDstMac, macStr);
-		lprintDirectf(LogDebug, "destination MAC = %s", macStr);
-		flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, ", mod_dl_dst=%s", macStr);
-		--actionLen;
-	}
-	lprintDirectf(LogDebug, ") priority %u\n", priority);
-	lprintDirectFinish(LogDebug);
-	flexBufferPrintf((void**)&ctx->actionBuffer, &actionLen, &ctx->actionBufferCap, ", output:%u", outPort);
+size_t ovsBatchAddPort(ovsBatch* batch, const char* intfName, uint32_t requestedPort) {
+	ovsBatchPort port;
+	port.name = strdup(intfName);
+	// Traffic Control switches cannot honor requests, so we always look up
+	// their port numbers
+	port.requestedPort = (batch->ctx->backend == SwitchTc ? 0 : requestedPort);
+	flexBufferGrow((void**)&batch->ports, batch->portCount, &batch->portCap, 1, sizeof(ovsBatchPort));
+	flexBufferAppend(batch->ports, &batch->portCount, &port, 1, sizeof(ovsBatchPort));
+	return batch->portCount - 1;
+}
+
+void ovsBatchAddIpFlow(ovsBatch* batch, uint8_t table, uint32_t inPort, const ip4Subnet* srcNet, const ip4Subnet* dstNet, const macAddr* newSrcMac, const macAddr* newDstMac, size_t outPortHandle, uint32_t priority) {
+	ovsBatchFlow flow;
+	memset(&flow, 0, sizeof(flow));
+	flow.table = table;
+	flow.inPort = inPort;
+	flow.hasSrcNet = (srcNet != NULL);
+	flow.hasDstNet = (dstNet != NULL);
+	flow.hasNewSrcMac = (newSrcMac != NULL);
+	flow.hasNewDstMac = (newDstMac != NULL);
+	if (srcNet != NULL) flow.srcNet = *srcNet;
+	if (dstNet != NULL) flow.dstNet = *dstNet;
+	if (newSrcMac != NULL) flow.newSrcMac = *newSrcMac;
+	if (newDstMac != NULL) flow.newDstMac = *newDstMac;
+	flow.outPortHandle = outPortHandle;
+	flow.priority = priority;
+
+	flexBufferGrow((void**)&batch->flows, batch->flowCount, &batch->flowCap, 1, sizeof(ovsBatchFlow));
+	flexBufferAppend(batch->flows, &batch->flowCount, &flow, 1, sizeof(ovsBatchFlow));
+}
+
+int ovsBatchFlush(ovsBatch* batch) {
+	if (batch->portCount == 0 && batch->flowCount == 0) return 0;
+
+	lprintf(LogDebug, "Flushing batch of %lu ports and %lu flows to Open vSwitch bridge '%s' in context %p\n", batch->portCount, batch->flowCount, batch->bridge, batch->ctx);
+
+	int err = 0;
+	const char** names = NULL;
+	uint32_t* ports = NULL;
+	const char** lookupNames = NULL;
+	uint32_t* lookupPorts = NULL;
+
+	if (batch->portCount > 0) {
+		names = eamalloc(batch->portCount, sizeof(char*), 0);
+		ports = eamalloc(batch->portCount, sizeof(uint32_t), 0);
+		for (size_t i = 0; i < batch->portCount; ++i) {
+			names[i] = batch->ports[i].name;
+			ports[i] = batch->ports[i].requestedPort;
+		}
+
+		err = ovsAddPorts(batch->ctx, batch->bridge, names, ports, batch->portCount);
+		if (err != 0) goto cleanup;
 
-	return ovsCommand(ctx->directory, "ovs-ofctl", ctx->compatArgs, "add-flow", bridge, ctx->actionBuffer, NULL);
+		// Requested port numbers are guaranteed by ovsAddPorts, so we only need
+		// to ask the switch about the rest
+		size_t lookupCount = 0;
+		for (size_t i = 0; i < batch->portCount; ++i) {
+			if (ports[i] == 0) ++lookupCount;
+		}
+		if (lookupCount > 0) {
+			lookupNames = eamalloc(lookupCount, sizeof(char*), 0);
+			lookupPorts = eamalloc(lookupCount, sizeof(uint32_t), 0);
+			for (size_t i = 0, j = 0; i < batch->portCount; ++i) {
+				if (ports[i] == 0) lookupNames[j++] = names[i];
+			}
+			err = ovsGetPorts(batch->ctx, batch->bridge, lookupNames, lookupCount, lookupPorts);
+			if (err != 0) goto cleanup;
+			for (size_t i = 0, j = 0; i < batch->portCount; ++i) {
+				if (ports[i] == 0) ports[i] = lookupPorts[j++];
+			}
+		}
+	}
+
+	for (size_t i = 0; i < batch->flowCount; ++i) {
+		ovsBatchFlow* flow = &batch->flows[i];
+		if (flow->outPortHandle >= batch->portCount) {
+			lprintf(LogError, "BUG: Open vSwitch batch flow refers to unknown port handle %lu\n", flow->outPortHandle);
+			err = 1;
+			goto cleanup;
+		}
+		err = ovsAddIpFlow(batch->ctx, batch->bridge, flow->table, flow->inPort, flow->hasSrcNet ? &flow->srcNet : NULL, flow->hasDstNet ? &flow->dstNet : NULL, flow->hasNewSrcMac ? &flow->newSrcMac : NULL, flow->hasNewDstMac ? &flow->newDstMac : NULL, ports[flow->outPortHandle], flow->priority);
+		if (err != 0) goto cleanup;
+	}
+	err = ovsFlushFlows(batch->ctx);
+
+cleanup:
+	free(names);
+	free(ports);
+	free(lookupNames);
+	free(lookupPorts);
+	ovsBatchClear(batch);
+	return err;
 }
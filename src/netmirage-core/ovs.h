@@ -20,20 +20,45 @@
 #pragma once
 
 // This module enables interaction with Open vSwitch. This module is not
-// thread-safe. Calling any of the functions in this module will result in the
-// active network namespace for the process being changed.
+// thread-safe. The OVS tools and daemons are reached through UNIX sockets in
+// the state directory, and Traffic Control filters are managed through the
+// netlink sockets of the context's namespace, so most functions leave the
+// active network namespace for the process unchanged. Only ovsStart switches
+// to the context's namespace, because the daemons must be started inside it.
+//
+// The same interface can alternatively be backed by Linux Traffic Control
+// filters, which requires no daemons. In this case, bridges are virtual: ports
+// are connected to a shared filter block in the context's namespace, port
+// numbers are interface indices, and the kernel responds to ARP queries for the
+// addresses of the ports.
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "ip.h"
 #include "net.h"
 
 typedef struct ovsContext ovsContext;
 
+// Implementations of the switch
+typedef enum {
+	SwitchOvs, // Isolated Open vSwitch instance
+	SwitchTc,  // Linux Traffic Control flower filters
+} SwitchBackend;
+
 // Returns a human-readable version string for the Open vSwitch installation. If
 // Open vSwitch is not installed or is not accessible, returns NULL. The caller
-// is responsible for freeing this string.
-char* ovsVersion(bool* validVersion, unsigned int* major, unsigned int* minor);
+// is responsible for freeing this string. Determining the version requires
+// running every OVS tool, so if cacheDir is not NULL, the result is cached in
+// that directory and reused until one of the tool binaries changes. The result
+// is also remembered for the rest of the process, as with ovsUseVersion.
+char* ovsVersion(const char* cacheDir, bool* validVersion, unsigned int* major, unsigned int* minor);
+
+// Informs the module of the installed Open vSwitch version, as previously
+// returned by ovsVersion (possibly in another process). This prevents the
+// module from probing the version again when it needs to know it.
+void ovsUseVersion(bool validVersion, unsigned int major, unsigned int minor);
 
 // Starts up an isolated Open vSwitch instance in the given namespace. This
 // instance includes its own configuration database server and switching daemon.
@@ -43,45 +68,124 @@ char* ovsVersion(bool* validVersion, unsigned int* major, unsigned int* minor);
 // ovsSchema is NULL, then the default path is used. If existing is true, then
 // the function will reference an existing Open vSwitch instance rather than
 // creating one. Returns a new OVS context on success. If an error occurs,
-// returns NULL and sets err to the error code (if err is not NULL).
-ovsContext* ovsStart(netContext* net, const char* directory, const char* ovsSchema, bool existing, int* err);
+// returns NULL and sets err to the error code (if err is not NULL). If backend
+// is SwitchTc, then no instance is started and the directory and schema are
+// not used.
+ovsContext* ovsStart(netContext* net, SwitchBackend backend, const char* directory, const char* ovsSchema, bool existing, int* err);
 
 // Releases resources associated with a given Open vSwitch instance, but allows
 // it to continue running.
 int ovsFree(ovsContext* ctx);
 
 // Destroys a runnning Open vSwitch instance based in the given directory.
-// Returns 0 on success or an error code otherwise.
-int ovsDestroy(const char* directory);
+// Returns 0 on success or an error code otherwise. Does nothing for SwitchTc.
+int ovsDestroy(SwitchBackend backend, const char* directory);
 
-// Adds a new bridge to the given Open vSwitch instance. Returns 0 on success or
-// an error code otherwise.
+// Returns true if an Open vSwitch instance appears to be running in the given
+// directory. Always returns false for SwitchTc.
+bool ovsIsRunning(SwitchBackend backend, const char* directory);
+
+// Adds a new bridge to the given Open vSwitch instance and brings up its
+// interface. Returns 0 on success or an error code otherwise.
 int ovsAddBridge(ovsContext* ctx, const char* name);
 
 // Deletes a bridge from the given Open vSwitch instance. Returns 0 on success
 // or an error code otherwise.
 int ovsDelBridge(ovsContext* ctx, const char* name);
 
+// Returns a bridge to the state produced by ovsAddBridge and ovsClearFlows by
+// removing all of its ports and flows. This is much faster than restarting the
+// instance. Returns 0 on success or an error code otherwise.
+int ovsResetBridge(ovsContext* ctx, const char* bridge);
+
 // Sets the MTU for a bridge. Returns 0 on success or an error code otherwise.
 int ovsSetBridgeMtu(ovsContext* ctx, const char* bridge, int mtu);
 
-// Adds a port to the bridge in the given Open vSwitch instance. If portId is
-// not NULL, it is set to the new port index. Returns 0 on success or an error
+// Tunes the switching daemon for a network with the given number of clients.
+// This adjusts the thread counts and the datapath flow cache to better handle
+// many short-lived flows between clients. The settings apply to the whole
+// instance. Traffic Control switches are not affected. Returns 0 on success or
+// an error code otherwise.
+int ovsTuneDatapath(ovsContext* ctx, uint32_t clientCount);
+
+// The largest port number that can be requested when adding a port
+#define OVS_MAX_PORT_REQUEST 65279
+
+// Adds a port to the bridge in the given Open vSwitch instance. If
+// requestedPort is not 0, the switch uses it as the port number, or the
+// addition fails if the number is already in use. Traffic Control switches
+// ignore the request and always use the interface index. Returns 0 on success
+// or an error code otherwise.
+int ovsAddPort(ovsContext* ctx, const char* bridge, const char* intfName, uint32_t requestedPort);
+
+// Adds several ports to the bridge at once. This is much faster than adding
+// the ports individually because the switch only needs to reconfigure itself
+// once. requestedPorts may be NULL; otherwise, its entries have the same
+// meaning as for ovsAddPort. Ports without a requested number may be numbered
+// in any order. Returns 0 on success or an error code otherwise.
+int ovsAddPorts(ovsContext* ctx, const char* bridge, const char* const intfNames[], const uint32_t requestedPorts[], size_t count);
+
+// Looks up the port numbers that the switch assigned to interfaces in a bridge.
+// ports should have room for count entries. Returns 0 on success or an error
 // code otherwise.
-int ovsAddPort(ovsContext* ctx, const char* bridge, const char* intfName);
+int ovsGetPorts(ovsContext* ctx, const char* bridge, const char* const intfNames[], size_t count, uint32_t ports[]);
 
 // Deletes all flows in a bridge. All traffic will be silently dropped. Returns
 // 0 on success or an error code otherwise.
 int ovsClearFlows(ovsContext* ctx, const char* bridge);
 
-// Adds a flow to respond to ARP queries to bridge for ip. Returns 0 on success
-// or an error code otherwise.
+// The following functions queue flows for a bridge. The flows are sent to the
+// switch in bulk, and errors that the switch reports for them are only returned
+// by ovsFlushFlows. Each function returns 0 on success or an error code
+// otherwise.
+
+// Adds a flow to respond to ARP queries to bridge for ip.
 int ovsAddArpResponse(ovsContext* ctx, const char* bridge, ip4Addr ip, const macAddr* mac, uint32_t priority);
 
-// Adds a new IPv4 flow to a bridge. Matches traffic the comes from the inPort
-// and with the given source and destination subnets. If inPort is 0, any port
-// will match. If srcNet or dstNet are NULL, then they are not used for
-// matching. If non-NULL, newSrcMac and newDstMac specify new MAC addresses for
-// the Ethernet layer of the outgoing packet. The packet is sent out of outPort.
-// Returns 0 on success or an error code otherwise.
-int ovsAddIpFlow(ovsContext* ctx, const char* bridge, uint32_t inPort, const ip4Subnet* srcNet, const ip4Subnet* dstNet, const macAddr* newSrcMac, const macAddr* newDstMac, uint32_t outPort, uint32_t priority);
+// Adds a new IPv4 flow to a table in a bridge. Packets are first matched
+// against table 0. Matches traffic the comes from the inPort and with the
+// given source and destination subnets. If inPort is 0, any port will match.
+// If srcNet or dstNet are NULL, then they are not used for matching. If
+// non-NULL, newSrcMac and newDstMac specify new MAC addresses for the Ethernet
+// layer of the outgoing packet. The packet is sent out of outPort.
+int ovsAddIpFlow(ovsContext* ctx, const char* bridge, uint8_t table, uint32_t inPort, const ip4Subnet* srcNet, const ip4Subnet* dstNet, const macAddr* newSrcMac, const macAddr* newDstMac, uint32_t outPort, uint32_t priority);
+
+// Adds an IPv4 flow that continues matching packets in gotoTable, which must
+// be greater than table. The match parameters have the same meaning as for
+// ovsAddIpFlow. Packets that do not match any flow in gotoTable are dropped.
+int ovsAddIpGotoTable(ovsContext* ctx, const char* bridge, uint8_t table, uint32_t inPort, const ip4Subnet* srcNet, const ip4Subnet* dstNet, uint8_t gotoTable, uint32_t priority);
+
+// Waits for the switch to install all queued flows. Returns 0 on success or an
+// error code if any of the flows were rejected.
+int ovsFlushFlows(ovsContext* ctx);
+
+// A batch defers port additions and the flows that send traffic to those ports
+// until ovsBatchFlush is called. All of the ports in a batch are added in a
+// single transaction, and the flows are then sent together. Flows in a batch
+// refer to their output ports by the handles returned by ovsBatchAddPort. If a
+// port was added without a requested number, its actual number is looked up
+// when the batch is flushed. This allows ports to be added from several
+// contexts concurrently without coordinating their port numbers.
+typedef struct ovsBatch ovsBatch;
+
+// Creates a new, empty batch for a bridge. The context must remain valid until
+// the batch is freed.
+ovsBatch* ovsBatchNew(ovsContext* ctx, const char* bridge);
+
+// Frees a batch. Any pending operations that were not flushed are discarded.
+void ovsBatchFree(ovsBatch* batch);
+
+// Queues the addition of a port to the bridge. requestedPort has the same
+// meaning as for ovsAddPort. Returns a handle identifying the port in
+// subsequent calls to ovsBatchAddIpFlow for the same batch.
+size_t ovsBatchAddPort(ovsBatch* batch, const char* intfName, uint32_t requestedPort);
+
+// Queues an IPv4 flow. The parameters have the same meaning as for
+// ovsAddIpFlow, except that the packet is sent out of the port identified by
+// the handle outPortHandle.
+void ovsBatchAddIpFlow(ovsBatch* batch, uint8_t table, uint32_t inPort, const ip4Subnet* srcNet, const ip4Subnet* dstNet, const macAddr* newSrcMac, const macAddr* newDstMac, size_t outPortHandle, uint32_t priority);
+
+// Adds all of the queued ports, installs all of the queued flows, and empties
+// the batch. Returns 0 on success or an error code otherwise. The batch is
+// emptied even if an error occurs.
+int ovsBatchFlush(ovsBatch* batch);
@@ -0,0 +1,802 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#define _GNU_SOURCE // Needed for MSG_NOSIGNAL
+
+#include "ovsdb.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "mem.h"
+
+#define OVSDB_DB_NAME "Open_vSwitch"
+
+// Limits for waiting on ovs-vswitchd to apply a configuration change
+static const long CfgPollMaxSleepMs = 50;
+static const long CfgWaitTimeoutMs = 60 * 1000;
+
+// Maximum nesting depth accepted in JSON received from the server
+static const int JsonMaxDepth = 64;
+
+struct ovsdbConn {
+	int fd;
+	uint64_t nextId;
+
+	char* outBuf; // Flexible buffer for the request being constructed
+	size_t outLen;
+	size_t outCap;
+
+	char* inBuf; // Flexible buffer for data received from the server
+	size_t inLen;
+	size_t inCap;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// JSON parsing
+////////////////////////////////////////////////////////////////////////////////
+
+// We only need to inspect small replies from the server, so a simple tree
+// representation is sufficient.
+
+typedef enum {
+	JsonNull,
+	JsonFalse,
+	JsonTrue,
+	JsonNumber,
+	JsonString,
+	JsonArray,
+	JsonObject,
+} jsonType;
+
+typedef struct jsonValue jsonValue;
+struct jsonValue {
+	jsonType type;
+	double number;    // For numbers
+	char* string;     // For strings
+	size_t count;     // For arrays and objects
+	jsonValue* items; // For arrays and objects
+	char** keys;      // For objects
+};
+
+typedef struct {
+	const char* p;
+	const char* end;
+} jsonParser;
+
+static void jsonFree(jsonValue* value) {
+	free(value->string);
+	for (size_t i = 0; i < value->count; ++i) {
+		jsonFree(&value->items[i]);
+		if (value->keys != NULL) free(value->keys[i]);
+	}
+	free(value->items);
+	free(value->keys);
+	memset(value, 0, sizeof(jsonValue));
+}
+
+static void jsonSkipSpace(jsonParser* jp) {
+	while (jp->p < jp->end && (*jp->p == ' ' || *jp->p == '\t' || *jp->p == '\n' || *jp->p == '\r')) ++jp->p;
+}
+
+static bool jsonParseHex(jsonParser* jp, uint32_t* codepoint) {
+	if (jp->end - jp->p < 4) return false;
+	*codepoint = 0;
+	for (int i = 0; i < 4; ++i) {
+		char c = *jp->p++;
+		uint32_t digit;
+		if (c >= '0' && c <= '9') digit = (uint32_t)(c - '0');
+		else if (c >= 'a' && c <= 'f') digit = (uint32_t)(c - 'a' + 10);
+		else if (c >= 'A' && c <= 'F') digit = (uint32_t)(c - 'A' + 10);
+		else return false;
+		*codepoint = (*codepoint << 4) | digit;
+	}
+	return true;
+}
+
+// Parses a string. The parser must be positioned at the opening quote.
+static bool jsonParseString(jsonParser* jp, char** result) {
+	++jp->p;
+
+	// Escape sequences never expand, so the raw length is an upper bound
+	const char* q = jp->p;
+	while (q < jp->end && *q != '"') {
+		if (*q == '\\') ++q;
+		++q;
+	}
+	if (q >= jp->end) return false;
+
+	char* out = emalloc((size_t)(q - jp->p) + 1);
+	size_t n = 0;
+	while (*jp->p != '"') {
+		char c = *jp->p++;
+		if (c != '\\') {
+			out[n++] = c;
+			continue;
+		}
+		c = *jp->p++;
+		switch (c) {
+		case '"': case '\\': case '/': out[n++] = c; break;
+		case 'b': out[n++] = '\b'; break;
+		case 'f': out[n++] = '\f'; break;
+		case 'n': out[n++] = '\n'; break;
+		case 'r': out[n++] = '\r'; break;
+		case 't': out[n++] = '\t'; break;
+		case 'u': {
+			uint32_t cp;
+			if (!jsonParseHex(jp, &cp)) goto fail;
+			if (cp >= 0xD800 && cp <= 0xDBFF && jp->end - jp->p >= 6 && jp->p[0] == '\\' && jp->p[1] == 'u') {
+				jp->p += 2;
+				uint32_t low;
+				if (!jsonParseHex(jp, &low) || low < 0xDC00 || low > 0xDFFF) goto fail;
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+			}
+			if (cp < 0x80) {
+				out[n++] = (char)cp;
+			} else if (cp < 0x800) {
+				out[n++] = (char)(0xC0 | (cp >> 6));
+				out[n++] = (char)(0x80 | (cp & 0x3F));
+			} else if (cp < 0x10000) {
+				out[n++] = (char)(0xE0 | (cp >> 12));
+				out[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+				out[n++] = (char)(0x80 | (cp & 0x3F));
+			} else {
+				out[n++] = (char)(0xF0 | (cp >> 18));
+				out[n++] = (char)(0x80 | ((cp >> 12) & 0x3F));
+				out[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+				out[n++] = (char)(0x80 | (cp & 0x3F));
+			}
+			break;
+		}
+		default: goto fail;
+		}
+	}
+	++jp->p;
+	out[n] = '\0';
+	*result = out;
+	return true;
+fail:
+	free(out);
+	return false;
+}
+
+static bool jsonParseValue(jsonParser* jp, jsonValue* value, int depth);
+
+// Parses the members of an array or object. The parser must be positioned at
+// the opening bracket or brace.
+static bool jsonParseCompound(jsonParser* jp, jsonValue* value, int depth) {
+	bool isObject = (*jp->p == '{');
+	char closer = isObject ? '}' : ']';
+	value->type = isObject ? JsonObject : JsonArray;
+	++jp->p;
+
+	size_t itemCap = 0;
+	size_t keyCap = 0;
+	size_t keyCount = 0;
+	flexBufferInit((void**)&value->items, &value->count, &itemCap);
+	if (isObject) flexBufferInit((void**)&value->keys, &keyCount, &keyCap);
+
+	jsonSkipSpace(jp);
+	if (jp->p < jp->end && *jp->p == closer) {
+		++jp->p;
+		return true;
+	}
+	while (true) {
+		char* key = NULL;
+		if (isObject) {
+			jsonSkipSpace(jp);
+			if (jp->p >= jp->end || *jp->p != '"') return false;
+			if (!jsonParseString(jp, &key)) return false;
+			jsonSkipSpace(jp);
+			if (jp->p >= jp->end || *jp->p != ':') {
+				free(key);
+				return false;
+			}
+			++jp->p;
+		}
+
+		jsonValue item;
+		if (!jsonParseValue(jp, &item, depth+1)) {
+			free(key);
+			return false;
+		}
+		if (isObject) {
+			flexBufferGrow((void**)&value->keys, keyCount, &keyCap, 1, sizeof(char*));
+			flexBufferAppend(value->keys, &keyCount, &key, 1, sizeof(char*));
+		}
+		flexBufferGrow((void**)&value->items, value->count, &itemCap, 1, sizeof(jsonValue));
+		flexBufferAppend(value->items, &value->count, &item, 1, sizeof(jsonValue));
+
+		jsonSkipSpace(jp);
+		if (jp->p >= jp->end) return false;
+		if (*jp->p == closer) {
+			++jp->p;
+			return true;
+		}
+		if (*jp->p != ',') return false;
+		++jp->p;
+	}
+}
+
+// Parses any JSON value. On failure, value does not need to be freed.
+static bool jsonParseValue(jsonParser* jp, jsonValue* value, int depth) {
+	memset(value, 0, sizeof(jsonValue));
+	if (depth > JsonMaxDepth) return false;
+
+	jsonSkipSpace(jp);
+	if (jp->p >= jp->end) return false;
+
+	bool success = true;
+	char c = *jp->p;
+	if (c == '{' || c == '[') {
+		success = jsonParseCompound(jp, value, depth);
+	} else if (c == '"') {
+		value->type = JsonString;
+		success = jsonParseString(jp, &value->string);
+	} else if (c == '-' || (c >= '0' && c <= '9')) {
+		value->type = JsonNumber;
+		char* numEnd;
+		value->number = strtod(jp->p, &numEnd);
+		success = (numEnd > jp->p && numEnd <= jp->end);
+		if (success) jp->p = numEnd;
+	} else {
+		static const struct { const char* literal; jsonType type; } literals[] = {
+			{ "null", JsonNull }, { "true", JsonTrue }, { "false", JsonFalse },
+		};
+		success = false;
+		for (size_t i = 0; i < sizeof(literals) / sizeof(literals[0]); ++i) {
+			size_t len = strlen(literals[i].literal);
+			if ((size_t)(jp->end - jp->p) >= len && strncmp(jp->p, literals[i].literal, len) == 0) {
+				value->type = literals[i].type;
+				jp->p += len;
+				success = true;
+				break;
+			}
+		}
+	}
+
+	if (!success) jsonFree(value);
+	return success;
+}
+
+// Returns the member of an object with the given key, or NULL if the value is
+// not an object or the member does not exist.
+static const jsonValue* jsonGet(const jsonValue* object, const char* key) {
+	if (object == NULL || object->type != JsonObject) return NULL;
+	for (size_t i = 0; i < object->count; ++i) {
+		if (strcmp(object->keys[i], key) == 0) return &object->items[i];
+	}
+	return NULL;
+}
+
+// Returns the length of the first complete JSON compound value in a buffer, or
+// 0 if the buffer does not yet contain a complete value. JSON-RPC messages are
+// sent back-to-back without framing, so we need to find the boundaries.
+static size_t jsonFrameLength(const char* buf, size_t len) {
+	size_t depth = 0;
+	bool inString = false;
+	bool escaped = false;
+	for (size_t i = 0; i < len; ++i) {
+		char c = buf[i];
+		if (inString) {
+			if (escaped) escaped = false;
+			else if (c == '\\') escaped = true;
+			else if (c == '"') inString = false;
+		} else if (c == '"') {
+			inString = true;
+		} else if (c == '{' || c == '[') {
+			++depth;
+		} else if (c == '}' || c == ']') {
+			if (depth > 0 && --depth == 0) return i+1;
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// JSON-RPC
+////////////////////////////////////////////////////////////////////////////////
+
+ovsdbConn* ovsdbConnect(const char* socketPath, int* err) {
+	int localErr;
+	if (err == NULL) err = &localErr;
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+		lprintf(LogError, "OVSDB socket path '%s' is too long\n", socketPath);
+		*err = ENAMETOOLONG;
+		return NULL;
+	}
+	strcpy(addr.sun_path, socketPath);
+
+	errno = 0;
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		lprintf(LogError, "Failed to create OVSDB socket: %s\n", strerror(errno));
+		*err = errno;
+		return NULL;
+	}
+	errno = 0;
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		lprintf(LogError, "Failed to connect to OVSDB server at '%s': %s\n", socketPath, strerror(errno));
+		*err = errno;
+		close(fd);
+		return NULL;
+	}
+
+	ovsdbConn* conn = emalloc(sizeof(ovsdbConn));
+	conn->fd = fd;
+	conn->nextId = 1;
+	flexBufferInit((void**)&conn->outBuf, &conn->outLen, &conn->outCap);
+	flexBufferGrow((void**)&conn->outBuf, conn->outLen, &conn->outCap, 1024, 1);
+	flexBufferInit((void**)&conn->inBuf, &conn->inLen, &conn->inCap);
+	lprintf(LogDebug, "Connected to OVSDB server at '%s' with connection %p\n", socketPath, conn);
+	return conn;
+}
+
+void ovsdbClose(ovsdbConn* conn) {
+	close(conn->fd);
+	flexBufferFree((void**)&conn->outBuf, &conn->outLen, &conn->outCap);
+	flexBufferFree((void**)&conn->inBuf, &conn->inLen, &conn->inCap);
+	free(conn);
+}
+
+// Appends formatted text to the request being constructed
+static void ovsdbAppend(ovsdbConn* conn, const char* fmt, ...) {
+	while (true) {
+		size_t freeSpace = conn->outCap - conn->outLen;
+		va_list args;
+		va_start(args, fmt);
+		int neededChars = vsnprintf(&conn->outBuf[conn->outLen], freeSpace, fmt, args);
+		va_end(args);
+		if (neededChars < 0) return;
+		if ((size_t)neededChars < freeSpace) {
+			conn->outLen += (size_t)neededChars;
+			return;
+		}
+		flexBufferGrow((void**)&conn->outBuf, conn->outLen, &conn->outCap, (size_t)neededChars+1, 1);
+	}
+}
+
+// Appends a quoted and escaped JSON string to the request
+static void ovsdbAppendString(ovsdbConn* conn, const char* str) {
+	ovsdbAppend(conn, "\"");
+	for (const char* p = str; *p != '\0'; ++p) {
+		unsigned char c = (unsigned char)*p;
+		if (c == '"' || c == '\\') ovsdbAppend(conn, "\\%c", c);
+		else if (c < 0x20) ovsdbAppend(conn, "\\u%04x", c);
+		else ovsdbAppend(conn, "%c", c);
+	}
+	ovsdbAppend(conn, "\"");
+}
+
+static int ovsdbSend(ovsdbConn* conn, const char* data, size_t len) {
+	while (len > 0) {
+		errno = 0;
+		ssize_t sent = send(conn->fd, data, len, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) continue;
+			lprintf(LogError, "Failed to send request to OVSDB server: %s\n", strerror(errno));
+			return errno;
+		}
+		data += sent;
+		len -= (size_t)sent;
+	}
+	return 0;
+}
+
+// Receives the next complete message from the server. The caller must free msg
+// with jsonFree if the call succeeds.
+static int ovsdbReceive(ovsdbConn* conn, jsonValue* msg) {
+	while (true) {
+		size_t frameLen = jsonFrameLength(conn->inBuf, conn->inLen);
+		if (frameLen > 0) {
+			jsonParser jp = { .p = conn->inBuf, .end = &conn->inBuf[frameLen] };
+			bool parsed = jsonParseValue(&jp, msg, 0);
+			memmove(conn->inBuf, &conn->inBuf[frameLen], conn->inLen - frameLen);
+			conn->inLen -= frameLen;
+			if (!parsed) {
+				lprintln(LogError, "Received a malformed message from the OVSDB server");
+				return 1;
+			}
+			return 0;
+		}
+
+		flexBufferGrow((void**)&conn->inBuf, conn->inLen, &conn->inCap, 4096, 1);
+		errno = 0;
+		ssize_t readLen = recv(conn->fd, &conn->inBuf[conn->inLen], conn->inCap - conn->inLen, 0);
+		if (readLen < 0) {
+			if (errno == EINTR) continue;
+			lprintf(LogError, "Failed to read from OVSDB server: %s\n", strerror(errno));
+			return errno;
+		}
+		if (readLen == 0) {
+			lprintln(LogError, "The OVSDB server closed the connection unexpectedly");
+			return 1;
+		}
+		conn->inLen += (size_t)readLen;
+	}
+}
+
+// Starts a new transaction. Operations are added by appending JSON objects,
+// each preceded by a comma.
+static void ovsdbBeginTransact(ovsdbConn* conn) {
+	conn->outLen = 0;
+	ovsdbAppend(conn, "{\"method\":\"transact\",\"id\":%" PRIu64 ",\"params\":[\"" OVSDB_DB_NAME "\"", conn->nextId);
+}
+
+// Sends the transaction and waits for the reply. On success, reply contains the
+// full reply message, which must be freed with jsonFree, and results points to
+// its array of operation results. If any operation failed, an error is logged
+// and returned.
+static int ovsdbCommit(ovsdbConn* conn, jsonValue* reply, const jsonValue** results) {
+	ovsdbAppend(conn, "]}");
+	uint64_t id = conn->nextId++;
+	int err = ovsdbSend(conn, conn->outBuf, conn->outLen);
+	if (err != 0) return err;
+
+	while (true) {
+		err = ovsdbReceive(conn, reply);
+		if (err != 0) return err;
+
+		// The server may send us requests (e.g., inactivity probes) at any
+		// time. We answer echoes and ignore everything else.
+		const jsonValue* method = jsonGet(reply, "method");
+		if (method != NULL) {
+			if (method->type == JsonString && strcmp(method->string, "echo") == 0) {
+				const jsonValue* echoId = jsonGet(reply, "id");
+				if (echoId != NULL && echoId->type == JsonString) {
+					conn->outLen = 0;
+					ovsdbAppend(conn, "{\"result\":[],\"error\":null,\"id\":");
+					ovsdbAppendString(conn, echoId->string);
+					ovsdbAppend(conn, "}");
+					ovsdbSend(conn, conn->outBuf, conn->outLen);
+				}
+			}
+			jsonFree(reply);
+			continue;
+		}
+
+		const jsonValue* replyId = jsonGet(reply, "id");
+		if (replyId != NULL && replyId->type == JsonNumber && (uint64_t)replyId->number == id) break;
+		jsonFree(reply);
+	}
+
+	const jsonValue* error = jsonGet(reply, "error");
+	if (error != NULL && error->type != JsonNull) {
+		lprintf(LogError, "OVSDB server rejected transaction: %s\n", error->type == JsonString ? error->string : "(unknown error)");
+		goto fail;
+	}
+	*results = jsonGet(reply, "result");
+	if (*results == NULL || (*results)->type != JsonArray) {
+		lprintln(LogError, "OVSDB server sent an invalid reply to a transaction");
+		goto fail;
+	}
+	for (size_t i = 0; i < (*results)->count; ++i) {
+		const jsonValue* opError = jsonGet(&(*results)->items[i], "error");
+		if (opError != NULL && opError->type == JsonString) {
+			const jsonValue* details = jsonGet(&(*results)->items[i], "details");
+			lprintf(LogError, "OVSDB transaction failed: %s (%s)\n", opError->string, (details != NULL && details->type == JsonString) ? details->string : "no details");
+			goto fail;
+		}
+	}
+	return 0;
+fail:
+	jsonFree(reply);
+	return 1;
+}
+
+// Returns the numeric value of a column in the first row returned by a select
+// operation, or -1 if it is missing.
+static int64_t ovsdbSelectedInt(const jsonValue* result, const char* column) {
+	const jsonValue* rows = jsonGet(result, "rows");
+	if (rows == NULL || rows->type != JsonArray || rows->count < 1) return -1;
+	const jsonValue* value = jsonGet(&rows->items[0], column);
+	if (value == NULL || value->type != JsonNumber) return -1;
+	return (int64_t)value->number;
+}
+
+// Returns the number of rows affected by an update or mutate operation
+static int64_t ovsdbResultCount(const jsonValue* result) {
+	const jsonValue* count = jsonGet(result, "count");
+	if (count == NULL || count->type != JsonNumber) return -1;
+	return (int64_t)count->number;
+}
+
+static long elapsedMs(const struct timespec* start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long)(now.tv_sec - start->tv_sec) * 1000L + (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+// Appends operations that ask ovs-vswitchd to reconfigure itself after the
+// transaction. These must be the last operations in the transaction.
+static void ovsdbAppendCfgRequest(ovsdbConn* conn) {
+	ovsdbAppend(conn, ",{\"op\":\"mutate\",\"table\":\"Open_vSwitch\",\"where\":[],\"mutations\":[[\"next_cfg\",\"+=\",1]]}");
+	ovsdbAppend(conn, ",{\"op\":\"select\",\"table\":\"Open_vSwitch\",\"where\":[],\"columns\":[\"next_cfg\"]}");
+}
+
+// Waits until ovs-vswitchd has applied the configuration requested by a
+// transaction that ended with ovsdbAppendCfgRequest. Other processes may bump
+// the counter concurrently, so any value at least as new as ours suffices.
+static int ovsdbWaitForCfg(ovsdbConn* conn, const jsonValue* results) {
+	int64_t nextCfg = -1;
+	if (results->count > 0) nextCfg = ovsdbSelectedInt(&results->items[results->count-1], "next_cfg");
+	if (nextCfg < 0) {
+		lprintln(LogError, "OVSDB server did not report the new configuration sequence number");
+		return 1;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	long sleepMs = 1;
+	while (true) {
+		ovsdbBeginTransact(conn);
+		ovsdbAppend(conn, ",{\"op\":\"select\",\"table\":\"Open_vSwitch\",\"where\":[],\"columns\":[\"cur_cfg\"]}");
+		jsonValue reply;
+		const jsonValue* pollResults;
+		int err = ovsdbCommit(conn, &reply, &pollResults);
+		if (err != 0) return err;
+		int64_t curCfg = (pollResults->count > 0 ? ovsdbSelectedInt(&pollResults->items[0], "cur_cfg") : -1);
+		jsonFree(&reply);
+
+		if (curCfg >= nextCfg) break;
+		if (elapsedMs(&start) > CfgWaitTimeoutMs) {
+			lprintf(LogError, "Timed out waiting for Open vSwitch to apply configuration %" PRId64 " (currently at %" PRId64 ")\n", nextCfg, curCfg);
+			return ETIMEDOUT;
+		}
+
+		struct timespec delay = { .tv_sec = 0, .tv_nsec = sleepMs * 1000000L };
+		nanosleep(&delay, NULL);
+		sleepMs = (sleepMs * 2 < CfgPollMaxSleepMs ? sleepMs * 2 : CfgPollMaxSleepMs);
+	}
+	lprintf(LogDebug, "Open vSwitch applied configuration %" PRId64 " after %ld ms\n", nextCfg, elapsedMs(&start));
+	return 0;
+}
+
+// Commits a transaction that ended with ovsdbAppendCfgRequest and waits for
+// the configuration to be applied. If checkCountOp is non-negative, the result
+// of that operation must report that at least one row was affected; otherwise,
+// missingMsg is logged and an error is returned.
+static int ovsdbCommitAndWait(ovsdbConn* conn, long checkCountOp, const char* missingMsg, const char* missingName) {
+	jsonValue reply;
+	const jsonValue* results;
+	int err = ovsdbCommit(conn, &reply, &results);
+	if (err != 0) return err;
+
+	if (checkCountOp >= 0) {
+		if ((size_t)checkCountOp >= results->count || ovsdbResultCount(&results->items[checkCountOp]) < 1) {
+			lprintf(LogError, missingMsg, missingName);
+			err = 1;
+		}
+	}
+	if (err == 0) err = ovsdbWaitForCfg(conn, results);
+
+	jsonFree(&reply);
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Operations
+////////////////////////////////////////////////////////////////////////////////
+
+int ovsdbAddBridge(ovsdbConn* conn, const char* name) {
+	ovsdbBeginTransact(conn);
+
+	ovsdbAppend(conn, ",{\"op\":\"insert\",\"table\":\"Interface\",\"uuid-name\":\"intf\",\"row\":{\"type\":\"internal\",\"name\":");
+	ovsdbAppendString(conn, name);
+	ovsdbAppend(conn, "}},{\"op\":\"insert\",\"table\":\"Port\",\"uuid-name\":\"port\",\"row\":{\"interfaces\":[\"named-uuid\",\"intf\"],\"name\":");
+	ovsdbAppendString(conn, name);
+	ovsdbAppend(conn, "}},{\"op\":\"insert\",\"table\":\"Bridge\",\"uuid-name\":\"bridge\",\"row\":{\"protocols\":[\"set\",[\"OpenFlow10\",\"OpenFlow13\"]],\"ports\":[\"named-uuid\",\"port\"],\"name\":");
+	ovsdbAppendString(conn, name);
+	ovsdbAppend(conn, "}},{\"op\":\"mutate\",\"table\":\"Open_vSwitch\",\"where\":[],\"mutations\":[[\"bridges\",\"insert\",[\"named-uuid\",\"bridge\"]]]}");
+
+	ovsdbAppendCfgRequest(conn);
+	return ovsdbCommitAndWait(conn, 3, "Could not find the Open vSwitch root configuration while adding bridge '%s'\n", name);
+}
+
+int ovsdbDelBridge(ovsdbConn* conn, const char* name) {
+	// Bridges, ports, and interfaces are garbage collected once they are no
+	// longer referenced, so we only need to remove the root reference. We first
+	// need to look up the bridge's UUID.
+	ovsdbBeginTransact(conn);
+	ovsdbAppend(conn, ",{\"op\":\"select\",\"table\":\"Bridge\",\"columns\":[\"_uuid\"],\"where\":[[\"name\",\"==\",");
+	ovsdbAppendString(conn, name);
+	ovsdbAppend(conn, "]]}");
+
+	jsonValue reply;
+	const jsonValue* results;
+	int err = ovsdbCommit(conn, &reply, &results);
+	if (err != 0) return err;
+
+	const jsonValue* rows = (results->count > 0 ? jsonGet(&results->items[0], "rows") : NULL);
+	const jsonValue* uuid = NULL;
+	if (rows != NULL && rows->type == JsonArray && rows->count > 0) {
+		uuid = jsonGet(&rows->items[0], "_uuid");
+	}
+	if (uuid == NULL || uuid->type != JsonArray || uuid->count != 2 || uuid->items[1].type != JsonString) {
+		lprintf(LogDebug, "Open vSwitch bridge '%s' does not exist, so it was not deleted\n", name);
+		jsonFree(&reply);
+		return 0;
+	}
+
+	ovsdbBeginTransact(conn);
+	ovsdbAppend(conn, ",{\"op\":\"mutate\",\"table\":\"Open_vSwitch\",\"where\":[],\"mutations\":[[\"bridges\",\"delete\",[\"uuid\",");
+	ovsdbAppendString(conn, uuid->items[1].string);
+	ovsdbAppend(conn, "]]]}");
+	jsonFree(&reply);
+
+	ovsdbAppendCfgRequest(conn);
+	return ovsdbCommitAndWait(conn, -1, NULL, NULL);
+}
+
+int ovsdbClearPorts(ovsdbConn* conn, const char* bridge) {
+	// The bridge keeps its internal port, which shares its name. Replacing the
+	// port set releases every other port, which is then garbage collected along
+	// with its interfaces.
+	ovsdbBeginTransact(conn);
+	ovsdbAppend(conn, ",{\"op\":\"select\",\"table\":\"Port\",\"columns\":[\"_uuid\"],\"where\":[[\"name\",\"==\",");
+	ovsdbAppendString(conn, bridge);
+	ovsdbAppend(conn, "]]}");
+
+	jsonValue reply;
+	const jsonValue* results;
+	int err = ovsdbCommit(conn, &reply, &results);
+	if (err != 0) return err;
+
+	const jsonValue* rows = (results->count > 0 ? jsonGet(&results->items[0], "rows") : NULL);
+	const jsonValue* uuid = NULL;
+	if (rows != NULL && rows->type == JsonArray && rows->count > 0) {
+		uuid = jsonGet(&rows->items[0], "_uuid");
+	}
+	if (uuid == NULL || uuid->type != JsonArray || uuid->count != 2 || uuid->items[1].type != JsonString) {
+		lprintf(LogError, "The internal port for Open vSwitch bridge '%s' does not exist\n", bridge);
+		jsonFree(&reply);
+		return 1;
+	}
+
+	ovsdbBeginTransact(conn);
+	ovsdbAppend(conn, ",{\"op\":\"update\",\"table\":\"Bridge\",\"row\":{\"ports\":[\"uuid\",");
+	ovsdbAppendString(conn, uuid->items[1].string);
+	ovsdbAppend(conn, "]},\"where\":[[\"name\",\"==\",");
+	ovsdbAppendString(conn, bridge);
+	ovsdbAppend(conn, "]]}");
+	jsonFree(&reply);
+
+	ovsdbAppendCfgRequest(conn);
+	return ovsdbCommitAndWait(conn, 0, "Open vSwitch bridge '%s' does not exist\n", bridge);
+}
+
+int ovsdbSetInterfaceMtu(ovsdbConn* conn, const char* intfName, int mtu) {
+	ovsdbBeginTransact(conn);
+	ovsdbAppend(conn, ",{\"op\":\"update\",\"table\":\"Interface\",\"row\":{\"mtu_request\":%d},\"where\":[[\"name\",\"==\",", mtu);
+	ovsdbAppendString(conn, intfName);
+	ovsdbAppend(conn, "]]}");
+
+	ovsdbAppendCfgRequest(conn);
+	return ovsdbCommitAndWait(conn, 0, "Open vSwitch interface '%s' does not exist\n", intfName);
+}
+
+int ovsdbSetOtherConfig(ovsdbConn* conn, const char* const keys[], const char* const values[], size_t count) {
+	if (count < 1) return 0;
+
+	// Inserting into a map does not replace existing keys, so we delete them
+	// first. Mutations are applied in order.
+	ovsdbBeginTransact(conn);
+	ovsdbAppend(conn, ",{\"op\":\"mutate\",\"table\":\"Open_vSwitch\",\"where\":[],\"mutations\":[[\"other_config\",\"delete\",[\"set\",[");
+	for (size_t i = 0; i < count; ++i) {
+		if (i > 0) ovsdbAppend(conn, ",");
+		ovsdbAppendString(conn, keys[i]);
+	}
+	ovsdbAppend(conn, "]]],[\"other_config\",\"insert\",[\"map\",[");
+	for (size_t i = 0; i < count; ++i) {
+		ovsdbAppend(conn, "%s[", (i == 0 ? "" : ","));
+		ovsdbAppendString(conn, keys[i]);
+		ovsdbAppend(conn, ",");
+		ovsdbAppendString(conn, values[i]);
+		ovsdbAppend(conn, "]");
+	}
+	ovsdbAppend(conn, "]]]]}");
+
+	ovsdbAppendCfgRequest(conn);
+	return ovsdbCommitAndWait(conn, 0, "Could not find the Open vSwitch root configuration%s\n", "");
+}
+
+int ovsdbAddPorts(ovsdbConn* conn, const char* bridge, const char* const intfNames[], const uint32_t requestedPorts[], size_t count) {
+	if (count < 1) return 0;
+
+	ovsdbBeginTransact(conn);
+
+	// ovs-vswitchd silently ignores ofport_request if another interface already
+	// has (or requested) the number. We make the transaction fail in that case
+	// instead, so that requested numbers never need to be looked up.
+	size_t waitCount = 0;
+	for (size_t i = 0; requestedPorts != NULL && i < count; ++i) {
+		if (requestedPorts[i] == 0) continue;
+		ovsdbAppend(conn, ",{\"op\":\"wait\",\"timeout\":0,\"table\":\"Interface\",\"where\":[[\"ofport\",\"==\",%u]],\"columns\":[\"name\"],\"until\":\"==\",\"rows\":[]}", requestedPorts[i]);
+		ovsdbAppend(conn, ",{\"op\":\"wait\",\"timeout\":0,\"table\":\"Interface\",\"where\":[[\"ofport_request\",\"==\",%u]],\"columns\":[\"name\"],\"until\":\"==\",\"rows\":[]}", requestedPorts[i]);
+		waitCount += 2;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		ovsdbAppend(conn, ",{\"op\":\"insert\",\"table\":\"Interface\",\"uuid-name\":\"i%zu\",\"row\":{\"name\":", i);
+		ovsdbAppendString(conn, intfNames[i]);
+		if (requestedPorts != NULL && requestedPorts[i] != 0) {
+			ovsdbAppend(conn, ",\"ofport_request\":%u", requestedPorts[i]);
+		}
+		ovsdbAppend(conn, "}},{\"op\":\"insert\",\"table\":\"Port\",\"uuid-name\":\"p%zu\",\"row\":{\"interfaces\":[\"named-uuid\",\"i%zu\"],\"name\":", i, i);
+		ovsdbAppendString(conn, intfNames[i]);
+		ovsdbAppend(conn, "}}");
+	}
+	ovsdbAppend(conn, ",{\"op\":\"mutate\",\"table\":\"Bridge\",\"where\":[[\"name\",\"==\",");
+	ovsdbAppendString(conn, bridge);
+	ovsdbAppend(conn, "]],\"mutations\":[[\"ports\",\"insert\",[\"set\",[");
+	for (size_t i = 0; i < count; ++i) {
+		ovsdbAppend(conn, "%s[\"named-uuid\",\"p%zu\"]", (i == 0 ? "" : ","), i);
+	}
+	ovsdbAppend(conn, "]]]]}");
+
+	ovsdbAppendCfgRequest(conn);
+	return ovsdbCommitAndWait(conn, (long)(waitCount + 2 * count), "Open vSwitch bridge '%s' does not exist\n", bridge);
+}
+
+int ovsdbGetInterfacePorts(ovsdbConn* conn, const char* const intfNames[], size_t count, uint32_t ports[]) {
+	if (count < 1) return 0;
+
+	ovsdbBeginTransact(conn);
+	for (size_t i = 0; i < count; ++i) {
+		ovsdbAppend(conn, ",{\"op\":\"select\",\"table\":\"Interface\",\"columns\":[\"ofport\"],\"where\":[[\"name\",\"==\",");
+		ovsdbAppendString(conn, intfNames[i]);
+		ovsdbAppend(conn, "]]}");
+	}
+
+	jsonValue reply;
+	const jsonValue* results;
+	int err = ovsdbCommit(conn, &reply, &results);
+	if (err != 0) return err;
+
+	for (size_t i = 0; i < count; ++i) {
+		// ovs-vswitchd reports -1 if it failed to open the interface
+		int64_t port = (i < results->count ? ovsdbSelectedInt(&results->items[i], "ofport") : -1);
+		if (port < 1 || port > UINT32_MAX) {
+			lprintf(LogError, "Open vSwitch did not assign a port number to interface '%s'\n", intfNames[i]);
+			err = 1;
+			break;
+		}
+		ports[i] = (uint32_t)port;
+	}
+
+	jsonFree(&reply);
+	return err;
+}
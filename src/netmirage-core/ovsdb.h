@@ -0,0 +1,76 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module implements a minimal client for the OVSDB management protocol
+// (RFC 7047). It speaks JSON-RPC directly to ovsdb-server over its UNIX socket,
+// which avoids spawning an ovs-vsctl process for every database change. Each
+// operation is performed in a single transaction, after which the client waits
+// once for ovs-vswitchd to apply the new configuration. This module is not
+// thread-safe, but it does not depend on the active network namespace.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct ovsdbConn ovsdbConn;
+
+// Connects to the ovsdb-server listening on the given UNIX socket. Returns a
+// new connection on success. If an error occurs, returns NULL and sets err to
+// the error code (if err is not NULL).
+ovsdbConn* ovsdbConnect(const char* socketPath, int* err);
+
+// Closes a connection and frees its resources.
+void ovsdbClose(ovsdbConn* conn);
+
+// Adds a new bridge, along with its internal port and interface. The bridge
+// accepts OpenFlow 1.0 (used by ovs-ofctl by default) and OpenFlow 1.3 (used by
+// the openflow module). Returns 0 on success or an error code otherwise.
+int ovsdbAddBridge(ovsdbConn* conn, const char* name);
+
+// Deletes a bridge and all of its ports. Deleting a bridge that does not exist
+// is not an error. Returns 0 on success or an error code otherwise.
+int ovsdbDelBridge(ovsdbConn* conn, const char* name);
+
+// Removes all ports from a bridge except for its internal port. Returns 0 on
+// success or an error code otherwise.
+int ovsdbClearPorts(ovsdbConn* conn, const char* bridge);
+
+// Requests a new MTU for an interface. Returns 0 on success or an error code
+// otherwise.
+int ovsdbSetInterfaceMtu(ovsdbConn* conn, const char* intfName, int mtu);
+
+// Sets entries in the other_config column of the root configuration, which
+// tunes the behavior of ovs-vswitchd. Existing values for the keys are
+// replaced. Returns 0 on success or an error code otherwise.
+int ovsdbSetOtherConfig(ovsdbConn* conn, const char* const keys[], const char* const values[], size_t count);
+
+// Adds system interfaces to a bridge as new ports. All of the ports are added
+// in a single transaction. If requestedPorts is not NULL, then its non-zero
+// entries are requested as the port numbers for the corresponding interfaces.
+// The transaction fails if a requested number is already used or requested by
+// another interface, so successfully added ports always have the numbers that
+// were requested. Returns 0 on success or an error code otherwise.
+int ovsdbAddPorts(ovsdbConn* conn, const char* bridge, const char* const intfNames[], const uint32_t requestedPorts[], size_t count);
+
+// Looks up the OpenFlow port numbers that the switch assigned to interfaces.
+// ports must have space for count entries. Returns 0 on success or an error
+// code otherwise.
+int ovsdbGetInterfacePorts(ovsdbConn* conn, const char* const intfNames[], size_t count, uint32_t ports[]);
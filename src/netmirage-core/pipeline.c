@@ -0,0 +1,237 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "pipeline.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "mem.h"
+#include "spscqueue.h"
+
+// Batches are handed over once they reach either limit. Batching keeps the
+// synchronization cost per record negligible.
+static const size_t BatchRecords = 1024;
+static const size_t BatchNameBytes = 1024 * 64;
+
+// Number of batches in circulation. This bounds the amount of parsed data that
+// can be waiting for the consumer.
+#define PIPELINE_BATCHES 16
+
+typedef struct {
+	bool isLink;
+	size_t name;       // Offset of the node name or link source in the batch
+	size_t nameLen;
+	size_t target;     // Offset of the link target in the batch
+	size_t targetLen;
+	float weight;
+	union {
+		TopoNode node;
+		TopoLink link;
+	};
+} plRecord;
+
+typedef struct {
+	plRecord* records;
+	size_t recordCount;
+	size_t recordCap;
+
+	char* names; // NUL-terminated names referenced by the records
+	size_t namesLen;
+	size_t namesCap;
+
+	bool last;      // Set on the final batch of a run
+	int parseError; // Result of the parser, valid in the final batch
+} plBatch;
+
+typedef struct {
+	plParseFunc parse;
+	void* arg;
+
+	spscQueue* filled; // Parser => consumer
+	spscQueue* empty;  // Consumer => parser
+	plBatch* current;  // Batch being filled by the parser
+
+	// Set by the consumer when a callback fails, so that the parser stops
+	bool aborted;
+
+	uint64_t records;
+} plPipeline;
+
+// Called by the parser thread. Passes the current batch to the consumer and
+// takes an empty one.
+static void plFlush(plPipeline* pl) {
+	spscPush(pl->filled, pl->current);
+	pl->current = spscPop(pl->empty);
+	pl->current->recordCount = 0;
+	pl->current->namesLen = 0;
+}
+
+// Called by the parser thread. Copies a name into the current batch and
+// returns its offset.
+static size_t plStoreName(plBatch* batch, const char* name, size_t len) {
+	flexBufferGrow((void**)&batch->names, batch->namesLen, &batch->namesCap, len + 1, 1);
+	size_t offset = batch->namesLen;
+	memcpy(&batch->names[offset], name, len);
+	batch->names[offset + len] = '\0';
+	batch->namesLen += len + 1;
+	return offset;
+}
+
+// Called by the parser thread. Returns a new record in the current batch.
+static plRecord* plNewRecord(plPipeline* pl) {
+	plBatch* batch = pl->current;
+	if (batch->recordCount >= BatchRecords || batch->namesLen >= BatchNameBytes) {
+		plFlush(pl);
+		batch = pl->current;
+	}
+	flexBufferGrow((void**)&batch->records, batch->recordCount, &batch->recordCap, 1, sizeof(plRecord));
+	++pl->records;
+	return &batch->records[batch->recordCount++];
+}
+
+static int plQueueNode(const GmlNode* node, void* userData) {
+	plPipeline* pl = userData;
+	if (__atomic_load_n(&pl->aborted, __ATOMIC_RELAXED)) return 1;
+	plRecord* record = plNewRecord(pl);
+	record->isLink = false;
+	record->name = plStoreName(pl->current, node->name, node->nameLen);
+	record->nameLen = node->nameLen;
+	record->node = node->t;
+	return 0;
+}
+
+static int plQueueLink(const GmlLink* link, void* userData) {
+	plPipeline* pl = userData;
+	if (__atomic_load_n(&pl->aborted, __ATOMIC_RELAXED)) return 1;
+	plRecord* record = plNewRecord(pl);
+	record->isLink = true;
+	record->name = plStoreName(pl->current, link->sourceName, link->sourceNameLen);
+	record->nameLen = link->sourceNameLen;
+	record->target = plStoreName(pl->current, link->targetName, link->targetNameLen);
+	record->targetLen = link->targetNameLen;
+	record->weight = link->weight;
+	record->link = link->t;
+	return 0;
+}
+
+// The entry point for the parser thread
+static gpointer plParserThread(gpointer data) {
+	plPipeline* pl = data;
+	int err = pl->parse(&plQueueNode, &plQueueLink, pl, pl->arg);
+	pl->current->last = true;
+	pl->current->parseError = err;
+	spscPush(pl->filled, pl->current);
+	pl->current = NULL;
+	return NULL;
+}
+
+// Called by the consumer. Passes the records in a batch to the callbacks.
+static int plDeliver(const plBatch* batch, NewNodeFunc newNode, NewLinkFunc newLink, void* userData) {
+	for (size_t i = 0; i < batch->recordCount; ++i) {
+		const plRecord* record = &batch->records[i];
+		int err;
+		if (record->isLink) {
+			GmlLink link = {
+				.sourceName = &batch->names[record->name],
+				.sourceNameLen = record->nameLen,
+				.targetName = &batch->names[record->target],
+				.targetNameLen = record->targetLen,
+				.weight = record->weight,
+				.t = record->link,
+			};
+			err = newLink(&link, userData);
+		} else {
+			GmlNode node = {
+				.name = &batch->names[record->name],
+				.nameLen = record->nameLen,
+				.t = record->node,
+			};
+			err = newNode(&node, userData);
+		}
+		if (err != 0) return err;
+	}
+	return 0;
+}
+
+int plRun(plParseFunc parse, void* arg, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, plStats* stats) {
+	gint64 startTime = g_get_monotonic_time();
+
+	plPipeline pl = {
+		.parse = parse,
+		.arg = arg,
+		.filled = spscNewQueue(PIPELINE_BATCHES),
+		.empty = spscNewQueue(PIPELINE_BATCHES),
+		.aborted = false,
+		.records = 0,
+	};
+	plBatch batches[PIPELINE_BATCHES];
+	for (size_t i = 0; i < PIPELINE_BATCHES; ++i) {
+		plBatch* batch = &batches[i];
+		flexBufferInit((void**)&batch->records, &batch->recordCount, &batch->recordCap);
+		flexBufferInit((void**)&batch->names, &batch->namesLen, &batch->namesCap);
+		batch->last = false;
+		if (i == 0) pl.current = batch;
+		else spscPush(pl.empty, batch);
+	}
+
+	GThread* parser = g_thread_new("TopologyParser", &plParserThread, &pl);
+
+	// Consume batches until the parser finishes. After a callback fails, the
+	// remaining batches are discarded so that the parser can run to completion.
+	int err = 0;
+	uint64_t consumerTime = 0;
+	bool finished = false;
+	while (!finished) {
+		plBatch* batch = spscPop(pl.filled);
+		if (err == 0) {
+			gint64 deliverStart = g_get_monotonic_time();
+			err = plDeliver(batch, newNode, newLink, userData);
+			consumerTime += (uint64_t)(g_get_monotonic_time() - deliverStart);
+			if (err != 0) __atomic_store_n(&pl.aborted, true, __ATOMIC_RELAXED);
+		}
+		finished = batch->last;
+		if (finished) {
+			if (err == 0) err = batch->parseError;
+		} else {
+			spscPush(pl.empty, batch);
+		}
+	}
+	g_thread_join(parser);
+
+	if (stats != NULL) {
+		stats->records = pl.records;
+		stats->totalTime = (uint64_t)(g_get_monotonic_time() - startTime);
+		uint64_t unused;
+		spscStallTime(pl.empty, &unused, &stats->parserStall);
+		spscStallTime(pl.filled, &unused, &stats->consumerStall);
+		stats->consumerTime = consumerTime;
+	}
+
+	for (size_t i = 0; i < PIPELINE_BATCHES; ++i) {
+		flexBufferFree((void**)&batches[i].records, &batches[i].recordCount, &batches[i].recordCap);
+		flexBufferFree((void**)&batches[i].names, &batches[i].namesLen, &batches[i].namesCap);
+	}
+	spscFreeQueue(pl.filled);
+	spscFreeQueue(pl.empty);
+	return err;
+}
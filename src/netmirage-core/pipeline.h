@@ -0,0 +1,51 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module runs a topology parser on its own thread, so that parsing
+// overlaps with the processing of the nodes and links that it produces. Parsed
+// records are copied into batches that are passed to the calling thread
+// through a bounded single-producer, single-consumer queue. If the caller falls
+// behind, the parser blocks until a batch is released. The callbacks are always
+// invoked on the calling thread, in the order that the parser produced them.
+
+#include <stdint.h>
+
+#include "graphml.h"
+
+// Parses a topology, passing the results to newNode and newLink with the given
+// userData. arg is the argument given to plRun. Returns 0 for success.
+typedef int (*plParseFunc)(NewNodeFunc newNode, NewLinkFunc newLink, void* userData, void* arg);
+
+// Throughput counters for each stage of the pipeline. Times are in
+// microseconds.
+typedef struct {
+	uint64_t records;      // Nodes and links passed through the pipeline
+	uint64_t totalTime;    // Wall time for the whole run
+	uint64_t parserStall;  // Time that the parser waited for a free batch
+	uint64_t consumerStall; // Time that the caller waited for parsed batches
+	uint64_t consumerTime; // Time spent in the callbacks
+} plStats;
+
+// Runs parse with arg on a new thread, and invokes newNode and newLink on the
+// calling thread for each of the parsed records. If a callback fails, parsing
+// is terminated and its return value is returned. If stats is not NULL, it is
+// filled with the throughput counters for the run. Returns 0 for success.
+int plRun(plParseFunc parse, void* arg, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, plStats* stats);
@@ -32,11 +32,17 @@
 
 #include <glib.h>
 
+#include "edgelist.h"
 #include "graphml.h"
 #include "ip.h"
 #include "log.h"
 #include "mem.h"
+#include "modelnet.h"
+#include "nametable.h"
+#include "ovs.h"
+#include "pipeline.h"
 #include "routeplanner.h"
+#include "topofile.h"
 #include "topology.h"
 #include "work.h"
 
@@ -67,7 +73,27 @@ int setupInit(void) {
 int setupConfigure(const setupParams* params) {
 	globalParams = params;
 
-	DO_OR_RETURN(workConfigure(logThreshold(), logColorized(), params->nsPrefix, params->ovsDir, params->ovsSchema, params->softMemCap));
+	// We determine the Open vSwitch version once here rather than in every
+	// worker, since probing it requires running all of the OVS tools. The
+	// Traffic Control switch does not use Open vSwitch at all.
+	bool ovsValidVer = false;
+	unsigned int ovsMajor = 0, ovsMinor = 0;
+	if (params->switchBackend == SwitchOvs) {
+		char* ovsVer = ovsVersion(params->ovsDir, &ovsValidVer, &ovsMajor, &ovsMinor);
+		if (ovsVer == NULL) {
+			lprintln(LogError, "Open vSwitch is not installed, is not accessible, or was not recognized. Ensure that Open vSwitch is installed and is accessible using the system PATH.");
+			return 1;
+		}
+		lprintf(LogDebug, "Using Open vSwitch version '%s'\n", ovsVer);
+		if (!ovsValidVer || ovsMajor < 2 || (ovsMajor == 2 && ovsMinor < 1)) {
+			lprintf(LogWarning, "This program requires Open vSwitch 2.1.0 or later. You are using version '%s', which appears to be older. If an error occurs while setting up the switch, you will need to upgrade your version of Open vSwitch.\n", ovsVer);
+		}
+		free(ovsVer);
+	} else {
+		lprintln(LogDebug, "Using a Traffic Control switch in the root namespace");
+	}
+
+	DO_OR_RETURN(workConfigure(logThreshold(), logColorized(), params->nsPrefix, params->ovsDir, params->ovsSchema, params->softMemCap, params->nsPool, params->switchBackend, params->switchPipeline, params->keepSwitch, ovsValidVer, ovsMajor, ovsMinor));
 	DO_OR_RETURN(workJoin(false));
 
 	if (params->destroyOnly) {
@@ -193,8 +219,14 @@ int setupCleanup(void) {
 int destroyNetwork(void) {
 	DO_OR_RETURN(workJoin(true));
 	lprintf(LogInfo, "Destroying any existing virtual network with namespace prefix '%s'\n", globalParams->nsPrefix);
-	DO_OR_RETURN(workDestroyHosts());
-	DO_OR_RETURN(workJoin(false));
+
+	gint64 startTime = g_get_monotonic_time();
+	uint32_t deletedHosts = 0;
+	DO_OR_RETURN(workDestroyHosts(&deletedHosts));
+	if (deletedHosts > 0) {
+		double seconds = (double)(g_get_monotonic_time() - startTime) / 1000000.0;
+		lprintf(LogInfo, "Destroyed an existing virtual network with %u hosts in %.2f seconds (%.0f hosts per second)\n", deletedHosts, seconds, (double)deletedHosts / seconds);
+	}
 
 	return 0;
 }
@@ -211,17 +243,44 @@ typedef struct {
 	macAddr clientMacs[NEEDED_MACS_CLIENT];
 } gmlNodeState;
 
+// Links that are read before all of the nodes are known are stored in this
+// compact form until they can be added. Each endpoint is either the identifier
+// of a known node, or the index of a pending name (marked by PendingNameBit).
+typedef struct {
+	uint32_t source;
+	uint32_t target;
+	float weight;
+	TopoLink t;
+} gmlBufferedLink;
+
+static const uint32_t PendingNameBit = 0x80000000U;
+
+// Number of buffered links read back from the spill file at a time
+static const size_t SpillReadChunk = 4096;
+
 typedef struct {
 	bool finishedNodes;
 	bool ignoreNodes;
 	bool ignoreEdges;
 
+	// State for buffering links when nodes may follow them in the file
+	bool bufferLinks;
+	gmlBufferedLink* links; // Buffered links that have not been spilled
+	size_t linkCount;
+	size_t linkCap;
+	FILE* linkSpill;        // Temporary file holding earlier buffered links
+	uint64_t spilledLinks;
+	nameTable* pendingNames; // Maps names not yet seen as nodes to indices
+	const char** pendingNameList; // Interned in pendingNames
+	size_t pendingNameCount;
+	size_t pendingNameCap;
+
 	// Variable-sized buffer for storing all node states
 	gmlNodeState* nodeStates;
 	size_t nodeCount;   // Total number of nodes (client + non-client)
 	size_t clientNodes; // Total number of client nodes
 	size_t nodeCap;
-	GHashTable* gmlToState; // Maps GraphML names to indices in nodeStates
+	nameTable* gmlToState; // Maps GraphML names to indices in nodeStates
 
 	int mtu;
 
@@ -234,9 +293,9 @@ typedef struct {
 	macAddr macAddrIter;
 
 	routePlanner* routes;
-} gmlContext;
 
-static void gmlFreeData(gpointer data) { free(data); }
+	topoWriter* compiled; // Records the topology if it is being saved
+} gmlContext;
 
 static void gmlGenerateIp(gmlContext* ctx, bool* addrExhausted, ip4Addr* addr) {
 	if (*addrExhausted) return;
@@ -252,12 +311,11 @@ static void gmlGenerateIp(gmlContext* ctx, bool* addrExhausted, ip4Addr* addr) {
 // created and cached. Otherwise, an error occurs. Returns true on success, in
 // which case "id" and "state" are set. Otherwise, returns false and their
 // values are undefined.
-static bool gmlNameToState(gmlContext* ctx, const char* name, const TopoNode* node, nodeId* id, gmlNodeState** state) {
-	gpointer ptr;
-	gboolean exists = g_hash_table_lookup_extended(ctx->gmlToState, name, NULL, &ptr);
-	size_t index = GPOINTER_TO_SIZE(ptr);
-	*state = &ctx->nodeStates[index];
-	if (!exists) {
+static bool gmlNameToState(gmlContext* ctx, const char* name, size_t nameLen, const TopoNode* node, nodeId* id, gmlNodeState** state) {
+	uint32_t index;
+	if (ntLookup(ctx->gmlToState, name, nameLen, &index)) {
+		*state = &ctx->nodeStates[index];
+	} else {
 		if (node == NULL) {
 			lprintf(LogError, "Requested existing state for unknown host '%s'\n", name);
 			return NULL;
@@ -270,10 +328,10 @@ static bool gmlNameToState(gmlContext* ctx, const char* name, const TopoNode* no
 			return NULL;
 		}
 
-		index = ctx->nodeCount++;
+		index = (uint32_t)ctx->nodeCount++;
 
 		flexBufferGrow((void**)&ctx->nodeStates, ctx->nodeCount, &ctx->nodeCap, 1, sizeof(gmlNodeState));
-		g_hash_table_insert(ctx->gmlToState, (gpointer)strdup(name), GSIZE_TO_POINTER(index));
+		ntInsert(ctx->gmlToState, name, nameLen, index);
 
 		*state = &ctx->nodeStates[index];
 		(*state)->addr = newAddr;
@@ -287,13 +345,13 @@ static int gmlAddNode(const GmlNode* node, void* userData) {
 	gmlContext* ctx = userData;
 	if (ctx->ignoreNodes) return 0;
 	if (ctx->finishedNodes) {
-		lprintln(LogError, "The GraphML file contains some <node> elements after the <edge> elements. To parse this file, use the --two-pass option.");
+		lprintln(LogError, "The GraphML file contains some <node> elements after the <edge> elements. To parse this file, use the --buffer-edges or --two-pass option.");
 		return 1;
 	}
 
 	nodeId id;
 	gmlNodeState* state;
-	if (!gmlNameToState(ctx, node->name, &node->t, &id, &state)) return 1;
+	if (!gmlNameToState(ctx, node->name, node->nameLen, &node->t, &id, &state)) return 1;
 
 	if (node->t.client) {
 		if (!macNextAddrs(&ctx->macAddrIter, state->clientMacs, NEEDED_MACS_CLIENT)) {
@@ -309,6 +367,10 @@ static int gmlAddNode(const GmlNode* node, void* userData) {
 		lprintf(LogDebug, "GraphML node '%s' assigned identifier %u and IP address %s\n", node->name, id, ip);
 	}
 
+	if (ctx->compiled != NULL) {
+		DO_OR_RETURN(topoWriterAddNode(ctx->compiled, id, node->name, &node->t));
+	}
+
 	DO_OR_RETURN(workAddHost(id, state->addr, state->clientMacs, ctx->mtu, &node->t));
 	return 0;
 }
@@ -316,6 +378,7 @@ static int gmlAddNode(const GmlNode* node, void* userData) {
 static int gmlOnFinishedNodes(gmlContext* ctx) {
 	lprintln(LogInfo, "Host creation complete. Now adding virtual ethernet connections.");
 	lprintf(LogDebug, "Encountered %u nodes (%u clients)\n", ctx->nodeCount, ctx->clientNodes);
+	lprintf(LogDebug, "Node name table uses %lu bytes (memory limit: %lu bytes)\n", (unsigned long)ntMemoryUse(ctx->gmlToState), (unsigned long)globalParams->softMemCap);
 	if (ctx->clientNodes < globalParams->edgeNodeCount) {
 		lprintf(LogError, "There are fewer client nodes in the topology (%u) than edges nodes (%u). Either use a larger topology, or decrease the number of edge nodes.\n", ctx->clientNodes, globalParams->edgeNodeCount);
 		return 1;
@@ -323,7 +386,7 @@ static int gmlOnFinishedNodes(gmlContext* ctx) {
 
 	uint64_t worstCaseLinkCount = (uint64_t)ctx->nodeCount * (uint64_t)ctx->nodeCount;
 	DO_OR_RETURN(workJoin(false));
-	DO_OR_RETURN(workEnsureSystemScaling(worstCaseLinkCount, (nodeId)ctx->nodeCount, (nodeId)ctx->clientNodes));
+	DO_OR_RETURN(workEnsureSystemScaling(worstCaseLinkCount, (nodeId)ctx->nodeCount, (nodeId)ctx->clientNodes, globalParams->ovsTuning));
 	DO_OR_RETURN(workJoin(false));
 
 	ctx->clientsPerEdge = (double)ctx->clientNodes / (double)globalParams->edgeNodeCount;
@@ -331,25 +394,18 @@ static int gmlOnFinishedNodes(gmlContext* ctx) {
 	return 0;
 }
 
-static int gmlAddLink(const GmlLink* link, void* userData) {
-	gmlContext* ctx = userData;
+// Adds a link between two known nodes. The weight must not be negative.
+static int gmlAddResolvedLink(gmlContext* ctx, nodeId sourceId, nodeId targetId, float weight, const TopoLink* t) {
+	gmlNodeState* sourceState = &ctx->nodeStates[sourceId];
+	gmlNodeState* targetState = &ctx->nodeStates[targetId];
 
-	if (ctx->ignoreEdges) return 0;
-	if (!ctx->finishedNodes) {
-		ctx->finishedNodes = true;
-		int res = gmlOnFinishedNodes(ctx);
-		if (res != 0) return res;
+	if (ctx->compiled != NULL) {
+		DO_OR_RETURN(topoWriterAddLink(ctx->compiled, sourceId, targetId, weight, t));
 	}
 
-	nodeId sourceId, targetId;
-	gmlNodeState* sourceState;
-	gmlNodeState* targetState;
-	if (!gmlNameToState(ctx, link->sourceName, NULL, &sourceId, &sourceState)) return 1;
-	if (!gmlNameToState(ctx, link->targetName, NULL, &targetId, &targetState)) return 1;
-
 	if (sourceId == targetId) {
 		if (sourceState->isClient) {
-			DO_OR_RETURN(workSetSelfLink(sourceId, &link->t));
+			DO_OR_RETURN(workSetSelfLink(sourceId, t));
 		}
 	} else {
 		macAddr macs[NEEDED_MACS_LINK];
@@ -357,18 +413,219 @@ static int gmlAddLink(const GmlLink* link, void* userData) {
 			lprintln(LogError, "Ran out of MAC addresses when adding a new virtual ethernet connection.");
 			return 1;
 		}
-		DO_OR_RETURN(workAddLink(sourceId, targetId, sourceState->addr, targetState->addr, macs, ctx->mtu, &link->t));
-		if (link->weight < 0.f) {
-			lprintf(LogError, "The link from '%s' to '%s' in the topology has negative weight %f, which is not supported.\n", link->sourceName, link->targetName, link->weight);
+		DO_OR_RETURN(workAddLink(sourceId, targetId, sourceState->addr, targetState->addr, macs, ctx->mtu, t));
+		rpSetWeight(ctx->routes, sourceId, targetId, weight);
+		rpSetWeight(ctx->routes, targetId, sourceId, weight);
+	}
+	return 0;
+}
+
+// Determines the buffered form of a link endpoint. Names that have not been
+// seen as nodes yet are recorded so that they can be resolved later.
+static bool gmlBufferEndpoint(gmlContext* ctx, const char* name, size_t nameLen, uint32_t* endpoint) {
+	uint32_t value;
+	if (ntLookup(ctx->gmlToState, name, nameLen, &value)) {
+		*endpoint = value;
+		return true;
+	}
+	if (ntLookup(ctx->pendingNames, name, nameLen, &value)) {
+		*endpoint = PendingNameBit | value;
+		return true;
+	}
+	if (ctx->pendingNameCount >= PendingNameBit) {
+		lprintln(LogError, "The GraphML file contains too many links to nodes that appear later in the file.");
+		return false;
+	}
+
+	size_t index = ctx->pendingNameCount;
+	const char* copy = ntInsert(ctx->pendingNames, name, nameLen, (uint32_t)index);
+	flexBufferGrow((void**)&ctx->pendingNameList, ctx->pendingNameCount, &ctx->pendingNameCap, 1, sizeof(char*));
+	flexBufferAppend(ctx->pendingNameList, &ctx->pendingNameCount, &copy, 1, sizeof(char*));
+	*endpoint = PendingNameBit | (uint32_t)index;
+	return true;
+}
+
+// Stores a link until all nodes are known. If the buffer grows beyond the
+// memory limit, its contents are moved to a temporary file.
+static int gmlBufferLink(gmlContext* ctx, const GmlLink* link) {
+	gmlBufferedLink buffered;
+	if (!gmlBufferEndpoint(ctx, link->sourceName, link->sourceNameLen, &buffered.source)) return 1;
+	if (!gmlBufferEndpoint(ctx, link->targetName, link->targetNameLen, &buffered.target)) return 1;
+	buffered.weight = link->weight;
+	buffered.t = link->t;
+
+	if ((ctx->linkCount+1) * sizeof(gmlBufferedLink) > globalParams->softMemCap && ctx->linkCount > 0) {
+		if (ctx->linkSpill == NULL) {
+			errno = 0;
+			ctx->linkSpill = tmpfile();
+			if (ctx->linkSpill == NULL) {
+				lprintf(LogError, "Could not create a temporary file for buffering links: %s\n", strerror(errno));
+				return errno;
+			}
+			lprintln(LogInfo, "The buffered links exceed the memory limit. The remaining links will be buffered in a temporary file.");
+		}
+		if (fwrite(ctx->links, sizeof(gmlBufferedLink), ctx->linkCount, ctx->linkSpill) != ctx->linkCount) {
+			lprintln(LogError, "Could not write buffered links to the temporary file");
 			return 1;
-		} else {
-			rpSetWeight(ctx->routes, sourceId, targetId, link->weight);
-			rpSetWeight(ctx->routes, targetId, sourceId, link->weight);
 		}
+		ctx->spilledLinks += ctx->linkCount;
+		ctx->linkCount = 0;
 	}
+
+	flexBufferGrow((void**)&ctx->links, ctx->linkCount, &ctx->linkCap, 1, sizeof(gmlBufferedLink));
+	flexBufferAppend(ctx->links, &ctx->linkCount, &buffered, 1, sizeof(gmlBufferedLink));
 	return 0;
 }
 
+// Adds a batch of buffered links. pendingIds contains the resolved identifiers
+// of the pending names.
+static int gmlAddBufferedLinks(gmlContext* ctx, const gmlBufferedLink* links, size_t count, const nodeId* pendingIds) {
+	for (size_t i = 0; i < count; ++i) {
+		const gmlBufferedLink* link = &links[i];
+		nodeId sourceId = (link->source & PendingNameBit) ? pendingIds[link->source & ~PendingNameBit] : link->source;
+		nodeId targetId = (link->target & PendingNameBit) ? pendingIds[link->target & ~PendingNameBit] : link->target;
+		DO_OR_RETURN(gmlAddResolvedLink(ctx, sourceId, targetId, link->weight, &link->t));
+	}
+	return 0;
+}
+
+// Adds all buffered links once the nodes are complete. Links are added in the
+// order in which they appeared in the file.
+static int gmlAddAllBufferedLinks(gmlContext* ctx) {
+	uint64_t total = ctx->spilledLinks + ctx->linkCount;
+	if (total == 0) return 0;
+	lprintf(LogDebug, "Adding %lu buffered links (%lu from the temporary file)\n", (unsigned long)total, (unsigned long)ctx->spilledLinks);
+
+	int err = 0;
+	nodeId* pendingIds = eamalloc(ctx->pendingNameCount, sizeof(nodeId), 0);
+	for (size_t i = 0; i < ctx->pendingNameCount; ++i) {
+		nodeId id;
+		gmlNodeState* state;
+		if (!gmlNameToState(ctx, ctx->pendingNameList[i], strlen(ctx->pendingNameList[i]), NULL, &id, &state)) {
+			err = 1;
+			goto cleanup;
+		}
+		pendingIds[i] = id;
+	}
+
+	if (ctx->linkSpill != NULL) {
+		rewind(ctx->linkSpill);
+		gmlBufferedLink* chunk = eamalloc(SpillReadChunk, sizeof(gmlBufferedLink), 0);
+		uint64_t remaining = ctx->spilledLinks;
+		while (remaining > 0 && err == 0) {
+			size_t toRead = (remaining < SpillReadChunk ? (size_t)remaining : SpillReadChunk);
+			if (fread(chunk, sizeof(gmlBufferedLink), toRead, ctx->linkSpill) != toRead) {
+				lprintln(LogError, "Could not read buffered links from the temporary file");
+				err = 1;
+				break;
+			}
+			err = gmlAddBufferedLinks(ctx, chunk, toRead, pendingIds);
+			remaining -= toRead;
+		}
+		free(chunk);
+		if (err != 0) goto cleanup;
+	}
+
+	err = gmlAddBufferedLinks(ctx, ctx->links, ctx->linkCount, pendingIds);
+
+cleanup:
+	free(pendingIds);
+	return err;
+}
+
+static int gmlAddLink(const GmlLink* link, void* userData) {
+	gmlContext* ctx = userData;
+
+	if (ctx->ignoreEdges) return 0;
+	if (link->weight < 0.f) {
+		lprintf(LogError, "The link from '%s' to '%s' in the topology has negative weight %f, which is not supported.\n", link->sourceName, link->targetName, link->weight);
+		return 1;
+	}
+	if (ctx->bufferLinks) return gmlBufferLink(ctx, link);
+	if (!ctx->finishedNodes) {
+		ctx->finishedNodes = true;
+		int res = gmlOnFinishedNodes(ctx);
+		if (res != 0) return res;
+	}
+
+	nodeId sourceId, targetId;
+	gmlNodeState* sourceState;
+	gmlNodeState* targetState;
+	if (!gmlNameToState(ctx, link->sourceName, link->sourceNameLen, NULL, &sourceId, &sourceState)) return 1;
+	if (!gmlNameToState(ctx, link->targetName, link->targetNameLen, NULL, &targetId, &targetState)) return 1;
+
+	return gmlAddResolvedLink(ctx, sourceId, targetId, link->weight, &link->t);
+}
+
+// Ways of reading the topology source
+typedef enum {
+	GmlSourceCompiled,
+	GmlSourceMapped,
+	GmlSourceFile,
+	GmlSourceStdin,
+	GmlSourceEdgeList,
+	GmlSourceModelNet,
+} gmlSourceKind;
+
+typedef struct {
+	gmlSourceKind kind;
+	const setupGraphMLParams* gmlParams;
+} gmlSource;
+
+// Parses the topology source. Runs on the pipeline's parser thread.
+static int gmlParseSource(NewNodeFunc newNode, NewLinkFunc newLink, void* userData, void* arg) {
+	const gmlSource* source = arg;
+	const char* clientType = source->gmlParams->clientType;
+	const char* weightKey = source->gmlParams->weightKey;
+	switch (source->kind) {
+	case GmlSourceCompiled: return topoParseFile(globalParams->srcFile, newNode, newLink, userData);
+	case GmlSourceMapped: return gmlParseFileMapped(globalParams->srcFile, newNode, newLink, userData, clientType, weightKey);
+	case GmlSourceFile: return gmlParseFile(globalParams->srcFile, newNode, newLink, userData, clientType, weightKey);
+	case GmlSourceStdin: return gmlParse(stdin, newNode, newLink, userData, clientType, weightKey);
+	case GmlSourceEdgeList:
+		if (globalParams->srcFile) return elParseFile(globalParams->srcFile, newNode, newLink, userData, clientType, weightKey);
+		return elParse(stdin, newNode, newLink, userData, clientType, weightKey);
+	case GmlSourceModelNet:
+		if (globalParams->srcFile) return mnParseFile(globalParams->srcFile, newNode, newLink, userData);
+		return mnParse(stdin, newNode, newLink, userData);
+	}
+	return 1;
+}
+
+// Computes the number of records per second processed by a pipeline stage
+static double gmlStageRate(uint64_t records, uint64_t busyMicros) {
+	if (busyMicros == 0) busyMicros = 1;
+	return (double)records * 1000000.0 / (double)busyMicros;
+}
+
+// Reads the topology source on a separate thread, while the nodes and links
+// are passed to the workers on this one
+static int gmlReadTopology(gmlContext* ctx, gmlSourceKind kind, const setupGraphMLParams* gmlParams) {
+	gmlSource source = { .kind = kind, .gmlParams = gmlParams };
+	uint64_t ordersBefore, orderStallBefore;
+	workGetOrderStats(&ordersBefore, &orderStallBefore);
+
+	plStats stats;
+	int err = plRun(&gmlParseSource, &source, &gmlAddNode, &gmlAddLink, ctx, &stats);
+
+	if (PASSES_LOG_THRESHOLD(LogDebug)) {
+		uint64_t orders, orderStall;
+		workGetOrderStats(&orders, &orderStall);
+		orders -= ordersBefore;
+		orderStall -= orderStallBefore;
+
+		// Each stage's rate is measured over the time that it was not waiting
+		// for another stage. The slowest stage waits the least.
+		uint64_t parserBusy = stats.totalTime - stats.parserStall;
+		uint64_t dispatchBusy = stats.consumerTime - orderStall;
+		lprintf(LogDebug, "Topology pipeline handled %lu records in %.3f s\n", (unsigned long)stats.records, (double)stats.totalTime / 1000000.0);
+		lprintf(LogDebug, "  Parser:     %.0f records/s, waited %.3f s for the dispatcher\n", gmlStageRate(stats.records, parserBusy), (double)stats.parserStall / 1000000.0);
+		lprintf(LogDebug, "  Dispatcher: %.0f records/s, waited %.3f s for the parser\n", gmlStageRate(stats.records, dispatchBusy), (double)stats.consumerStall / 1000000.0);
+		lprintf(LogDebug, "  Workers:    %lu orders queued, dispatcher waited %.3f s for the workers\n", (unsigned long)orders, (double)orderStall / 1000000.0);
+	}
+	return err;
+}
+
 static bool gmlNextEdge(gmlContext* ctx) {
 	if (ctx->clientIter == NULL) {
 		ctx->currentEdgeIdx = 0;
@@ -447,24 +704,38 @@ static bool gmlNextClientSubnet(gmlContext* ctx, ip4Subnet* subnet) {
 	return true;
 }
 
-int setupGraphML(const setupGraphMLParams* gmlParams) {
-	lprintf(LogInfo, "Reading network topology in GraphML format from %s\n", globalParams->srcFile ? globalParams->srcFile : "<stdin>");
+// Sets up a network from any supported source. format is GmlSourceFile for
+// GraphML, or the kind of another source format. Compiled topologies are
+// detected automatically regardless of the format.
+static int setupTopology(const setupGraphMLParams* gmlParams, gmlSourceKind format, const char* formatName) {
+	lprintf(LogInfo, "Reading network topology in %s format from %s\n", formatName, globalParams->srcFile ? globalParams->srcFile : "<stdin>");
 
 	gmlContext ctx = {
 		.finishedNodes = false,
 		.ignoreNodes = false,
 		.ignoreEdges = false,
 
+		.bufferLinks = gmlParams->bufferLinks,
+		.linkSpill = NULL,
+		.spilledLinks = 0,
+		.pendingNameCount = 0,
+
 		.clientNodes = 0,
 
 		.clientIter = NULL,
 		.macAddrIter = { .octets = { 0 } },
 
 		.routes = NULL,
+
+		.compiled = NULL,
 	};
 	macNextAddr(&ctx.macAddrIter); // Skip all-zeroes address (unassignable)
 	flexBufferInit((void**)&ctx.nodeStates, &ctx.nodeCount, &ctx.nodeCap);
-	ctx.gmlToState = g_hash_table_new_full(&g_str_hash, &g_str_equal, &gmlFreeData, NULL);
+	ctx.gmlToState = ntNewTable(globalParams->softMemCap);
+	flexBufferInit((void**)&ctx.links, &ctx.linkCount, &ctx.linkCap);
+	flexBufferInit((void**)&ctx.pendingNameList, &ctx.pendingNameCount, &ctx.pendingNameCap);
+	ctx.pendingNames = ntNewTable(globalParams->softMemCap);
+	if (gmlParams->saveTopology != NULL) ctx.compiled = topoNewWriter();
 
 	// We assign internal interface addresses from the full IPv4 space, but
 	// avoid the subnets reserved for the edge nodes. The fact that the
@@ -490,7 +761,6 @@ int setupGraphML(const setupGraphMLParams* gmlParams) {
 
 	int err;
 	uint32_t* edgePorts = eamalloc(globalParams->edgeNodeCount, sizeof(uint32_t), 0);
-	uint32_t nextOvsPort = 1;
 
 	ip4Addr rootAddrs[2];
 	for (int i = 0; i < 2; ++i) {
@@ -532,45 +802,35 @@ int setupGraphML(const setupGraphMLParams* gmlParams) {
 		goto cleanup;
 	}
 
+	// The switch in the root namespace starts in the background while the hosts
+	// and links are created. Orders that need the switch wait for it.
 	DO_OR_GOTO(workAddRoot(rootAddrs[0], rootAddrs[1], ctx.mtu, globalParams->rootIsInitNs), cleanup, err);
-	DO_OR_GOTO(workJoin(false), cleanup, err);
-
-	// Move all interfaces associated with edge nodes into the root namespace
-	for (size_t i = 0; i < globalParams->edgeNodeCount; ++i) {
-		edgeNodeParams* edge = &globalParams->edgeNodes[i];
 
-		// Check to see if this is a duplicate interface. We simply perform
-		// linear searches because the number of edge nodes should be relatively
-		// small (typically less than 10).
-		bool duplicateIntf = false;
-		for (size_t j = 0; j < i; ++j) {
-			edgeNodeParams* otherEdge = &globalParams->edgeNodes[j];
-			if (strcmp(edge->intf, otherEdge->intf) == 0) {
-				edgePorts[i] = edgePorts[j];
-				duplicateIntf = true;
-				break;
-			}
-		}
-		if (!duplicateIntf) {
-			DO_OR_GOTO(workAddEdgeInterface(edge->intf), cleanup, err);
-			DO_OR_GOTO(workJoin(false), cleanup, err);
-			edgePorts[i] = nextOvsPort++;
-		}
-
-		macAddr edgeLocalMac;
-		DO_OR_GOTO(workGetEdgeLocalMac(edge->intf, &edgeLocalMac), cleanup, err);
-		DO_OR_GOTO(workAddEdgeRoutes(&edge->vsubnet, edgePorts[i], &edgeLocalMac, &edge->mac), cleanup, err);
+	if (gmlParams->twoPass && gmlParams->bufferLinks) {
+		lprintln(LogError, "The --two-pass and --buffer-edges options cannot be used together.");
+		err = 1;
+		goto cleanup;
 	}
-	DO_OR_GOTO(workJoin(false), cleanup, err);
 
-	if (globalParams->srcFile) {
+	if (globalParams->srcFile && topoIsCompiledFile(globalParams->srcFile)) {
+		// Compiled topologies always list nodes before links
+		lprintln(LogInfo, "The topology file is a compiled topology");
+		err = gmlReadTopology(&ctx, GmlSourceCompiled, gmlParams);
+		if (err != 0) goto cleanup;
+	} else if (format == GmlSourceModelNet) {
+		// ModelNet topologies always list nodes before links
+		err = gmlReadTopology(&ctx, format, gmlParams);
+		if (err != 0) goto cleanup;
+	} else if (globalParams->srcFile) {
 		int passes = gmlParams->twoPass ? 2 : 1;
+		gmlSourceKind kind = format;
+		if (format == GmlSourceFile && gmlParams->mappedScan) kind = GmlSourceMapped;
 
 		// Setup based on number of passes
 		if (passes > 1) ctx.ignoreEdges = true;
 
 		for (int pass = passes; pass > 0; --pass) {
-			err = gmlParseFile(globalParams->srcFile, &gmlAddNode, &gmlAddLink, &ctx, gmlParams->clientType, gmlParams->weightKey);
+			err = gmlReadTopology(&ctx, kind, gmlParams);
 			if (err != 0) goto cleanup;
 
 			// Transitions between passes
@@ -581,18 +841,59 @@ int setupGraphML(const setupGraphMLParams* gmlParams) {
 				ctx.finishedNodes = true;
 				ctx.ignoreNodes = true;
 				ctx.ignoreEdges = false;
+				DO_OR_GOTO(gmlOnFinishedNodes(&ctx), cleanup, err);
 			}
 		}
 	} else {
 		if (gmlParams->twoPass) {
-			lprintln(LogError, "Cannot perform two passes when reading a GraphML file from stdin. Either ensure that all nodes appear before edges, or read from a file.");
+			lprintln(LogError, "Cannot perform two passes when reading a topology from stdin. Either ensure that all nodes appear before edges, use the --buffer-edges option, or read from a file.");
 			err = 1;
 			goto cleanup;
 
 		}
-		err = gmlParse(stdin, &gmlAddNode, &gmlAddLink, &ctx, gmlParams->clientType, gmlParams->weightKey);
+		err = gmlReadTopology(&ctx, format == GmlSourceFile ? GmlSourceStdin : format, gmlParams);
+		if (err != 0) goto cleanup;
+	}
+
+	// With buffering, the links are only added once the whole file was read
+	if (ctx.bufferLinks && (ctx.linkCount > 0 || ctx.spilledLinks > 0)) {
+		ctx.finishedNodes = true;
+		DO_OR_GOTO(gmlOnFinishedNodes(&ctx), cleanup, err);
+		DO_OR_GOTO(gmlAddAllBufferedLinks(&ctx), cleanup, err);
 	}
 
+	if (ctx.compiled != NULL) {
+		DO_OR_GOTO(topoWriterSave(ctx.compiled, gmlParams->saveTopology), cleanup, err);
+	}
+
+	DO_OR_GOTO(workJoin(false), cleanup, err);
+
+	// Move all interfaces associated with edge nodes into the root namespace
+	for (size_t i = 0; i < globalParams->edgeNodeCount; ++i) {
+		edgeNodeParams* edge = &globalParams->edgeNodes[i];
+
+		// Check to see if this is a duplicate interface. We simply perform
+		// linear searches because the number of edge nodes should be relatively
+		// small (typically less than 10).
+		bool duplicateIntf = false;
+		for (size_t j = 0; j < i; ++j) {
+			edgeNodeParams* otherEdge = &globalParams->edgeNodes[j];
+			if (strcmp(edge->intf, otherEdge->intf) == 0) {
+				edgePorts[i] = edgePorts[j];
+				duplicateIntf = true;
+				break;
+			}
+		}
+		if (!duplicateIntf) {
+			// Edge interfaces are numbered by their position, so they never
+			// conflict with the client ports requested below
+			DO_OR_GOTO(workAddEdgeInterface(edge->intf, (uint32_t)i + 1, &edgePorts[i]), cleanup, err);
+		}
+
+		macAddr edgeLocalMac;
+		DO_OR_GOTO(workGetEdgeLocalMac(edge->intf, &edgeLocalMac), cleanup, err);
+		DO_OR_GOTO(workAddEdgeRoutes(&edge->vsubnet, edgePorts[i], &edgeLocalMac, &edge->mac), cleanup, err);
+	}
 	DO_OR_GOTO(workJoin(false), cleanup, err);
 
 	// Host and link construction is finished. Now we set up routing
@@ -605,6 +906,13 @@ int setupGraphML(const setupGraphMLParams* gmlParams) {
 	}
 	rpPlanRoutes(ctx.routes);
 
+	// We compute the switch port numbers for all clients in advance, so that
+	// the workers can add the ports in any order. The two ports for each client
+	// follow the ports for the edge interfaces. If a network is too large for
+	// the available port numbers, the remaining clients are numbered by the
+	// switch instead.
+	uint32_t nextClientPort = (uint32_t)globalParams->edgeNodeCount + 1;
+
 	lprintf(LogDebug, "Assigning %u client nodes to %u edge nodes\n", ctx.clientNodes, globalParams->edgeNodeCount);
 	for (size_t id = 0; id < ctx.nodeCount; ++id) {
 		gmlNodeState* node = &ctx.nodeStates[id];
@@ -620,12 +928,16 @@ int setupGraphML(const setupGraphMLParams* gmlParams) {
 			ip4SubnetToString(&node->clientSubnet, subnet);
 			lprintf(LogDebug, "Assigned client node %u to subnet %s owned by edge %lu\n", id, subnet, edgeIdx);
 		}
-		DO_OR_GOTO(workAddClientRoutes((nodeId)id, node->clientMacs, &node->clientSubnet, edgePorts[edgeIdx], nextOvsPort), cleanup, err);
-		nextOvsPort += NEEDED_PORTS_CLIENT;
-		// We need to join here because Open vSwitch locks the database file
-		// when processing commands. They cannot be parallelized.
-		DO_OR_GOTO(workJoin(false), cleanup, err);
+		uint32_t firstPort = 0;
+		if (nextClientPort < OVS_MAX_PORT_REQUEST) {
+			firstPort = nextClientPort;
+			nextClientPort += 2;
+		}
+		DO_OR_GOTO(workAddClientRoutes((nodeId)id, node->clientMacs, &node->clientSubnet, edgePorts[edgeIdx], firstPort), cleanup, err);
 	}
+	// The workers only queued the switch changes for the clients. Applying them
+	// in one batch per worker avoids reconfiguring the switch for every port.
+	DO_OR_GOTO(workFlushSwitch(), cleanup, err);
 
 	// Build routes between every pair of client nodes
 	lprintln(LogDebug, "Adding static routes along paths for all client node pairs");
@@ -670,9 +982,45 @@ int setupGraphML(const setupGraphMLParams* gmlParams) {
 cleanup:
 	if (ctx.clientIter != NULL) ip4FreeFragIter(ctx.clientIter);
 	if (ctx.routes != NULL) rpFreePlan(ctx.routes);
-	g_hash_table_destroy(ctx.gmlToState);
+	ntFreeTable(ctx.gmlToState);
+	ntFreeTable(ctx.pendingNames);
+	flexBufferFree((void**)&ctx.pendingNameList, &ctx.pendingNameCount, &ctx.pendingNameCap);
+	flexBufferFree((void**)&ctx.links, &ctx.linkCount, &ctx.linkCap);
+	if (ctx.linkSpill != NULL) fclose(ctx.linkSpill);
+	if (ctx.compiled != NULL) topoFreeWriter(ctx.compiled);
 	ip4FreeIter(ctx.intfAddrIter);
 	flexBufferFree((void**)&ctx.nodeStates, &ctx.nodeCount, &ctx.nodeCap);
 	free(edgePorts);
 	return err;
 }
+
+int setupGraphML(const setupGraphMLParams* gmlParams) {
+	return setupTopology(gmlParams, GmlSourceFile, "GraphML");
+}
+
+int setupEdgeList(const setupEdgeListParams* elParams) {
+	setupGraphMLParams params = {
+		.twoPass = elParams->twoPass,
+		.bufferLinks = elParams->bufferLinks || !elParams->twoPass,
+		.mappedScan = false,
+		.saveTopology = elParams->saveTopology,
+		.weightKey = elParams->weightKey,
+		.clientType = elParams->clientType,
+	};
+	return setupTopology(&params, GmlSourceEdgeList, "edge list");
+}
+
+int setupModelNet(const setupModelNetParams* mnParams) {
+	if (mnParams->twoPass || mnParams->bufferLinks) {
+		lprintln(LogWarning, "The --two-pass and --buffer-edges options are ignored for ModelNet topologies, which are always read completely before any nodes are created.");
+	}
+	setupGraphMLParams params = {
+		.twoPass = false,
+		.bufferLinks = false,
+		.mappedScan = false,
+		.saveTopology = mnParams->saveTopology,
+		.weightKey = "latency",
+		.clientType = NULL,
+	};
+	return setupTopology(&params, GmlSourceModelNet, "ModelNet");
+}
@@ -29,6 +29,7 @@
 #include <stdint.h>
 
 #include "ip.h"
+#include "ovs.h"
 
 typedef struct {
 	ip4Addr ip;            // The real IP address of the edge node
@@ -74,6 +75,13 @@ typedef struct {
 	} edgeNodeDefaults;
 
 	uint64_t softMemCap; // (Very) approximate memory use
+
+	bool nsPool; // If true, destroyed host namespaces are kept for reuse
+
+	SwitchBackend switchBackend; // Implementation of the root switch
+	bool switchPipeline; // If true, client flows are kept in a separate table
+	bool ovsTuning; // If true, Open vSwitch is tuned for the number of clients
+	bool keepSwitch; // If true, Open vSwitch keeps running between networks
 } setupParams;
 
 typedef struct {
@@ -81,11 +89,42 @@ typedef struct {
 	float bandwidthDivisor;
 
 	bool twoPass; // True if the file contains node elements after edge elements
+	bool bufferLinks; // True if edges are buffered until all nodes are read
+	bool mappedScan; // True if files are read with the memory-mapped scanner
+
+	// If not NULL, the parsed topology is saved to this path as a compiled
+	// topology, which can later be loaded in place of the GraphML file
+	const char* saveTopology;
 
 	const char* weightKey; // Data key used for static routing computation
 	const char* clientType; // Value for "type" identifying client nodes
 } setupGraphMLParams;
 
+typedef struct {
+	const char* weightKey; // Edge column used for static routing computation
+	const char* clientType; // Value in the "type" column identifying client nodes
+
+	// The same as in setupGraphMLParams. If neither is set, edges are buffered,
+	// because nodes may be implied by the edges that refer to them.
+	bool twoPass;
+	bool bufferLinks;
+
+	// If not NULL, the parsed topology is saved to this path as a compiled
+	// topology
+	const char* saveTopology;
+} setupEdgeListParams;
+
+typedef struct {
+	// If not NULL, the parsed topology is saved to this path as a compiled
+	// topology
+	const char* saveTopology;
+
+	// ModelNet topologies always report nodes before links, so these options
+	// only cause a warning
+	bool twoPass;
+	bool bufferLinks;
+} setupModelNetParams;
+
 // Initializes the setup system. setupConfigure must be called before any
 // source-specific setup functions. Returns 0 on success or an error code
 // otherwise.
@@ -103,5 +142,14 @@ int setupCleanup(void);
 // error code otherwise.
 int setupGraphML(const setupGraphMLParams* gmlParams);
 
+// Sets up a virtual network from an edge list, which contains delimited tables
+// of nodes and edges. The format is described in edgelist.h. Returns 0 on
+// success or an error code otherwise.
+int setupEdgeList(const setupEdgeListParams* elParams);
+
+// Sets up a virtual network from a topology in ModelNet's XML format. Returns 0
+// on success or an error code otherwise.
+int setupModelNet(const setupModelNetParams* mnParams);
+
 // Destroys a previous network. Returns 0 on success or an error code otherwise.
 int destroyNetwork(void);
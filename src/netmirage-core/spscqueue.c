@@ -0,0 +1,140 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "spscqueue.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "mem.h"
+
+// Padding used to keep the indices owned by each thread on separate cache
+// lines, so that the threads do not contend for them
+#define CACHE_LINE_SIZE 64
+
+struct spscQueue {
+	void** slots;
+	size_t mask;
+
+	// Owned by the producer. cachedTail is the last consumer position that
+	// the producer observed, so the shared tail is only read when the queue
+	// appears to be full.
+	char padProducer[CACHE_LINE_SIZE];
+	size_t head;
+	size_t cachedTail;
+	uint64_t pushStall;
+
+	// Owned by the consumer
+	char padConsumer[CACHE_LINE_SIZE];
+	size_t tail;
+	size_t cachedHead;
+	uint64_t popStall;
+
+	// Sleeping state. A thread publishes its waiting flag before checking the
+	// queue again, and the other thread checks the flag after publishing its
+	// index. Since both use sequentially consistent operations, at least one
+	// of them sees the other's write, so wakeups are never lost.
+	char padShared[CACHE_LINE_SIZE];
+	GMutex lock;
+	GCond notFull;
+	GCond notEmpty;
+	bool producerWaiting;
+	bool consumerWaiting;
+};
+
+spscQueue* spscNewQueue(size_t capacity) {
+	size_t slots = 1;
+	while (slots < capacity) slots *= 2;
+
+	spscQueue* queue = ecalloc(1, sizeof(spscQueue));
+	queue->slots = eamalloc(slots, sizeof(void*), 0);
+	queue->mask = slots - 1;
+	g_mutex_init(&queue->lock);
+	g_cond_init(&queue->notFull);
+	g_cond_init(&queue->notEmpty);
+	return queue;
+}
+
+void spscFreeQueue(spscQueue* queue) {
+	g_mutex_clear(&queue->lock);
+	g_cond_clear(&queue->notFull);
+	g_cond_clear(&queue->notEmpty);
+	free(queue->slots);
+	free(queue);
+}
+
+// Wakes the other thread if it is sleeping on cond
+static void spscWake(spscQueue* queue, bool* waiting, GCond* cond) {
+	if (!__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) return;
+	g_mutex_lock(&queue->lock);
+	g_cond_signal(cond);
+	g_mutex_unlock(&queue->lock);
+}
+
+void spscPush(spscQueue* queue, void* item) {
+	size_t head = queue->head;
+	if (head - queue->cachedTail > queue->mask) {
+		queue->cachedTail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+		if (head - queue->cachedTail > queue->mask) {
+			gint64 stallStart = g_get_monotonic_time();
+			g_mutex_lock(&queue->lock);
+			__atomic_store_n(&queue->producerWaiting, true, __ATOMIC_SEQ_CST);
+			while (head - (queue->cachedTail = __atomic_load_n(&queue->tail, __ATOMIC_SEQ_CST)) > queue->mask) {
+				g_cond_wait(&queue->notFull, &queue->lock);
+			}
+			__atomic_store_n(&queue->producerWaiting, false, __ATOMIC_RELAXED);
+			g_mutex_unlock(&queue->lock);
+			queue->pushStall += (uint64_t)(g_get_monotonic_time() - stallStart);
+		}
+	}
+
+	queue->slots[head & queue->mask] = item;
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_SEQ_CST);
+	spscWake(queue, &queue->consumerWaiting, &queue->notEmpty);
+}
+
+void* spscPop(spscQueue* queue) {
+	size_t tail = queue->tail;
+	if (tail == queue->cachedHead) {
+		queue->cachedHead = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+		if (tail == queue->cachedHead) {
+			gint64 stallStart = g_get_monotonic_time();
+			g_mutex_lock(&queue->lock);
+			__atomic_store_n(&queue->consumerWaiting, true, __ATOMIC_SEQ_CST);
+			while (tail == (queue->cachedHead = __atomic_load_n(&queue->head, __ATOMIC_SEQ_CST))) {
+				g_cond_wait(&queue->notEmpty, &queue->lock);
+			}
+			__atomic_store_n(&queue->consumerWaiting, false, __ATOMIC_RELAXED);
+			g_mutex_unlock(&queue->lock);
+			queue->popStall += (uint64_t)(g_get_monotonic_time() - stallStart);
+		}
+	}
+
+	void* item = queue->slots[tail & queue->mask];
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_SEQ_CST);
+	spscWake(queue, &queue->producerWaiting, &queue->notFull);
+	return item;
+}
+
+void spscStallTime(const spscQueue* queue, uint64_t* pushMicros, uint64_t* popMicros) {
+	*pushMicros = queue->pushStall;
+	*popMicros = queue->popStall;
+}
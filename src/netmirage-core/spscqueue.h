@@ -0,0 +1,51 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module implements a bounded single-producer, single-consumer queue of
+// pointers. Items are exchanged through a ring buffer using only atomic loads
+// and stores. A thread only blocks when the queue is full (for the producer)
+// or empty (for the consumer), in which case it sleeps until the other thread
+// makes progress. Exactly one thread may push items, and exactly one thread
+// may pop them.
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct spscQueue spscQueue;
+
+// Allocates a new queue that holds at least the given number of items.
+spscQueue* spscNewQueue(size_t capacity);
+
+// Releases the queue. Items still in the queue are not freed.
+void spscFreeQueue(spscQueue* queue);
+
+// Adds an item to the queue, blocking while the queue is full. Must only be
+// called by the producer thread.
+void spscPush(spscQueue* queue, void* item);
+
+// Removes the oldest item from the queue, blocking while the queue is empty.
+// Must only be called by the consumer thread.
+void* spscPop(spscQueue* queue);
+
+// Retrieves the total time, in microseconds, that the producer spent blocked
+// on a full queue and that the consumer spent blocked on an empty queue. The
+// values are only accurate when neither thread is using the queue.
+void spscStallTime(const spscQueue* queue, uint64_t* pushMicros, uint64_t* popMicros);
@@ -0,0 +1,435 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#define _POSIX_C_SOURCE 200809L // Require POSIX.1-2008
+
+#include "topofile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "mem.h"
+
+static const char TopoMagic[8] = { 'N', 'M', 'T', 'O', 'P', 'O', '\0', '\0' };
+static const uint32_t TopoVersion = 1;
+
+#define TOPO_HEADER_SIZE 48
+#define TOPO_NODE_SIZE   40
+#define TOPO_OFFSET_SIZE 8
+#define TOPO_LINK_SIZE   40
+
+// Flags for node records
+static const uint32_t TopoNodeClient = 0x1;
+
+/******************************************************************************\
+|                              Binary Encoding                                 |
+\******************************************************************************/
+
+static void putU32(unsigned char* p, uint32_t v) {
+	for (int i = 0; i < 4; ++i) p[i] = (unsigned char)(v >> (8*i));
+}
+
+static void putU64(unsigned char* p, uint64_t v) {
+	for (int i = 0; i < 8; ++i) p[i] = (unsigned char)(v >> (8*i));
+}
+
+static void putF32(unsigned char* p, float v) {
+	uint32_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	putU32(p, bits);
+}
+
+static void putF64(unsigned char* p, double v) {
+	uint64_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	putU64(p, bits);
+}
+
+static uint32_t getU32(const unsigned char* p) {
+	uint32_t v = 0;
+	for (int i = 3; i >= 0; --i) v = (v << 8) | p[i];
+	return v;
+}
+
+static uint64_t getU64(const unsigned char* p) {
+	uint64_t v = 0;
+	for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+	return v;
+}
+
+static float getF32(const unsigned char* p) {
+	uint32_t bits = getU32(p);
+	float v;
+	memcpy(&v, &bits, sizeof(v));
+	return v;
+}
+
+static double getF64(const unsigned char* p) {
+	uint64_t bits = getU64(p);
+	double v;
+	memcpy(&v, &bits, sizeof(v));
+	return v;
+}
+
+/******************************************************************************\
+|                                  Writing                                     |
+\******************************************************************************/
+
+typedef struct {
+	TopoNode t;
+	uint64_t nameOffset;
+	uint32_t nameLen;
+} topoWriterNode;
+
+typedef struct {
+	nodeId source;
+	nodeId target;
+	float weight;
+	TopoLink t;
+} topoWriterLink;
+
+struct topoWriter {
+	topoWriterNode* nodes;
+	size_t nodeCount;
+	size_t nodeCap;
+
+	topoWriterLink* links;
+	size_t linkCount;
+	size_t linkCap;
+
+	char* strings;
+	size_t stringLen;
+	size_t stringCap;
+};
+
+topoWriter* topoNewWriter(void) {
+	topoWriter* writer = emalloc(sizeof(topoWriter));
+	flexBufferInit((void**)&writer->nodes, &writer->nodeCount, &writer->nodeCap);
+	flexBufferInit((void**)&writer->links, &writer->linkCount, &writer->linkCap);
+	flexBufferInit((void**)&writer->strings, &writer->stringLen, &writer->stringCap);
+	return writer;
+}
+
+void topoFreeWriter(topoWriter* writer) {
+	flexBufferFree((void**)&writer->nodes, &writer->nodeCount, &writer->nodeCap);
+	flexBufferFree((void**)&writer->links, &writer->linkCount, &writer->linkCap);
+	flexBufferFree((void**)&writer->strings, &writer->stringLen, &writer->stringCap);
+	free(writer);
+}
+
+int topoWriterAddNode(topoWriter* writer, nodeId id, const char* name, const TopoNode* node) {
+	if (id != writer->nodeCount) {
+		lprintf(LogError, "Compiled topology nodes were added out of order (expected %lu, got %u)\n", (unsigned long)writer->nodeCount, id);
+		return 1;
+	}
+	size_t nameLen = strlen(name);
+	if (nameLen > UINT32_MAX) {
+		lprintln(LogError, "A node name is too long to store in a compiled topology");
+		return 1;
+	}
+
+	topoWriterNode entry = {
+		.t = *node,
+		.nameOffset = writer->stringLen,
+		.nameLen = (uint32_t)nameLen,
+	};
+	flexBufferGrow((void**)&writer->nodes, writer->nodeCount, &writer->nodeCap, 1, sizeof(topoWriterNode));
+	flexBufferAppend(writer->nodes, &writer->nodeCount, &entry, 1, sizeof(topoWriterNode));
+
+	flexBufferGrow((void**)&writer->strings, writer->stringLen, &writer->stringCap, nameLen+1, 1);
+	flexBufferAppend(writer->strings, &writer->stringLen, name, nameLen+1, 1);
+	return 0;
+}
+
+int topoWriterAddLink(topoWriter* writer, nodeId source, nodeId target, float weight, const TopoLink* link) {
+	if (source >= writer->nodeCount || target >= writer->nodeCount) {
+		lprintf(LogError, "Compiled topology link from %u to %u refers to an unknown node\n", source, target);
+		return 1;
+	}
+	topoWriterLink entry = {
+		.source = source,
+		.target = target,
+		.weight = weight,
+		.t = *link,
+	};
+	flexBufferGrow((void**)&writer->links, writer->linkCount, &writer->linkCap, 1, sizeof(topoWriterLink));
+	flexBufferAppend(writer->links, &writer->linkCount, &entry, 1, sizeof(topoWriterLink));
+	return 0;
+}
+
+int topoWriterSave(topoWriter* writer, const char* filename) {
+	lprintf(LogInfo, "Saving compiled topology with %lu nodes and %lu links to '%s'\n", (unsigned long)writer->nodeCount, (unsigned long)writer->linkCount, filename);
+
+	// Group the links by source node with a counting sort. The sort is
+	// stable, so links from the same node keep their original order.
+	uint64_t* offsets = ecalloc(writer->nodeCount+1, sizeof(uint64_t));
+	for (size_t i = 0; i < writer->linkCount; ++i) {
+		++offsets[writer->links[i].source + 1];
+	}
+	for (size_t i = 0; i < writer->nodeCount; ++i) {
+		offsets[i+1] += offsets[i];
+	}
+	size_t* order = eamalloc(writer->linkCount, sizeof(size_t), 0);
+	{
+		uint64_t* next = eamalloc(writer->nodeCount, sizeof(uint64_t), 0);
+		memcpy(next, offsets, writer->nodeCount * sizeof(uint64_t));
+		for (size_t i = 0; i < writer->linkCount; ++i) {
+			order[next[writer->links[i].source]++] = i;
+		}
+		free(next);
+	}
+
+	int err = 0;
+	errno = 0;
+	FILE* file = fopen(filename, "wb");
+	if (file == NULL) {
+		err = errno;
+		lprintf(LogError, "Could not open '%s' for writing: %s\n", filename, strerror(err));
+		goto cleanup;
+	}
+
+	unsigned char record[TOPO_HEADER_SIZE];
+	memset(record, 0, sizeof(record));
+	memcpy(record, TopoMagic, sizeof(TopoMagic));
+	putU32(record+8, TopoVersion);
+	putU32(record+12, TOPO_HEADER_SIZE);
+	putU64(record+16, writer->nodeCount);
+	putU64(record+24, writer->linkCount);
+	putU64(record+32, writer->stringLen);
+	fwrite(record, TOPO_HEADER_SIZE, 1, file);
+
+	for (size_t i = 0; i < writer->nodeCount; ++i) {
+		const topoWriterNode* node = &writer->nodes[i];
+		putF64(record, node->t.packetLoss);
+		putF64(record+8, node->t.bandwidthUp);
+		putF64(record+16, node->t.bandwidthDown);
+		putU64(record+24, node->nameOffset);
+		putU32(record+32, node->nameLen);
+		putU32(record+36, node->t.client ? TopoNodeClient : 0);
+		fwrite(record, TOPO_NODE_SIZE, 1, file);
+	}
+
+	for (size_t i = 0; i <= writer->nodeCount; ++i) {
+		putU64(record, offsets[i]);
+		fwrite(record, TOPO_OFFSET_SIZE, 1, file);
+	}
+
+	for (size_t i = 0; i < writer->linkCount; ++i) {
+		const topoWriterLink* link = &writer->links[order[i]];
+		putU32(record, link->target);
+		putF32(record+4, link->weight);
+		putF64(record+8, link->t.latency);
+		putF64(record+16, link->t.packetLoss);
+		putF64(record+24, link->t.jitter);
+		putU32(record+32, link->t.queueLen);
+		putU32(record+36, 0);
+		fwrite(record, TOPO_LINK_SIZE, 1, file);
+	}
+
+	fwrite(writer->strings, 1, writer->stringLen, file);
+
+	if (ferror(file)) {
+		lprintf(LogError, "Failed to write compiled topology to '%s'\n", filename);
+		err = 1;
+	}
+	if (fclose(file) != 0 && err == 0) {
+		err = errno;
+		lprintf(LogError, "Failed to write compiled topology to '%s': %s\n", filename, strerror(err));
+	}
+
+cleanup:
+	free(order);
+	free(offsets);
+	return err;
+}
+
+/******************************************************************************\
+|                                  Loading                                     |
+\******************************************************************************/
+
+bool topoIsCompiledFile(const char* filename) {
+	// Reading the signature from a pipe would consume it, and compiled
+	// topologies must be mapped anyway, so only regular files are checked
+	struct stat info;
+	if (stat(filename, &info) != 0 || !S_ISREG(info.st_mode)) return false;
+
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL) return false;
+	char magic[sizeof(TopoMagic)];
+	bool matches = (fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, TopoMagic, sizeof(magic)) == 0);
+	fclose(file);
+	return matches;
+}
+
+// Reports all nodes and links in a mapped compiled topology. The sizes of the
+// sections have already been checked against the size of the file.
+static int topoReadMapped(const unsigned char* nodes, const unsigned char* offsets, const unsigned char* links, const char* strings, uint64_t nodeCount, uint64_t linkCount, uint64_t stringLen, NewNodeFunc newNode, NewLinkFunc newLink, void* userData) {
+	for (uint64_t i = 0; i < nodeCount; ++i) {
+		const unsigned char* record = nodes + i*TOPO_NODE_SIZE;
+		uint64_t nameOffset = getU64(record+24);
+		uint32_t nameLen = getU32(record+32);
+		if (nameOffset >= stringLen || nameLen >= stringLen - nameOffset || strings[nameOffset+nameLen] != '\0') {
+			lprintf(LogError, "The compiled topology has an invalid name for node %lu\n", (unsigned long)i);
+			return 1;
+		}
+		GmlNode node = {
+			.name = strings + nameOffset,
+			.nameLen = nameLen,
+			.t = {
+				.client = (getU32(record+36) & TopoNodeClient) != 0,
+				.packetLoss = getF64(record),
+				.bandwidthUp = getF64(record+8),
+				.bandwidthDown = getF64(record+16),
+			},
+		};
+		int err = newNode(&node, userData);
+		if (err != 0) return err;
+	}
+
+	uint64_t prevOffset = 0;
+	for (uint64_t source = 0; source < nodeCount; ++source) {
+		uint64_t start = getU64(offsets + source*TOPO_OFFSET_SIZE);
+		uint64_t end = getU64(offsets + (source+1)*TOPO_OFFSET_SIZE);
+		if (start != prevOffset || end < start || end > linkCount) {
+			lprintf(LogError, "The compiled topology has invalid link offsets for node %lu\n", (unsigned long)source);
+			return 1;
+		}
+		prevOffset = end;
+
+		const unsigned char* sourceRecord = nodes + source*TOPO_NODE_SIZE;
+		for (uint64_t i = start; i < end; ++i) {
+			const unsigned char* record = links + i*TOPO_LINK_SIZE;
+			uint32_t target = getU32(record);
+			if (target >= nodeCount) {
+				lprintf(LogError, "The compiled topology has a link to unknown node %u\n", target);
+				return 1;
+			}
+			const unsigned char* targetRecord = nodes + (uint64_t)target*TOPO_NODE_SIZE;
+			GmlLink link = {
+				.sourceName = strings + getU64(sourceRecord+24),
+				.targetName = strings + getU64(targetRecord+24),
+				.sourceNameLen = getU32(sourceRecord+32),
+				.targetNameLen = getU32(targetRecord+32),
+				.weight = getF32(record+4),
+				.t = {
+					.latency = getF64(record+8),
+					.packetLoss = getF64(record+16),
+					.jitter = getF64(record+24),
+					.queueLen = getU32(record+32),
+				},
+			};
+			int err = newLink(&link, userData);
+			if (err != 0) return err;
+		}
+	}
+	if (prevOffset != linkCount) {
+		lprintln(LogError, "The compiled topology contains links that do not belong to any node");
+		return 1;
+	}
+	return 0;
+}
+
+int topoParseFile(const char* filename, NewNodeFunc newNode, NewLinkFunc newLink, void* userData) {
+	errno = 0;
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		int err = errno;
+		lprintf(LogError, "Could not open compiled topology '%s': %s\n", filename, strerror(err));
+		return err;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < TOPO_HEADER_SIZE || (uintmax_t)st.st_size > SIZE_MAX) {
+		close(fd);
+		lprintf(LogError, "'%s' is not a valid compiled topology\n", filename);
+		return 1;
+	}
+	size_t len = (size_t)st.st_size;
+	void* map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	int err = errno;
+	close(fd);
+	if (map == MAP_FAILED) {
+		lprintf(LogError, "Failed to map compiled topology '%s' into memory: %s\n", filename, strerror(err));
+		return err;
+	}
+	posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+
+	const unsigned char* data = map;
+	err = 0;
+	if (memcmp(data, TopoMagic, sizeof(TopoMagic)) != 0) {
+		lprintf(LogError, "'%s' is not a compiled topology\n", filename);
+		err = 1;
+		goto cleanup;
+	}
+	uint32_t version = getU32(data+8);
+	if (version != TopoVersion) {
+		lprintf(LogError, "The compiled topology '%s' uses unsupported format version %u\n", filename, version);
+		err = 1;
+		goto cleanup;
+	}
+
+	// Check the section sizes against the file size. Each comparison is
+	// arranged so that it cannot overflow.
+	uint64_t headerSize = getU32(data+12);
+	uint64_t nodeCount = getU64(data+16);
+	uint64_t linkCount = getU64(data+24);
+	uint64_t stringLen = getU64(data+32);
+	uint64_t remaining = len;
+	bool valid = (headerSize >= TOPO_HEADER_SIZE && headerSize <= remaining);
+	if (valid) {
+		remaining -= headerSize;
+		valid = (nodeCount <= (uint64_t)MAX_NODE_ID + 1 && nodeCount <= remaining / (TOPO_NODE_SIZE + TOPO_OFFSET_SIZE));
+	}
+	if (valid) {
+		remaining -= nodeCount * (TOPO_NODE_SIZE + TOPO_OFFSET_SIZE);
+		valid = (remaining >= TOPO_OFFSET_SIZE);
+	}
+	if (valid) {
+		remaining -= TOPO_OFFSET_SIZE;
+		valid = (linkCount <= remaining / TOPO_LINK_SIZE);
+	}
+	if (valid) {
+		remaining -= linkCount * TOPO_LINK_SIZE;
+		valid = (stringLen <= remaining);
+	}
+	if (!valid) {
+		lprintf(LogError, "The compiled topology '%s' is truncated or corrupt\n", filename);
+		err = 1;
+		goto cleanup;
+	}
+
+	lprintf(LogDebug, "Loading compiled topology with %lu nodes and %lu links\n", (unsigned long)nodeCount, (unsigned long)linkCount);
+	const unsigned char* nodes = data + headerSize;
+	const unsigned char* offsets = nodes + nodeCount*TOPO_NODE_SIZE;
+	const unsigned char* links = offsets + (nodeCount+1)*TOPO_OFFSET_SIZE;
+	const char* strings = (const char*)(links + linkCount*TOPO_LINK_SIZE);
+	err = topoReadMapped(nodes, offsets, links, strings, nodeCount, linkCount, stringLen, newNode, newLink, userData);
+
+cleanup:
+	munmap(map, len);
+	return err;
+}
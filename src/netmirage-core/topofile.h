@@ -0,0 +1,73 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module reads and writes compiled topologies. A compiled topology holds
+// the nodes and links of a parsed GraphML file in a binary form that can be
+// loaded without any parsing. Compiled files use the following little-endian
+// layout, with all sections aligned to 8 bytes:
+//
+//   Header:  magic "NMTOPO\0\0", u32 version, u32 header size, u64 node count,
+//            u64 link count, u64 string table size, u64 reserved
+//   Nodes:   per node: f64 packet loss, f64 upstream bandwidth, f64 downstream
+//            bandwidth, u64 name offset, u32 name length, u32 flags
+//   Offsets: node count + 1 u64 indices into the link table (CSR format)
+//   Links:   per link: u32 target, f32 routing weight, f64 latency, f64 packet
+//            loss, f64 jitter, u32 queue length, u32 reserved
+//   Strings: NUL-terminated original node names
+//
+// The links of node i are stored at the indices [offsets[i], offsets[i+1]).
+// Each link appears once, in the row of the node that was its source.
+
+#include <stdbool.h>
+
+#include "graphml.h"
+#include "topology.h"
+
+typedef struct topoWriter topoWriter;
+
+// Creates a new writer for a compiled topology. Nodes and links are kept in
+// memory until topoWriterSave is called.
+topoWriter* topoNewWriter(void);
+
+// Releases all resources associated with a writer.
+void topoFreeWriter(topoWriter* writer);
+
+// Adds a node to the topology. Nodes must be added in identifier order,
+// starting from 0. Returns 0 on success or an error code otherwise.
+int topoWriterAddNode(topoWriter* writer, nodeId id, const char* name, const TopoNode* node);
+
+// Adds a link between two nodes that were previously added to the topology.
+// Returns 0 on success or an error code otherwise.
+int topoWriterAddLink(topoWriter* writer, nodeId source, nodeId target, float weight, const TopoLink* link);
+
+// Writes the topology to a file, replacing any existing file. Returns 0 on
+// success or an error code otherwise.
+int topoWriterSave(topoWriter* writer, const char* filename);
+
+// Returns true if the file at the given path is a regular file that begins with
+// the signature of a compiled topology. Other kinds of files, such as pipes,
+// are never read.
+bool topoIsCompiledFile(const char* filename);
+
+// Loads a compiled topology by mapping it into memory. All nodes are reported
+// before any links, in identifier order. The names given to the callbacks
+// point into the mapped file. Returns 0 for success.
+int topoParseFile(const char* filename, NewNodeFunc newNode, NewLinkFunc newLink, void* userData);
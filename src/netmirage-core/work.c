@@ -76,6 +76,7 @@ typedef enum {
 	WorkerGetInterfaceMtu,
 	WorkerMtuSupported,
 	WorkerAddRoot,
+	WorkerAddRootSwitch,
 	WorkerAddEdgeInterface,
 	WorkerAddHost,
 	WorkerSetSelfLink,
@@ -84,7 +85,9 @@ typedef enum {
 	WorkerAddInternalRoutes,
 	WorkerAddClientRoutes,
 	WorkerAddEdgeRoutes,
-	WorkerDestroyHosts,
+	WorkerFlushSwitch,
+	WorkerDestroyRoot,
+	WorkerDestroyHostShard,
 } WorkerOrderCode;
 
 typedef struct {
@@ -97,6 +100,13 @@ typedef struct {
 			size_t ovsDirLen;
 			size_t ovsSchemaLen;
 			uint64_t softMemCap;
+			bool nsPool;
+			SwitchBackend switchBackend;
+			bool switchPipeline;
+			bool keepSwitch;
+			bool ovsValidVer;
+			unsigned int ovsMajor;
+			unsigned int ovsMinor;
 			char* nsPrefix;
 			char* ovsDir;
 			char* ovsSchema;
@@ -117,10 +127,13 @@ typedef struct {
 		struct {
 			ip4Addr addrSelf;
 			ip4Addr addrOther;
-			int mtu;
 			bool useInitNs;
 			bool existing;
 		} addRoot;
+		struct {
+			int mtu;
+			bool existing;
+		} addRootSwitch;
 		struct {
 			nodeId id;
 			ip4Addr ip;
@@ -136,6 +149,7 @@ typedef struct {
 			uint64_t linkCount;
 			nodeId nodeCount;
 			nodeId clientNodes;
+			bool tuneSwitch;
 		} ensureSystemScaling;
 		struct {
 			nodeId sourceId;
@@ -159,7 +173,7 @@ typedef struct {
 			macAddr clientMacs[NEEDED_MACS_CLIENT];
 			ip4Subnet subnet;
 			uint32_t edgePort;
-			uint32_t clientPorts[NEEDED_PORTS_CLIENT];
+			uint32_t firstPort;
 		} addClientRoutes;
 		struct {
 			ip4Subnet edgeSubnet;
@@ -169,7 +183,12 @@ typedef struct {
 		} addEdgeRoutes;
 		struct {
 			char intfName[INTERFACE_BUF_LEN];
+			uint32_t requestedPort;
 		} addEdgeInterface;
+		struct {
+			uint32_t shard;
+			uint32_t shardCount;
+		} destroyHostShard;
 	};
 } WorkerOrder;
 
@@ -181,7 +200,9 @@ typedef enum {
 	ResponseGotMac,
 	ResponseGotMtu,
 	ResponseGotMtuSupported,
+	ResponseAddedRootSwitch,
 	ResponseAddedEdgeInterface,
+	ResponseDestroyedHosts,
 } WorkerResponseCode;
 
 typedef struct {
@@ -203,6 +224,12 @@ typedef struct {
 			bool supported;
 			const char* failReason;
 		} gotMtuSupported;
+		struct {
+			uint32_t port;
+		} addedEdgeInterface;
+		struct {
+			uint32_t count;
+		} destroyedHosts;
 	};
 } WorkerResponse;
 
@@ -233,6 +260,14 @@ static struct {
 	uint32_t unsentOrders;
 	GCond allOrdersSent;
 
+	// Orders are queued without waiting until this many are unsent per
+	// worker. Beyond that, the main thread waits so that it does not run
+	// arbitrarily far ahead of the workers.
+	bool orderSpaceWanted;
+	GCond orderSpace;
+	uint64_t queuedOrders;    // Total number of orders queued
+	uint64_t orderStallTime;  // Microseconds spent waiting for queue space
+
 	// State for responses from the child processes:
 
 	bool receivedError;
@@ -244,8 +279,19 @@ static struct {
 
 	guint pongsExpected;
 	GCond pongsFinished;
+
+	uint32_t destroyedHosts; // Sum of the counts reported by all workers
+
+	// The root switch is started asynchronously by a single worker. Orders that
+	// use the switch must call waitForRootSwitch before being sent.
+	bool rootSwitchPending; // A worker is starting the switch
+	bool rootSwitchStarted; // The worker reported that the switch is running
+	GCond rootSwitchReady;
+	int rootSwitchMtu;
 } workMain;
 
+static const uint32_t UnsentOrdersPerWorker = 256;
+
 // Memory clearing functions to prevent irrelevant alerts from debuggers
 #ifdef DEBUG
 #define ZERO_ORDER(order) do{ memset((order), 0, sizeof(WorkerOrder)); }while(0)
@@ -372,7 +418,18 @@ static int sendOrder(WorkerOrder* order, bool ignoreErrors) {
 	if (abort) return workMain.errorCode;
 
 	g_mutex_lock(&workMain.lock);
+	uint32_t maxUnsent = UnsentOrdersPerWorker * workMain.poolSize;
+	if (workMain.unsentOrders >= maxUnsent && order->code != WorkerTerminate) {
+		gint64 stallStart = g_get_monotonic_time();
+		workMain.orderSpaceWanted = true;
+		while (workMain.unsentOrders >= maxUnsent) {
+			g_cond_wait(&workMain.orderSpace, &workMain.lock);
+		}
+		workMain.orderSpaceWanted = false;
+		workMain.orderStallTime += (uint64_t)(g_get_monotonic_time() - stallStart);
+	}
 	++workMain.unsentOrders;
+	++workMain.queuedOrders;
 	g_async_queue_push(workMain.orderQueue, order);
 	g_mutex_unlock(&workMain.lock);
 
@@ -398,6 +455,33 @@ static bool broadcastOrder(WorkerOrder* order) {
 	return success;
 }
 
+// Called by main process => main thread. Blocks until the root switch started
+// by workAddRoot is running, and then instructs all workers to connect to it.
+static int waitForRootSwitch(void) {
+	g_mutex_lock(&workMain.lock);
+	if (!workMain.rootSwitchPending) {
+		g_mutex_unlock(&workMain.lock);
+		return 0;
+	}
+	lprintln(LogDebug, "Waiting for the switch in the root namespace to start");
+	while (!workMain.receivedError && !workMain.rootSwitchStarted) {
+		g_cond_wait(&workMain.rootSwitchReady, &workMain.lock);
+	}
+	int err = 0;
+	if (workMain.receivedError) err = workMain.errorCode;
+	else workMain.rootSwitchPending = false;
+	int mtu = workMain.rootSwitchMtu;
+	g_mutex_unlock(&workMain.lock);
+	if (err != 0) return err;
+
+	WorkerOrder order;
+	ZERO_ORDER(&order);
+	order.code = WorkerAddRootSwitch;
+	order.addRootSwitch.mtu = mtu;
+	order.addRootSwitch.existing = true;
+	return (broadcastOrder(&order) ? 0 : 1);
+}
+
 // The entry point for the send threads in the main process
 static void* sendThread(gpointer data) {
 	Workplace* wp = data;
@@ -417,6 +501,7 @@ static void* sendThread(gpointer data) {
 		g_mutex_lock(&workMain.lock);
 		--workMain.unsentOrders;
 		if (workMain.unsentOrders == 0) g_cond_signal(&workMain.allOrdersSent);
+		if (workMain.orderSpaceWanted) g_cond_signal(&workMain.orderSpace);
 		g_mutex_unlock(&workMain.lock);
 	}
 
@@ -440,6 +525,17 @@ static void* responseThread(gpointer data) {
 			if (workMain.pongsExpected == 0) g_cond_signal(&workMain.pongsFinished);
 			g_mutex_unlock(&workMain.lock);
 			break;
+		case ResponseDestroyedHosts:
+			g_mutex_lock(&workMain.lock);
+			workMain.destroyedHosts += resp.destroyedHosts.count;
+			g_mutex_unlock(&workMain.lock);
+			break;
+		case ResponseAddedRootSwitch:
+			g_mutex_lock(&workMain.lock);
+			workMain.rootSwitchStarted = true;
+			g_cond_signal(&workMain.rootSwitchReady);
+			g_mutex_unlock(&workMain.lock);
+			break;
 		case ResponseLogPrint:
 			flexBufferGrow((void**)&wp->logBuffer, wp->logLen, &wp->logCap, resp.logMessage.len, 1);
 			if (!readAll(wp->responsesFd, &wp->logBuffer[wp->logLen], resp.logMessage.len)) goto done;
@@ -460,6 +556,7 @@ static void* responseThread(gpointer data) {
 			// handle errors asynchronously.
 			g_cond_signal(&workMain.receivedResponse);
 			g_cond_signal(&workMain.pongsFinished);
+			g_cond_signal(&workMain.rootSwitchReady);
 
 			g_mutex_unlock(&workMain.lock);
 			break;
@@ -543,7 +640,7 @@ static int childProcess(guint id) {
 				logSetColorize(order.configure.logColorize);
 				logSetThreshold(order.configure.logThreshold);
 				lprintf(LogDebug, "Configuring worker process\n");
-				err = workerInit(order.configure.nsPrefix, order.configure.ovsDir, order.configure.ovsSchema, order.configure.softMemCap);
+				err = workerInit(order.configure.nsPrefix, order.configure.ovsDir, order.configure.ovsSchema, order.configure.softMemCap, order.configure.nsPool, order.configure.switchBackend, order.configure.switchPipeline, order.configure.keepSwitch, order.configure.ovsValidVer, order.configure.ovsMajor, order.configure.ovsMinor);
 				if (err == 0) {
 					initialized = true;
 				} else {
@@ -588,10 +685,24 @@ static int childProcess(guint id) {
 				break;
 			}
 			case WorkerAddRoot:
-				err = workerAddRoot(order.addRoot.addrSelf, order.addRoot.addrOther, order.addRoot.mtu, order.addRoot.useInitNs, order.addRoot.existing);
+				err = workerAddRoot(order.addRoot.addrSelf, order.addRoot.addrOther, order.addRoot.useInitNs, order.addRoot.existing);
+				break;
+			case WorkerAddRootSwitch:
+				err = workerAddRootSwitch(order.addRootSwitch.mtu, order.addRootSwitch.existing);
+				if (err == 0 && !order.addRootSwitch.existing) {
+					WorkerResponse resp;
+					ZERO_RESPONSE(&resp);
+					resp.code = ResponseAddedRootSwitch;
+					writeAll(STDOUT_FILENO, &resp, sizeof(WorkerResponse));
+				}
 				break;
 			case WorkerAddEdgeInterface: {
-				err = workerAddEdgeInterface(order.addEdgeInterface.intfName);
+				WorkerResponse resp;
+				ZERO_RESPONSE(&resp);
+				resp.code = ResponseAddedEdgeInterface;
+
+				err = workerAddEdgeInterface(order.addEdgeInterface.intfName, order.addEdgeInterface.requestedPort, &resp.addedEdgeInterface.port);
+				if (err == 0) writeAll(STDOUT_FILENO, &resp, sizeof(WorkerResponse));
 				break;
 			}
 			case WorkerAddHost:
@@ -601,7 +712,7 @@ static int childProcess(guint id) {
 				err = workerSetSelfLink(order.setSelfLink.id, &order.setSelfLink.link);
 				break;
 			case WorkerEnsureSystemScaling:
-				err = workerEnsureSystemScaling(order.ensureSystemScaling.linkCount, order.ensureSystemScaling.nodeCount, order.ensureSystemScaling.clientNodes);
+				err = workerEnsureSystemScaling(order.ensureSystemScaling.linkCount, order.ensureSystemScaling.nodeCount, order.ensureSystemScaling.clientNodes, order.ensureSystemScaling.tuneSwitch);
 				break;
 			case WorkerAddLink:
 				err = workerAddLink(order.addLink.sourceId, order.addLink.targetId, order.addLink.sourceIp, order.addLink.targetIp, order.addLink.macs, order.addLink.mtu, &order.addLink.link);
@@ -610,14 +721,27 @@ static int childProcess(guint id) {
 				err = workerAddInternalRoutes(order.addInternalRoutes.id1, order.addInternalRoutes.id2, order.addInternalRoutes.ip1, order.addInternalRoutes.ip2, &order.addInternalRoutes.subnet1, &order.addInternalRoutes.subnet2);
 				break;
 			case WorkerAddClientRoutes:
-				err = workerAddClientRoutes(order.addClientRoutes.clientId, order.addClientRoutes.clientMacs, &order.addClientRoutes.subnet, order.addClientRoutes.edgePort, order.addClientRoutes.clientPorts);
+				err = workerAddClientRoutes(order.addClientRoutes.clientId, order.addClientRoutes.clientMacs, &order.addClientRoutes.subnet, order.addClientRoutes.edgePort, order.addClientRoutes.firstPort);
 				break;
 			case WorkerAddEdgeRoutes:
 				err = workerAddEdgeRoutes(&order.addEdgeRoutes.edgeSubnet, order.addEdgeRoutes.edgePort, &order.addEdgeRoutes.edgeLocalMac, &order.addEdgeRoutes.edgeRemoteMac);
 				break;
-			case WorkerDestroyHosts:
-				err = workerDestroyHosts();
+			case WorkerFlushSwitch:
+				err = workerFlushSwitch();
+				break;
+			case WorkerDestroyRoot:
+				err = workerDestroyRoot();
+				break;
+			case WorkerDestroyHostShard: {
+				WorkerResponse resp;
+				ZERO_RESPONSE(&resp);
+				resp.code = ResponseDestroyedHosts;
+
+				// We report the count even if an error occurred part way
+				err = workerDestroyHostShard(order.destroyHostShard.shard, order.destroyHostShard.shardCount, &resp.destroyedHosts.count);
+				writeAll(STDOUT_FILENO, &resp, sizeof(WorkerResponse));
 				break;
+			}
 			default:
 				lprintf(LogError, "Unknown order code %d\n", order.code);
 				err = 1;
@@ -711,6 +835,9 @@ int workInit(void) {
 	workMain.workplaces = eamalloc(workMain.poolSize, sizeof(Workplace), 0);
 	workMain.orderQueue = g_async_queue_new_full(&g_free);
 	workMain.unsentOrders = 0;
+	workMain.orderSpaceWanted = false;
+	workMain.queuedOrders = 0;
+	workMain.orderStallTime = 0;
 	workMain.responseQueued = false;
 
 	lprintf(LogDebug, "Initializing %u worker processes\n", workMain.poolSize);
@@ -749,7 +876,7 @@ int workInit(void) {
 }
 
 // Called by main process => main thread
-int workConfigure(LogLevel logThreshold, bool logColorize, const char* nsPrefix, const char* ovsDir, const char* ovsSchema, uint64_t softMemCap) {
+int workConfigure(LogLevel logThreshold, bool logColorize, const char* nsPrefix, const char* ovsDir, const char* ovsSchema, uint64_t softMemCap, bool nsPool, SwitchBackend switchBackend, bool switchPipeline, bool keepSwitch, bool ovsValidVer, unsigned int ovsMajor, unsigned int ovsMinor) {
 	WorkerOrder order;
 	order.code = WorkerConfigure;
 	order.configure.logThreshold = logThreshold;
@@ -758,6 +885,13 @@ int workConfigure(LogLevel logThreshold, bool logColorize, const char* nsPrefix,
 	order.configure.ovsDirLen = strlen(ovsDir);
 	order.configure.ovsSchemaLen = (ovsSchema == NULL ? 0 : strlen(ovsSchema));
 	order.configure.softMemCap = (uint64_t)llrint((double)softMemCap / (double)workMain.poolSize);
+	order.configure.nsPool = nsPool;
+	order.configure.switchBackend = switchBackend;
+	order.configure.switchPipeline = switchPipeline;
+	order.configure.keepSwitch = keepSwitch;
+	order.configure.ovsValidVer = ovsValidVer;
+	order.configure.ovsMajor = ovsMajor;
+	order.configure.ovsMinor = ovsMinor;
 	order.configure.nsPrefix = strdup(nsPrefix);
 	order.configure.ovsDir = strdup(ovsDir);
 	order.configure.ovsSchema = strdup(ovsSchema == NULL ? "" : ovsSchema);
@@ -807,6 +941,14 @@ int workCleanup(void) {
 	return err;
 }
 
+// Called by main process => main thread
+void workGetOrderStats(uint64_t* queuedOrders, uint64_t* stallMicros) {
+	g_mutex_lock(&workMain.lock);
+	*queuedOrders = workMain.queuedOrders;
+	*stallMicros = workMain.orderStallTime;
+	g_mutex_unlock(&workMain.lock);
+}
+
 // Called by main process => main thread
 int workJoin(bool resetError) {
 	lprintf(LogDebug, "Performing join on worker pool%s to ensure that all work is finished\n", (resetError ? " (and resetting error state)" : ""));
@@ -915,7 +1057,6 @@ int workAddRoot(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs) {
 	WorkerOrder* loadOrder = newOrder(WorkerAddRoot);
 	loadOrder->addRoot.addrSelf = addrSelf;
 	loadOrder->addRoot.addrOther = addrOther;
-	loadOrder->addRoot.mtu = mtu;
 	loadOrder->addRoot.useInitNs = useInitNs;
 	loadOrder->addRoot.existing = true;
 
@@ -933,13 +1074,41 @@ int workAddRoot(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs) {
 	// Next, make sure that all workers load root namespace contexts
 	bool success = broadcastOrder(loadOrder);
 	free(loadOrder);
-	return (success ? 0 : 1);
+	if (!success) return 1;
+
+	// Finally, start the switch in the background. Other orders can be
+	// processed while it starts, and the workers connect to it once it is
+	// needed.
+	WorkerOrder* switchOrder = newOrder(WorkerAddRootSwitch);
+	switchOrder->addRootSwitch.mtu = mtu;
+	switchOrder->addRootSwitch.existing = false;
+
+	g_mutex_lock(&workMain.lock);
+	workMain.rootSwitchPending = true;
+	workMain.rootSwitchStarted = false;
+	workMain.rootSwitchMtu = mtu;
+	g_mutex_unlock(&workMain.lock);
+
+	return sendOrder(switchOrder, false);
 }
 
-int workAddEdgeInterface(const char* intfName) {
+int workAddEdgeInterface(const char* intfName, uint32_t requestedPort, uint32_t* port) {
+	int err = waitForRootSwitch();
+	if (err != 0) return err;
+
 	WorkerOrder* order = newOrder(WorkerAddEdgeInterface);
 	strncpy(order->addEdgeInterface.intfName, intfName, INTERFACE_BUF_LEN);
-	return sendOrder(order, false);
+	order->addEdgeInterface.requestedPort = requestedPort;
+	err = sendOrder(order, false);
+	if (err != 0) return err;
+
+	g_mutex_lock(&workMain.lock);
+	err = waitForResponse(ResponseAddedEdgeInterface);
+	if (err == 0) {
+		*port = workMain.response.addedEdgeInterface.port;
+	}
+	g_mutex_unlock(&workMain.lock);
+	return err;
 }
 
 int workAddHost(nodeId id, ip4Addr ip, macAddr macs[], int mtu, const TopoNode* node) {
@@ -963,11 +1132,17 @@ int workSetSelfLink(nodeId id, const TopoLink* link) {
 	return sendOrder(order, false);
 }
 
-int workEnsureSystemScaling(uint64_t linkCount, nodeId nodeCount, nodeId clientNodes) {
+int workEnsureSystemScaling(uint64_t linkCount, nodeId nodeCount, nodeId clientNodes, bool tuneSwitch) {
+	if (tuneSwitch) {
+		int err = waitForRootSwitch();
+		if (err != 0) return err;
+	}
+
 	WorkerOrder* order = newOrder(WorkerEnsureSystemScaling);
 	order->ensureSystemScaling.linkCount = linkCount;
 	order->ensureSystemScaling.nodeCount = nodeCount;
 	order->ensureSystemScaling.clientNodes = clientNodes;
+	order->ensureSystemScaling.tuneSwitch = tuneSwitch;
 	return sendOrder(order, false);
 }
 
@@ -996,21 +1171,25 @@ int workAddInternalRoutes(nodeId id1, nodeId id2, ip4Addr ip1, ip4Addr ip2, cons
 	return sendOrder(order, false);
 }
 
-int workAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet* subnet, uint32_t edgePort, uint32_t nextOvsPort) {
+int workAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet* subnet, uint32_t edgePort, uint32_t firstPort) {
+	int err = waitForRootSwitch();
+	if (err != 0) return err;
+
 	WorkerOrder* order = newOrder(WorkerAddClientRoutes);
 	order->addClientRoutes.clientId = clientId;
 	for (int i = 0; i < NEEDED_MACS_CLIENT; ++i) {
 		memcpy(order->addClientRoutes.clientMacs[i].octets, clientMacs[i].octets, MAC_ADDR_BYTES);
 	}
-	for (int i = 0; i < NEEDED_PORTS_CLIENT; ++i) {
-		order->addClientRoutes.clientPorts[i] = nextOvsPort++;
-	}
 	order->addClientRoutes.subnet = *subnet;
 	order->addClientRoutes.edgePort = edgePort;
+	order->addClientRoutes.firstPort = firstPort;
 	return sendOrder(order, false);
 }
 
 int workAddEdgeRoutes(const ip4Subnet* edgeSubnet, uint32_t edgePort, const macAddr* edgeLocalMac, const macAddr* edgeRemoteMac) {
+	int err = waitForRootSwitch();
+	if (err != 0) return err;
+
 	WorkerOrder* order = newOrder(WorkerAddEdgeRoutes);
 	order->addEdgeRoutes.edgeSubnet = *edgeSubnet;
 	order->addEdgeRoutes.edgePort = edgePort;
@@ -1019,6 +1198,51 @@ int workAddEdgeRoutes(const ip4Subnet* edgeSubnet, uint32_t edgePort, const macA
 	return sendOrder(order, false);
 }
 
-int workDestroyHosts(void) {
-	return sendOrder(newOrder(WorkerDestroyHosts), false);
+int workFlushSwitch(void) {
+	int err = waitForRootSwitch();
+	if (err != 0) return err;
+
+	// Every worker may have queued changes, so all of them must flush
+	WorkerOrder order;
+	order.code = WorkerFlushSwitch;
+	if (!broadcastOrder(&order)) return 1;
+	return workJoin(false);
+}
+
+int workDestroyHosts(uint32_t* deletedHosts) {
+	// A single worker cleans up the root namespace first. This removes the
+	// client links, which makes the remaining namespaces cheaper to delete.
+	int err = sendOrder(newOrder(WorkerDestroyRoot), false);
+	if (err != 0) return err;
+	err = workJoin(false);
+	if (err != 0) return err;
+
+	g_mutex_lock(&workMain.lock);
+	workMain.destroyedHosts = 0;
+	g_mutex_unlock(&workMain.lock);
+
+	// Each worker deletes a disjoint shard of the namespaces. The shards differ
+	// for each worker, so we send the orders directly rather than through the
+	// queue.
+	waitForSending();
+	lprintf(LogDebug, "Sharding host destruction across %u child processes\n", workMain.poolSize);
+	WorkerOrder order;
+	ZERO_ORDER(&order);
+	order.code = WorkerDestroyHostShard;
+	order.destroyHostShard.shardCount = workMain.poolSize;
+	bool success = true;
+	for (guint i = 0; i < workMain.poolSize; ++i) {
+		order.destroyHostShard.shard = i;
+		if (!writeOrderToWorkplace(&order, &workMain.workplaces[i])) success = false;
+	}
+	if (!success) return 1;
+
+	err = workJoin(false);
+
+	if (deletedHosts != NULL) {
+		g_mutex_lock(&workMain.lock);
+		*deletedHosts = workMain.destroyedHosts;
+		g_mutex_unlock(&workMain.lock);
+	}
+	return err;
 }
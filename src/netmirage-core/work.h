@@ -36,18 +36,26 @@
 
 #include "ip.h"
 #include "log.h"
+#include "ovs.h"
 #include "topology.h"
 
 #define NEEDED_MACS_LINK 2
 #define NEEDED_MACS_CLIENT (2 * NEEDED_MACS_LINK)
-#define NEEDED_PORTS_CLIENT 2
 
 // Initializes the work subsystem. Free resources with workCleanup.
 // workConfigure must be called before sending any work commands.
 int workInit(void);
 
-// Sends configuration values to the initialized work subsystem.
-int workConfigure(LogLevel logThreshold, bool logColorize, const char* nsPrefix, const char* ovsDir, const char* ovsSchema, uint64_t softMemCap);
+// Sends configuration values to the initialized work subsystem. If nsPool is
+// true, destroyed host namespaces are kept in a warm pool for reuse.
+// switchBackend selects the implementation of the switch in the root
+// namespace. If switchPipeline is true, the switch matches traffic from edge
+// nodes in two stages, so that its main table only grows with the number of
+// edge nodes. If keepSwitch is true, a running Open vSwitch instance is kept
+// when destroying a network and reused by the next one. The Open vSwitch
+// version should be the one returned by ovsVersion, so that the workers do not
+// need to probe it themselves.
+int workConfigure(LogLevel logThreshold, bool logColorize, const char* nsPrefix, const char* ovsDir, const char* ovsSchema, uint64_t softMemCap, bool nsPool, SwitchBackend switchBackend, bool switchPipeline, bool keepSwitch, bool ovsValidVer, unsigned int ovsMajor, unsigned int ovsMinor);
 
 // Frees all resources associated with the work subsystem. This function
 // automatically joins before cleaning up.
@@ -73,16 +81,20 @@ int workGetInterfaceMtu(const char* intfName, int* mtu);
 int workMtuSupported(int mtu, bool* supported, const char** failReason);
 
 // Creates a network namespace called the "root", which provides connectivity to
-// the external world.
+// the external world. The namespace is ready when this call returns, but the
+// switch inside of it is started asynchronously. Orders that use the switch
+// (edge interfaces, edge and client routes, switch flushes, and switch tuning)
+// automatically wait until it is running. Other orders may run in the meantime.
 int workAddRoot(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs);
 
 // Adds an external interface to the root namespace. This removes it from the
 // init namespace, so it will appear to vanish from a simple "ifconfig" listing.
 // The interface is added to the switch, thereby connecting it to to virtual
-// network. Port numbers are assigned on a first-come-first-served basis, so the
-// caller should ensure that workJoin is called between workAddEdgeInterface
-// calls.
-int workAddEdgeInterface(const char* intfName);
+// network. If requestedPort is not 0, it is requested as the port number (see
+// ovsAddPort). This call blocks until the interface has been added. On
+// success, port is set to the port number that the switch assigned to the
+// interface.
+int workAddEdgeInterface(const char* intfName, uint32_t requestedPort, uint32_t* port);
 
 // Creates a new virtual host in its own network namespace. If the node is a
 // client, then it is connected to the root. If the node is a client, then macs
@@ -93,8 +105,9 @@ int workAddHost(nodeId id, ip4Addr ip, macAddr macs[], int mtu, const TopoNode*
 int workSetSelfLink(nodeId id, const TopoLink* link);
 
 // Sets system parameters to ensure that the kernel allocates enough resources
-// for the network. This should be called before adding any links or routes.
-int workEnsureSystemScaling(uint64_t linkCount, nodeId nodeCount, nodeId clientNodes);
+// for the network. This should be called before adding any links or routes. If
+// tuneSwitch is true, the root switch is also tuned for the number of clients.
+int workEnsureSystemScaling(uint64_t linkCount, nodeId nodeCount, nodeId clientNodes, bool tuneSwitch);
 
 // Adds a virtual connection between two hosts. macs should contain
 // NeededMacsLink unique addresses.
@@ -105,14 +118,21 @@ int workAddLink(nodeId sourceId, nodeId targetId, ip4Addr sourceIp, ip4Addr targ
 int workAddInternalRoutes(nodeId id1, nodeId id2, ip4Addr ip1, ip4Addr ip2, const ip4Subnet* subnet1, const ip4Subnet* subnet2);
 
 // Adds static routing paths between a client node and the root. The subnet is
-// the range that the client node is responsible for. This also adds the
-// associated flow rules to the switch in the root namespace. clientMacs should
-// have the same value as the call to workAddHost. edgePort is the port
-// identifier for the associated edge node interface, as assigned during the
-// workAddEdgeInterface call. nextOvsPort should be the next available port in
-// the switch. This call will add NEEDED_PORTS_CLIENT ports to the switch. The
-// caller should join between calls in order to prevent port number races.
-int workAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet* subnet, uint32_t edgePort, uint32_t nextOvsPort);
+// the range that the client node is responsible for. This also queues the
+// associated ports and flow rules for the switch in the root namespace; they
+// are not applied until workFlushSwitch is called. clientMacs should have the
+// same value as the call to workAddHost. edgePort is the port identifier for
+// the associated edge node interface, as assigned during the
+// workAddEdgeInterface call. If firstPort is not 0, then firstPort and
+// firstPort+1 are requested as the port numbers for the client's links. These
+// numbers must not be used by any other port. If firstPort is 0, the switch
+// chooses the numbers, and they are looked up when the switch is flushed.
+int workAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet* subnet, uint32_t edgePort, uint32_t firstPort);
+
+// Applies all switch changes queued by workAddClientRoutes. Each worker adds its
+// pending ports in a single transaction and then installs the flows that refer
+// to them. This function automatically joins.
+int workFlushSwitch(void);
 
 // Adds egression routes for an edge node to the switch in the root namespace.
 // edgeLocalMac should be the MAC address associated with the edge interface,
@@ -121,10 +141,16 @@ int workAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet*
 int workAddEdgeRoutes(const ip4Subnet* edgeSubnet, uint32_t edgePort, const macAddr* edgeLocalMac, const macAddr* edgeRemoteMac);
 
 // Destroys all hosts created with the network prefix. If an Open vSwitch
-// instance is running for a root namespace, it is shut down and deleted. If
-// deletedHosts is not NULL, the number of deleted hosts is stored. If an error
-// was encountered, the value of deletedHosts is undefined.
-int workDestroyHosts(void);
+// instance is running for a root namespace, it is shut down and deleted. The
+// namespaces are deleted in parallel by all of the workers. If deletedHosts is
+// not NULL, the number of deleted hosts is stored. If an error was encountered,
+// the value of deletedHosts is undefined. This function automatically joins.
+int workDestroyHosts(uint32_t* deletedHosts);
+
+// Retrieves the total number of orders queued for the workers, and the time in
+// microseconds that callers spent waiting because too many orders were not yet
+// sent. A large waiting time indicates that the workers are the bottleneck.
+void workGetOrderStats(uint64_t* queuedOrders, uint64_t* stallMicros);
 
 // Waits until all submitted work has been completed. If resetError is true,
 // then all queued errors are ignored, and the error state of the subsystem is
@@ -47,8 +47,21 @@
 static char ovsDir[PATH_MAX+1] = {0};
 static char ovsSchema[PATH_MAX+1] = {0};
 
+static SwitchBackend switchBackend = SwitchOvs;
+
+// If true, the root switch matches traffic from edge nodes in two stages (see
+// workerAddEdgeRoutes for details)
+static bool switchPipeline = false;
 static bool ovsSupportsJumboPackets = false;
 
+// If true, destroyed host namespaces are scrubbed and kept for reuse
+static bool poolNamespaces = false;
+
+// If true, a running Open vSwitch instance is kept when destroying the network
+// and reused by the next one. The root namespace is kept along with it, because
+// the daemons remain inside of it.
+static bool keepSwitch = false;
+
 static netCache* nc = NULL;
 
 // We keep these outside of the cache because they are used frequently:
@@ -61,6 +74,7 @@ static ip4Addr rootIpSelf;
 static ip4Addr rootIpOther;
 
 static ovsContext* rootSwitch = NULL;
+static ovsBatch* rootBatch = NULL; // Client ports and flows awaiting workerFlushSwitch
 
 // Converts a node identifier into a namespace name. buffer should be large
 // enough to hold the identifier in decimal representation and the NUL
@@ -86,6 +100,10 @@ static const uint32_t OvsPrioritySelf = 1 << 14;
 static const uint32_t OvsPriorityIn = 1 << 13;
 static const uint32_t OvsPriorityOut = 1 << 7;
 
+// Switch tables. The client table is only used with switchPipeline.
+static const uint8_t OvsTableMain = 0;
+static const uint8_t OvsTableClients = 1;
+
 #define MAC_CLIENT_SELF  0
 #define MAC_ROOT_SELF    1
 #define MAC_CLIENT_OTHER 2
@@ -97,33 +115,21 @@ bool workerHaveCap(void) {
 	return (getuid() == 0);
 }
 
-int workerInit(const char* nsPrefix, const char* ovsDirArg, const char* ovsSchemaArg, uint64_t softMemCap) {
+int workerInit(const char* nsPrefix, const char* ovsDirArg, const char* ovsSchemaArg, uint64_t softMemCap, bool nsPool, SwitchBackend backend, bool pipeline, bool keep, bool ovsValidVer, unsigned int ovsMajor, unsigned int ovsMinor) {
 	if (!workerHaveCap()) {
 		lprintln(LogError, "BUG: attempted to start a worker thread with insufficient capabilities!");
 		return 1;
 	}
 
-	bool ovsValidVer;
-	unsigned int ovsMajor, ovsMinor;
-	char* ovsVer = ovsVersion(&ovsValidVer, &ovsMajor, &ovsMinor);
-	if (ovsVer == NULL) {
-		lprintln(LogError, "Open vSwitch is not installed, is not accessible, or was not recognized. Ensure that Open vSwitch is installed and is accessible using the system PATH.");
-		return 1;
-	}
-	lprintf(LogDebug, "Using Open vSwitch version '%s'\n", ovsVer);
-	bool ovsNewEnough = false;
-	if (ovsValidVer) {
-		if (ovsMajor > 2 || (ovsMajor == 2 && ovsMinor >= 1)) {
-			ovsNewEnough = true;
-		}
-		if (ovsMajor > 2 || (ovsMajor == 2 && ovsMinor >= 6)) {
-			ovsSupportsJumboPackets = true;
-		}
+	// The main process already probed the version. Traffic Control switches
+	// have no MTU limitations of their own.
+	switchBackend = backend;
+	switchPipeline = pipeline;
+	keepSwitch = keep;
+	ovsUseVersion(ovsValidVer, ovsMajor, ovsMinor);
+	if (backend == SwitchTc || (ovsValidVer && (ovsMajor > 2 || (ovsMajor == 2 && ovsMinor >= 6)))) {
+		ovsSupportsJumboPackets = true;
 	}
-	if (!ovsNewEnough) {
-		lprintf(LogWarning, "This program requires Open vSwitch 2.1.0 or later. You are using version '%s', which appears to be older. If an error occurs while setting up the switch, you will need to upgrade your version of Open vSwitch.\n", ovsVer);
-	}
-	free(ovsVer);
 
 	strncpy(ovsDir, ovsDirArg, PATH_MAX+1);
 	if (ovsSchemaArg != NULL) strncpy(ovsSchema, ovsSchemaArg, PATH_MAX+1);
@@ -131,6 +137,8 @@ int workerInit(const char* nsPrefix, const char* ovsDirArg, const char* ovsSchem
 	nc = ncNewCache(softMemCap);
 	int err = netInit(nsPrefix);
 	if (err != 0) return err;
+	poolNamespaces = nsPool;
+	netSetNamespacePool(nsPool);
 	defaultNet = netOpenNamespace(NULL, false, false, &err);
 	if (defaultNet == NULL) return err;
 
@@ -158,26 +166,31 @@ static int workerInitRoot(bool useInitNs, bool existing) {
 		}
 		rootNet = defaultNet;
 	} else {
-		rootNet = netOpenNamespace(RootName, !existing, !existing, &err);
+		// A kept switch still runs inside of the previous root namespace
+		bool reuse = (keepSwitch && ovsIsRunning(switchBackend, ovsDir));
+		rootNet = netOpenNamespace(RootName, !existing, !existing && !reuse, &err);
 		if (rootNet == NULL) return err;
 	}
 
-	const char* schemaPath = ovsSchema;
-	if (schemaPath[0] == '\0') schemaPath = NULL;
-	rootSwitch = ovsStart(rootNet, ovsDir, schemaPath, existing, &err);
-	if (rootSwitch == NULL) return err;
-
 	return 0;
 }
 
 static void workerCleanupRoot(void) {
+	if (rootBatch != NULL) ovsBatchFree(rootBatch);
 	if (rootSwitch != NULL) ovsFree(rootSwitch);
 	if (rootNet != NULL && rootNet != defaultNet) netCloseNamespace(rootNet, false);
+	rootBatch = NULL;
 	rootSwitch = NULL;
 	rootNet = NULL;
 }
 
 int workerCleanup(void) {
+	if (PASSES_LOG_THRESHOLD(LogDebug)) {
+		netSwitchStats stats;
+		netGetSwitchStats(&stats);
+		lprintf(LogDebug, "Namespace switches: %lu performed, %lu redundant switches skipped, %lu cached contexts used without switching\n", stats.performed, stats.avoided, ncCacheHits(nc));
+	}
+
 	workerCleanupRoot();
 	netCloseNamespace(defaultNet, false);
 	netCleanup();
@@ -186,6 +199,7 @@ int workerCleanup(void) {
 }
 
 int workerGetEdgeRemoteMac(const char* intfName, ip4Addr ip, macAddr* edgeRemoteMac) {
+	// The ping process inherits our active namespace
 	int res = netSwitchNamespace(defaultNet);
 	if (res != 0) return res;
 
@@ -245,14 +259,14 @@ int workerMtuSupported(int mtu, bool* supported, const char** failReason) {
 	return 0;
 }
 
-static int applyNamespaceParams(void) {
-	int err = netSetForwarding(true);
+static int applyNamespaceParams(netContext* net) {
+	int err = netSetForwarding(net, true);
 	if (err != 0) return err;
 
-	err = netSetMartians(true);
+	err = netSetMartians(net, true);
 	if (err != 0) return err;
 
-	err = netSetIPv6(false);
+	err = netSetIPv6(net, false);
 	return err;
 }
 
@@ -302,23 +316,58 @@ static int buildVethPair(netContext* sourceNet, netContext* targetNet,
 // has already created the namespace, then the command is ignored. This is
 // useful because we can instruct a single worker to create the namespace, and
 // tell all others to use the same one.
-int workerAddRoot(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs, bool existing) {
+int workerAddRoot(ip4Addr addrSelf, ip4Addr addrOther, bool useInitNs, bool existing) {
 	if (existing && rootNet != NULL) {
 		lprintln(LogDebug, "Root creation command ignored because we created the namespace earlier");
 		return 0;
 	}
 
-	int err = 0;
-	err = workerInitRoot(useInitNs, existing);
+	int err = workerInitRoot(useInitNs, existing);
+	if (err != 0) return err;
 
 	rootIpSelf = addrSelf;
 	rootIpOther = addrOther;
 
 	if (!existing) {
-		err = applyNamespaceParams();
+		err = applyNamespaceParams(rootNet);
 		if (err != 0) return err;
+	}
+
+	return 0;
+}
+
+// Starts the switch in the root namespace, which must already be set up by
+// workerAddRoot. The existing flag has the same meaning as for workerAddRoot.
+// Starting the switch is slow, so it is separated from the namespace creation
+// to allow other work to proceed in the meantime.
+int workerAddRootSwitch(int mtu, bool existing) {
+	if (existing && rootSwitch != NULL) {
+		lprintln(LogDebug, "Root switch command ignored because we started the switch earlier");
+		return 0;
+	}
+	if (rootNet == NULL) {
+		lprintln(LogError, "BUG: Starting the root switch before creating the root namespace");
+		return 1;
+	}
+
+	bool reuse = (!existing && keepSwitch && ovsIsRunning(switchBackend, ovsDir));
+	if (reuse) {
+		lprintln(LogInfo, "Reusing the running Open vSwitch instance in the 'root' namespace");
+	} else {
+		lprintf(LogDebug, "%s the switch in the 'root' namespace\n", (existing ? "Connecting to" : "Starting"));
+	}
+
+	int err = 0;
+	const char* schemaPath = ovsSchema;
+	if (schemaPath[0] == '\0') schemaPath = NULL;
+	rootSwitch = ovsStart(rootNet, switchBackend, ovsDir, schemaPath, existing || reuse, &err);
+	if (rootSwitch == NULL) return err;
 
-		err = ovsAddBridge(rootSwitch, RootBridgeName);
+	if (!existing) {
+		// A kept bridge was already reset when the previous network was
+		// destroyed, but we reset it again in case that was interrupted
+		if (reuse) err = ovsResetBridge(rootSwitch, RootBridgeName);
+		else err = ovsAddBridge(rootSwitch, RootBridgeName);
 		if (err != 0) return err;
 
 		if (mtu != IP4_DEFAULT_MTU) {
@@ -327,11 +376,10 @@ int workerAddRoot(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs,
 		}
 
 		// Reject everything initially, but switch ARP normally
-		err = ovsClearFlows(rootSwitch, RootBridgeName);
-		if (err != 0) return err;
-
-		err = netSetInterfaceUp(rootNet, RootBridgeName, true);
-		if (err != 0) return err;
+		if (!reuse) {
+			err = ovsClearFlows(rootSwitch, RootBridgeName);
+			if (err != 0) return err;
+		}
 	}
 
 	return 0;
@@ -341,7 +389,7 @@ static int addArpResponses(ip4Addr addr, void* userData) {
 	return ovsAddArpResponse(rootSwitch, RootBridgeName, addr, (const macAddr*)userData, OvsPriorityArp);
 }
 
-int workerAddEdgeInterface(const char* intfName) {
+int workerAddEdgeInterface(const char* intfName, uint32_t requestedPort, uint32_t* port) {
 	lprintf(LogDebug, "Adding external interface '%s' to the switch in the root namespace\n", intfName);
 
 	int err;
@@ -355,7 +403,7 @@ int workerAddEdgeInterface(const char* intfName) {
 	err = netSetInterfaceUp(rootNet, intfName, true);
 	if (err != 0) return err;
 
-	err = ovsAddPort(rootSwitch, RootBridgeName, intfName);
+	err = ovsAddPort(rootSwitch, RootBridgeName, intfName, requestedPort);
 	if (err != 0) return err;
 
 	macAddr intfMac;
@@ -365,7 +413,10 @@ int workerAddEdgeInterface(const char* intfName) {
 	err = netEnumAddresses(&addArpResponses, rootNet, intfIdx, &intfMac);
 	if (err != 0) return err;
 
-	return 0;
+	err = ovsFlushFlows(rootSwitch);
+	if (err != 0) return err;
+
+	return ovsGetPorts(rootSwitch, RootBridgeName, &intfName, 1, port);
 }
 
 static void sprintRootSelfIntf(char* buf, nodeId id) {
@@ -386,7 +437,7 @@ int workerAddHost(nodeId id, ip4Addr ip, macAddr macs[], int mtu, const TopoNode
 	netContext* net = ncOpenNamespace(nc, id, nodeName, true, true, &err);
 	if (net == NULL) return err;
 
-	err = applyNamespaceParams();
+	err = applyNamespaceParams(net);
 	if (err != 0) return err;
 
 	if (node->client) {
@@ -453,18 +504,16 @@ static int workGetLinkEndpoints(nodeId id1, nodeId id2, char* name1, char* name2
 	return 0;
 }
 
-int workerEnsureSystemScaling(uint64_t linkCount, nodeId nodeCount, nodeId clientNodes) {
+int workerEnsureSystemScaling(uint64_t linkCount, nodeId nodeCount, nodeId clientNodes, bool tuneSwitch) {
 	lprintf(LogDebug, "Preparing system to handle %u nodes (%u clients) and %lu links\n", nodeCount, clientNodes, linkCount);
 
 	int err;
-	err = netSwitchNamespace(defaultNet);
-	if (err != 0) return err;
 
 	// Ensure that the system-wide ARP hash table is large enough to hold static
 	// routing entries for every interface in the network.
 
 	int arpThresh1, arpThresh2, arpThresh3;
-	err = netGetArpTableSize(&arpThresh1, &arpThresh2, &arpThresh3);
+	err = netGetArpTableSize(defaultNet, &arpThresh1, &arpThresh2, &arpThresh3);
 	if (err != 0) return err;
 
 	uint64_t fudgeFactor = 100; // In case a few extras are needed
@@ -483,7 +532,7 @@ int workerEnsureSystemScaling(uint64_t linkCount, nodeId nodeCount, nodeId clien
 		int newThresh1 = arpThresh1 + extraSpace;
 		int newThresh2 = arpThresh2 + extraSpace;
 		int newThresh3 = arpThresh3 + extraSpace;
-		err = netSetArpTableSize(newThresh1, newThresh2, newThresh3);
+		err = netSetArpTableSize(defaultNet, newThresh1, newThresh2, newThresh3);
 		if (err != 0) {
 			lprintln(LogError, "Could not modify the ARP table size to support the network topology.");
 			return err;
@@ -491,6 +540,11 @@ int workerEnsureSystemScaling(uint64_t linkCount, nodeId nodeCount, nodeId clien
 		lprintf(LogWarning, "The system's ARP thresholds have been set to (%d, %d, %d), which may degrade the performance of the system. After finishing the experiments, we recommend setting the values back to (%d, %d, %d).\n", newThresh1, newThresh2, newThresh3, arpThresh1, arpThresh2, arpThresh3);
 	}
 
+	if (tuneSwitch) {
+		err = ovsTuneDatapath(rootSwitch, clientNodes);
+		if (err != 0) return err;
+	}
+
 	return 0;
 }
 
@@ -565,7 +619,7 @@ int workerAddInternalRoutes(nodeId id1, nodeId id2, ip4Addr ip1, ip4Addr ip2, co
 	return 0;
 }
 
-int workerAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet* subnet, uint32_t edgePort, uint32_t clientPorts[]) {
+int workerAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet* subnet, uint32_t edgePort, uint32_t firstPort) {
 	lprintf(LogDebug, "Adding routes to root namespace for client node %u\n", clientId);
 
 	// We have two objectives: packets for the subnet from other clients must be
@@ -613,27 +667,37 @@ int workerAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet
 	if (err != 0) return err;
 
 	// At this point, the client namespace is fully set up. Now we add flow
-	// rules to the root switch
+	// rules to the root switch. The ports and flows are only queued; they are
+	// added to the switch in bulk by workerFlushSwitch.
+
+	if (rootBatch == NULL) rootBatch = ovsBatchNew(rootSwitch, RootBridgeName);
 
 	char intfBuf[INTERFACE_BUF_LEN];
+	size_t port;
+
+	// With the pipeline, the main table has already checked that the traffic
+	// came from the edge node, so the client table only matches the subnets
+	uint8_t table = (switchPipeline ? OvsTableClients : OvsTableMain);
+	uint32_t inPort = (switchPipeline ? 0 : edgePort);
 
 	// Incoming "self" link for intra-client communication
 	sprintRootSelfIntf(intfBuf, clientId);
-	err = ovsAddPort(rootSwitch, RootBridgeName, intfBuf);
-	if (err != 0) return err;
-	err = ovsAddIpFlow(rootSwitch, RootBridgeName, edgePort, subnet, subnet, &clientMacs[MAC_ROOT_SELF], &clientMacs[MAC_CLIENT_SELF], clientPorts[0], OvsPrioritySelf);
-	if (err != 0) return err;
+	port = ovsBatchAddPort(rootBatch, intfBuf, firstPort);
+	ovsBatchAddIpFlow(rootBatch, table, inPort, subnet, subnet, &clientMacs[MAC_ROOT_SELF], &clientMacs[MAC_CLIENT_SELF], port, OvsPrioritySelf);
 
 	// Incoming uplink for inter-client communication
 	sprintRootUpIntf(intfBuf, clientId);
-	err = ovsAddPort(rootSwitch, RootBridgeName, intfBuf);
-	if (err != 0) return err;
-	err = ovsAddIpFlow(rootSwitch, RootBridgeName, edgePort, subnet, NULL, &clientMacs[MAC_ROOT_OTHER], &clientMacs[MAC_CLIENT_OTHER], clientPorts[1], OvsPriorityIn);
-	if (err != 0) return err;
+	port = ovsBatchAddPort(rootBatch, intfBuf, (firstPort == 0 ? 0 : firstPort + 1));
+	ovsBatchAddIpFlow(rootBatch, table, inPort, subnet, NULL, &clientMacs[MAC_ROOT_OTHER], &clientMacs[MAC_CLIENT_OTHER], port, OvsPriorityIn);
 
 	return 0;
 }
 
+int workerFlushSwitch(void) {
+	if (rootBatch == NULL) return 0;
+	return ovsBatchFlush(rootBatch);
+}
+
 int workerAddEdgeRoutes(const ip4Subnet* edgeSubnet, uint32_t edgePort, const macAddr* edgeLocalMac, const macAddr* edgeRemoteMac) {
 	if (PASSES_LOG_THRESHOLD(LogDebug)) {
 		char macStr[MAC_ADDR_BUFLEN];
@@ -644,7 +708,22 @@ int workerAddEdgeRoutes(const ip4Subnet* edgeSubnet, uint32_t edgePort, const ma
 	}
 
 	// Outgoing downlink and "self" link
-	return ovsAddIpFlow(rootSwitch, RootBridgeName, 0, NULL, edgeSubnet, edgeLocalMac, edgeRemoteMac, edgePort, OvsPriorityOut);
+	int err = ovsAddIpFlow(rootSwitch, RootBridgeName, OvsTableMain, 0, NULL, edgeSubnet, edgeLocalMac, edgeRemoteMac, edgePort, OvsPriorityOut);
+	if (err != 0) return err;
+
+	// Without the pipeline, every client has flows in the main table that match
+	// traffic from its edge node. With the pipeline, the main table only has
+	// one flow per edge node, which sends traffic from the edge node's clients
+	// to the client table. Client subnets are assigned contiguously from the
+	// edge subnet, so this matches the same traffic. This keeps the main table
+	// small, so that traffic sent by clients is not checked against flows for
+	// every other client.
+	if (switchPipeline) {
+		err = ovsAddIpGotoTable(rootSwitch, RootBridgeName, OvsTableMain, edgePort, edgeSubnet, NULL, OvsTableClients, OvsPriorityIn);
+		if (err != 0) return err;
+	}
+
+	return ovsFlushFlows(rootSwitch);
 }
 
 typedef struct workerMoveIntfDirective workerMoveIntfDirective;
@@ -654,6 +733,18 @@ struct workerMoveIntfDirective {
 	workerMoveIntfDirective* next;
 };
 
+// We cannot modify interfaces within enumeration callbacks because this would
+// result in nested netlink calls. Instead, the callbacks save a linked list of
+// interfaces to process afterwards.
+static void pushIntfDirective(workerMoveIntfDirective** list, const char* name, int idx) {
+	workerMoveIntfDirective* node = emalloc(sizeof(workerMoveIntfDirective));
+	node->idx = idx;
+	strncpy(node->name, name, INTERFACE_BUF_LEN);
+	node->name[INTERFACE_BUF_LEN] = '\0';
+	node->next = *list;
+	*list = node;
+}
+
 static int workerRestoreInterface(const char* name, int idx, void* userData) {
 	// Ignore any interfaces that we may have created
 	if (strcmp(name, "lo") == 0) return 0;
@@ -662,28 +753,26 @@ static int workerRestoreInterface(const char* name, int idx, void* userData) {
 	if (strncmp(name, SelfLinkPrefix, strlen(SelfLinkPrefix)) == 0 && name[strlen(SelfLinkPrefix)] == '-') return 0;
 	if (strncmp(name, NodeLinkPrefix, strlen(NodeLinkPrefix)) == 0 && name[strlen(NodeLinkPrefix)] == '-') return 0;
 
-	// We cannot perform the move within the callback because this would result
-	// in nested netlink calls. Instead, we save a linked list of interfaces to
-	// move.
-	workerMoveIntfDirective** intfToMove = userData;
-	workerMoveIntfDirective* node = emalloc(sizeof(workerMoveIntfDirective));
-	node->idx = idx;
-	strncpy(node->name, name, INTERFACE_BUF_LEN);
-	node->name[INTERFACE_BUF_LEN] = '\0';
-	node->next = *intfToMove;
-	*intfToMove = node;
+	pushIntfDirective(userData, name, idx);
 	return 0;
 }
 
-static int workerDestroyNamespace(const char* name, void* userData) {
-	uint32_t* deletedHosts = userData;
-	if (deletedHosts != NULL) ++*deletedHosts;
-	return netDeleteNamespace(name);
+// Collects the root side of the veth pairs connecting the root to clients
+static int workerCollectClientLink(const char* name, int idx, void* userData) {
+	bool isSelf = (strncmp(name, SelfLinkPrefix, strlen(SelfLinkPrefix)) == 0 && name[strlen(SelfLinkPrefix)] == '-');
+	bool isNode = (strncmp(name, NodeLinkPrefix, strlen(NodeLinkPrefix)) == 0 && name[strlen(NodeLinkPrefix)] == '-');
+	if (!isSelf && !isNode) return 0;
+
+	pushIntfDirective(userData, name, idx);
+	return 0;
 }
 
-int workerDestroyHosts(void) {
+int workerDestroyRoot(void) {
 	int err = 0;
 
+	bool keep = (keepSwitch && ovsIsRunning(switchBackend, ovsDir));
+	if (keep) lprintln(LogDebug, "Keeping the running Open vSwitch instance for the next network");
+
 	// Create a temporary OVS context if needed, then delete the bridge. If we
 	// don't explicitly do this, then the interface will remain after the Open
 	// vSwitch instance is shut down.
@@ -693,15 +782,23 @@ int workerDestroyHosts(void) {
 		// the init namespace to avoid creating a new one, just to destroy it
 		// later.
 		err = workerInitRoot(true, true);
+		if (err == 0) err = workerAddRootSwitch(IP4_DEFAULT_MTU, true);
 	}
 	if (err == 0) {
-		ovsDelBridge(rootSwitch, RootBridgeName);
+		if (keep) {
+			err = ovsResetBridge(rootSwitch, RootBridgeName);
+			if (err != 0) {
+				lprintf(LogWarning, "Could not reset the kept Open vSwitch bridge, so the instance will be restarted. Error code: %d\n", err);
+				keep = false;
+			}
+		}
+		if (!keep) ovsDelBridge(rootSwitch, RootBridgeName);
 	}
 	if (useTemporaryOvs) {
 		workerCleanupRoot();
 	}
 
-	ovsDestroy(ovsDir);
+	if (!keep) ovsDestroy(switchBackend, ovsDir);
 
 	// We need to manually move external interfaces out of the root namespace.
 	// While the kernel will do this automatically when the namespace is
@@ -728,13 +825,134 @@ int workerDestroyHosts(void) {
 				free(prev);
 			}
 		}
+
+		// Deleting the root side of the client links also deletes the peers in
+		// the client namespaces, which makes the namespaces much cheaper for
+		// the kernel to tear down later. The deletions are pipelined; only the
+		// last one waits for the kernel.
+		workerMoveIntfDirective* intfToDelete = NULL;
+		err = netEnumInterfaces(&workerCollectClientLink, ctx, &intfToDelete);
+		if (err != 0) {
+			lprintf(LogWarning, "An error occurred while listing the client links in the previously created root network namespace. Error code: %d\n", err);
+		}
+		uint32_t deletedLinks = 0;
+		while (intfToDelete != NULL) {
+			bool last = (intfToDelete->next == NULL);
+			if (netDeleteInterface(ctx, intfToDelete->idx, last) == 0) {
+				++deletedLinks;
+			} else {
+				lprintf(LogDebug, "Failed to delete client link %p:'%s'\n", ctx, intfToDelete->name);
+			}
+
+			workerMoveIntfDirective* prev = intfToDelete;
+			intfToDelete = intfToDelete->next;
+			free(prev);
+		}
+		if (deletedLinks > 0) {
+			lprintf(LogDebug, "Deleted %u client links from the root namespace\n", deletedLinks);
+		}
+
 		netCloseNamespace(ctx, false);
 	}
 
-	uint32_t deletedHosts = 0;
-	int res = netEnumNamespaces(&workerDestroyNamespace, &deletedHosts);
-	if (deletedHosts > 0) {
-		lprintf(LogInfo, "Destroyed an existing virtual network with %lu hosts\n", deletedHosts);
+	return 0;
+}
+
+// Number of deleted hosts between progress reports
+static const uint32_t DestroyProgressInterval = 1000;
+
+typedef struct {
+	uint32_t shard;
+	uint32_t shardCount;
+	uint32_t deletedHosts;
+} workerDestroyShard;
+
+// Collects every link in a host namespace except for the loopback interface
+static int workerCollectHostLink(const char* name, int idx, void* userData) {
+	if (strcmp(name, "lo") == 0) return 0;
+
+	pushIntfDirective(userData, name, idx);
+	return 0;
+}
+
+// Removes everything that we configured in a host namespace so that it can be
+// placed in the warm pool. Deleting the links also removes their addresses,
+// routes, static ARP entries, and queuing disciplines. The sysctls are left
+// alone because workerAddHost applies them to every host.
+static int workerScrubNamespace(const char* name) {
+	int err;
+	netContext* net = netOpenNamespace(name, false, false, &err);
+	if (net == NULL) return err;
+
+	workerMoveIntfDirective* intfToDelete = NULL;
+	err = netEnumInterfaces(&workerCollectHostLink, net, &intfToDelete);
+	while (intfToDelete != NULL) {
+		// Other workers may concurrently delete the peers of these links, which
+		// also deletes our side, so failures are expected
+		if (netDeleteInterface(net, intfToDelete->idx, true) != 0) {
+			lprintf(LogDebug, "Link %p:'%s' was already deleted\n", net, intfToDelete->name);
+		}
+
+		workerMoveIntfDirective* prev = intfToDelete;
+		intfToDelete = intfToDelete->next;
+		free(prev);
+	}
+
+	// Policy routing rules are not tied to the links
+	if (err == 0) {
+		bool exists;
+		err = netRuleExists(net, CustomTablePriority, &exists);
+		if (err == 0 && exists) {
+			err = netModifyRule(net, true, NULL, NULL, CustomTableId, CreatorAdmin, CustomTablePriority, true);
+		}
+	}
+
+	netCloseNamespace(net, false);
+	return err;
+}
+
+static int workerDestroyNamespace(const char* name, void* userData) {
+	workerDestroyShard* ds = userData;
+
+	// FNV-1a hash of the name determines the shard
+	uint32_t hash = 2166136261U;
+	for (const char* p = name; *p != '\0'; ++p) {
+		hash = (hash ^ (uint8_t)*p) * 16777619U;
 	}
-	return res;
+	if (hash % ds->shardCount != ds->shard) return 0;
+
+	// Namespaces already in the pool are only deleted if pooling is disabled
+	if (netIsPooledNamespace(name)) {
+		if (poolNamespaces) return 0;
+		return netDeleteNamespace(name);
+	}
+
+	// The root namespace holds a kept switch, and is reused by the next network
+	if (keepSwitch && strcmp(name, RootName) == 0 && ovsIsRunning(switchBackend, ovsDir)) return 0;
+
+	int err = 1;
+	if (poolNamespaces && strcmp(name, RootName) != 0) {
+		err = workerScrubNamespace(name);
+		if (err == 0) err = netRetireNamespace(name);
+		if (err != 0) {
+			lprintf(LogWarning, "Could not place namespace '%s' in the warm pool; deleting it instead. Error code: %d\n", name, err);
+		}
+	}
+	if (err != 0) err = netDeleteNamespace(name);
+	if (err != 0) return err;
+
+	++ds->deletedHosts;
+	if (ds->deletedHosts % DestroyProgressInterval == 0) {
+		lprintf(LogInfo, "Destroyed %u hosts so far\n", ds->deletedHosts);
+	}
+	return 0;
+}
+
+int workerDestroyHostShard(uint32_t shard, uint32_t shardCount, uint32_t* deletedHosts) {
+	lprintf(LogDebug, "Destroying hosts in shard %u of %u\n", shard, shardCount);
+
+	workerDestroyShard ds = { .shard = shard, .shardCount = shardCount, .deletedHosts = 0 };
+	int err = netEnumNamespaces(&workerDestroyNamespace, &ds);
+	*deletedHosts = ds.deletedHosts;
+	return err;
 }
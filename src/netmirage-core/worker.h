@@ -28,6 +28,7 @@
 #include <stdint.h>
 
 #include "ip.h"
+#include "ovs.h"
 #include "topology.h"
 
 // Checks to see if the current thread has the required capabilities to be a
@@ -42,7 +43,7 @@ bool workerDropCap(void);
 bool workerDropAllCap(void);
 
 // Initialize the current process as a worker process.
-int workerInit(const char* nsPrefix, const char* ovsDirArg, const char* ovsSchemaArg, uint64_t softMemCap);
+int workerInit(const char* nsPrefix, const char* ovsDirArg, const char* ovsSchemaArg, uint64_t softMemCap, bool nsPool, SwitchBackend backend, bool pipeline, bool keep, bool ovsValidVer, unsigned int ovsMajor, unsigned int ovsMinor);
 
 int workerCleanup(void);
 
@@ -51,13 +52,20 @@ int workerGetEdgeRemoteMac(const char* intfName, ip4Addr ip, macAddr* edgeRemote
 int workerGetEdgeLocalMac(const char* intfName, macAddr* edgeLocalMac);
 int workerGetInterfaceMtu(const char* intfName, int* mtu);
 int workerMtuSupported(int mtu, bool* supported, const char** failReason);
-int workerAddRoot(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs, bool existing);
-int workerAddEdgeInterface(const char* intfName);
+int workerAddRoot(ip4Addr addrSelf, ip4Addr addrOther, bool useInitNs, bool existing);
+int workerAddRootSwitch(int mtu, bool existing);
+int workerAddEdgeInterface(const char* intfName, uint32_t requestedPort, uint32_t* port);
 int workerAddHost(nodeId id, ip4Addr ip, macAddr macs[], int mtu, const TopoNode* node);
 int workerSetSelfLink(nodeId id, const TopoLink* link);
-int workerEnsureSystemScaling(uint64_t linkCount, nodeId nodeCount, nodeId clientNodes);
+int workerEnsureSystemScaling(uint64_t linkCount, nodeId nodeCount, nodeId clientNodes, bool tuneSwitch);
 int workerAddLink(nodeId sourceId, nodeId targetId, ip4Addr sourceIp, ip4Addr targetIp, macAddr macs[], int mtu, const TopoLink* link);
 int workerAddInternalRoutes(nodeId id1, nodeId id2, ip4Addr ip1, ip4Addr ip2, const ip4Subnet* subnet1, const ip4Subnet* subnet2);
-int workerAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet* subnet, uint32_t edgePort, uint32_t clientPorts[]);
+int workerAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet* subnet, uint32_t edgePort, uint32_t firstPort);
+int workerFlushSwitch(void);
 int workerAddEdgeRoutes(const ip4Subnet* edgeSubnet, uint32_t edgePort, const macAddr* edgeLocalMac, const macAddr* edgeRemoteMac);
-int workerDestroyHosts(void);
+
+// workDestroyHosts is split into two phases. First, one worker shuts down the
+// switch and cleans up the root namespace. Next, every worker deletes the
+// namespaces whose names hash to its shard.
+int workerDestroyRoot(void);
+int workerDestroyHostShard(uint32_t shard, uint32_t shardCount, uint32_t* deletedHosts);